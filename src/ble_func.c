@@ -11,6 +11,7 @@
 
 #include "gatt_svr.h"
 #include "hid_func.h"
+#include "tlog.h"
 
 #define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
 #define MAC2STR_REV(a) (a)[5], (a)[4], (a)[3], (a)[2], (a)[1], (a)[0]
@@ -20,6 +21,9 @@ static const char *tag = "NimBLEKBD_BLEFUNC";
 static int bleprph_gap_event(struct ble_gap_event *event, void *arg);
 static uint8_t own_addr_type;
 
+/* device GAP events are passed to, set by ble_init() */
+static struct hid_dev *Hid;
+
 /* Forward decl: provided by NimBLE store module */
 void ble_store_config_init(void);
 
@@ -63,6 +67,7 @@ user_parse(const struct ble_hs_adv_field *data, void *arg)
  * Enables advertising with the following parameters:
  *     o General discoverable mode.
  *     o Undirected connectable mode.
+ * Does nothing if advertising is active already or no more centrals can connect.
  */
 static void
 bleprph_advertise(void)
@@ -72,6 +77,10 @@ bleprph_advertise(void)
     const char *name;
     int rc;
 
+    if (ble_gap_adv_active() || !hid_conn_slots_free(Hid)) {
+        return;
+    }
+
     /**
      *  Set the advertisement data included in our advertisements:
      *     o Flags (indicates advertisement type and other general info).
@@ -178,8 +187,14 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
             assert(rc == 0);
             bleprph_print_conn_desc(&desc);
 
-            hid_clean_vars(&desc);
-            
+            if (hid_set_connected(Hid, &desc) != 0) {
+                ble_gap_terminate(event->connect.conn_handle, BLE_ERR_CONN_LIMIT);
+                return 0;
+            }
+
+            /* Keep advertising while other centrals can connect. */
+            bleprph_advertise();
+
             // Proactively initiate security to start pairing
             ESP_LOGI(tag, "Initiating security (pairing)...");
             rc = ble_gap_security_initiate(event->connect.conn_handle);
@@ -194,7 +209,7 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(tag, "disconnect; reason=%d ", event->disconnect.reason);
-        hid_set_disconnected();
+        hid_set_disconnected(Hid, event->disconnect.conn.conn_handle);
 
         /* Connection terminated; resume advertising. */
         bleprph_advertise();
@@ -209,6 +224,10 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
         /* The central has updated the connection parameters. */
         ESP_LOGI(tag, "connection updated; status=%d ",
                     event->conn_update.status);
+        if (event->conn_update.status == 0 &&
+            ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            hid_set_conn_itvl(Hid, desc.conn_handle, desc.conn_itvl);
+        }
         return 0;
 
     case BLE_GAP_EVENT_ADV_COMPLETE:
@@ -230,6 +249,7 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
                     desc.sec_state.encrypted,
                     desc.sec_state.authenticated,
                     desc.sec_state.bonded);
+                hid_set_encrypted(Hid, desc.conn_handle, desc.sec_state.encrypted);
             }
         } else {
             ESP_LOGE(tag, "Encryption/Pairing FAILED with status=%d", event->enc_change.status);
@@ -255,17 +275,21 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
                     event->subscribe.prev_indicate,
                     event->subscribe.cur_indicate);
 
-        hid_set_notify(event->subscribe.attr_handle,
+        hid_set_notify(Hid, event->subscribe.conn_handle,
+            event->subscribe.attr_handle,
             event->subscribe.cur_notify,
             event->subscribe.cur_indicate);
         return 0;
 
     case BLE_GAP_EVENT_NOTIFY_TX:
-        ESP_LOGI(tag, "notify event; status=%d conn_handle=%d attr_handle=%04X type=%s",
+        TLOGI(tag, "notify event; status=%d conn_handle=%d attr_handle=%04X type=%s",
                     event->notify_tx.status,
                     event->notify_tx.conn_handle,
                     event->notify_tx.attr_handle,
                     event->notify_tx.indication?"indicate":"notify");
+        hid_notify_tx_done(Hid, event->notify_tx.conn_handle,
+            event->notify_tx.status,
+            event->notify_tx.indication);
         return 0;
 
     case BLE_GAP_EVENT_MTU:
@@ -415,8 +439,10 @@ bleprph_host_task(void *param)
 
 
 void
-ble_init()
+ble_init(struct hid_dev *dev)
 {
+    Hid = dev;
+
     ESP_LOGI(tag, "ble_init: nimble_port_init starting...");
     int rc = nimble_port_init();
     if (rc != ESP_OK) {
@@ -459,8 +485,10 @@ ble_init()
     ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
 #endif
 
+    hid_init(dev, Svc_char_handles);
+
     ESP_LOGI(tag, "ble_init: initializing GATT server...");
-    rc = gatt_svr_init();
+    rc = gatt_svr_init(dev);
     if (rc != 0) {
         ESP_LOGE(tag, "gatt_svr_init failed: %d", rc);
         return;
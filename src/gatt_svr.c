@@ -25,9 +25,14 @@
 
 #include "gatt_svr.h"
 #include "hid_func.h"
+#include "hid_latency.h"
+#include "tlog.h"
 
 static const char *tag = "NimBLEKBD_GATT_SVR";
 
+/* device the characteristics of HID and battery services belong to, set by gatt_svr_init() */
+static struct hid_dev *Hid;
+
 int
 gatt_svr_chr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
                    void *dst, uint16_t *len)
@@ -56,14 +61,14 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
     uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
     int rc;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d", __FUNCTION__,
-        uuid16, attr_handle, (int)arg, ctxt->op);
+    TLOGI(tag, "%s: UUID %04X attr %04X arg %d op %d",
+        __func__, uuid16, attr_handle, (int)arg, ctxt->op);
 
     switch (uuid16) {
 
     case GATT_UUID_HID_INFORMATION:
         if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
-            ESP_LOGI(tag, "invalid op %d", ctxt->op);
+            TLOGI(tag, "invalid op %d", ctxt->op);
             break;
         }
         rc = os_mbuf_append(ctxt->om, HidInfo,
@@ -72,7 +77,7 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
     case GATT_UUID_HID_CONTROL_POINT: {
         if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
-            ESP_LOGI(tag, "invalid op %d", ctxt->op);
+            TLOGI(tag, "invalid op %d", ctxt->op);
             break;
         }
 
@@ -80,9 +85,9 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
         rc = gatt_svr_chr_write(ctxt->om, 1, 1, &new_suspend_state, NULL);
         if (!rc) {
-            bool old_state = hid_set_suspend((bool) new_suspend_state);
+            bool old_state = hid_set_suspend(Hid, conn_handle, (bool) new_suspend_state);
 
-            ESP_LOGI(tag, "HID_CONTROL_POINT received new suspend state: %d, old state is: %d",
+            TLOGI(tag, "HID_CONTROL_POINT received new suspend state: %d, old state is: %d",
                 (int)new_suspend_state, (int)old_state);
         }
         return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -90,7 +95,7 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
     case GATT_UUID_HID_REPORT_MAP: {
         if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
-            ESP_LOGI(tag, "invalid op %d", ctxt->op);
+            TLOGI(tag, "invalid op %d", ctxt->op);
             break;
         }
 
@@ -100,7 +105,7 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
     case GATT_UUID_EXT_RPT_REF_DESCR: {
         if (ctxt->op != BLE_GATT_ACCESS_OP_READ_DSC) {
-            ESP_LOGI(tag, "invalid op %d", ctxt->op);
+            TLOGI(tag, "invalid op %d", ctxt->op);
             break;
         }
 
@@ -113,8 +118,11 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
         if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
 
-            rc = os_mbuf_append(ctxt->om, &HidProtocolMode,
-                                sizeof(HidProtocolMode));
+            uint8_t protocol_mode = hid_get_report_mode(Hid, conn_handle) ?
+                HID_PROTOCOL_MODE_BOOT : HID_PROTOCOL_MODE_REPORT;
+
+            rc = os_mbuf_append(ctxt->om, &protocol_mode,
+                                sizeof(protocol_mode));
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
@@ -124,28 +132,30 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
             rc = gatt_svr_chr_write(ctxt->om, 1, sizeof(new_protocol_mode),
                 &new_protocol_mode, NULL);
             if (!rc) {
-                HidProtocolMode = new_protocol_mode;
-                // send true if new mode is boot mode, else guess
-                hid_set_report_mode(HidProtocolMode == HID_PROTOCOL_MODE_BOOT);
+                // protocol mode is kept per connection, true if new mode is boot mode
+                hid_set_report_mode(Hid, conn_handle, new_protocol_mode == HID_PROTOCOL_MODE_BOOT);
 
-                ESP_LOGI(tag, "Received new protocol mode: %d",
-                    (int)new_protocol_mode);
+                TLOGI(tag, "Received new protocol mode: %d, conn %d",
+                    (int)new_protocol_mode, conn_handle);
             }
 
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
         } else {
-            ESP_LOGI(tag, "invalid op %d", ctxt->op);
+            TLOGI(tag, "invalid op %d", ctxt->op);
         }
         return BLE_ATT_ERR_INSUFFICIENT_RES;
     }
 
     default:
-        ESP_LOGI(tag, "invalid UUID %02X", uuid16);
+        TLOGI(tag, "invalid UUID %02X", uuid16);
         break;
     }
     return BLE_ATT_ERR_UNLIKELY;
 }
 
+/* index in Hid_report_ref_data for every handle index, -1 if report has no reference */
+static int8_t Report_ref_by_handle[HANDLE_HID_COUNT];
+
 /* Report access function for all reports */
 
 int
@@ -157,25 +167,20 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
     int handle_num = (int) arg;
     int rc = BLE_ATT_ERR_UNLIKELY;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid16, attr_handle, (int)arg, ctxt->op);
+    TLOGI(tag, "%s: UUID %04X attr %04X arg %d op %d",
+         __func__, uuid16, attr_handle, (int)arg, ctxt->op);
 
 
     do {
         // Report reference descriptors
         if (uuid16 == GATT_UUID_RPT_REF_DESCR) {
             if (ctxt->op != BLE_GATT_ACCESS_OP_READ_DSC) {
-                ESP_LOGI(tag, "invalid op %d", ctxt->op);
+                TLOGI(tag, "invalid op %d", ctxt->op);
                 break;
             }
-            int rpt_ind = -1;
+            int rpt_ind = (handle_num >= 0 && handle_num < HANDLE_HID_COUNT) ?
+                Report_ref_by_handle[handle_num] : -1;
 
-            for (int i = 0; i < Hid_report_ref_data_count; ++i) {
-                if ((int)Hid_report_ref_data[i].id == handle_num) {
-                    rpt_ind = i;
-                    break;
-                }
-            }
             if (rpt_ind != -1) {
                 rc = os_mbuf_append(ctxt->om,
                     (uint8_t *)Hid_report_ref_data[rpt_ind].hidReportRef,
@@ -190,13 +195,26 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
             break;
         }
 
+        // resolution multipliers are set by every central for itself
+        if (handle_num == HANDLE_HID_MOUSE_FEATURE_REPORT) {
+            if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+                rc = hid_mouse_feature_read(Hid, conn_handle, ctxt->om);
+            } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+                rc = hid_mouse_feature_write(Hid, conn_handle, ctxt->om);
+            }
+            if (rc) {
+                rc = BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            break;
+        }
+
         /* reports read */
         if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR && (
                 (uuid16 == GATT_UUID_HID_REPORT)            ||
                 (uuid16 == GATT_UUID_HID_BT_MOUSE_INPUT)    ||
                 (uuid16 == GATT_UUID_HID_BT_KB_INPUT)       ||
                 (uuid16 == GATT_UUID_HID_BT_KB_OUTPUT)      )) {
-            rc = hid_read_buffer(ctxt->om, handle_num);
+            rc = hid_read_buffer(Hid, ctxt->om, handle_num);
             if (rc) {
                 rc = BLE_ATT_ERR_INSUFFICIENT_RES;
             }
@@ -208,7 +226,7 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
             switch (handle_num) {
                 case HANDLE_HID_KB_OUT_REPORT:
                 case HANDLE_HID_FEATURE_REPORT:
-                    rc = hid_write_buffer(ctxt->om, handle_num);
+                    rc = hid_write_buffer(Hid, ctxt->om, handle_num);
                     if (rc) {
                         rc = BLE_ATT_ERR_INSUFFICIENT_RES;
                     }
@@ -235,16 +253,16 @@ ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
     uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
     int rc = 0;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid16, attr_handle, (int) arg, ctxt->op);
+    TLOGI(tag, "%s: UUID %04X attr %04X arg %d op %d",
+         __func__, uuid16, attr_handle, (int) arg, ctxt->op);
 
     switch (uuid16) {
         case BLE_SVC_BAS_CHR_UUID16_BATTERY_LEVEL:
             if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-                rc = hid_read_buffer(ctxt->om, (int) arg);
+                rc = hid_read_buffer(Hid, ctxt->om, (int) arg);
                 // rc = hid_battery_level_get(ctxt->om);
                 if (rc) {
-                    ESP_LOGW(tag, "Error reading battery buffer, rc = %d", rc);
+                    TLOGW(tag, "Error reading battery buffer, rc = %d", rc);
                     rc = BLE_ATT_ERR_INSUFFICIENT_RES;
                 }
             } else {
@@ -254,7 +272,7 @@ ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
 
         case GATT_UUID_BAT_PRESENT_DESCR:
             if (ctxt->op == BLE_GATT_ACCESS_OP_READ_DSC) {
-                ESP_LOGI(tag, "battery character presentation descriptor read, op: %d", ctxt->op);
+                TLOGI(tag, "battery character presentation descriptor read, op: %d", ctxt->op);
                 rc = os_mbuf_append(ctxt->om, &Battery_level_units,
                                     sizeof Battery_level_units);
 
@@ -284,8 +302,8 @@ ble_svc_dis_access(uint16_t conn_handle, uint16_t attr_handle,
     int rc = 0;
     int data_len = 0;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid, attr_handle, (int)arg, ctxt->op);
+    TLOGI(tag, "%s: UUID %04X attr %04X arg %d op %d",
+         __func__, uuid, attr_handle, (int)arg, ctxt->op);
 
     switch(uuid) {
     case BLE_SVC_DIS_CHR_UUID16_MODEL_NUMBER:
@@ -355,6 +373,49 @@ ble_svc_dis_access(uint16_t conn_handle, uint16_t attr_handle,
     return rc;
 }
 
+#ifdef CONFIG_HID_LATENCY_TRACE
+/**
+ * Access function for key press latency histograms
+ */
+int
+ble_svc_latency_access(uint16_t conn_handle, uint16_t attr_handle,
+                       struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    struct hid_lat_summary summary[HID_LAT_HISTS];
+    uint8_t cmd;
+    int rc = 0;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            hid_lat_summary_get(summary);
+            rc = os_mbuf_append(ctxt->om, summary, sizeof(summary));
+            if (rc) {
+                rc = BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            break;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            rc = gatt_svr_chr_write(ctxt->om, sizeof(cmd), sizeof(cmd), &cmd, NULL);
+            if (rc) {
+                break;
+            }
+            if (cmd == LATENCY_CMD_RESET) {
+                hid_lat_reset();
+            } else if (cmd == LATENCY_CMD_DUMP) {
+                hid_lat_dump();
+            } else {
+                rc = BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+            }
+            break;
+
+        default:
+            rc = BLE_ATT_ERR_UNLIKELY;
+    }
+
+    return rc;
+}
+#endif
+
 void
 gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
 {
@@ -368,6 +429,15 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
             break;
 
         case BLE_GATT_REGISTER_OP_CHR:
+            // remember which of Svc_char_handles got this value handle
+            if (ctxt->chr.chr_def->val_handle >= Svc_char_handles &&
+                ctxt->chr.chr_def->val_handle < Svc_char_handles + HANDLE_HID_COUNT &&
+                ctxt->chr.val_handle < SVC_ATTR_HANDLES_MAX) {
+                Svc_handle_nums[ctxt->chr.val_handle] =
+                    ctxt->chr.chr_def->val_handle - Svc_char_handles;
+            } else if (ctxt->chr.val_handle >= SVC_ATTR_HANDLES_MAX) {
+                ESP_LOGE(tag, "val_handle %d out of lookup table", ctxt->chr.val_handle);
+            }
             ESP_LOGI("charact",
                 "uuid16 %s arg %d def_handle=%d (%04X) val_handle=%d (%04X)",
                 ble_uuid_to_str(ctxt->chr.chr_def->uuid, buf),
@@ -388,14 +458,22 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
 #define BREAK_IF_NOT_ZERO(EXPR2TEST) if ((EXPR2TEST)!= 0) break
 
 int
-gatt_svr_init(void)
+gatt_svr_init(struct hid_dev *dev)
 {
     int rc = 0;
 
+    Hid = dev;
+
     ble_svc_gap_init();
     ble_svc_gatt_init();
 
     memset(&Svc_char_handles, 0, sizeof(Svc_char_handles[0]) * HANDLE_HID_COUNT);
+    memset(Svc_handle_nums, HANDLE_HID_COUNT, sizeof(Svc_handle_nums));
+
+    memset(Report_ref_by_handle, -1, sizeof(Report_ref_by_handle));
+    for (int i = 0; i < Hid_report_ref_data_count; ++i) {
+        Report_ref_by_handle[Hid_report_ref_data[i].id] = i;
+    }
 
     do {
         BREAK_IF_NOT_ZERO( rc = ble_gatts_count_cfg(Gatt_svr_included_services) );
@@ -410,6 +488,14 @@ gatt_svr_init(void)
 
         ESP_LOGI(tag, "GATT root services added");
 
+#ifdef CONFIG_HID_LATENCY_TRACE
+        BREAK_IF_NOT_ZERO( rc = ble_gatts_count_cfg(Gatt_svr_latency_svcs) );
+
+        BREAK_IF_NOT_ZERO( rc = ble_gatts_add_svcs(Gatt_svr_latency_svcs) );
+
+        ESP_LOGI(tag, "GATT latency service added");
+#endif
+
     } while (0);
 
     return rc;
@@ -36,6 +36,7 @@
 
 #include "modlog/modlog.h"
 #include "hid_codes.h"
+#include "hid_reports.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -92,82 +93,8 @@ extern "C" {
 /* Attribute value lengths */
 #define HID_PROTOCOL_MODE_LEN           1         // HID Protocol Mode
 #define HID_INFORMATION_LEN             4         // HID Information
-#define HID_REPORT_REF_LEN              2         // HID Report Reference Descriptor
 #define HID_EXT_REPORT_REF_LEN          2         // External Report Reference Descriptor
 
-// HID Report IDs for the service
-#define HID_RPT_ID_KB_OUT               0   // LED output report ID from report map
-#define HID_RPT_ID_MOUSE_IN             1   // Mouse input report ID from report map
-#define HID_RPT_ID_KB_IN                2   // Keyboard input report ID from report map
-#define HID_RPT_ID_CC_IN                3   // Consumer Control input report ID from report map
-#define HID_RPT_ID_FEATURE              4   // Feature report ID from report map
-
-// boot report cb_access args
-#define HID_BOOT_KB_IN                  6   // Keyboard input report ID
-#define HID_BOOT_KB_OUT                 7   // LED output report ID
-#define HID_BOOT_MOUSE_IN               8   // Mouse input report ID
-
-// HID Report types
-#define HID_REPORT_TYPE_INPUT           1
-#define HID_REPORT_TYPE_OUTPUT          2
-#define HID_REPORT_TYPE_FEATURE         3
-
-#define HID_CC_RPT_MUTE                 1
-#define HID_CC_RPT_POWER                2
-#define HID_CC_RPT_LAST                 3
-#define HID_CC_RPT_ASSIGN_SEL           4
-#define HID_CC_RPT_PLAY                 5
-#define HID_CC_RPT_PAUSE                6
-#define HID_CC_RPT_RECORD               7
-#define HID_CC_RPT_FAST_FWD             8
-#define HID_CC_RPT_REWIND               9
-#define HID_CC_RPT_SCAN_NEXT_TRK        10
-#define HID_CC_RPT_SCAN_PREV_TRK        11
-#define HID_CC_RPT_STOP                 12
-
-#define HID_CC_RPT_CHANNEL_UP           0x01
-#define HID_CC_RPT_CHANNEL_DOWN         0x03
-#define HID_CC_RPT_VOLUME_UP            0x40
-#define HID_CC_RPT_VOLUME_DOWN          0x80
-
-// HID Consumer Control report bitmasks
-#define HID_CC_RPT_NUMERIC_BITS         0xF0
-#define HID_CC_RPT_CHANNEL_BITS         0xCF
-#define HID_CC_RPT_VOLUME_BITS          0x3F
-#define HID_CC_RPT_BUTTON_BITS          0xF0
-#define HID_CC_RPT_SELECTION_BITS       0xCF
-
-
-// Macros for the HID Consumer Control 2-byte report
-#define HID_CC_RPT_SET_NUMERIC(s, x)    (s)[0] &= HID_CC_RPT_NUMERIC_BITS;   \
-                                        (s)[0] |= (x)
-#define HID_CC_RPT_SET_CHANNEL(s, x)    (s)[0] &= HID_CC_RPT_CHANNEL_BITS;   \
-                                        (s)[0] |= ((x) & 0x03) << 4
-#define HID_CC_RPT_SET_VOLUME(s, x)     (s)[0] &= HID_CC_RPT_VOLUME_BITS;    \
-                                        (s)[0] |= (x)
-#define HID_CC_RPT_SET_BUTTON(s, x)     (s)[1] &= HID_CC_RPT_BUTTON_BITS;    \
-                                        (s)[1] |= (x)
-#define HID_CC_RPT_SET_SELECTION(s, x)  (s)[1] &= HID_CC_RPT_SELECTION_BITS; \
-                                        (s)[1] |= ((x) & 0x03) << 4
-
-// Keyboard report size
-#define HIDD_LE_REPORT_KB_IN_SIZE       (8)
-
-// Mouse report size
-#define HIDD_LE_REPORT_MOUSE_SIZE       (4)
-
-// LEDS report size
-#define HIDD_LE_REPORT_KB_OUT_SIZE      (1)
-
-// Consumer control report size
-#define HIDD_LE_REPORT_CC_SIZE          (2)
-
-// battery level data size
-#define HIDD_LE_BATTERY_LEVEL_SIZE      (1)
-
-// feature data size
-#define HIDD_LE_REPORT_FEATURE          (6)
-
 /* HID information flags */
 #define HID_FLAGS_REMOTE_WAKE           0x01      // RemoteWake
 #define HID_FLAGS_NORMALLY_CONNECTABLE  0x02      // NormallyConnectable
@@ -192,6 +119,20 @@ extern "C" {
 #define NVS_IO_CAP_NUM "io_cap_number"
 #define DEFAULT_IO_CAP BLE_HS_IO_NO_INPUT_OUTPUT
 
+/*
+Vendor service with key press latency histograms. Reading the characteristic
+gives struct hid_lat_summary (count, p50, p99 and max in microseconds, 32-bit
+little endian) for every histogram of hid_latency.h. Writing 0 clears the
+histograms, writing 1 prints them on the console.
+*/
+#define GATT_UUID_LATENCY_SERVICE   0x42, 0x0a, 0x1e, 0x7b, 0x2d, 0x3c, 0x55, 0x9a, \
+                                    0x8e, 0x4b, 0x1c, 0x8f, 0x01, 0x00, 0x4a, 0x6e
+#define GATT_UUID_LATENCY_HIST      0x42, 0x0a, 0x1e, 0x7b, 0x2d, 0x3c, 0x55, 0x9a, \
+                                    0x8e, 0x4b, 0x1c, 0x8f, 0x02, 0x00, 0x4a, 0x6e
+
+#define LATENCY_CMD_RESET               0x00
+#define LATENCY_CMD_DUMP                0x01
+
 #define HID_KEYBOARD_APPEARENCE         0x03c1 // appearance field in advertising packet
 
 struct ble_hs_cfg;
@@ -213,41 +154,15 @@ struct prf_char_pres_fmt
     uint16_t description;
 } __attribute__((packed));
 
-enum attr_handles {
-    HANDLE_BATTERY_LEVEL,               //  0
-    HANDLE_DIS_MODEL_NUMBER,            //  1
-    HANDLE_DIS_SERIAL_NUMBER,           //  2
-    HANDLE_DIS_HARDWARE_REVISION,       //  3
-    HANDLE_DIS_FIRMWARE_REVISION,       //  4
-    HANDLE_DIS_SOFWARE_REVISION,        //  5
-    HANDLE_DIS_MANUFACTURER_NAME,       //  6
-    HANDLE_DIS_SYSTEM_ID,               //  7
-    HANDLE_DIS_PNP_INFO,                //  8
-
-    // HID SERVICE
-    HANDLE_HID_INFORMATION,             //  9
-    HANDLE_HID_CONTROL_POINT,           // 10
-    HANDLE_HID_REPORT_MAP,              // 11
-    HANDLE_HID_PROTO_MODE,              // 12
-    HANDLE_HID_MOUSE_REPORT,            // 13
-    HANDLE_HID_KB_IN_REPORT,            // 14
-    HANDLE_HID_KB_OUT_REPORT,           // 15
-    HANDLE_HID_CC_REPORT,               // 16
-    HANDLE_HID_BOOT_KB_IN_REPORT,       // 17
-    HANDLE_HID_BOOT_KB_OUT_REPORT,      // 18
-    HANDLE_HID_BOOT_MOUSE_REPORT,       // 19
-    HANDLE_HID_FEATURE_REPORT,          // 20
-    HANDLE_HID_COUNT                    // 21
-};
-
-struct report_reference_table {
-    int id;
-    uint8_t hidReportRef[HID_REPORT_REF_LEN];
-} __attribute__((packed));
+
+/* ATT handles are small numbers, this server uses less than a hundred of them */
+#define SVC_ATTR_HANDLES_MAX 256
+
 
 
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
-int gatt_svr_init(void);
+struct hid_dev;
+int gatt_svr_init(struct hid_dev *dev);
 
 
 int hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
@@ -266,26 +181,36 @@ int ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
 int ble_svc_dis_access(uint16_t conn_handle, uint16_t attr_handle,
                    struct ble_gatt_access_ctxt *ctxt, void *arg);
 
-// Globals
-
-extern const uint8_t Hid_report_map[];
+#ifdef CONFIG_HID_LATENCY_TRACE
+/* Access function for key press latency service */
+int ble_svc_latency_access(uint16_t conn_handle, uint16_t attr_handle,
+                   struct ble_gatt_access_ctxt *ctxt, void *arg);
+#endif
 
-extern size_t Hid_report_map_size;
+// Globals
 
 /* handles for all characteristics in GATT services */
 extern uint16_t Svc_char_handles[];
 
+/* reverse of Svc_char_handles: index in it for every value ATT handle, HANDLE_HID_COUNT if none */
+extern uint8_t Svc_handle_nums[SVC_ATTR_HANDLES_MAX];
+
+static inline int
+gatt_svr_handle_num(uint16_t attr_handle)
+{
+    return attr_handle < SVC_ATTR_HANDLES_MAX ? Svc_handle_nums[attr_handle] : HANDLE_HID_COUNT;
+}
+
 extern const struct ble_gatt_svc_def Gatt_svr_included_services[];
 extern const struct ble_gatt_svc_def Gatt_svr_svcs[];
+#ifdef CONFIG_HID_LATENCY_TRACE
+extern const struct ble_gatt_svc_def Gatt_svr_latency_svcs[];
+#endif
 
 extern const uint8_t HidInfo[];
 
 // HID External Report Reference Descriptor
 extern uint16_t HidExtReportRefDesc;
-extern uint8_t HidProtocolMode;
-
-extern struct report_reference_table Hid_report_ref_data[];
-extern size_t Hid_report_ref_data_count;
 
 extern struct prf_char_pres_fmt Battery_level_units;
 
@@ -8,6 +8,7 @@
 
 #include "gpio_func.h"
 #include "hid_codes.h"
+#include "hid_latency.h"
 
 #define task_delay_ms(PAR_MS) vTaskDelay(pdMS_TO_TICKS(PAR_MS))
 
@@ -30,70 +31,33 @@ static const char *tag = "NimBLEKBD_gpio";
 // #define WAIT_TICKS  (1)
 // #endif
 
-// ticks in antirattling time
-int Ticks_to_wait = 1;
-
-// buttons array
-static struct kbd_button {
-    // button's GPIO
-    uint32_t gpio;
-
-    // ticks from program start when rattling will over
-    // if this not 0, then it is rattling right now
-    TickType_t max_ticks;
-
-    // button to emulate, 32 bit
-    // bits 0-7: button keycode (from hid_codes.h)
-    // bits 24-26: key code type: 1 - keyboard, 2 - consumer control, 3 - mouse keys
-    // bits 8 to 15  (byte 1) - mouse axis X changes
-    // bits 16 to 23 (byte 2) - mouse axis Y changes
-    uint32_t hid_button;
-
-    // last state of the button
-    uint32_t last_state;
-} Hid_buttons[] = {
-    { .gpio = 13, .hid_button = HID_CONSUMER_VOLUME_DOWN    | BUTTON_TYPE_CC },
-    { .gpio = 12, .hid_button = HID_CONSUMER_VOLUME_UP      | BUTTON_TYPE_CC },
-    // { .gpio = 13, .hid_button = HID_KEY_LEFT_ARROW          | BUTTON_TYPE_KEYBOARD },
-    // { .gpio = 12, .hid_button = HID_KEY_RIGHT_ARROW         | BUTTON_TYPE_KEYBOARD },
-};
-static int Hid_buttons_count = sizeof(Hid_buttons)/sizeof(Hid_buttons[0]);
-
-static SemaphoreHandle_t ISR_semaphore = NULL;
-
 static void IRAM_ATTR
 gpio_isr_handler1(void* arg)  // gpio isr
 {
-    uint32_t gpio_num = (uint32_t)arg;
-    int cur_button = -1;
-
-    // find the index of button in Hid_buttons array
-    for (int i = 0; i < Hid_buttons_count; ++i) {
-        if (Hid_buttons[i].gpio == gpio_num) {
-            cur_button = i;
-            break;
-        }
-    }
-    if (cur_button == -1) return;
+    struct gpio_button *button = arg;
+    struct gpio_buttons *group = button->group;
 
     uint32_t cur_ticks = xTaskGetTickCountFromISR(),
-             old_ticks = Hid_buttons[cur_button].max_ticks;
+             old_ticks = button->max_ticks;
 
-    Hid_buttons[cur_button].max_ticks = cur_ticks + Ticks_to_wait;
+    button->max_ticks = cur_ticks + group->ticks_to_wait;
 
     // "give" semaphore to start gpio_btn_task watching at this gpio pin
     // ISR will not give seamphore on rattle interrupts
     if (old_ticks == 0) {
-        xSemaphoreGiveFromISR(ISR_semaphore, NULL);
+#ifdef CONFIG_HID_LATENCY_TRACE
+        button->isr_us = hid_lat_now();
+#endif
+        xSemaphoreGiveFromISR(group->isr_semaphore, NULL);
     }
 }
 
 void
-gpio_reset()
+gpio_reset(struct gpio_buttons *group)
 {
     uint64_t in_pins = 0;
-    for (int i = 0; i < Hid_buttons_count; ++i) {
-        in_pins |= (1ULL << Hid_buttons[i].gpio);
+    for (int i = 0; i < group->count; ++i) {
+        in_pins |= (1ULL << group->buttons[i].gpio);
     }
     gpio_config_t io_conf;
     memset(&io_conf, 0, sizeof(io_conf));
@@ -105,7 +69,7 @@ gpio_reset()
 }
 
 void
-gpio_setup()
+gpio_setup(struct gpio_buttons *group)
 {
     esp_err_t ret;
     
@@ -117,12 +81,12 @@ gpio_setup()
     }
     gpio_set_level(CAPS_GPIO, 0);
 
-    ESP_LOGI(tag, "Setting up %d button GPIOs...", Hid_buttons_count);
+    ESP_LOGI(tag, "Setting up %d button GPIOs...", group->count);
 
     uint64_t in_pins = 0;
-    for (int i = 0; i < Hid_buttons_count; ++i) {
-        in_pins |= (1ULL << Hid_buttons[i].gpio);
-        ESP_LOGI(tag, "  Button %d: GPIO%d", i, Hid_buttons[i].gpio);
+    for (int i = 0; i < group->count; ++i) {
+        in_pins |= (1ULL << group->buttons[i].gpio);
+        ESP_LOGI(tag, "  Button %d: GPIO%d", i, group->buttons[i].gpio);
     }
     gpio_config_t io_conf;
     memset(&io_conf, 0, sizeof(io_conf));
@@ -150,15 +114,19 @@ gpio_setup()
         // Continue anyway - might already be installed
     }
     
-    ESP_LOGI(tag, "Adding ISR handlers for %d buttons...", Hid_buttons_count);
-    for (uint32_t i = 0; i < Hid_buttons_count; ++i) {
+    ESP_LOGI(tag, "Adding ISR handlers for %d buttons...", group->count);
+    for (uint32_t i = 0; i < group->count; ++i) {
         // zero button state values
-        Hid_buttons[i].max_ticks = 0;
-        Hid_buttons[i].last_state = Hid_buttons[i].hid_button | BUTTON_RELEASED_BIT;
+        group->buttons[i].group = group;
+        group->buttons[i].max_ticks = 0;
+        group->buttons[i].last_state = group->buttons[i].hid_button | BUTTON_RELEASED_BIT;
+#ifdef CONFIG_HID_LATENCY_TRACE
+        group->buttons[i].trace = HID_LAT_NONE;
+#endif
         
-        ret = gpio_isr_handler_add(Hid_buttons[i].gpio, gpio_isr_handler1, (void *) Hid_buttons[i].gpio);
+        ret = gpio_isr_handler_add(group->buttons[i].gpio, gpio_isr_handler1, &group->buttons[i]);
         if (ret != ESP_OK) {
-            ESP_LOGE(tag, "Failed to add ISR for GPIO%d: %d", Hid_buttons[i].gpio, ret);
+            ESP_LOGE(tag, "Failed to add ISR for GPIO%d: %d", group->buttons[i].gpio, ret);
         }
     }
     ESP_LOGI(tag, "GPIO setup complete");
@@ -175,15 +143,15 @@ set_leds(uint8_t hid_leds)
 void IRAM_ATTR
 gpio_btn_task(void* arg)
 {
-    QueueHandle_t buttons_queue = arg;
+    struct gpio_buttons *group = arg;
     TickType_t delay_time = portMAX_DELAY, cur_ticks;
     uint32_t button;
 
     ESP_LOGI(tag, "GPIO task started, creating semaphore...");
 
-    ISR_semaphore = xSemaphoreCreateBinary();
-    if (!ISR_semaphore || !buttons_queue) {
-        ESP_LOGE(tag, "Can not create semaphore! %p %p", buttons_queue, ISR_semaphore);
+    group->isr_semaphore = xSemaphoreCreateBinary();
+    if (!group->isr_semaphore || !group->queue) {
+        ESP_LOGE(tag, "Can not create semaphore! %p %p", group->queue, group->isr_semaphore);
         vTaskDelay(pdMS_TO_TICKS(30000));
         esp_restart();
     }
@@ -191,52 +159,68 @@ gpio_btn_task(void* arg)
     ESP_LOGI(tag, "Semaphore created, configuring GPIOs...");
 
     // when ticks per second is too small, rattle period can be zero, but it is unacceptable
-    Ticks_to_wait = pdMS_TO_TICKS(ANTI_RATTLE_TIME) > 0 ? pdMS_TO_TICKS(ANTI_RATTLE_TIME) : 1;
+    group->ticks_to_wait = pdMS_TO_TICKS(ANTI_RATTLE_TIME) > 0 ? pdMS_TO_TICKS(ANTI_RATTLE_TIME) : 1;
 
-    gpio_setup();
+    gpio_setup(group);
     
     ESP_LOGI(tag, "GPIO setup complete, entering main loop");
 
     while(1) {
 
-        xSemaphoreTake(ISR_semaphore, delay_time);
+        xSemaphoreTake(group->isr_semaphore, delay_time);
 
         cur_ticks = xTaskGetTickCount();
 
         delay_time = portMAX_DELAY;
 
-        for (int i = 0; i < Hid_buttons_count; ++i) {
+        for (int i = 0; i < group->count; ++i) {
 
-            if (Hid_buttons[i].max_ticks) {
-                if (Hid_buttons[i].max_ticks <= cur_ticks) {
+            struct gpio_button *btn = &group->buttons[i];
+
+            if (btn->max_ticks) {
+                if (btn->max_ticks <= cur_ticks) {
                     // this button does not rattle any more
 
-                    button = Hid_buttons[i].hid_button;
+                    button = btn->hid_button;
                     // gpio level 0 is pressed, 1 is released
-                    if (gpio_get_level(Hid_buttons[i].gpio) > 0) {
+                    if (gpio_get_level(btn->gpio) > 0) {
                         button |= BUTTON_RELEASED_BIT; // it is released
                     }
 
-                    if (Hid_buttons[i].last_state == button) {
+                    if (btn->last_state == button) {
                         // false state change
-                        Hid_buttons[i].max_ticks = 0;
+                        btn->max_ticks = 0;
+#ifdef CONFIG_HID_LATENCY_TRACE
+                        btn->trace = HID_LAT_NONE;
+#endif
                     } else {
-                        if (xQueueSend(buttons_queue, (void *) &button, 0) == pdTRUE) {
-                            Hid_buttons[i].max_ticks = 0;
-                            Hid_buttons[i].last_state = button;
+                        uint32_t event = button;
+#ifdef CONFIG_HID_LATENCY_TRACE
+                        // one trace for the edge, retries for a full queue keep it
+                        if (btn->trace == HID_LAT_NONE) {
+                            btn->trace = hid_lat_begin(btn->isr_us);
+                        }
+                        event |= (uint32_t)(btn->trace + 1) << BUTTON_TRACE_SHIFT;
+#endif
+                        if (xQueueSend(group->queue, (void *) &event, 0) == pdTRUE) {
+                            btn->max_ticks = 0;
+                            btn->last_state = button;
+#ifdef CONFIG_HID_LATENCY_TRACE
+                            btn->trace = HID_LAT_NONE;
+#endif
                             continue;
                         } else {
                             // no room in queue, trying to send it on next tick
                             ESP_LOGI(tag, "No room in out queue!");
-                            Hid_buttons[i].max_ticks = cur_ticks + 1;
+                            btn->max_ticks = cur_ticks + 1;
                         }
                     }
                 }
 
                 // find shortest time among the rattling buttons
-                if (Hid_buttons[i].max_ticks > cur_ticks &&
-                    Hid_buttons[i].max_ticks - cur_ticks < delay_time) {
-                    delay_time = Hid_buttons[i].max_ticks - cur_ticks;
+                if (btn->max_ticks > cur_ticks &&
+                    btn->max_ticks - cur_ticks < delay_time) {
+                    delay_time = btn->max_ticks - cur_ticks;
                 }
             }
         }
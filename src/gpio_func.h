@@ -1,11 +1,71 @@
 #ifndef H_GPIO_FUNC_
 #define H_GPIO_FUNC_
 
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 #define BUTTON_RELEASED_BIT     (uint32_t)(1 << 31)
 #define BUTTON_TYPE_MASK        (uint32_t)(3 << 24)
 #define BUTTON_TYPE_KEYBOARD    (uint32_t)(1 << 24)
 #define BUTTON_TYPE_CC          (uint32_t)(2 << 24)
 #define BUTTON_TYPE_MOUSE       (uint32_t)(3 << 24)
+// mouse keys direction button, bytes 1 and 2 keep X and Y direction (-1, 0, 1)
+#define BUTTON_MOUSE_KEYS       (uint32_t)(1 << 30)
+#define BUTTON_MOUSE_DIR(x, y)  (BUTTON_TYPE_MOUSE | BUTTON_MOUSE_KEYS | \
+                                 ((uint32_t)(uint8_t)(int8_t)(x) << 8) | ((uint32_t)(uint8_t)(int8_t)(y) << 16))
+// latency trace slot + 1, 0 if the event is not traced
+#define BUTTON_TRACE_SHIFT      26
+#define BUTTON_TRACE_MASK       (uint32_t)(0xF << BUTTON_TRACE_SHIFT)
+
+struct gpio_buttons;
+
+// button wired to a GPIO pin, level 0 is pressed
+struct gpio_button {
+    // button's GPIO
+    uint32_t gpio;
+
+    // button to emulate, 32 bit
+    // bits 0-7: button keycode (from hid_codes.h)
+    // bits 24-26: key code type: 1 - keyboard, 2 - consumer control, 3 - mouse keys
+    // bits 8 to 15  (byte 1) - mouse axis X changes
+    // bits 16 to 23 (byte 2) - mouse axis Y changes
+    // bit 30: mouse keys, bytes 1 and 2 are the direction to move while held,
+    //         see BUTTON_MOUSE_DIR()
+    uint32_t hid_button;
+
+    // ticks from program start when rattling will over
+    // if this not 0, then it is rattling right now
+    TickType_t max_ticks;
+
+    // last state of the button
+    uint32_t last_state;
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+    // time of the first edge, latency trace starts here
+    uint32_t isr_us;
+    // trace slot of the change waiting for room in the queue, HID_LAT_NONE if none
+    uint8_t trace;
+#endif
+
+    // buttons it belongs to, set by gpio_btn_task()
+    struct gpio_buttons *group;
+};
+
+// buttons watched by one gpio_btn_task(), it gets them as its argument
+struct gpio_buttons {
+    struct gpio_button *buttons;
+    int count;
+
+    // button events go there
+    QueueHandle_t queue;
+
+    // set by gpio_btn_task()
+    SemaphoreHandle_t isr_semaphore;
+    TickType_t ticks_to_wait;   // ticks in antirattling time
+};
 
 extern void gpio_btn_task(void* arg);
 
@@ -0,0 +1,387 @@
+#include <string.h>
+#include "esp_log.h"
+
+#include "hid_reports.h"
+#include "hid_desc.h"
+
+static const char *tag = "NimBLEKBD_HIDDESC";
+
+/*
+HID report descriptor parser. Hid_report_map is walked once at start and every
+report (report ID and type) gets a table of its data fields: usage, bit offset,
+width and signedness. Report sizes and field positions are taken from these
+tables, so the report map can change without changing the code which fills
+the reports.
+*/
+#define HID_DESC_MAX_REPORTS    16
+#define HID_DESC_MAX_FIELDS     64
+#define HID_DESC_MAX_USAGES     16  // usages of one main item
+#define HID_DESC_STACK_DEPTH    2   // Push items
+
+/* short item prefix without size bits */
+#define ITEM_INPUT              0x80
+#define ITEM_OUTPUT             0x90
+#define ITEM_COLLECTION         0xA0
+#define ITEM_FEATURE            0xB0
+#define ITEM_END_COLLECTION     0xC0
+#define ITEM_USAGE_PAGE         0x04
+#define ITEM_LOGICAL_MIN        0x14
+#define ITEM_LOGICAL_MAX        0x24
+#define ITEM_REPORT_SIZE        0x74
+#define ITEM_REPORT_ID          0x84
+#define ITEM_REPORT_COUNT       0x94
+#define ITEM_PUSH               0xA4
+#define ITEM_POP                0xB4
+#define ITEM_USAGE              0x08
+#define ITEM_USAGE_MIN          0x18
+#define ITEM_USAGE_MAX          0x28
+#define ITEM_LONG               0xFE
+
+struct hid_desc_globals {
+    uint16_t usage_page;
+    int32_t logical_min;
+    uint32_t logical_max;       // raw, sign is known when the field is added
+    uint8_t logical_max_size;
+    uint8_t report_size;
+    uint8_t report_id;
+    uint8_t report_count;
+};
+
+struct hid_desc_locals {
+    uint32_t usages[HID_DESC_MAX_USAGES];   // extended usages: page in high 16 bits, 0 if none
+    uint8_t usage_count;
+    uint32_t usage_min, usage_max;
+    bool has_range;
+};
+
+static struct hid_desc_report Desc_reports[HID_DESC_MAX_REPORTS];
+static struct hid_desc_field Desc_fields[HID_DESC_MAX_FIELDS];
+static uint8_t Desc_report_count, Desc_field_count;
+
+/* report index of every field while parsing, fields are grouped by report at the end */
+static uint8_t Field_report[HID_DESC_MAX_FIELDS];
+
+/* sign extend item data of size bytes */
+static int32_t
+hid_desc_signed(uint32_t data, uint8_t size)
+{
+    switch (size) {
+        case 1:
+            return (int8_t) data;
+        case 2:
+            return (int16_t) data;
+        default:
+            return (int32_t) data;
+    }
+}
+
+/* usage with page, item size 4 keeps page in high 16 bits */
+static uint32_t
+hid_desc_usage(uint32_t data, uint8_t size)
+{
+    return size == 4 ? data : data | 0x80000000;   // bit 31: page is not given yet
+}
+
+/* page and usage of local usage, current usage page is used if item had none */
+static void
+hid_desc_split_usage(uint32_t usage, uint16_t usage_page, uint16_t *page, uint16_t *id)
+{
+    *page = (usage & 0x80000000) ? usage_page : usage >> 16;
+    *id = usage & 0xffff;
+}
+
+static int
+hid_desc_report_idx(uint8_t id, uint8_t type)
+{
+    for (int i = 0; i < Desc_report_count; ++i) {
+        if (Desc_reports[i].id == id && Desc_reports[i].type == type) {
+            return i;
+        }
+    }
+
+    if (Desc_report_count == HID_DESC_MAX_REPORTS) {
+        return -1;
+    }
+
+    struct hid_desc_report *report = &Desc_reports[Desc_report_count];
+    memset(report, 0, sizeof(*report));
+    report->id = id;
+    report->type = type;
+    return Desc_report_count++;
+}
+
+static int
+hid_desc_add_field(int report_idx, const struct hid_desc_field *field)
+{
+    if (Desc_field_count == HID_DESC_MAX_FIELDS) {
+        return 1;
+    }
+    Field_report[Desc_field_count] = report_idx;
+    Desc_fields[Desc_field_count++] = *field;
+    return 0;
+}
+
+/* Input, Output or Feature item: add its fields and grow the report */
+static int
+hid_desc_add_main(uint8_t type, uint32_t data, const struct hid_desc_globals *g,
+    const struct hid_desc_locals *l)
+{
+    int report_idx = hid_desc_report_idx(g->report_id, type);
+
+    if (report_idx == -1) {
+        ESP_LOGE(tag, "too many reports in report map");
+        return 1;
+    }
+
+    struct hid_desc_report *report = &Desc_reports[report_idx];
+    uint16_t bits = g->report_size * g->report_count;
+    int rc = 0;
+
+    if (!(data & HID_DESC_F_CONSTANT) && bits) {
+        struct hid_desc_field field = {
+            .bit_offset = report->bit_size,
+            .bit_size = g->report_size,
+            .flags = data & (HID_DESC_F_CONSTANT | HID_DESC_F_VARIABLE | HID_DESC_F_RELATIVE),
+            .logical_min = g->logical_min,
+        };
+
+        if (g->logical_min < 0) {
+            field.flags |= HID_DESC_F_SIGNED;
+            field.logical_max = hid_desc_signed(g->logical_max, g->logical_max_size);
+        } else {
+            field.logical_max = g->logical_max;
+        }
+
+        if ((data & HID_DESC_F_VARIABLE) && !l->has_range && l->usage_count) {
+            // every element has its own usage, the last one repeats for the rest
+            for (int i = 0; i < g->report_count && !rc; ++i) {
+                uint32_t usage = l->usages[i < l->usage_count ? i : l->usage_count - 1];
+
+                hid_desc_split_usage(usage, g->usage_page, &field.usage_page, &field.usage_min);
+                field.usage_max = field.usage_min;
+                field.count = 1;
+                field.bit_offset = report->bit_size + i * g->report_size;
+                rc = hid_desc_add_field(report_idx, &field);
+            }
+        } else {
+            // usage range, or array which reports usages as values
+            uint32_t first = l->has_range ? l->usage_min : l->usages[0],
+                     last = l->has_range ? l->usage_max : l->usages[l->usage_count ? l->usage_count - 1 : 0];
+            uint16_t last_page;
+
+            hid_desc_split_usage(first, g->usage_page, &field.usage_page, &field.usage_min);
+            hid_desc_split_usage(last, g->usage_page, &last_page, &field.usage_max);
+            field.count = g->report_count;
+            rc = hid_desc_add_field(report_idx, &field);
+        }
+
+        if (rc) {
+            ESP_LOGE(tag, "too many fields in report map");
+        }
+    }
+
+    report->bit_size += bits;
+    return rc;
+}
+
+/* walk report map and build report and field tables, 0 on success */
+int
+hid_desc_parse(const uint8_t *desc, size_t size)
+{
+    struct hid_desc_globals g, stack[HID_DESC_STACK_DEPTH];
+    struct hid_desc_locals l;
+    int depth = 0;
+    size_t pos = 0;
+
+    memset(&g, 0, sizeof(g));
+    memset(&l, 0, sizeof(l));
+    Desc_report_count = 0;
+    Desc_field_count = 0;
+
+    while (pos < size) {
+        uint8_t prefix = desc[pos];
+
+        if (prefix == ITEM_LONG) {
+            // long items are reserved, skip them: prefix, data size, tag and the data
+            if (pos + 2 >= size || pos + 3 + desc[pos + 1] > size) {
+                ESP_LOGE(tag, "report map is cut at byte %u", (unsigned) pos);
+                return 2;
+            }
+            pos += 3 + desc[pos + 1];
+            continue;
+        }
+
+        uint8_t data_size = (prefix & 3) == 3 ? 4 : prefix & 3;
+        uint32_t data = 0;
+
+        if (pos + 1 + data_size > size) {
+            ESP_LOGE(tag, "report map is cut at byte %u", (unsigned) pos);
+            return 2;
+        }
+        for (int i = 0; i < data_size; ++i) {
+            data |= (uint32_t) desc[pos + 1 + i] << (8 * i);
+        }
+        pos += 1 + data_size;
+
+        switch (prefix & 0xFC) {
+            case ITEM_INPUT:
+            case ITEM_OUTPUT:
+            case ITEM_FEATURE: {
+                uint8_t type = (prefix & 0xFC) == ITEM_INPUT ? HID_REPORT_TYPE_INPUT :
+                               (prefix & 0xFC) == ITEM_OUTPUT ? HID_REPORT_TYPE_OUTPUT :
+                               HID_REPORT_TYPE_FEATURE;
+
+                if (hid_desc_add_main(type, data, &g, &l)) {
+                    return 1;
+                }
+                memset(&l, 0, sizeof(l));
+                break;
+            }
+            case ITEM_COLLECTION:
+            case ITEM_END_COLLECTION:
+                memset(&l, 0, sizeof(l));
+                break;
+
+            case ITEM_USAGE_PAGE:
+                g.usage_page = data;
+                break;
+            case ITEM_LOGICAL_MIN:
+                g.logical_min = hid_desc_signed(data, data_size);
+                break;
+            case ITEM_LOGICAL_MAX:
+                g.logical_max = data;
+                g.logical_max_size = data_size;
+                break;
+            case ITEM_REPORT_SIZE:
+                g.report_size = data;
+                break;
+            case ITEM_REPORT_ID:
+                g.report_id = data;
+                break;
+            case ITEM_REPORT_COUNT:
+                g.report_count = data;
+                break;
+            case ITEM_PUSH:
+                if (depth == HID_DESC_STACK_DEPTH) {
+                    ESP_LOGE(tag, "report map Push is nested too deep");
+                    return 2;
+                }
+                stack[depth++] = g;
+                break;
+            case ITEM_POP:
+                if (depth == 0) {
+                    ESP_LOGE(tag, "report map Pop without Push");
+                    return 2;
+                }
+                g = stack[--depth];
+                break;
+
+            case ITEM_USAGE:
+                if (l.usage_count < HID_DESC_MAX_USAGES) {
+                    l.usages[l.usage_count++] = hid_desc_usage(data, data_size);
+                }
+                break;
+            case ITEM_USAGE_MIN:
+                l.usage_min = hid_desc_usage(data, data_size);
+                l.has_range = true;
+                break;
+            case ITEM_USAGE_MAX:
+                l.usage_max = hid_desc_usage(data, data_size);
+                l.has_range = true;
+                break;
+
+            default:
+                // physical range, units, strings and designators do not change layout
+                break;
+        }
+    }
+
+    // group fields by report, keep descriptor order inside a report
+    static struct hid_desc_field sorted[HID_DESC_MAX_FIELDS];
+    uint8_t n = 0;
+
+    for (int r = 0; r < Desc_report_count; ++r) {
+        Desc_reports[r].first_field = n;
+        for (int f = 0; f < Desc_field_count; ++f) {
+            if (Field_report[f] == r) {
+                sorted[n++] = Desc_fields[f];
+            }
+        }
+        Desc_reports[r].field_count = n - Desc_reports[r].first_field;
+    }
+    memcpy(Desc_fields, sorted, n * sizeof(sorted[0]));
+
+    ESP_LOGI(tag, "report map: %d reports, %d fields", Desc_report_count, Desc_field_count);
+    return 0;
+}
+
+const struct hid_desc_report *
+hid_desc_report_get(uint8_t id, uint8_t type)
+{
+    for (int i = 0; i < Desc_report_count; ++i) {
+        if (Desc_reports[i].id == id && Desc_reports[i].type == type) {
+            return &Desc_reports[i];
+        }
+    }
+    return NULL;
+}
+
+/* report data size in bytes, report ID byte not counted, 0 if there is no such report */
+size_t
+hid_desc_report_size(uint8_t id, uint8_t type)
+{
+    const struct hid_desc_report *report = hid_desc_report_get(id, type);
+
+    return report ? (report->bit_size + 7) / 8 : 0;
+}
+
+const struct hid_desc_field *
+hid_desc_report_field(const struct hid_desc_report *report, int n)
+{
+    if (!report || n < 0 || n >= report->field_count) {
+        return NULL;
+    }
+    return &Desc_fields[report->first_field + n];
+}
+
+/* find element of variable field with the usage, 1 if report has no such usage */
+int
+hid_desc_find(uint8_t id, uint8_t type, uint16_t usage_page, uint16_t usage,
+    struct hid_desc_ref *ref)
+{
+    const struct hid_desc_report *report = hid_desc_report_get(id, type);
+
+    ref->field = NULL;
+    ref->index = 0;
+
+    if (!report) {
+        return 1;
+    }
+
+    for (int i = 0; i < report->field_count; ++i) {
+        const struct hid_desc_field *field = &Desc_fields[report->first_field + i];
+
+        if ((field->flags & HID_DESC_F_VARIABLE) && field->usage_page == usage_page &&
+            usage >= field->usage_min && usage <= field->usage_max &&
+            usage - field->usage_min < field->count) {
+            ref->field = field;
+            ref->index = usage - field->usage_min;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* write value of usage into report buffer, looks the usage up every time */
+int
+hid_desc_set(uint8_t id, uint8_t type, uint8_t *buf, uint16_t usage_page, uint16_t usage,
+    int32_t value)
+{
+    struct hid_desc_ref ref;
+
+    if (hid_desc_find(id, type, usage_page, usage, &ref)) {
+        return 1;
+    }
+    hid_desc_ref_write(buf, &ref, value);
+    return 0;
+}
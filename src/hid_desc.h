@@ -0,0 +1,127 @@
+#ifndef H_HID_DESC_
+#define H_HID_DESC_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* usage pages and usages the code looks up in report map */
+#define HID_USAGE_PAGE_GENERIC_DESKTOP  0x01
+#define HID_USAGE_PAGE_KEYBOARD         0x07
+#define HID_USAGE_PAGE_LEDS             0x08
+#define HID_USAGE_PAGE_BUTTON           0x09
+#define HID_USAGE_PAGE_CONSUMER         0x0C
+#define HID_USAGE_PAGE_DIGITIZER        0x0D
+
+#define HID_USAGE_X                     0x30    // Generic Desktop
+#define HID_USAGE_Y                     0x31
+#define HID_USAGE_Z                     0x32
+#define HID_USAGE_RX                    0x33
+#define HID_USAGE_RY                    0x34
+#define HID_USAGE_RZ                    0x35
+#define HID_USAGE_WHEEL                 0x38
+#define HID_USAGE_HAT_SWITCH            0x39
+#define HID_USAGE_RESOLUTION_MULTIPLIER 0x48
+#define HID_USAGE_AC_PAN                0x238   // Consumer
+#define HID_USAGE_IN_RANGE              0x32    // Digitizer
+#define HID_USAGE_TIP_SWITCH            0x42
+#define HID_USAGE_BARREL_SWITCH         0x44
+
+/* field flags, bits 0 to 2 are the same as in Input/Output/Feature items */
+#define HID_DESC_F_CONSTANT     0x01
+#define HID_DESC_F_VARIABLE     0x02
+#define HID_DESC_F_RELATIVE     0x04
+#define HID_DESC_F_SIGNED       0x80    // logical minimum is negative
+
+/* one data item of a report, constant (padding) items are not kept */
+struct hid_desc_field {
+    uint16_t usage_page;
+    uint16_t usage_min;         // usage of element 0
+    uint16_t usage_max;         // usage of the last element, arrays: last usage value
+    uint16_t bit_offset;        // from the start of report data, report ID byte not counted
+    uint8_t bit_size;           // of one element
+    uint8_t count;              // elements
+    uint8_t flags;              // HID_DESC_F_*
+    int32_t logical_min;
+    int32_t logical_max;
+};
+
+/* one report (report ID and type), its fields follow each other in the field table */
+struct hid_desc_report {
+    uint8_t id;
+    uint8_t type;               // HID_REPORT_TYPE_*
+    uint16_t bit_size;          // report data size, report ID byte not counted
+    uint8_t first_field;
+    uint8_t field_count;
+};
+
+/* resolved place of one usage: field and element in it */
+struct hid_desc_ref {
+    const struct hid_desc_field *field;
+    uint8_t index;
+};
+
+extern int hid_desc_parse(const uint8_t *desc, size_t size);
+
+extern const struct hid_desc_report *hid_desc_report_get(uint8_t id, uint8_t type);
+extern size_t hid_desc_report_size(uint8_t id, uint8_t type);
+extern const struct hid_desc_field *hid_desc_report_field(const struct hid_desc_report *report, int n);
+
+extern int hid_desc_find(uint8_t id, uint8_t type, uint16_t usage_page, uint16_t usage,
+    struct hid_desc_ref *ref);
+extern int hid_desc_set(uint8_t id, uint8_t type, uint8_t *buf, uint16_t usage_page, uint16_t usage,
+    int32_t value);
+
+/* write value into element index of field, the value is cut to the element width */
+static inline void
+hid_desc_field_write(uint8_t *buf, const struct hid_desc_field *field, int index, int32_t value)
+{
+    uint32_t v = (uint32_t) value;
+    unsigned pos = field->bit_offset + index * field->bit_size;
+    unsigned left = field->bit_size;
+
+    while (left) {
+        unsigned shift = pos & 7;
+        unsigned n = 8 - shift < left ? 8 - shift : left;
+        uint8_t mask = ((1u << n) - 1) << shift;
+
+        buf[pos >> 3] = (buf[pos >> 3] & ~mask) | ((v << shift) & mask);
+        v >>= n;
+        pos += n;
+        left -= n;
+    }
+}
+
+/* read element index of field, sign extended if the logical minimum is negative */
+static inline int32_t
+hid_desc_field_read(const uint8_t *buf, const struct hid_desc_field *field, int index)
+{
+    uint32_t v = 0;
+    unsigned pos = field->bit_offset + index * field->bit_size;
+
+    for (unsigned i = 0; i < field->bit_size; ++i, ++pos) {
+        v |= (uint32_t)((buf[pos >> 3] >> (pos & 7)) & 1) << i;
+    }
+    if ((field->flags & HID_DESC_F_SIGNED) && field->bit_size < 32 && (v >> (field->bit_size - 1))) {
+        v |= ~0u << field->bit_size;
+    }
+    return (int32_t) v;
+}
+
+/* write value of usage resolved by hid_desc_find(), nothing if the usage was not found */
+static inline void
+hid_desc_ref_write(uint8_t *buf, const struct hid_desc_ref *ref, int32_t value)
+{
+    if (ref->field) {
+        hid_desc_field_write(buf, ref->field, ref->index, value);
+    }
+}
+
+/* read value of usage resolved by hid_desc_find(), 0 if the usage was not found */
+static inline int32_t
+hid_desc_ref_read(const uint8_t *buf, const struct hid_desc_ref *ref)
+{
+    return ref->field ? hid_desc_field_read(buf, ref->field, ref->index) : 0;
+}
+
+#endif
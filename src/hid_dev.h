@@ -0,0 +1,319 @@
+#ifndef H_HID_DEV_
+#define H_HID_DEV_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+
+#include "hid_func.h"
+#include "hid_input.h"
+#include "hid_reports.h"
+
+/*
+Layout of the HID device context. Its fields belong to hid_func.c, the layout
+is here only so that the owner can keep the instance: main.c has the one the
+firmware runs, hid_init() sets it up, every hid_* call gets it.
+*/
+
+/* largest report buffer, fits into one notification with the default ATT MTU */
+#define HID_REPORT_MAX_SIZE 20
+
+/* notify data buffers */
+struct hid_report_buffers {
+    /* mouse: the last report sent, layout is taken from the report map (Mouse_layout)
+    boot mouse report: byte 0 buttons, bytes 1 to 3: 8-bit X, Y and wheel (no AC Pan) */
+    uint8_t mouse[HIDD_LE_REPORT_MOUSE_SIZE];
+    /* keyboard
+    byte 0: modifiers: bit 0 LEFT CTRL, 1 LEFT SHIFT, 2 LEFT ALT, 3 LEFT GUI
+                           4 RIGHT CTRL, 5 RIGHT SHIFT, 6 RIGHT ALT, 7 RIGHT GUI
+    byte 1: reserved (zeroes),
+    bytes 2 to 7: keyboard scan codes from 4 to 221     */
+    uint8_t keyboard[HIDD_LE_REPORT_KB_IN_SIZE];
+    /* N-key rollover keyboard
+    byte 0: modifiers, same as in keyboard
+    bytes 1 to 19: bit per key code, bit 0 of byte 1 is code 0     */
+    uint8_t keyboard_nkro[HIDD_LE_REPORT_KB_NKRO_SIZE];
+    /* absolute pointer (pen): switches and X, Y, layout is taken from the report map (Abs_layout) */
+    uint8_t abs_pointer[HIDD_LE_REPORT_ABS_POINTER_SIZE];
+    /* gamepad: buttons, sticks, triggers and hat, layout is taken from the report map (Gamepad_layout) */
+    uint8_t gamepad[HIDD_LE_REPORT_GAMEPAD_SIZE];
+    /* consumer control: array of HID_CC_SLOTS 16-bit Consumer page usages, 0 in empty slots */
+    uint8_t cc[HIDD_LE_REPORT_CC_SIZE];
+    /* Keyboard out report keeps data for leds in one byte
+    LEDS: bit 0 NUM LOCK, 1 CAPS LOCK, 2 SCROLL LOCK, 3 COMPOSE, 4 KANA, 5 to 7 RESERVED (zeroes) */
+    uint8_t leds[HIDD_LE_REPORT_KB_OUT_SIZE];
+    /* battery level */
+    uint8_t battery_level[HIDD_LE_BATTERY_LEVEL_SIZE];
+    /* Feature data - custom data for this device */
+    uint8_t feature[HIDD_LE_REPORT_FEATURE];
+};
+
+/*
+Report buffers are shared between the input path (writers) and the NimBLE host
+task (GATT reads, notifications). Every buffer is guarded by a sequence counter
+(seqlock): a writer makes the counter odd, changes the buffer and makes it even
+again, a reader copies the buffer and retries if the counter was odd or has
+changed meanwhile. Readers never block, writers only serialize among themselves
+on a short spinlock, so nobody waits for a mutex with a timeout any more.
+*/
+struct hid_notify_data {
+    const struct hid_report_def *def;
+    uint8_t *buffer;            // data to send, def->buffer_size bytes
+    uint32_t seq;               // seqlock counter, odd while buffer is being written
+    uint8_t delivery;           // HID_DELIVERY_*, see hid_set_delivery()
+};
+
+/*
+Pressed keys are kept in a 256-bit set and in a list ordered by press time,
+both are changed in O(1). Report mode sends the set as the NKRO bitmap, boot
+mode report is derived from the first keys of the list.
+*/
+struct hid_key_state {
+    uint8_t pressed[32];        // bit per key code
+    uint8_t next[256];          // press order list, index 0 (no key) is the list head
+    uint8_t prev[256];
+    uint8_t count;              // ordinary keys (not modifiers) in the list
+    uint8_t modifiers;          // bit per modifier key, same as report byte 0
+};
+
+/*
+Typing engine. Text is buffered and turned into keyboard reports in the NimBLE
+host task, a few reports at a time: the next report is built only when TX
+queues of all centrals have room, so long texts are never dropped and the link
+is kept busy. Consecutive characters share reports where possible, "ab" is
+[a] [b] [], only a repeated key or shift change needs a report in between:
+"aa" is [a] [] [a] [], "aB" is [a] [Shift] [Shift B] [].
+*/
+#define HID_TYPE_BUF_SIZE   256
+
+struct hid_typing {
+    portMUX_TYPE lock;
+    char buf[HID_TYPE_BUF_SIZE];
+    uint16_t head;              // next character to type
+    uint16_t count;
+    uint8_t key;                // typed key still pressed, 0 if none
+    bool shift;                 // typing holds left shift
+    struct ble_npl_event step_ev;
+};
+
+/*
+Mouse keys: held direction buttons move the pointer. A press moves one count at
+once, after profile.delay_ms the pointer moves continuously, every tick by speed
+times the time since the previous tick. The speed rises from initial_speed to
+max_speed over time_to_max_ms along a quadratic curve kept in speed_lut, so a tick
+is a table lookup and integer arithmetic. Ticks follow the shortest connection
+interval of the connected centrals: every tick arms the next one and a change of
+the intervals re-arms the pending one. Motion is accumulated in subpixels and sent
+by hid_mouse_flush() like any other motion. Held directions add up, left and up
+together move diagonally at the same speed as one direction.
+*/
+struct hid_mouse_keys {
+    portMUX_TYPE lock;
+    struct hid_mouse_keys_profile profile;
+    uint32_t speed_lut[HID_MOUSE_KEYS_LUT + 1];     // subpixels per second
+    int16_t dir_x, dir_y;       // sum of held directions, only the sign counts
+    uint8_t held;               // direction buttons held
+    int64_t start_us;           // first of the held buttons was pressed
+    int64_t last_us;            // previous tick
+    esp_timer_handle_t timer;
+};
+
+/* report TX queue of one central, see hid_tx_pump() */
+#define HID_TX_CLASS_SIZE   16  // reports waiting for the link in one class
+#define HID_TX_CREDITS      4   // reports handed to the host and not completed yet
+
+struct hid_tx_entry {
+    uint16_t attr_handle;       // characteristic value handle to send to
+    uint8_t report_idx;         // index in hid_dev.reports
+    uint8_t size;
+    bool indicate;
+    bool edge;                  // pointer report pressing or releasing a button, never merged
+#ifdef CONFIG_HID_LATENCY_TRACE
+    uint8_t trace;              // latency trace slot, HID_LAT_NONE if not traced
+#endif
+    uint8_t data[HID_REPORT_MAX_SIZE];
+};
+
+/* last report queued to a central, 0 size if unknown */
+struct hid_last_sent {
+    uint8_t size;
+    uint8_t data[HID_REPORT_MAX_SIZE];
+};
+
+struct hid_tx_class {
+    struct hid_tx_entry entries[HID_TX_CLASS_SIZE];
+    uint8_t head;               // oldest entry
+    uint8_t count;
+    uint8_t inflight;           // credits held by reports of this class
+    uint8_t passed;             // higher class sends while this one could send
+    bool head_busy;             // head entry is being handed to NimBLE, it must not change
+};
+
+struct hid_tx_queue {
+    portMUX_TYPE lock;
+    struct hid_tx_class classes[HID_TX_CLASSES];
+    uint8_t count;              // reports waiting in all classes
+    uint8_t credits;
+    bool indication_pending;    // indication sent, waiting for confirmation
+    uint8_t indication_class;   // class of the pending indication
+    bool sending;               // hid_tx_pump() is in hid_tx_send(), NOTIFY_TX now is about that report
+    uint8_t held;               // frames being queued, the pump waits for all of them
+    bool release_held;          // the pump ran while held
+    struct ble_npl_event pump_ev;
+    struct ble_npl_callout retry_co;
+    struct hid_tx_stats stats;
+    /* a report equal to the last one is not queued again, see hid_conn_enqueue() */
+    struct hid_last_sent last[HID_REPORTS_COUNT];
+#ifdef CONFIG_HID_LATENCY_TRACE
+    uint8_t sending_trace;      // trace slot of the report being sent
+    uint8_t indication_trace;   // trace slot of the pending indication
+#endif
+};
+
+/*
+Relative mouse motion is not written to the mouse buffer directly. Deltas are summed
+here and flushed as one report per connection interval. X and Y are kept in
+1/HID_MOUSE_SUBPIXELS counts, only whole counts are sent and the fraction stays
+for the next report, as does anything beyond the report field range (16 bit in
+report mode, 8 bit in boot mode). Wheel and AC Pan are kept in 1/HID_WHEEL_MULTIPLIER
+detents: a central which enabled the resolution multiplier gets every step, others
+get whole detents.
+*/
+struct hid_mouse_motion {
+    int32_t x, y;               // accumulated deltas not sent yet, in subpixels
+    int32_t wheel, pan;         // scroll not sent yet, in 1/HID_WHEEL_MULTIPLIER detents
+    bool dirty;                 // buttons or deltas wait for the next report
+    uint8_t trace;              // latency trace of the first input waiting, HID_LAT_NONE if none
+    int64_t last_send_us;       // time of the last mouse report
+    esp_timer_handle_t timer;   // fires on the next send opportunity
+};
+
+/*
+Gamepad axis changes are merged: the state is written to the gamepad buffer at once,
+every central gets at most one axis report per connection interval, the state that
+is current when its send opportunity comes. Button and hat changes are sent at once
+and never merged, each press and release reaches the host.
+*/
+struct hid_gamepad_pace {
+    bool dirty;                 // axes changed since the last report, under hid_dev.writer_lock
+    uint8_t trace;              // latency trace of the first change waiting, under hid_dev.writer_lock
+    int64_t last_send_us;
+    esp_timer_handle_t timer;   // fires on the next send opportunity
+};
+
+/*
+Every connected central has its own slot with subscriptions, protocol mode,
+suspend state, mouse motion not sent yet and TX queue. Input report buffers
+describe the device itself and are shared, each report is fanned out to all
+centrals subscribed to it.
+*/
+#define HID_MAX_CONNS MYNEWT_VAL(BLE_MAX_CONNECTIONS)
+
+struct hid_dev;
+
+struct hid_conn {
+    struct hid_dev *dev;        // device the slot belongs to
+    bool in_use;                // changed under tx.lock
+    bool encrypted;             // reports are READ_ENC, nothing is sent before
+    bool suspended_state;
+    bool report_mode_boot;
+    uint16_t conn_handle;
+    uint32_t conn_itvl_us;      // connection interval, one send opportunity per interval
+    /* HID_SUBSCRIBED_* flags for every characteristic in hid_dev.char_handles */
+    uint8_t subscribed[HANDLE_HID_COUNT];
+    uint8_t mouse_feature[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE];   // resolution multipliers set by central
+    bool wheel_hires, pan_hires;        // multipliers are on, report fields carry 1/HID_WHEEL_MULTIPLIER
+    struct hid_mouse_motion motion;
+    struct hid_gamepad_pace gamepad;
+    struct hid_tx_queue tx;
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+    int64_t anchor_us;          // a connection event started about then, 0 if unknown
+    esp_timer_handle_t release_timer;   // pumps queued reports just before the next event
+    bool release_armed;         // changed under tx.lock
+#endif
+};
+
+#ifdef CONFIG_HID_PENDING_INPUT
+/*
+Input made while no central can take it: nobody is connected, the link is not
+encrypted yet, the central has not subscribed (bonded centrals get their
+subscriptions back only after encryption) or it is suspended. Report snapshots
+are kept in the order they were made for CONFIG_HID_PENDING_INPUT_TTL_MS and
+replayed to the first central which takes them, before its state is resynced.
+So the keystroke which woke the central up is typed, not only its net state.
+*/
+#define HID_PENDING_SIZE        CONFIG_HID_PENDING_INPUT_SIZE
+
+struct hid_pending_entry {
+    uint32_t time_ms;           // when the report was made
+    uint8_t report_idx;
+    uint8_t size;
+    uint8_t data[HID_REPORT_MAX_SIZE];
+};
+
+struct hid_pending {
+    portMUX_TYPE lock;
+    struct hid_pending_entry entries[HID_PENDING_SIZE];     // oldest first
+    uint8_t count;
+    struct hid_pending_stats stats;
+};
+#endif
+
+/*  send report to central using different ways
+    0 - using ble_gattc_indicate_custom     using custom buffer
+    1 - using ble_gattc_indicate            to only one connection
+    2 - using ble_gatts_chr_updated         to all connected centrals
+    Only the custom method sends the report snapshot taken when it was queued,
+    others read the buffer again when the report leaves the queue.
+*/
+#define SEND_METHOD_CUSTOM  0
+#define SEND_METHOD_STD     1
+#define SEND_METHOD_ALL     2
+
+#ifndef NOTIFY_METHOD
+#define NOTIFY_METHOD SEND_METHOD_CUSTOM
+#endif
+
+/*
+SEND_METHOD_CUSTOM builds reports in mbufs of a dedicated pool, so they do not
+compete with ATT/L2CAP traffic for msys buffers. Every block fits one report and
+the headers the host prepends in front of it. A block is held until the host
+hands the report to the controller, empty pool is handled like BLE_HS_ENOMEM.
+*/
+#define HID_MBUF_LEADING_SPACE  16  // HCI ACL (4) + L2CAP (4) + ATT (3) headers, rounded up
+#define HID_MBUF_COUNT          (2 * HID_TX_CREDITS * HID_MAX_CONNS)
+#define HID_MBUF_BLOCK_SIZE     OS_ALIGN(sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) + \
+                                    HID_MBUF_LEADING_SPACE + HID_REPORT_MAX_SIZE, OS_ALIGNMENT)
+
+/*
+Run time state of the device: report buffers, what is pressed, connected
+centrals and engines that turn input into reports, all in one context.
+Report layouts are not here: they are resolved in the report map, which is
+the same for every device.
+*/
+struct hid_dev {
+    portMUX_TYPE writer_lock;   // serializes writers of report buffers, readers do not take it
+    struct hid_report_buffers buffers;
+    struct hid_notify_data reports[HID_REPORTS_COUNT];  // in Hid_report_defs order
+    const uint16_t *char_handles;   // characteristic value handles by handle index, see hid_init()
+    struct hid_key_state key_state;
+    uint8_t mouse_buttons;      // pressed now, bit 0 Button 1, bit 1 Button 2, bit 2 Button 3
+    /* consumer control usages held now in press order, the report carries as many as it has slots for */
+    struct hid_cc_keys cc_keys;
+    struct hid_conn conns[HID_MAX_CONNS];
+    struct hid_typing typing;
+    struct hid_mouse_keys mouse_keys;
+#ifdef CONFIG_HID_PENDING_INPUT
+    struct hid_pending pending;
+#endif
+    os_membuf_t mbuf_mem[OS_MEMPOOL_SIZE(HID_MBUF_COUNT, HID_MBUF_BLOCK_SIZE)];
+    struct os_mempool mbuf_mempool;
+    struct os_mbuf_pool mbuf_pool;
+    uint32_t mbuf_exhausted;    // sends postponed because the pool was empty
+};
+
+#endif
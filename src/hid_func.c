@@ -1,624 +1,2860 @@
+#include <inttypes.h>
+#include <pthread.h>
 #include "nvs_flash.h"
 #include "esp_log.h"
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "esp_timer.h"
 
 #include "gatt_svr.h"
 #include "gpio_func.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "hid_input.h"
+#include "hid_latency.h"
+#include "hid_reports.h"
+#include "hid_seqlock.h"
+#include "tlog.h"
 
 static const char *tag = "NimBLEKBD_HIDFUNC";
 
-/*
-10 ms is enough time for writing operation, and
-a very large amount of time im terms of ble operations*/
-#define HID_DEV_BUF_MUTEX_WAIT 10
 #define BATTERY_DEFAULT_LEVEL 77
 
-/* notify data buffers */
-static uint8_t
-    /* mouse: byte 0: bit 0 Button 1, bit 1 Button 2, bit 2 Button 3, bits 4 to 7 zero
-    byte 1 : X displacement, byte 2: Y displacement, byte 3: wheel    */
-    Mouse_buffer[HIDD_LE_REPORT_MOUSE_SIZE],
-    /* keyboard
-    byte 0: modifiers: bit 0 LEFT CTRL, 1 LEFT SHIFT, 2 LEFT ALT, 3 LEFT GUI
-                           4 RIGHT CTRL, 5 RIGHT SHIFT, 6 RIGHT ALT, 7 RIGHT GUI
-    byte 1: reserved (zeroes),
-    bytes 2 to 7: keyboard scan codes from 4 to 221     */
-    Keyboard_buffer[HIDD_LE_REPORT_KB_IN_SIZE],
-    /* consumer control buffer
-    byte 0: bits 0-3 num key pad, 4-5 - channel (+1 -1), 6 - volume up, 7 - volume down
-    byte 1: 0-3 - buttons, 4-5 - selection buttons, 6-7 - zero    */
-    CC_buffer[HIDD_LE_REPORT_CC_SIZE],
-    /* Keyboard out report keeps data for leds in one byte
-    LEDS: bit 0 NUM LOCK, 1 CAPS LOCK, 2 SCROLL LOCK, 3 COMPOSE, 4 KANA, 5 to 7 RESERVED (zeroes) */
-    Leds_buffer[HIDD_LE_REPORT_KB_OUT_SIZE],
-    /* battery level */
-    Battery_level[] = { BATTERY_DEFAULT_LEVEL, },
-    /* Feature data - custom data for this device */
-    Feature_buffer[] = "olegos";
-
-static struct hid_notify_data {
-    const char *name;
-    int handle_num;        // handle index from Svc_char_handles
-    int handle_boot_num;   // handle num in boot mode
-    uint8_t *buffer;            // data to send
-    size_t buffer_size;
-    bool can_indicate;          // preffered method, because central will response to it
-    bool can_notify;
-} Notify_data_reports[] =
-{
-    {   .name = "mouse",
-        .handle_num = HANDLE_HID_MOUSE_REPORT,
-        .handle_boot_num = HANDLE_HID_BOOT_MOUSE_REPORT,
-        .buffer = Mouse_buffer,
-        .buffer_size = HIDD_LE_REPORT_MOUSE_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "keyboard",
-        .handle_num = HANDLE_HID_KB_IN_REPORT,
-        .handle_boot_num = HANDLE_HID_BOOT_KB_IN_REPORT,
-        .buffer = Keyboard_buffer,
-        .buffer_size = HIDD_LE_REPORT_KB_IN_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "leds",
-        .handle_num = HANDLE_HID_KB_OUT_REPORT,
-        .handle_boot_num = HANDLE_HID_BOOT_KB_OUT_REPORT,
-        .buffer = Leds_buffer,
-        .buffer_size = HIDD_LE_REPORT_KB_OUT_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "consumer control",
-        .handle_num = HANDLE_HID_CC_REPORT,
-        .handle_boot_num = HANDLE_HID_CC_REPORT,
-        .buffer = CC_buffer,
-        .buffer_size = HIDD_LE_REPORT_CC_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "battery level",
-        .handle_num = HANDLE_BATTERY_LEVEL,
-        .handle_boot_num = HANDLE_BATTERY_LEVEL,
-        .buffer = Battery_level,
-        .buffer_size = HIDD_LE_BATTERY_LEVEL_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "feature",
-        .handle_num = HANDLE_HID_FEATURE_REPORT,
-        .handle_boot_num = HANDLE_HID_FEATURE_REPORT,
-        .buffer = Feature_buffer,
-        .buffer_size = HIDD_LE_REPORT_FEATURE,
-        .can_indicate = false, .can_notify= false
-    },
+/* report fields resolved in report map, reports are filled through them */
+struct hid_mouse_layout {
+    struct hid_desc_ref buttons[3], x, y, wheel, pan;
+    int32_t xy_max, wheel_max, pan_max;     // largest delta the fields can carry
+    /* feature report: resolution multipliers of wheel and AC Pan */
+    const struct hid_desc_field *wheel_mult, *pan_mult;
+};
+
+struct hid_abs_layout {
+    struct hid_desc_ref tip, barrel, in_range, x, y;
+};
+
+struct hid_gamepad_layout {
+    struct hid_desc_ref button1;            // buttons follow it in the same field
+    struct hid_desc_ref axes[HID_GAMEPAD_AXES];
+    struct hid_desc_ref hat;
+};
+
+/*
+What the report map and the report table say: it is the same for every device,
+so it is built once for the process by the first hid_init() and only read after,
+through the const Layout; devices running in parallel share it without locks.
+*/
+struct hid_layout {
+    int8_t report_idx_by_handle[HANDLE_HID_COUNT];  // index in hid_dev.reports, -1 for others
+    struct hid_mouse_layout mouse;
+    const struct hid_desc_field *cc;                // consumer control usage array
+    struct hid_abs_layout abs;
+    struct hid_gamepad_layout gamepad;
 };
 
-static struct hid_device_data {
-    /* Mutex semaphore for access to this struct */
-    SemaphoreHandle_t semaphore;
-    bool suspended_state;
-    bool report_mode_boot;
-    bool connected;
-    uint16_t conn_handle;
-} My_hid_dev = {
-    .semaphore = 0,
-    .connected = false,
-    .suspended_state = false,
-    .report_mode_boot = false,
+static struct hid_layout Layout_data;
+static const struct hid_layout *const Layout = &Layout_data;
+static pthread_once_t Layout_once = PTHREAD_ONCE_INIT;
+
+#define HID_SUBSCRIBED_NOTIFY   0x01
+#define HID_SUBSCRIBED_INDICATE 0x02  // used when delivery policy of report asks for it
+
+/* typing engine, see struct hid_typing */
+#define HID_TYPE_AHEAD      HID_TX_CREDITS  // reports queued ahead of the link for every central
+#define HID_TYPE_SHIFT      0x80            // flag in Ascii_keys, character needs shift
+
+/* mouse keys, see struct hid_mouse_keys */
+#define HID_MOUSE_KEYS_TICK_US  10000       // tick without a connected central
+#define HID_MOUSE_KEYS_DIAG     181         // 1/sqrt(2) in 1/256, diagonal scale
+
+/*
+Outgoing reports are queued and sent from the NimBLE host task. Every send
+takes a credit. An indication gives it back when it is confirmed or times out.
+Notification credits are host-side only: NimBLE raises BLE_GAP_EVENT_NOTIFY_TX
+for a notification inside ble_gattc_notify_custom(), when the host has taken it,
+not when the controller has sent it, so the credit comes back as soon as the call
+returns. What holds notifications back is the HID mbuf pool, whose blocks stay
+in use until the controller takes the packets. When the host is out of buffers
+(BLE_HS_ENOMEM) the report stays at the head of the queue and is retried later
+by retry_co, so key releases are never lost on a busy link.
+
+Every HID_TX_CLASS_* has its own queue. Reports leave in strict class priority:
+keys before pointer motion, pointer motion before battery and feature updates.
+A class may hold only Tx_class_credits of the credits, so a stream of mouse
+motion never hands more reports to the host than its share. A class passed over
+HID_TX_STARVE_MAX times in a row while it could send gets the next turn.
+
+A pointer report that presses or releases a button is input of the same kind as
+a key: it goes to the keys class, together with the reports of the same pointer
+still queued before it, so Ctrl+click reaches the host as Ctrl, click, release
+of Ctrl, whatever the pointer class is doing. Reports of that pointer stay in the
+keys class until it has sent them all, in order; indicated positions between two
+edges still merge there, see hid_conn_enqueue().
+*/
+#define HID_TX_RETRY_MS     5   // delay before retrying after BLE_HS_ENOMEM
+#define HID_TX_STARVE_MAX   8   // sends of higher classes a waiting class lets go first
+
+/* credits a class may hold at once */
+static const uint8_t Tx_class_credits[HID_TX_CLASSES] = {
+    [HID_TX_CLASS_KEYS] = HID_TX_CREDITS,
+    [HID_TX_CLASS_POINTER] = 2,
+    [HID_TX_CLASS_BULK] = 1,
 };
 
+#ifdef CONFIG_HID_PENDING_INPUT
+/* keyboard, NKRO and consumer control: their current state follows a replay in the keys class */
+#define HID_PENDING_EVENT_REPORTS   3
+
+_Static_assert(HID_PENDING_SIZE + HID_PENDING_EVENT_REPORTS <= HID_TX_CLASS_SIZE,
+    "replay must fit in TX queue class");
+#endif
+
+static void hid_mouse_timer_cb(void *arg);
+static void hid_mouse_keys_timer_cb(void *arg);
+static void hid_mouse_keys_retick(struct hid_dev *dev);
+static void hid_gamepad_timer_cb(void *arg);
+static void hid_gamepad_clear(struct hid_dev *dev);
+static size_t hid_mouse_render_boot(struct hid_dev *dev, uint8_t *dst);
+static void hid_tx_pump(struct ble_npl_event *ev);
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+static void hid_tx_release_cb(void *arg);
+#endif
+static void hid_tx_reset(struct hid_conn *conn);
+static void hid_type_step(struct ble_npl_event *ev);
+static void hid_type_reset(struct hid_dev *dev);
+static void hid_conn_resync_report(struct hid_conn *conn, int report_idx);
+static void hid_pending_replay(struct hid_conn *conn);
+static uint16_t hid_gamepad_buttons_read(const uint8_t *buf);
+
+/* slot of connected central, NULL if conn_handle is unknown */
+static struct hid_conn *
+hid_conn_find(struct hid_dev *dev, uint16_t conn_handle)
+{
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        if (dev->conns[i].in_use && dev->conns[i].conn_handle == conn_handle) {
+            return &dev->conns[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+a packet of the central has just arrived, so a connection event is going on now;
+the next ones follow every conn_itvl_us, see hid_tx_release()
+*/
+static void
+hid_conn_event_seen(struct hid_conn *conn)
+{
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+    conn->anchor_us = esp_timer_get_time();
+#endif
+}
+
 /* mark report for indicate/notify when central subscribes to service charachetric with report */
 void
-hid_set_notify(uint16_t attr_handle, uint8_t cur_notify, uint8_t cur_indicate)
+hid_set_notify(struct hid_dev *dev, uint16_t conn_handle, uint16_t attr_handle,
+               uint8_t cur_notify, uint8_t cur_indicate)
 {
-    int report_idx = -1;
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+    int handle_num = gatt_svr_handle_num(attr_handle);
 
-    /* find hid_notify_data struct index of reports array for given atribute handle */
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        uint16_t current_handle_idx = My_hid_dev.report_mode_boot ?
-            Notify_data_reports[i].handle_boot_num :
-            Notify_data_reports[i].handle_num;
-        if (attr_handle == Svc_char_handles[current_handle_idx]) {
-            report_idx = i;
-            break;
+    if (!conn) {
+        ESP_LOGW(tag, "%s: conn_handle %d not connected", __FUNCTION__, conn_handle);
+    } else if (handle_num == HANDLE_HID_COUNT || Layout->report_idx_by_handle[handle_num] == -1) {
+        ESP_LOGW(tag, "%s: attr_handle %04X not found in reports", __FUNCTION__, attr_handle);
+    } else {
+        bool was_subscribed = conn->subscribed[handle_num];
+
+        hid_conn_event_seen(conn);
+
+        conn->subscribed[handle_num] =
+            (cur_notify ? HID_SUBSCRIBED_NOTIFY : 0) |
+            (cur_indicate ? HID_SUBSCRIBED_INDICATE : 0);
+
+        TLOGI(tag, "%s: conn %d, service %s, attr_handle %d, notify %d, indicate %d",
+                    __func__, conn_handle, dev->reports[Layout->report_idx_by_handle[handle_num]].def->name,
+                    attr_handle, cur_notify, cur_indicate);
+
+        if (!was_subscribed && conn->subscribed[handle_num]) {
+            // input made before the subscription goes first, the current state follows it
+            hid_pending_replay(conn);
+#ifdef CONFIG_HID_RESYNC_ON_SUBSCRIBE
+            hid_conn_resync_report(conn, Layout->report_idx_by_handle[handle_num]);
+#endif
+        }
+
+        if (dev->typing.count) {
+            // text was waiting for a central
+            ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &dev->typing.step_ev);
+        }
+    }
+}
+
+/* find report index in hid_dev.reports by handle index, -1 if not found */
+static int
+hid_report_idx(int handle_num)
+{
+    if (handle_num < 0 || handle_num >= HANDLE_HID_COUNT) {
+        return -1;
+    }
+    return Layout->report_idx_by_handle[handle_num];
+}
+
+/* make sequence counter odd, caller holds dev->writer_lock */
+static void
+hid_report_seq_begin(struct hid_notify_data *report)
+{
+    hid_seq_write_begin(&report->seq);
+}
+
+/* make sequence counter even again, caller holds dev->writer_lock */
+static void
+hid_report_seq_end(struct hid_notify_data *report)
+{
+    hid_seq_write_end(&report->seq);
+}
+
+/* start changing report buffer, readers will retry until hid_report_write_end() */
+static void
+hid_report_write_begin(struct hid_dev *dev, struct hid_notify_data *report)
+{
+    portENTER_CRITICAL(&dev->writer_lock);
+    hid_lat_stamp(hid_lat_current(), HID_LAT_LOCKED);
+    hid_report_seq_begin(report);
+}
+
+/* publish changed report buffer */
+static void
+hid_report_write_end(struct hid_dev *dev, struct hid_notify_data *report)
+{
+    hid_report_seq_end(report);
+    portEXIT_CRITICAL(&dev->writer_lock);
+}
+
+/* copy consistent snapshot of report buffer to dst, returns number of bytes copied */
+static size_t
+hid_report_read(struct hid_notify_data *report, uint8_t *dst)
+{
+    hid_seq_read(&report->seq, report->buffer, dst, report->def->buffer_size);
+    return report->def->buffer_size;
+}
+
+/* largest value of field, fallback if usage is not in report map */
+static int32_t
+hid_layout_max(const struct hid_desc_ref *ref, int32_t fallback)
+{
+    return ref->field ? ref->field->logical_max : fallback;
+}
+
+/*
+parse report map, check report buffers against it and resolve fields filled by code;
+runs once for the process, see struct hid_layout
+*/
+static void
+hid_layout_init(void)
+{
+    memset(Layout_data.report_idx_by_handle, -1, sizeof(Layout_data.report_idx_by_handle));
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        Layout_data.report_idx_by_handle[Hid_report_defs[i].handle_num] = i;
+        Layout_data.report_idx_by_handle[Hid_report_defs[i].handle_boot_num] = i;
+    }
+
+    if (hid_desc_parse(Hid_report_map, Hid_report_map_size) != 0) {
+        ESP_LOGE(tag, "%s: report map can not be parsed", __FUNCTION__);
+    }
+
+    for (int i = 0; i < Hid_report_ref_data_count; ++i) {
+        int report_idx = Layout_data.report_idx_by_handle[Hid_report_ref_data[i].id];
+        size_t size = hid_desc_report_size(Hid_report_ref_data[i].hidReportRef[0],
+                                           Hid_report_ref_data[i].hidReportRef[1]);
+
+        if (report_idx == -1) {
+            continue;
+        }
+        if (!size) {
+            ESP_LOGW(tag, "%s: report %s is not in report map", __FUNCTION__,
+                Hid_report_defs[report_idx].name);
+        } else if (size != Hid_report_defs[report_idx].buffer_size) {
+            ESP_LOGE(tag, "%s: report %s is %u bytes in report map, buffer has %u", __FUNCTION__,
+                Hid_report_defs[report_idx].name, (unsigned) size,
+                (unsigned) Hid_report_defs[report_idx].buffer_size);
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, i + 1,
+            &Layout_data.mouse.buttons[i]);
+    }
+    hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &Layout_data.mouse.x);
+    hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &Layout_data.mouse.y);
+    hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_WHEEL, &Layout_data.mouse.wheel);
+
+    int32_t x_max = hid_layout_max(&Layout_data.mouse.x, 127),
+            y_max = hid_layout_max(&Layout_data.mouse.y, 127);
+    Layout_data.mouse.xy_max = x_max < y_max ? x_max : y_max;
+    hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_CONSUMER,
+        HID_USAGE_AC_PAN, &Layout_data.mouse.pan);
+    Layout_data.mouse.wheel_max = hid_layout_max(&Layout_data.mouse.wheel, 127);
+    Layout_data.mouse.pan_max = hid_layout_max(&Layout_data.mouse.pan, 127);
+
+    // both multipliers have the same usage, they are told apart by order: wheel, then AC Pan
+    const struct hid_desc_report *mouse_feature =
+        hid_desc_report_get(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_FEATURE);
+    Layout_data.mouse.wheel_mult = hid_desc_report_field(mouse_feature, 0);
+    Layout_data.mouse.pan_mult = hid_desc_report_field(mouse_feature, 1);
+    if (hid_desc_report_size(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_FEATURE) != HIDD_LE_REPORT_MOUSE_FEATURE_SIZE) {
+        ESP_LOGE(tag, "%s: mouse feature report does not match report map", __FUNCTION__);
+    }
+
+    Layout_data.cc = hid_desc_report_field(hid_desc_report_get(HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT), 0);
+    if (Layout_data.cc && (Layout_data.cc->flags & HID_DESC_F_VARIABLE)) {
+        ESP_LOGE(tag, "%s: consumer control report is not a usage array", __FUNCTION__);
+        Layout_data.cc = NULL;
+    }
+
+    hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_DIGITIZER,
+        HID_USAGE_TIP_SWITCH, &Layout_data.abs.tip);
+    hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_DIGITIZER,
+        HID_USAGE_BARREL_SWITCH, &Layout_data.abs.barrel);
+    hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_DIGITIZER,
+        HID_USAGE_IN_RANGE, &Layout_data.abs.in_range);
+    hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &Layout_data.abs.x);
+    hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &Layout_data.abs.y);
+
+    static const uint16_t gamepad_axes[HID_GAMEPAD_AXES] = {
+        HID_USAGE_X, HID_USAGE_Y, HID_USAGE_Z, HID_USAGE_RZ, HID_USAGE_RX, HID_USAGE_RY,
+    };
+
+    hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, 1,
+        &Layout_data.gamepad.button1);
+    for (int i = 0; i < HID_GAMEPAD_AXES; ++i) {
+        hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+            gamepad_axes[i], &Layout_data.gamepad.axes[i]);
+    }
+    hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_HAT_SWITCH, &Layout_data.gamepad.hat);
+}
+
+/* report buffer of device for report handle index, NULL if the handle has no report */
+static uint8_t *
+hid_report_buffer(struct hid_dev *dev, int handle_num)
+{
+    switch (handle_num) {
+        case HANDLE_HID_MOUSE_REPORT:       return dev->buffers.mouse;
+        case HANDLE_HID_KB_IN_REPORT:       return dev->buffers.keyboard;
+        case HANDLE_HID_KB_OUT_REPORT:      return dev->buffers.leds;
+        case HANDLE_HID_CC_REPORT:          return dev->buffers.cc;
+        case HANDLE_BATTERY_LEVEL:          return dev->buffers.battery_level;
+        case HANDLE_HID_FEATURE_REPORT:     return dev->buffers.feature;
+        case HANDLE_HID_KB_NKRO_REPORT:     return dev->buffers.keyboard_nkro;
+        case HANDLE_HID_ABS_POINTER_REPORT: return dev->buffers.abs_pointer;
+        case HANDLE_HID_GAMEPAD_REPORT:     return dev->buffers.gamepad;
+    }
+    return NULL;
+}
+
+/*
+one time initialization of device context, called before GATT services are registered;
+char_handles are the characteristic value handles by handle index, NimBLE fills them in
+when it registers the services
+*/
+void
+hid_init(struct hid_dev *dev, const uint16_t *char_handles)
+{
+    static const struct hid_mouse_keys_profile mouse_keys_profile = {
+        .delay_ms = 250,
+        .initial_speed = 80,
+        .max_speed = 1200,
+        .time_to_max_ms = 1500,
+    };
+
+    memset(dev, 0, sizeof(*dev));
+    portMUX_INITIALIZE(&dev->writer_lock);
+    portMUX_INITIALIZE(&dev->typing.lock);
+    portMUX_INITIALIZE(&dev->mouse_keys.lock);
+#ifdef CONFIG_HID_PENDING_INPUT
+    portMUX_INITIALIZE(&dev->pending.lock);
+#endif
+    dev->char_handles = char_handles;
+    dev->buffers.battery_level[0] = BATTERY_DEFAULT_LEVEL;
+    memcpy(dev->buffers.feature, "olegos", sizeof(dev->buffers.feature));
+
+    pthread_once(&Layout_once, hid_layout_init);
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        dev->reports[i].def = &Hid_report_defs[i];
+        dev->reports[i].buffer = hid_report_buffer(dev, Hid_report_defs[i].handle_num);
+    }
+
+    hid_gamepad_clear(dev);
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_conn *conn = &dev->conns[i];
+
+        conn->dev = dev;
+        const esp_timer_create_args_t timer_args = {
+            .callback = hid_mouse_timer_cb,
+            .arg = conn,
+            .name = "hid_mouse",
+        };
+
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &conn->motion.timer));
+
+        const esp_timer_create_args_t gamepad_args = {
+            .callback = hid_gamepad_timer_cb,
+            .arg = conn,
+            .name = "hid_gamepad",
+        };
+
+        ESP_ERROR_CHECK(esp_timer_create(&gamepad_args, &conn->gamepad.timer));
+
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+        const esp_timer_create_args_t release_args = {
+            .callback = hid_tx_release_cb,
+            .arg = conn,
+            .name = "hid_release",
+        };
+
+        ESP_ERROR_CHECK(esp_timer_create(&release_args, &conn->release_timer));
+#endif
+
+        portMUX_INITIALIZE(&conn->tx.lock);
+        ble_npl_event_init(&conn->tx.pump_ev, hid_tx_pump, conn);
+        ble_npl_callout_init(&conn->tx.retry_co, nimble_port_get_dflt_eventq(), hid_tx_pump, conn);
+    }
+
+    ble_npl_event_init(&dev->typing.step_ev, hid_type_step, dev);
+
+    const esp_timer_create_args_t mouse_keys_args = {
+        .callback = hid_mouse_keys_timer_cb,
+        .arg = dev,
+        .name = "hid_mouse_keys",
+    };
+
+    ESP_ERROR_CHECK(esp_timer_create(&mouse_keys_args, &dev->mouse_keys.timer));
+    hid_mouse_keys_profile_set(dev, &mouse_keys_profile);
+
+    ESP_ERROR_CHECK(os_mempool_init(&dev->mbuf_mempool, HID_MBUF_COUNT, HID_MBUF_BLOCK_SIZE,
+        dev->mbuf_mem, "hid_mbuf"));
+    ESP_ERROR_CHECK(os_mbuf_pool_init(&dev->mbuf_pool, &dev->mbuf_mempool, HID_MBUF_BLOCK_SIZE,
+        HID_MBUF_COUNT));
+}
+
+/* take free slot for new connection, returns 1 if all slots are busy */
+int
+hid_set_connected(struct hid_dev *dev, struct ble_gap_conn_desc *desc)
+{
+    struct hid_conn *conn = NULL;
+    bool first = true;
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        if (dev->conns[i].in_use) {
+            first = false;
+        } else if (!conn) {
+            conn = &dev->conns[i];
+        }
+    }
+
+    if (!conn) {
+        ESP_LOGE(tag, "%s: no free slot for conn_handle %d", __FUNCTION__, desc->conn_handle);
+        return 1;
+    }
+
+    if (first) {
+        // nobody else is connected, forget keys and buttons pressed before
+        for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+            switch (dev->reports[i].def->handle_num) {
+                case HANDLE_HID_MOUSE_REPORT:
+                case HANDLE_HID_KB_IN_REPORT:
+                case HANDLE_HID_KB_OUT_REPORT:
+                case HANDLE_HID_CC_REPORT:
+                case HANDLE_HID_KB_NKRO_REPORT:
+                case HANDLE_HID_ABS_POINTER_REPORT:
+                    hid_report_write_begin(dev, &dev->reports[i]);
+                    memset(dev->reports[i].buffer, 0, dev->reports[i].def->buffer_size);
+                    hid_report_write_end(dev, &dev->reports[i]);
+            }
+        }
+
+        hid_gamepad_clear(dev);
+
+        portENTER_CRITICAL(&dev->writer_lock);
+        memset(&dev->key_state, 0, sizeof(dev->key_state));
+        dev->mouse_buttons = 0;
+        dev->cc_keys.count = 0;
+        portEXIT_CRITICAL(&dev->writer_lock);
+    }
+
+    conn->encrypted = desc->sec_state.encrypted;
+    conn->suspended_state = false;
+    conn->report_mode_boot = false;
+    conn->conn_handle = desc->conn_handle;
+    conn->conn_itvl_us = desc->conn_itvl * 1250;
+    memset(conn->subscribed, 0, sizeof(conn->subscribed));
+    memset(conn->mouse_feature, 0, sizeof(conn->mouse_feature));
+    conn->wheel_hires = conn->pan_hires = false;
+
+    portENTER_CRITICAL(&dev->writer_lock);
+    conn->motion.x = conn->motion.y = conn->motion.wheel = conn->motion.pan = 0;
+    conn->motion.dirty = false;
+    conn->motion.trace = HID_LAT_NONE;
+    conn->motion.last_send_us = 0;
+    conn->gamepad.dirty = false;
+    conn->gamepad.trace = HID_LAT_NONE;
+    conn->gamepad.last_send_us = 0;
+    portEXIT_CRITICAL(&dev->writer_lock);
+
+    hid_tx_reset(conn);
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+    conn->anchor_us = 0;
+#endif
+    hid_conn_event_seen(conn);
+
+    portENTER_CRITICAL(&conn->tx.lock);
+    memset(&conn->tx.stats, 0, sizeof(conn->tx.stats));
+    conn->in_use = true;
+    portEXIT_CRITICAL(&conn->tx.lock);
+
+    hid_mouse_keys_retick(dev);
+
+    return 0;
+}
+
+/* number of centrals which can connect yet */
+int
+hid_conn_slots_free(struct hid_dev *dev)
+{
+    int free_slots = 0;
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        if (!dev->conns[i].in_use) {
+            free_slots++;
+        }
+    }
+    return free_slots;
+}
+
+/* central changed connection parameters, conn_itvl is in 1.25 ms units */
+void
+hid_set_conn_itvl(struct hid_dev *dev, uint16_t conn_handle, uint16_t conn_itvl)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (conn) {
+        conn->conn_itvl_us = conn_itvl * 1250;
+        // new parameters apply from an event just taking place
+        hid_conn_event_seen(conn);
+        hid_mouse_keys_retick(dev);
+    }
+}
+
+/* link encryption changed, reports can be sent on an encrypted link only */
+void
+hid_set_encrypted(struct hid_dev *dev, uint16_t conn_handle, bool encrypted)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return;
+    }
+
+    conn->encrypted = encrypted;
+    if (encrypted) {
+        // subscriptions made before encryption take effect now
+        hid_pending_replay(conn);
+        if (dev->typing.count) {
+            ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &dev->typing.step_ev);
+        }
+    }
+}
+
+static void hid_tx_stats_read(struct hid_conn *conn, struct hid_tx_stats *stats);
+
+void
+hid_set_disconnected(struct hid_dev *dev, uint16_t conn_handle)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+    struct hid_tx_stats stats;
+
+    if (!conn) {
+        return;
+    }
+
+    portENTER_CRITICAL(&conn->tx.lock);
+    conn->in_use = false;
+    portEXIT_CRITICAL(&conn->tx.lock);
+
+    esp_timer_stop(conn->motion.timer);
+    esp_timer_stop(conn->gamepad.timer);
+    ble_npl_callout_stop(&conn->tx.retry_co);
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+    esp_timer_stop(conn->release_timer);
+    conn->release_armed = false;
+#endif
+
+    hid_tx_stats_read(conn, &stats);
+    TLOGI(tag, "conn %d TX stats: sent %" PRIu32 ", suppressed %" PRIu32 ", coalesced %" PRIu32,
+        conn_handle, stats.sent, stats.suppressed, stats.coalesced);
+    TLOGI(tag, "conn %d TX stats: retries %" PRIu32 ", drops %" PRIu32 ", max queue depth %" PRIu32,
+        conn_handle, stats.retries, stats.drops, stats.max_depth);
+
+    struct hid_mbuf_stats mbuf_stats;
+
+    hid_mbuf_stats_get(dev, &mbuf_stats);
+    TLOGI(tag, "report mbufs: %" PRIu32 " of %" PRIu32 " in use, high water %" PRIu32
+        ", exhausted %" PRIu32 " times",
+        mbuf_stats.in_use, mbuf_stats.blocks, mbuf_stats.high_water, mbuf_stats.exhausted);
+
+#ifdef CONFIG_HID_PENDING_INPUT
+    struct hid_pending_stats pending_stats;
+
+    hid_pending_stats_get(dev, &pending_stats);
+    TLOGI(tag, "pending input: kept %" PRIu32 ", collapsed %" PRIu32 ", replayed %" PRIu32
+        ", expired %" PRIu32 ", overflows %" PRIu32 ", longest wait %" PRIu32 " ms",
+        pending_stats.kept, pending_stats.collapsed, pending_stats.replayed,
+        pending_stats.expired, pending_stats.overflows, pending_stats.max_wait_ms);
+#endif
+
+    hid_lat_dump();
+
+    hid_tx_reset(conn);
+    hid_mouse_keys_retick(dev);
+
+    if (hid_conn_slots_free(dev) == HID_MAX_CONNS) {
+        hid_type_reset(dev);
+    }
+}
+
+bool
+hid_set_suspend(struct hid_dev *dev, uint16_t conn_handle, bool need_suspend)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return false;
+    }
+
+    bool last_state = conn->suspended_state;
+    conn->suspended_state = need_suspend;
+    if (last_state && !need_suspend) {
+        hid_pending_replay(conn);
+    }
+    return last_state;
+}
+
+bool
+hid_set_report_mode(struct hid_dev *dev, uint16_t conn_handle, bool is_mode_boot)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return false;
+    }
+
+    hid_conn_event_seen(conn);
+
+    bool old_boot = conn->report_mode_boot;
+    conn->report_mode_boot = is_mode_boot;
+    if (old_boot != is_mode_boot) {
+        // reports go to other characteristics now, central has not seen any of them
+        hid_resync(dev, conn_handle);
+    }
+    return old_boot;
+}
+
+bool
+hid_get_report_mode(struct hid_dev *dev, uint16_t conn_handle)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    return conn ? conn->report_mode_boot : false;
+}
+
+char outbuf[100];
+
+char * print_buf(uint8_t *buf, int buf_size)
+{
+    outbuf[0] = 0;
+    for (int i = 0; i < buf_size; ++i) {
+        sprintf(outbuf + strlen(outbuf),"%s%02X", i?" ":"", buf[i]);
+    }
+    return outbuf;
+}
+
+int
+hid_read_buffer(struct hid_dev *dev, struct os_mbuf *buf, int handle_num)
+{
+    uint8_t data[HID_REPORT_MAX_SIZE];
+    int rep_idx = hid_report_idx(handle_num);
+
+    if (rep_idx == -1) {
+        ESP_LOGW(tag, "%s: handle_num %d not found", __FUNCTION__, handle_num);
+        return 2;
+    }
+
+    size_t size = hid_report_read(&dev->reports[rep_idx], data);
+
+    if (handle_num == HANDLE_HID_BOOT_MOUSE_REPORT) {
+        size = hid_mouse_render_boot(dev, data);
+    }
+
+    return os_mbuf_append(buf, data, size);
+}
+
+int
+hid_write_buffer(struct hid_dev *dev, struct os_mbuf *buf, int handle_num)
+{
+    uint8_t data[HID_REPORT_MAX_SIZE];
+    int rep_idx = hid_report_idx(handle_num);
+
+    if (rep_idx == -1) {
+        return 2;
+    }
+
+    struct hid_notify_data *report = &dev->reports[rep_idx];
+
+    if (OS_MBUF_PKTLEN(buf) != report->def->buffer_size) {
+        return 4;
+    }
+
+    int rc = ble_hs_mbuf_to_flat(buf, data, report->def->buffer_size, NULL);
+    if (rc == 0) {
+        hid_report_write_begin(dev, report);
+        memcpy(report->buffer, data, report->def->buffer_size);
+        hid_report_write_end(dev, report);
+
+        if (handle_num == HANDLE_HID_KB_OUT_REPORT) {
+            // change LEDs level when Keyboard out report received
+            set_leds(data[0]);
+        }
+    }
+
+    return rc;
+}
+
+/* mouse feature report of one central: resolution multipliers it has set */
+int
+hid_mouse_feature_read(struct hid_dev *dev, uint16_t conn_handle, struct os_mbuf *buf)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return 1;
+    }
+    return os_mbuf_append(buf, conn->mouse_feature, sizeof(conn->mouse_feature));
+}
+
+/*
+central sets resolution multipliers, from now on its wheel and AC Pan fields carry
+1/HID_WHEEL_MULTIPLIER detents; scroll accumulated so far is kept in the same units
+*/
+int
+hid_mouse_feature_write(struct hid_dev *dev, uint16_t conn_handle, struct os_mbuf *buf)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_MOUSE_REPORT)];
+    uint8_t data[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE];
+
+    if (!conn) {
+        return 1;
+    }
+    if (OS_MBUF_PKTLEN(buf) != sizeof(data)) {
+        return 4;
+    }
+
+    int rc = ble_hs_mbuf_to_flat(buf, data, sizeof(data), NULL);
+    if (rc == 0) {
+        hid_conn_event_seen(conn);
+
+        // motion is flushed under the report lock, it must not see half of the change
+        hid_report_write_begin(dev, report);
+        memcpy(conn->mouse_feature, data, sizeof(data));
+        conn->wheel_hires = Layout->mouse.wheel_mult &&
+            hid_desc_field_read(data, Layout->mouse.wheel_mult, 0) == Layout->mouse.wheel_mult->logical_max;
+        conn->pan_hires = Layout->mouse.pan_mult &&
+            hid_desc_field_read(data, Layout->mouse.pan_mult, 0) == Layout->mouse.pan_mult->logical_max;
+        hid_report_write_end(dev, report);
+
+        TLOGI(tag, "%s: conn %d, high resolution wheel %d, AC Pan %d", __func__,
+            conn_handle, conn->wheel_hires, conn->pan_hires);
+    }
+    return rc;
+}
+
+/* drop all queued reports and restore credits, on connect and disconnect */
+static void
+hid_tx_reset(struct hid_conn *conn)
+{
+    portENTER_CRITICAL(&conn->tx.lock);
+    for (int i = 0; i < HID_TX_CLASSES; ++i) {
+        struct hid_tx_class *cls = &conn->tx.classes[i];
+
+        cls->head = 0;
+        cls->count = 0;
+        cls->inflight = 0;
+        cls->passed = 0;
+        cls->head_busy = false;
+    }
+    conn->tx.count = 0;
+    conn->tx.credits = HID_TX_CREDITS;
+    conn->tx.indication_pending = false;
+    conn->tx.sending = false;
+    conn->tx.release_held = false;
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        conn->tx.last[i].size = 0;
+    }
+    portEXIT_CRITICAL(&conn->tx.lock);
+}
+
+/* copy report into a block of the HID pool, NULL if the pool is empty */
+static struct os_mbuf *
+hid_mbuf_get(struct hid_dev *dev, const uint8_t *data, uint8_t size)
+{
+    struct os_mbuf *om = os_mbuf_get_pkthdr(&dev->mbuf_pool, 0);
+
+    if (!om) {
+        __atomic_fetch_add(&dev->mbuf_exhausted, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    // leave room for the headers, so the host does not chain another mbuf in front
+    om->om_data += HID_MBUF_LEADING_SPACE;
+
+    if (os_mbuf_append(om, data, size) != 0) {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
+    return om;
+}
+
+void
+hid_mbuf_stats_get(struct hid_dev *dev, struct hid_mbuf_stats *stats)
+{
+    stats->blocks = dev->mbuf_mempool.mp_num_blocks;
+    stats->in_use = dev->mbuf_mempool.mp_num_blocks - dev->mbuf_mempool.mp_num_free;
+    stats->high_water = dev->mbuf_mempool.mp_num_blocks - dev->mbuf_mempool.mp_min_free;
+    stats->exhausted = __atomic_load_n(&dev->mbuf_exhausted, __ATOMIC_RELAXED);
+}
+
+/* hand one queued report to NimBLE */
+static int
+hid_tx_send(struct hid_conn *conn, struct hid_tx_entry *entry)
+{
+    int rc = 0;
+
+    switch (NOTIFY_METHOD) {
+        case SEND_METHOD_CUSTOM: {
+            struct os_mbuf *om = hid_mbuf_get(conn->dev, entry->data, entry->size);
+            if (!om) {
+                return BLE_HS_ENOMEM;
+            }
+
+            if (entry->indicate) {
+                rc = ble_gattc_indicate_custom(conn->conn_handle, entry->attr_handle, om);
+            } else {
+                rc = ble_gattc_notify_custom(conn->conn_handle, entry->attr_handle, om);
+            }
+            break;
+        }
+
+        case SEND_METHOD_STD:
+            if (entry->indicate) {
+                rc = ble_gattc_indicate(conn->conn_handle, entry->attr_handle);
+            } else {
+                rc = ble_gattc_notify(conn->conn_handle, entry->attr_handle);
+            }
+            break;
+
+        case SEND_METHOD_ALL:
+            ble_gatts_chr_updated(entry->attr_handle);
+            rc = 0;
+            break;
+    }
+
+    return rc;
+}
+
+/*
+class to send the next report from, -1 if none can send now; the highest class
+that has a report, a credit of its own and is not waiting for a confirmation,
+unless a lower one has been passed over HID_TX_STARVE_MAX times; under tx->lock
+*/
+static int
+hid_tx_pick(struct hid_tx_queue *tx)
+{
+    uint8_t ready = 0;
+
+    for (int i = 0; i < HID_TX_CLASSES; ++i) {
+        struct hid_tx_class *cls = &tx->classes[i];
+
+        if (cls->count && cls->inflight < Tx_class_credits[i] &&
+            !(tx->indication_pending && cls->entries[cls->head].indicate)) {
+            ready |= 1 << i;
+        }
+    }
+    if (!ready) {
+        return -1;
+    }
+
+    int pick = __builtin_ctz(ready);
+    for (int i = pick + 1; i < HID_TX_CLASSES; ++i) {
+        if ((ready & (1 << i)) && tx->classes[i].passed >= HID_TX_STARVE_MAX) {
+            pick = i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < HID_TX_CLASSES; ++i) {
+        if (i == pick) {
+            tx->classes[i].passed = 0;
+        } else if (i > pick && (ready & (1 << i))) {
+            tx->classes[i].passed++;
+        }
+    }
+    return pick;
+}
+
+/*
+send queued reports of one connection while there are credits, runs in NimBLE host task;
+NimBLE reports the result of a send by BLE_GAP_EVENT_NOTIFY_TX before the call returns,
+so the report is accounted for as in flight first and rolled back if the send fails
+*/
+static void
+hid_tx_pump(struct ble_npl_event *ev)
+{
+    struct hid_conn *conn = ble_npl_event_get_arg(ev);
+    struct hid_tx_queue *tx = &conn->tx;
+    struct hid_tx_entry entry;
+
+    while (1) {
+        portENTER_CRITICAL(&tx->lock);
+        if (tx->held) {
+            // hid_frame_hold() pumps again once the whole frame is queued
+            tx->release_held = true;
+            portEXIT_CRITICAL(&tx->lock);
+            break;
+        }
+        int class = conn->in_use && tx->credits ? hid_tx_pick(tx) : -1;
+        if (class == -1) {
+            portEXIT_CRITICAL(&tx->lock);
+            break;
+        }
+        struct hid_tx_class *cls = &tx->classes[class];
+        entry = cls->entries[cls->head];
+        tx->credits--;
+        cls->inflight++;
+        cls->head_busy = true;
+        tx->sending = true;
+        if (entry.indicate) {
+            tx->indication_pending = true;
+            tx->indication_class = class;
+        }
+#ifdef CONFIG_HID_LATENCY_TRACE
+        tx->sending_trace = entry.trace;
+        if (entry.indicate) {
+            tx->indication_trace = entry.trace;
+        }
+#endif
+        portEXIT_CRITICAL(&tx->lock);
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+        hid_lat_stamp(entry.trace, HID_LAT_SENT);
+#endif
+        int rc = hid_tx_send(conn, &entry);
+
+        portENTER_CRITICAL(&tx->lock);
+        cls->head_busy = false;
+        tx->sending = false;
+        if (rc || !entry.indicate) {
+            // a notification is done with once the host has it, a failed send never started
+            tx->credits++;
+            cls->inflight--;
+        }
+        if (rc && entry.indicate) {
+            tx->indication_pending = false;
+        }
+        if (rc == BLE_HS_ENOMEM) {
+            // out of buffers, keep the report and try again later
+            tx->stats.retries++;
+        } else {
+            if (rc == 0) {
+                tx->stats.sent++;
+            } else {
+                tx->stats.drops++;
+                // central did not get it, the next report must not be suppressed
+                tx->last[entry.report_idx].size = 0;
+            }
+            cls->head = (cls->head + 1) % HID_TX_CLASS_SIZE;
+            cls->count--;
+            tx->count--;
+        }
+        portEXIT_CRITICAL(&tx->lock);
+
+        if (rc == BLE_HS_ENOMEM) {
+            ble_npl_callout_reset(&tx->retry_co, ble_npl_time_ms_to_ticks32(HID_TX_RETRY_MS));
+            break;
+        }
+        if (rc) {
+            ESP_LOGE(tag, "%s: conn %d report %s dropped, rc=%d", __FUNCTION__,
+                conn->conn_handle, Hid_report_defs[entry.report_idx].name, rc);
+        }
+    }
+}
+
+/*
+BLE_GAP_EVENT_NOTIFY_TX handler. Raised inside hid_tx_send() for every send, with
+its result: hid_tx_pump() takes care of that one, only a notification the host has
+taken completes its trace here. An indication completes later, when it is confirmed
+(BLE_HS_EDONE) or times out, and gives back its credit then.
+*/
+void
+hid_notify_tx_done(struct hid_dev *dev, uint16_t conn_handle, int status, bool indication)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+    bool completed = false, sent = false;
+
+    if (!conn) {
+        return;
+    }
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+    uint8_t trace = HID_LAT_NONE;
+#endif
+
+    portENTER_CRITICAL(&conn->tx.lock);
+    if (conn->tx.sending) {
+        // result of the send going on, the pump accounts for it when the call returns
+        sent = !indication && status == 0;
+#ifdef CONFIG_HID_LATENCY_TRACE
+        if (sent) {
+            trace = conn->tx.sending_trace;
+        }
+#endif
+    } else if (indication && status != 0 && conn->tx.indication_pending) {
+        // indication is confirmed (BLE_HS_EDONE) or timed out
+        if (status == BLE_HS_EDONE) {
+            hid_conn_event_seen(conn);
+#ifdef CONFIG_HID_LATENCY_TRACE
+            trace = conn->tx.indication_trace;
+#endif
+        }
+        conn->tx.indication_pending = false;
+        conn->tx.credits++;
+        conn->tx.classes[conn->tx.indication_class].inflight--;
+        completed = true;
+    }
+    portEXIT_CRITICAL(&conn->tx.lock);
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+    hid_lat_done(trace);
+#endif
+
+    if (completed) {
+        // the pump is not running, a failed send is retried by retry_co instead
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->tx.pump_ev);
+    }
+    if ((completed || sent) && (dev->typing.count || dev->typing.key || dev->typing.shift)) {
+        // queue has room again, continue typing
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &dev->typing.step_ev);
+    }
+}
+
+static void
+hid_tx_stats_read(struct hid_conn *conn, struct hid_tx_stats *stats)
+{
+    portENTER_CRITICAL(&conn->tx.lock);
+    *stats = conn->tx.stats;
+    stats->depth = conn->tx.count;
+    portEXIT_CRITICAL(&conn->tx.lock);
+}
+
+/* TX counters of one connection, returns 1 if conn_handle is not connected */
+int
+hid_tx_stats_get(struct hid_dev *dev, uint16_t conn_handle, struct hid_tx_stats *stats)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return 1;
+    }
+
+    hid_tx_stats_read(conn, stats);
+    return 0;
+}
+
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+/*
+Reports are not pumped the moment they are queued. The release timer fires
+CONFIG_HID_TX_RELEASE_LEAD_US ahead of the next connection event, estimated
+from the last packet of the central and the connection interval, and everything
+queued until then leaves together. The controller gets the reports at the same
+point of every interval, not anywhere in it.
+*/
+static void
+hid_tx_release_cb(void *arg)
+{
+    struct hid_conn *conn = arg;
+
+    portENTER_CRITICAL(&conn->tx.lock);
+    conn->release_armed = false;
+    portEXIT_CRITICAL(&conn->tx.lock);
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->tx.pump_ev);
+}
+#endif
+
+/* pump queued reports of one central, aligned to its connection events if configured */
+static void
+hid_tx_release(struct hid_conn *conn)
+{
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+    int64_t wait_us = 0;
+
+    if (conn->anchor_us && conn->conn_itvl_us > CONFIG_HID_TX_RELEASE_LEAD_US) {
+        int64_t since_us = (esp_timer_get_time() - conn->anchor_us) % conn->conn_itvl_us;
+
+        wait_us = conn->conn_itvl_us - since_us - CONFIG_HID_TX_RELEASE_LEAD_US;
+    }
+
+    if (wait_us > 0) {
+        bool armed;
+
+        portENTER_CRITICAL(&conn->tx.lock);
+        armed = conn->release_armed;
+        conn->release_armed = true;
+        portEXIT_CRITICAL(&conn->tx.lock);
+
+        if (!armed) {
+            esp_timer_start_once(conn->release_timer, wait_us);
+        }
+        return;
+    }
+    // estimate is unknown or the next event is too close to wait for
+#endif
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->tx.pump_ev);
+}
+
+/* report is sent in protocol mode the central is in now */
+static bool
+hid_conn_in_mode(struct hid_conn *conn, struct hid_notify_data *report)
+{
+    return report->def->send_in & (conn->report_mode_boot ? HID_SEND_IN_BOOT : HID_SEND_IN_REPORT);
+}
+
+/* central takes the report now: link is encrypted, not suspended, subscribed in its protocol mode */
+static bool
+hid_conn_wants(struct hid_conn *conn, struct hid_notify_data *report)
+{
+    int send_handle_num = conn->report_mode_boot ? report->def->handle_boot_num : report->def->handle_num;
+
+    return conn->encrypted && !conn->suspended_state && hid_conn_in_mode(conn, report) &&
+        conn->subscribed[send_handle_num];
+}
+
+/* buttons, switches and hat a pointer report carries, 0 for other reports */
+static uint32_t
+hid_report_buttons(int report_idx, const uint8_t *data, bool boot)
+{
+    uint32_t buttons = 0;
+
+    switch (Hid_report_defs[report_idx].handle_num) {
+        case HANDLE_HID_MOUSE_REPORT:
+            if (boot) {
+                return data[0] & 0x07;
+            }
+            for (int i = 0; i < 3; ++i) {
+                buttons |= (hid_desc_ref_read(data, &Layout->mouse.buttons[i]) & 1) << i;
+            }
+            break;
+        case HANDLE_HID_ABS_POINTER_REPORT:
+            buttons = (hid_desc_ref_read(data, &Layout->abs.tip) & 1) |
+                (hid_desc_ref_read(data, &Layout->abs.barrel) & 1) << 1 |
+                (hid_desc_ref_read(data, &Layout->abs.in_range) & 1) << 2;
+            break;
+        case HANDLE_HID_GAMEPAD_REPORT:
+            buttons = hid_gamepad_buttons_read(data) |
+                (uint32_t)(hid_desc_ref_read(data, &Layout->gamepad.hat) & 0xFF) << 16;
+            break;
+    }
+    return buttons;
+}
+
+/* class has a report of report_idx queued, under tx->lock */
+static bool
+hid_tx_class_has(struct hid_tx_class *cls, int report_idx)
+{
+    for (int i = 0; i < cls->count; ++i) {
+        if (cls->entries[(cls->head + i) % HID_TX_CLASS_SIZE].report_idx == report_idx) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+move reports of report_idx waiting in class from to the tail of class to, in the
+order they were queued; the head being sent now stays, it is ahead anyway; under tx->lock
+*/
+static void
+hid_tx_class_move(struct hid_tx_queue *tx, int report_idx, int from, int to)
+{
+    struct hid_tx_class *src = &tx->classes[from], *dst = &tx->classes[to];
+    int kept = 0;
+
+    for (int i = 0; i < src->count; ++i) {
+        struct hid_tx_entry *entry = &src->entries[(src->head + i) % HID_TX_CLASS_SIZE];
+
+        if (entry->report_idx == report_idx && !(i == 0 && src->head_busy) && dst->count < HID_TX_CLASS_SIZE) {
+            dst->entries[(dst->head + dst->count++) % HID_TX_CLASS_SIZE] = *entry;
+        } else {
+            // kept entries close the gap, kept <= i
+            src->entries[(src->head + kept++) % HID_TX_CLASS_SIZE] = *entry;
+        }
+    }
+    src->count = kept;
+}
+
+/*
+queue report snapshot for one central, if it is subscribed to the report;
+a report equal to the last one queued is suppressed, unless it carries motion:
+repeated deltas of a relative report are new input, not a repeated state;
+trace is the latency trace of the input the snapshot was made for
+*/
+static int
+hid_conn_enqueue(struct hid_conn *conn, int report_idx, const uint8_t *data, size_t size, bool motion,
+    uint8_t trace)
+{
+    struct hid_dev *dev = conn->dev;
+    struct hid_notify_data *report = &dev->reports[report_idx];
+    struct hid_tx_queue *tx = &conn->tx;
+    struct hid_tx_class *cls;
+    struct hid_tx_entry entry;
+    bool boot = conn->report_mode_boot;
+    int send_handle_num = boot ? report->def->handle_boot_num : report->def->handle_num;
+    uint8_t subscribed = conn->subscribed[send_handle_num];
+
+    if (!hid_conn_wants(conn, report)) {
+        return 0;   // central does not want this report now
+    }
+
+    entry.attr_handle = dev->char_handles[send_handle_num];
+    entry.report_idx = report_idx;
+    // notifications unless the report asks for reliability or the central takes indications only
+    entry.indicate = (subscribed & HID_SUBSCRIBED_INDICATE) &&
+        (report->delivery == HID_DELIVERY_RELIABLE || !(subscribed & HID_SUBSCRIBED_NOTIFY));
+    entry.size = size;
+#ifdef CONFIG_HID_LATENCY_TRACE
+    entry.trace = trace;
+#endif
+    memcpy(entry.data, data, size);
+
+    int rc = 0;
+    struct hid_last_sent *last = &tx->last[report_idx];
+    struct hid_tx_entry *queued = NULL;
+
+    portENTER_CRITICAL(&tx->lock);
+    int class = report->def->tx_class;
+    // nothing sent yet or the last report was lost: compare with no button pressed
+    uint32_t last_buttons = last->size == size ? hid_report_buttons(report_idx, last->data, boot) : 0;
+
+    entry.edge = class != HID_TX_CLASS_KEYS && last_buttons != hid_report_buttons(report_idx, data, boot);
+    if (entry.edge || (class != HID_TX_CLASS_KEYS &&
+                       hid_tx_class_has(&tx->classes[HID_TX_CLASS_KEYS], report_idx))) {
+        // button edge keeps its order with keys, so does everything queued around it
+        hid_tx_class_move(tx, report_idx, class, HID_TX_CLASS_KEYS);
+        class = HID_TX_CLASS_KEYS;
+    }
+    cls = &tx->classes[class];
+
+    if (entry.indicate && !report->def->relative && report->def->tx_class != HID_TX_CLASS_KEYS &&
+        !entry.edge) {
+        /*
+        indications wait for each other, newer state replaces the one not sent yet;
+        keys and button edges are never merged, a short press would be lost, only
+        positions, axes and levels are, in the keys class too when they follow an
+        edge there; the newest report queued only, an edge is never overtaken
+        */
+        for (int i = cls->count - 1; i >= 0; --i) {
+            int pos = (cls->head + i) % HID_TX_CLASS_SIZE;
+
+            if (cls->entries[pos].report_idx == report_idx) {
+                if (cls->entries[pos].indicate && !cls->entries[pos].edge && !(i == 0 && cls->head_busy)) {
+                    queued = &cls->entries[pos];
+                }
+                break;
+            }
+        }
+    }
+
+    if (!conn->in_use) {
+        rc = 1;
+    } else if (!motion && last->size == size && !memcmp(last->data, data, size)) {
+        tx->stats.suppressed++;
+        rc = -1;
+    } else if (queued) {
+        *queued = entry;
+        tx->stats.coalesced++;
+        last->size = size;
+        memcpy(last->data, data, size);
+    } else if (cls->count < HID_TX_CLASS_SIZE) {
+        cls->entries[(cls->head + cls->count) % HID_TX_CLASS_SIZE] = entry;
+        cls->count++;
+        tx->count++;
+        last->size = size;
+        memcpy(last->data, data, size);
+        if (tx->count > tx->stats.max_depth) {
+            tx->stats.max_depth = tx->count;
+        }
+    } else {
+        tx->stats.drops++;
+        rc = 3;
+    }
+    portEXIT_CRITICAL(&tx->lock);
+
+    if (rc == 3) {
+        ESP_LOGE(tag, "%s: conn %d TX queue is full, report %s dropped", __FUNCTION__,
+            conn->conn_handle, report->def->name);
+    }
+    if (rc) {
+        return rc == -1 ? 0 : rc;
+    }
+
+    hid_tx_release(conn);
+
+    return 0;
+}
+
+#ifdef CONFIG_HID_PENDING_INPUT
+static uint32_t
+hid_pending_now_ms(void)
+{
+    return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+/* drop entry i, caller holds pending.lock */
+static void
+hid_pending_remove(struct hid_pending *pending, int i)
+{
+    pending->count--;
+    memmove(&pending->entries[i], &pending->entries[i + 1],
+        (pending->count - i) * sizeof(pending->entries[0]));
+}
+
+/* drop entries older than the TTL, caller holds pending.lock */
+static void
+hid_pending_expire(struct hid_pending *pending, uint32_t now_ms)
+{
+    int i = 0;
+
+    // entries are in time order, only the head can be too old
+    while (i < pending->count && now_ms - pending->entries[i].time_ms > CONFIG_HID_PENDING_INPUT_TTL_MS) {
+        i++;
+    }
+    if (i) {
+        pending->stats.expired += i;
+        pending->count -= i;
+        memmove(&pending->entries[0], &pending->entries[i], pending->count * sizeof(pending->entries[0]));
+    }
+}
+
+/*
+keep report snapshot nobody could take; a state report keeps only its newest
+snapshot, an event report every change, the oldest entry makes room if full
+*/
+static void
+hid_pending_add(struct hid_dev *dev, int report_idx, const uint8_t *data, size_t size)
+{
+    struct hid_notify_data *report = &dev->reports[report_idx];
+    struct hid_pending *pending = &dev->pending;
+    uint32_t now_ms = hid_pending_now_ms();
+
+    if (report->def->pending == HID_PENDING_NONE) {
+        return;
+    }
+
+    portENTER_CRITICAL(&pending->lock);
+    hid_pending_expire(pending, now_ms);
+
+    for (int i = pending->count - 1; i >= 0; --i) {
+        struct hid_pending_entry *entry = &pending->entries[i];
+
+        if (entry->report_idx != report_idx) {
+            continue;
+        }
+        if (entry->size == size && !memcmp(entry->data, data, size)) {
+            size = 0;   // the same state is waiting already
+        } else if (report->def->pending == HID_PENDING_STATE) {
+            hid_pending_remove(pending, i);
+            pending->stats.collapsed++;
+        }
+        break;
+    }
+
+    if (size) {
+        if (pending->count == HID_PENDING_SIZE) {
+            hid_pending_remove(pending, 0);
+            pending->stats.overflows++;
+        }
+
+        struct hid_pending_entry *entry = &pending->entries[pending->count++];
+
+        entry->time_ms = now_ms;
+        entry->report_idx = report_idx;
+        entry->size = size;
+        memcpy(entry->data, data, size);
+        pending->stats.kept++;
+    }
+    portEXIT_CRITICAL(&pending->lock);
+}
+
+/*
+central has become ready for some reports, queue what waited for them in the order
+it was made; the current state of every replayed report follows, so a key whose
+release was lost (overflow, TTL, state cleared on connect) does not stay pressed
+*/
+static void
+hid_pending_replay(struct hid_conn *conn)
+{
+    struct hid_dev *dev = conn->dev;
+    struct hid_pending *pending = &dev->pending;
+    struct hid_pending_entry entry;
+    uint32_t now_ms = hid_pending_now_ms();
+    uint32_t replayed = 0, wait_ms = 0, reports = 0;
+    int i = 0;
+
+    _Static_assert(HID_REPORTS_COUNT <= 32, "replayed reports are kept in a 32-bit mask");
+
+    while (1) {
+        bool found = false;
+
+        portENTER_CRITICAL(&pending->lock);
+        hid_pending_expire(pending, now_ms);
+        for (; i < pending->count; ++i) {
+            if (hid_conn_wants(conn, &dev->reports[pending->entries[i].report_idx])) {
+                entry = pending->entries[i];
+                hid_pending_remove(pending, i);
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            pending->stats.replayed++;
+            if (now_ms - entry.time_ms > pending->stats.max_wait_ms) {
+                pending->stats.max_wait_ms = now_ms - entry.time_ms;
+            }
+        }
+        portEXIT_CRITICAL(&pending->lock);
+
+        if (!found) {
+            break;
+        }
+
+        if (!replayed) {
+            wait_ms = now_ms - entry.time_ms;
+        }
+        replayed++;
+        reports |= 1u << entry.report_idx;
+        // the wait was for a central, not for the link, it is not traced
+        hid_conn_enqueue(conn, entry.report_idx, entry.data, entry.size, false, HID_LAT_NONE);
+    }
+
+    for (int idx = 0; reports; ++idx, reports >>= 1) {
+        if (reports & 1) {
+            uint8_t data[HID_REPORT_MAX_SIZE];
+            size_t size = hid_report_read(&dev->reports[idx], data);
+
+            // suppressed if the last snapshot replayed is the current state already
+            hid_conn_enqueue(conn, idx, data, size, false, HID_LAT_NONE);
+        }
+    }
+
+    if (replayed) {
+        TLOGI(tag, "conn %d: %" PRIu32 " reports made before it was ready replayed, the first waited %"
+            PRIu32 " ms", conn->conn_handle, replayed, wait_ms);
+    }
+}
+#else
+static void hid_pending_add(struct hid_dev *dev, int report_idx, const uint8_t *data, size_t size) { }
+static void hid_pending_replay(struct hid_conn *conn) { }
+#endif
+
+void
+hid_pending_stats_get(struct hid_dev *dev, struct hid_pending_stats *stats)
+{
+#ifdef CONFIG_HID_PENDING_INPUT
+    portENTER_CRITICAL(&dev->pending.lock);
+    *stats = dev->pending.stats;
+    portEXIT_CRITICAL(&dev->pending.lock);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/*
+queue report data to every central subscribed to it, returns 1 if nobody is connected;
+input nobody can take now is kept for the first central to become ready, see hid_pending_add()
+*/
+int
+hid_send_report(struct hid_dev *dev, int report_handle_num)
+{
+    int report_idx = hid_report_idx(report_handle_num);
+
+    if (report_idx == -1) {
+        ESP_LOGW(tag, "%s: Unknown report_handle_num %d", __FUNCTION__, report_handle_num);
+        return 2;
+    }
+
+    uint8_t data[HID_REPORT_MAX_SIZE];
+    size_t size = hid_report_read(&dev->reports[report_idx], data);
+    uint8_t trace = hid_lat_current();
+    int rc = 1;
+    bool taken = false;
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_conn *conn = &dev->conns[i];
+
+        if (!conn->in_use) {
+            continue;
+        }
+        // central in the other protocol mode gets the same input by its own report
+        taken |= !hid_conn_in_mode(conn, &dev->reports[report_idx]) ||
+            hid_conn_wants(conn, &dev->reports[report_idx]);
+
+        int conn_rc = hid_conn_enqueue(conn, report_idx, data, size, false, trace);
+        if (rc == 1 || conn_rc) {
+            rc = conn_rc;
+        }
+    }
+
+    if (!taken) {
+        hid_pending_add(dev, report_idx, data, size);
+    }
+
+    return rc;
+}
+
+/*
+Choose how a report reaches centrals that enabled both notifications and indications.
+HID_DELIVERY_NOTIFY (default) sends notifications: several of them go out in one
+connection event. HID_DELIVERY_RELIABLE sends indications: each one waits for the
+confirmation of the previous one. Pointer positions, gamepad axes and levels sent
+meanwhile are merged into one queued indication; keys, consumer controls and
+button edges are queued one by one, so a short press is never skipped.
+A central that enabled only one method always gets that one.
+*/
+int
+hid_set_delivery(struct hid_dev *dev, int report_handle_num, uint8_t delivery)
+{
+    int report_idx = hid_report_idx(report_handle_num);
+
+    if (report_idx == -1 || delivery > HID_DELIVERY_RELIABLE) {
+        return 2;
+    }
+
+    dev->reports[report_idx].delivery = delivery;
+    return 0;
+}
+
+/* forget last report sent to central and queue current state of report to it again */
+static void
+hid_conn_resync_report(struct hid_conn *conn, int report_idx)
+{
+    struct hid_notify_data *report = &conn->dev->reports[report_idx];
+    uint8_t data[HID_REPORT_MAX_SIZE];
+
+    portENTER_CRITICAL(&conn->tx.lock);
+    conn->tx.last[report_idx].size = 0;
+    portEXIT_CRITICAL(&conn->tx.lock);
+
+    if (report->def->relative) {
+        return;     // old deltas must not be applied twice
+    }
+
+    size_t size = hid_report_read(report, data);
+    hid_conn_enqueue(conn, report_idx, data, size, false, HID_LAT_NONE);
+}
+
+/* send current state of every report to central, even if it was sent before */
+int
+hid_resync(struct hid_dev *dev, uint16_t conn_handle)
+{
+    struct hid_conn *conn = hid_conn_find(dev, conn_handle);
+
+    if (!conn) {
+        return 1;
+    }
+
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        hid_conn_resync_report(conn, i);
+    }
+
+    return 0;
+}
+
+uint8_t
+hid_battery_level_get(struct hid_dev *dev)
+{
+    return dev->buffers.battery_level[0];
+}
+
+int
+hid_battery_level_set(struct hid_dev *dev, uint8_t level)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_BATTERY_LEVEL)];
+
+    hid_report_write_begin(dev, report);
+    dev->buffers.battery_level[0] = level;
+    hid_report_write_end(dev, report);
+
+    return hid_send_report(dev, HANDLE_BATTERY_LEVEL);
+}
+
+/* scroll units per report field step of one central */
+static int32_t
+hid_mouse_wheel_unit(struct hid_conn *conn, bool hires)
+{
+    return hires && !conn->report_mode_boot ? 1 : HID_WHEEL_MULTIPLIER;
+}
+
+/* motion has something for a report, fractions of a count or detent wait for more */
+static bool
+hid_mouse_has_motion(struct hid_conn *conn)
+{
+    struct hid_mouse_motion *motion = &conn->motion;
+
+    return motion->x / HID_MOUSE_SUBPIXELS || motion->y / HID_MOUSE_SUBPIXELS ||
+        motion->wheel / hid_mouse_wheel_unit(conn, conn->wheel_hires) ||
+        (!conn->report_mode_boot && motion->pan / hid_mouse_wheel_unit(conn, conn->pan_hires));
+}
+
+/* boot mouse report for GATT reads, deltas are not kept after they are sent */
+static size_t
+hid_mouse_render_boot(struct hid_dev *dev, uint8_t *dst)
+{
+    dst[0] = dev->mouse_buttons;
+    dst[1] = dst[2] = dst[3] = 0;
+    return HIDD_LE_BOOT_MOUSE_SIZE;
+}
+
+/* send pending mouse report to one central if the send opportunity has come or immediate is set, else wait for timer */
+static int
+hid_mouse_flush(struct hid_conn *conn, bool immediate)
+{
+    struct hid_dev *dev = conn->dev;
+    int report_idx = hid_report_idx(HANDLE_HID_MOUSE_REPORT);
+    struct hid_notify_data *report = &dev->reports[report_idx];
+    struct hid_mouse_motion *motion = &conn->motion;
+    uint8_t data[HIDD_LE_REPORT_MOUSE_SIZE];
+    size_t size = 0;
+    bool moved = false;
+    int32_t x = 0, y = 0, wheel = 0, pan = 0, wheel_unit = 1, pan_unit = 1;
+    uint8_t trace = HID_LAT_NONE;
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us = 0;
+
+    hid_report_write_begin(dev, report);
+
+    if (motion->dirty && conn->in_use) {
+        wait_us = motion->last_send_us + conn->conn_itvl_us - now;
+        if (wait_us <= 0 || immediate) {
+            bool boot = conn->report_mode_boot;
+
+            wheel_unit = hid_mouse_wheel_unit(conn, conn->wheel_hires);
+            pan_unit = hid_mouse_wheel_unit(conn, conn->pan_hires);
+            x = hid_take_delta(&motion->x, HID_MOUSE_SUBPIXELS, boot ? 127 : Layout->mouse.xy_max);
+            y = hid_take_delta(&motion->y, HID_MOUSE_SUBPIXELS, boot ? 127 : Layout->mouse.xy_max);
+            wheel = hid_take_delta(&motion->wheel, wheel_unit, boot ? 127 : Layout->mouse.wheel_max);
+            // boot report has no AC Pan, it waits for report mode
+            pan = boot ? 0 : hid_take_delta(&motion->pan, pan_unit, Layout->mouse.pan_max);
+
+            moved = x || y || wheel || pan;
+
+            if (boot) {
+                // boot protocol layout is fixed, it is not in the report map
+                data[0] = dev->mouse_buttons;
+                data[1] = (int8_t) x;
+                data[2] = (int8_t) y;
+                data[3] = (int8_t) wheel;
+                size = HIDD_LE_BOOT_MOUSE_SIZE;
+            } else {
+                size = report->def->buffer_size;
+                memset(data, 0, size);
+                for (int i = 0; i < 3; ++i) {
+                    hid_desc_ref_write(data, &Layout->mouse.buttons[i], (dev->mouse_buttons >> i) & 1);
+                }
+                hid_desc_ref_write(data, &Layout->mouse.x, x);
+                hid_desc_ref_write(data, &Layout->mouse.y, y);
+                hid_desc_ref_write(data, &Layout->mouse.wheel, wheel);
+                hid_desc_ref_write(data, &Layout->mouse.pan, pan);
+                // mouse buffer keeps the last report sent, for GATT reads
+                memcpy(dev->buffers.mouse, data, size);
+            }
+            motion->dirty = hid_mouse_has_motion(conn);
+            trace = motion->trace;
+            motion->trace = HID_LAT_NONE;
+            motion->last_send_us = now;
+            wait_us = conn->conn_itvl_us;
+        }
+    }
+
+    bool rearm = motion->dirty && conn->in_use;
+
+    hid_report_write_end(dev, report);
+
+    if (rearm && !esp_timer_is_active(motion->timer)) {
+        esp_timer_start_once(motion->timer, wait_us > 0 ? wait_us : 1);
+    }
+
+    int rc = size ? hid_conn_enqueue(conn, report_idx, data, size, moved, trace) : 0;
+
+    if (rc && moved) {
+        // queue refused the report, its deltas go back and leave with the next one
+        hid_report_write_begin(dev, report);
+        motion->x = hid_sat_add(motion->x, x * HID_MOUSE_SUBPIXELS);
+        motion->y = hid_sat_add(motion->y, y * HID_MOUSE_SUBPIXELS);
+        motion->wheel = hid_sat_add(motion->wheel, wheel * wheel_unit);
+        motion->pan = hid_sat_add(motion->pan, pan * pan_unit);
+        motion->dirty = true;
+        rearm = conn->in_use;
+        hid_report_write_end(dev, report);
+
+        if (rearm && !esp_timer_is_active(motion->timer)) {
+            esp_timer_start_once(motion->timer, conn->conn_itvl_us);
+        }
+    }
+
+    return rc;
+}
+
+static void
+hid_mouse_timer_cb(void *arg)
+{
+    hid_mouse_flush((struct hid_conn *) arg, false);
+}
+
+/* add motion for every central, call between hid_report_write_begin/end; wheel and pan in 1/HID_WHEEL_MULTIPLIER */
+static void
+hid_mouse_motion_add(struct hid_dev *dev, int32_t dx, int32_t dy, int32_t wheel, int32_t pan, bool force)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_MOUSE_REPORT)];
+    uint8_t trace = hid_lat_current();
+
+    // every central taking reports gets all the motion, at its own connection interval
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_mouse_motion *motion = &dev->conns[i].motion;
+
+        if (!dev->conns[i].in_use || !hid_conn_wants(&dev->conns[i], report)) {
+            // motion made before the central takes reports is not sent later in a jump
+            continue;
+        }
+        motion->x = hid_sat_add(motion->x, dx);
+        motion->y = hid_sat_add(motion->y, dy);
+        motion->wheel = hid_sat_add(motion->wheel, wheel);
+        motion->pan = hid_sat_add(motion->pan, pan);
+        motion->dirty |= force || hid_mouse_has_motion(&dev->conns[i]);
+        if (motion->trace == HID_LAT_NONE) {
+            // the report flushed later carries the trace of its first input
+            motion->trace = trace;
+        }
+    }
+}
+
+/* flush motion of every central, immediate does not wait for the next connection interval */
+static int
+hid_mouse_send(struct hid_dev *dev, bool immediate)
+{
+    int rc = 1; // nobody is connected
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        if (!dev->conns[i].in_use) {
+            continue;
+        }
+
+        int conn_rc = hid_mouse_flush(&dev->conns[i], immediate);
+        if (rc == 1 || conn_rc) {
+            rc = conn_rc;
+        }
+    }
+
+    return rc;
+}
+
+/* add motion for every central and send it, force sends report even without motion (buttons changed) */
+static int
+hid_mouse_commit(struct hid_dev *dev, int32_t dx, int32_t dy, int32_t wheel, int32_t pan, bool force)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_MOUSE_REPORT)];
+
+    hid_report_write_begin(dev, report);
+    hid_mouse_motion_add(dev, dx, dy, wheel, pan, force);
+    hid_report_write_end(dev, report);
+
+    return hid_mouse_send(dev, false);
+}
+
+/* move pointer by dx, dy in 1/HID_MOUSE_SUBPIXELS counts */
+int
+hid_mouse_move(struct hid_dev *dev, int32_t dx, int32_t dy)
+{
+    if (!dx && !dy) {
+        return 0;
+    }
+    return hid_mouse_commit(dev, dx, dy, 0, 0, false);
+}
+
+/*
+scroll vertically (wheel, positive is up) and horizontally (AC Pan, positive is right)
+by 1/HID_WHEEL_MULTIPLIER detents; sent at most once per connection interval, partial
+detents wait for more for centrals which did not enable the resolution multiplier
+*/
+int
+hid_mouse_scroll(struct hid_dev *dev, int32_t wheel, int32_t pan)
+{
+    if (!wheel && !pan) {
+        return 0;
+    }
+    return hid_mouse_commit(dev, 0, 0, wheel, pan, false);
+}
+
+/* apply mouse command to dev->mouse_buttons, call between hid_report_write_begin/end, true if buttons changed */
+static bool
+hid_mouse_button_set(struct hid_dev *dev, int cmd, bool pressed, int32_t *wheel)
+{
+    uint8_t buttons = dev->mouse_buttons;
+
+    switch (cmd) {
+        case HID_MOUSE_LEFT:
+        case HID_MOUSE_MIDDLE:
+        case HID_MOUSE_RIGHT:
+            if (pressed) {
+                buttons |= 1 << (cmd - HID_MOUSE_LEFT);
+            } else {
+                buttons &= ~(1 << (cmd - HID_MOUSE_LEFT));
+            }
+            break;
+        // wheel is relative too, one detent per press
+        case HID_MOUSE_WHEEL_UP:
+            *wheel += pressed ? HID_WHEEL_MULTIPLIER : 0;
+            break;
+        case HID_MOUSE_WHEEL_DOWN:
+            *wheel -= pressed ? HID_WHEEL_MULTIPLIER : 0;
+            break;
+    }
+
+    bool changed = buttons != dev->mouse_buttons;
+    dev->mouse_buttons = buttons;
+    return changed;
+}
+
+int
+hid_mouse_change_key(struct hid_dev *dev, int cmd, int16_t move_x, int16_t move_y, bool pressed)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_MOUSE_REPORT)];
+    int32_t wheel = 0;
+    bool buttons_changed = false;
+
+    switch (cmd) {
+        case HID_MOUSE_LEFT:
+        case HID_MOUSE_MIDDLE:
+        case HID_MOUSE_RIGHT:
+        case HID_MOUSE_WHEEL_UP:
+        case HID_MOUSE_WHEEL_DOWN:
+            break;
+        default:
+            TLOGI(tag, "Unknown mouse cmd %d!", cmd);
+            if (!move_x && !move_y) {
+                return 1;
+            }
+    }
+
+    hid_report_write_begin(dev, report);
+    buttons_changed = hid_mouse_button_set(dev, cmd, pressed, &wheel);
+    hid_mouse_motion_add(dev, move_x * HID_MOUSE_SUBPIXELS, move_y * HID_MOUSE_SUBPIXELS,
+        wheel, 0, buttons_changed);
+    hid_report_write_end(dev, report);
+
+    return hid_mouse_send(dev, false);
+}
+
+/* set acceleration of mouse keys, returns 1 if the profile is not valid */
+int
+hid_mouse_keys_profile_set(struct hid_dev *dev, const struct hid_mouse_keys_profile *profile)
+{
+    uint32_t lut[HID_MOUSE_KEYS_LUT + 1];
+
+    if (hid_mouse_keys_lut_build(profile, lut)) {
+        return 1;
+    }
+
+    portENTER_CRITICAL(&dev->mouse_keys.lock);
+    dev->mouse_keys.profile = *profile;
+    memcpy(dev->mouse_keys.speed_lut, lut, sizeof(lut));
+    portEXIT_CRITICAL(&dev->mouse_keys.lock);
+
+    return 0;
+}
+
+/* speed after moving continuously for t_us, subpixels per second; under dev->mouse_keys.lock */
+static uint32_t
+hid_mouse_keys_speed(struct hid_dev *dev, int64_t t_us)
+{
+    return hid_mouse_keys_lut_speed(dev->mouse_keys.speed_lut, dev->mouse_keys.profile.time_to_max_ms, t_us);
+}
+
+/* unit direction of held buttons, returns false if nothing moves */
+static bool
+hid_mouse_keys_dir(struct hid_dev *dev, int *dx, int *dy)
+{
+    *dx = (dev->mouse_keys.dir_x > 0) - (dev->mouse_keys.dir_x < 0);
+    *dy = (dev->mouse_keys.dir_y > 0) - (dev->mouse_keys.dir_y < 0);
+    return *dx || *dy;
+}
+
+/* shortest connection interval of connected centrals, they all get motion at their own pace */
+static uint32_t
+hid_mouse_keys_tick_us(struct hid_dev *dev)
+{
+    uint32_t tick_us = 0;
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        uint32_t itvl_us = dev->conns[i].conn_itvl_us;
+
+        if (dev->conns[i].in_use && itvl_us && (!tick_us || itvl_us < tick_us)) {
+            tick_us = itvl_us;
+        }
+    }
+    return tick_us ? tick_us : HID_MOUSE_KEYS_TICK_US;
+}
+
+static void
+hid_mouse_keys_timer_cb(void *arg)
+{
+    struct hid_dev *dev = arg;
+    int64_t now = esp_timer_get_time();
+    int32_t move_x = 0, move_y = 0;
+    int dx, dy;
+
+    portENTER_CRITICAL(&dev->mouse_keys.lock);
+    bool held = dev->mouse_keys.held;
+    int64_t moving_us = now - dev->mouse_keys.start_us - (int64_t) dev->mouse_keys.profile.delay_ms * 1000;
+
+    if (moving_us > 0 && hid_mouse_keys_dir(dev, &dx, &dy)) {
+        int64_t dt_us = now - dev->mouse_keys.last_us;
+
+        if (dt_us > moving_us) {
+            dt_us = moving_us;  // the delay was over during this tick
+        }
+
+        int32_t dist = (int64_t) hid_mouse_keys_speed(dev, moving_us) * dt_us / 1000000;
+
+        if (dx && dy) {
+            dist = dist * HID_MOUSE_KEYS_DIAG / 256;
+        }
+        move_x = dx * dist;
+        move_y = dy * dist;
+    }
+    dev->mouse_keys.last_us = now;
+    portEXIT_CRITICAL(&dev->mouse_keys.lock);
+
+    if (!held) {
+        // released meanwhile, the next tick is not armed
+        return;
+    }
+    esp_timer_start_once(dev->mouse_keys.timer, hid_mouse_keys_tick_us(dev));
+    hid_mouse_move(dev, move_x, move_y);
+}
+
+/*
+connection intervals changed, the pending mouse keys tick is armed again at the new
+shortest one; motion is taken from the time since the last tick, nothing is lost
+*/
+static void
+hid_mouse_keys_retick(struct hid_dev *dev)
+{
+    portENTER_CRITICAL(&dev->mouse_keys.lock);
+    bool held = dev->mouse_keys.held;
+    portEXIT_CRITICAL(&dev->mouse_keys.lock);
+
+    if (held) {
+        esp_timer_stop(dev->mouse_keys.timer);
+        esp_timer_start_once(dev->mouse_keys.timer, hid_mouse_keys_tick_us(dev));
+    }
+}
+
+/*
+direction button of mouse keys pressed or released, dir_x and dir_y are -1, 0 or 1
+(bytes 1 and 2 of a BUTTON_MOUSE_KEYS button)
+*/
+int
+hid_mouse_keys_change(struct hid_dev *dev, int8_t dir_x, int8_t dir_y, bool pressed)
+{
+    int sign = pressed ? 1 : -1;
+    bool start = false, stop = false;
+    int dx = 0, dy = 0;
+
+    dir_x = (dir_x > 0) - (dir_x < 0);
+    dir_y = (dir_y > 0) - (dir_y < 0);
+    if (!dir_x && !dir_y) {
+        return 1;
+    }
+
+    portENTER_CRITICAL(&dev->mouse_keys.lock);
+    if (pressed || dev->mouse_keys.held) {
+        dev->mouse_keys.dir_x += sign * dir_x;
+        dev->mouse_keys.dir_y += sign * dir_y;
+        dev->mouse_keys.held += sign;
+        if (pressed && dev->mouse_keys.held == 1) {
+            dev->mouse_keys.start_us = dev->mouse_keys.last_us = esp_timer_get_time();
+            start = true;
+            hid_mouse_keys_dir(dev, &dx, &dy);
+        } else if (!dev->mouse_keys.held) {
+            dev->mouse_keys.dir_x = dev->mouse_keys.dir_y = 0;
+            stop = true;
+        }
+    }
+    portEXIT_CRITICAL(&dev->mouse_keys.lock);
+
+    if (stop) {
+        esp_timer_stop(dev->mouse_keys.timer);
+    }
+    if (start) {
+        esp_timer_stop(dev->mouse_keys.timer);
+        esp_timer_start_once(dev->mouse_keys.timer, hid_mouse_keys_tick_us(dev));
+        return hid_mouse_move(dev, dx * HID_MOUSE_SUBPIXELS, dy * HID_MOUSE_SUBPIXELS);
+    }
+    return 0;
+}
+
+/*
+Put the absolute pointer at x, y (0 to HID_ABS_POINTER_MAX on both axes, the host
+maps it to the screen) with HID_ABS_* switches. One report reaches the target,
+there is nothing to accumulate or carry over, so it is sent at once.
+*/
+int
+hid_abs_pointer_move(struct hid_dev *dev, uint16_t x, uint16_t y, uint8_t switches)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_ABS_POINTER_REPORT)];
+
+    if (x > HID_ABS_POINTER_MAX) {
+        x = HID_ABS_POINTER_MAX;
+    }
+    if (y > HID_ABS_POINTER_MAX) {
+        y = HID_ABS_POINTER_MAX;
+    }
+
+    // coordinates of the API are scaled to the field range of the report map
+    int32_t x_max = hid_layout_max(&Layout->abs.x, HID_ABS_POINTER_MAX),
+            y_max = hid_layout_max(&Layout->abs.y, HID_ABS_POINTER_MAX);
+
+    hid_report_write_begin(dev, report);
+    memset(dev->buffers.abs_pointer, 0, sizeof(dev->buffers.abs_pointer));
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.tip, !!(switches & HID_ABS_TIP));
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.barrel, !!(switches & HID_ABS_BARREL));
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.in_range, 1);
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.x, (int32_t) x * x_max / HID_ABS_POINTER_MAX);
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.y, (int32_t) y * y_max / HID_ABS_POINTER_MAX);
+    hid_report_write_end(dev, report);
+
+    return hid_send_report(dev, HANDLE_HID_ABS_POINTER_REPORT);
+}
+
+/* pointer leaves the digitizer, host shows relative mouse pointer again */
+int
+hid_abs_pointer_leave(struct hid_dev *dev)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_ABS_POINTER_REPORT)];
+
+    hid_report_write_begin(dev, report);
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.tip, 0);
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.barrel, 0);
+    hid_desc_ref_write(dev->buffers.abs_pointer, &Layout->abs.in_range, 0);
+    hid_report_write_end(dev, report);
+
+    return hid_send_report(dev, HANDLE_HID_ABS_POINTER_REPORT);
+}
+
+/* neutral gamepad state: nothing pressed, sticks centered, hat released */
+static void
+hid_gamepad_clear(struct hid_dev *dev)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_GAMEPAD_REPORT)];
+
+    hid_report_write_begin(dev, report);
+    memset(dev->buffers.gamepad, 0, sizeof(dev->buffers.gamepad));
+    hid_desc_ref_write(dev->buffers.gamepad, &Layout->gamepad.hat, HID_GAMEPAD_HAT_NONE);
+    hid_report_write_end(dev, report);
+}
+
+/* send gamepad state to one central if its send opportunity has come, else wait for timer */
+static int
+hid_gamepad_flush(struct hid_conn *conn)
+{
+    struct hid_dev *dev = conn->dev;
+    struct hid_gamepad_pace *pace = &conn->gamepad;
+    uint8_t data[HIDD_LE_REPORT_GAMEPAD_SIZE];
+    uint8_t trace = HID_LAT_NONE;
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us = 0;
+    bool send = false;
+
+    // writers hold the lock while they change the buffer, the copy is a consistent state
+    portENTER_CRITICAL(&dev->writer_lock);
+    if (pace->dirty && conn->in_use) {
+        wait_us = pace->last_send_us + conn->conn_itvl_us - now;
+        if (wait_us <= 0) {
+            memcpy(data, dev->buffers.gamepad, sizeof(data));
+            pace->dirty = false;
+            trace = pace->trace;
+            pace->trace = HID_LAT_NONE;
+            pace->last_send_us = now;
+            send = true;
+        }
+    }
+    portEXIT_CRITICAL(&dev->writer_lock);
+
+    if (wait_us > 0 && !esp_timer_is_active(pace->timer)) {
+        esp_timer_start_once(pace->timer, wait_us);
+    }
+
+    return send ? hid_conn_enqueue(conn, hid_report_idx(HANDLE_HID_GAMEPAD_REPORT), data, sizeof(data), false,
+        trace) : 0;
+}
+
+static void
+hid_gamepad_timer_cb(void *arg)
+{
+    hid_gamepad_flush((struct hid_conn *) arg);
+}
+
+/*
+gamepad state changed, flush it to every central at its own pace; an edge, a button
+or the hat changed, goes out at once with the axes as they are now, never merged
+with the next change, so a tap shorter than the interval still reaches the host
+*/
+static int
+hid_gamepad_send(struct hid_dev *dev, bool edge)
+{
+    int rc = 1; // nobody is connected
+    int report_idx = hid_report_idx(HANDLE_HID_GAMEPAD_REPORT);
+    uint8_t trace = hid_lat_current();
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_conn *conn = &dev->conns[i];
+        struct hid_gamepad_pace *pace = &conn->gamepad;
+        uint8_t data[HIDD_LE_REPORT_GAMEPAD_SIZE];
+        uint8_t conn_trace = trace;
+        bool send = false;
+
+        portENTER_CRITICAL(&dev->writer_lock);
+        if (conn->in_use && !conn->suspended_state) {
+            if (edge) {
+                // the axes ride along, pending ones are sent with the edge
+                memcpy(data, dev->buffers.gamepad, sizeof(data));
+                if (pace->trace != HID_LAT_NONE) {
+                    conn_trace = pace->trace;
+                }
+                pace->dirty = false;
+                pace->trace = HID_LAT_NONE;
+                pace->last_send_us = esp_timer_get_time();
+                send = true;
+            } else {
+                pace->dirty = true;
+                if (pace->trace == HID_LAT_NONE) {
+                    pace->trace = trace;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&dev->writer_lock);
+
+        if (!conn->in_use) {
+            continue;
+        }
+
+        int conn_rc;
+
+        if (send) {
+            // the changed buttons make it an edge in the keys class of hid_conn_enqueue()
+            conn_rc = hid_conn_enqueue(conn, report_idx, data, sizeof(data), false, conn_trace);
+        } else {
+            conn_rc = hid_gamepad_flush(conn);
+        }
+        if (rc == 1 || conn_rc) {
+            rc = conn_rc;
         }
     }
-    if (report_idx == -1) {
-        ESP_LOGW(tag, "%s: attr_handle %04X not found in reports", __FUNCTION__, attr_handle);
-    } else {
-        Notify_data_reports[report_idx].can_indicate = cur_indicate;
-        Notify_data_reports[report_idx].can_notify = cur_notify;
+    return rc;
+}
 
-        ESP_LOGI(tag, "%s: service %s, attr_handle %d, notify %d, indicate %d",
-                    __FUNCTION__, Notify_data_reports[report_idx].name, attr_handle, cur_notify, cur_indicate);
-    }
+/* buttons and hat of the gamepad buffer, call between hid_report_write_begin/end */
+static uint32_t
+hid_gamepad_keys(struct hid_dev *dev)
+{
+    return hid_report_buttons(hid_report_idx(HANDLE_HID_GAMEPAD_REPORT), dev->buffers.gamepad, false);
 }
 
-/* lock report buffers with mutex semaphore */
-static int
-lock_hid_data()
+/* write axis value cut to its field range, call between hid_report_write_begin/end */
+static void
+hid_gamepad_axis_write(struct hid_dev *dev, int axis, int32_t value)
 {
-    if (!My_hid_dev.semaphore) {
-        ESP_LOGW(tag, "%s semaphore is NULL", __FUNCTION__);
-        return 1;
+    const struct hid_desc_ref *ref = &Layout->gamepad.axes[axis];
+
+    if (!ref->field) {
+        return;
     }
-    if (xSemaphoreTake( My_hid_dev.semaphore, pdMS_TO_TICKS(HID_DEV_BUF_MUTEX_WAIT) ) == pdTRUE) {
-        return 0;
-    } else {
-        ESP_LOGW(tag, "%s: can't lock", __FUNCTION__);
+    if (value < ref->field->logical_min) {
+        value = ref->field->logical_min;
+    } else if (value > ref->field->logical_max) {
+        value = ref->field->logical_max;
     }
+    hid_desc_ref_write(dev->buffers.gamepad, ref, value);
+}
 
-    return 2;
+/* write buttons, bit 0 is button 1, call between hid_report_write_begin/end */
+static void
+hid_gamepad_buttons_write(struct hid_dev *dev, uint16_t buttons)
+{
+    const struct hid_desc_ref *ref = &Layout->gamepad.button1;
 
+    for (int i = 0; ref->field && i < HID_GAMEPAD_BUTTONS && ref->index + i < ref->field->count; ++i) {
+        hid_desc_field_write(dev->buffers.gamepad, ref->field, ref->index + i, (buttons >> i) & 1);
+    }
 }
 
-/* unlock report buffers locked with mutex semaphore */
-static int
-unlock_hid_data()
+/* read buttons of gamepad report, the gamepad buffer between hid_report_write_begin/end */
+static uint16_t
+hid_gamepad_buttons_read(const uint8_t *buf)
 {
-    if (!My_hid_dev.semaphore) {
-        ESP_LOGW(tag, "%s semaphore is NULL", __FUNCTION__);
-        return 1;
+    const struct hid_desc_ref *ref = &Layout->gamepad.button1;
+    uint16_t buttons = 0;
+
+    for (int i = 0; ref->field && i < HID_GAMEPAD_BUTTONS && ref->index + i < ref->field->count; ++i) {
+        buttons |= (hid_desc_field_read(buf, ref->field, ref->index + i) & 1) << i;
     }
-    if (xSemaphoreGive( My_hid_dev.semaphore ) == pdTRUE) {
-        return 0;
+    return buttons;
+}
+
+/* replace whole gamepad state, e.g. with a new sample of all inputs */
+int
+hid_gamepad_update(struct hid_dev *dev, const struct hid_gamepad_state *state)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_GAMEPAD_REPORT)];
+
+    hid_report_write_begin(dev, report);
+    uint32_t keys = hid_gamepad_keys(dev);
+    hid_gamepad_buttons_write(dev, state->buttons);
+    for (int i = 0; i < HID_GAMEPAD_AXES; ++i) {
+        hid_gamepad_axis_write(dev, i, state->axes[i]);
     }
-    return 2;
+    hid_desc_ref_write(dev->buffers.gamepad, &Layout->gamepad.hat,
+        state->hat < HID_GAMEPAD_HAT_NONE ? state->hat : HID_GAMEPAD_HAT_NONE);
+    bool edge = keys != hid_gamepad_keys(dev);
+    hid_report_write_end(dev, report);
 
+    return hid_gamepad_send(dev, edge);
 }
 
-/* zero all fields on new connection */
-void
-hid_clean_vars(struct ble_gap_conn_desc *desc)
+/* move one HID_GAMEPAD_AXIS_*, changes between two reports are merged into the last value */
+int
+hid_gamepad_axis_set(struct hid_dev *dev, int axis, int32_t value)
 {
-    // save semaphore for new connection use
-    SemaphoreHandle_t semaphore_saved = My_hid_dev.semaphore;
-    int rc = -1;
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_GAMEPAD_REPORT)];
 
-    if (semaphore_saved) {
-        rc = lock_hid_data();
+    if (axis < 0 || axis >= HID_GAMEPAD_AXES) {
+        return 2;
     }
 
-    memset(&My_hid_dev, 0, sizeof(struct hid_device_data));
+    hid_report_write_begin(dev, report);
+    hid_gamepad_axis_write(dev, axis, value);
+    hid_report_write_end(dev, report);
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        Notify_data_reports[i].can_indicate = false;
-        Notify_data_reports[i].can_notify = false;
-        switch (Notify_data_reports[i].handle_num) {
-            case HANDLE_HID_MOUSE_REPORT:
-            case HANDLE_HID_KB_IN_REPORT:
-            case HANDLE_HID_KB_OUT_REPORT:
-            case HANDLE_HID_CC_REPORT:
-                memset(Notify_data_reports[i].buffer, 0, Notify_data_reports[i].buffer_size);
-        }
+    return hid_gamepad_send(dev, false);
+}
+
+/* press or release button 1 to HID_GAMEPAD_BUTTONS, sent at once */
+int
+hid_gamepad_button_set(struct hid_dev *dev, int button, bool pressed)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_GAMEPAD_REPORT)];
+
+    if (button < 1 || button > HID_GAMEPAD_BUTTONS) {
+        return 2;
     }
 
-    if (semaphore_saved) {
-        My_hid_dev.semaphore = semaphore_saved;
+    hid_report_write_begin(dev, report);
+    uint16_t buttons = hid_gamepad_buttons_read(dev->buffers.gamepad);
+    if (pressed) {
+        buttons |= 1 << (button - 1);
     } else {
-        My_hid_dev.semaphore = xSemaphoreCreateMutex();
-        assert(My_hid_dev.semaphore != NULL);
+        buttons &= ~(1 << (button - 1));
     }
+    bool edge = buttons != hid_gamepad_buttons_read(dev->buffers.gamepad);
+    hid_gamepad_buttons_write(dev, buttons);
+    hid_report_write_end(dev, report);
 
-    My_hid_dev.conn_handle = desc->conn_handle;
-    My_hid_dev.connected = true;
-
-    if (!rc) {
-        unlock_hid_data();
-    }
+    return hid_gamepad_send(dev, edge);
 }
 
-void
-hid_set_disconnected()
+/* set hat direction, 0 (up) to 7 clockwise, HID_GAMEPAD_HAT_NONE to release; sent at once */
+int
+hid_gamepad_hat_set(struct hid_dev *dev, uint8_t direction)
 {
-    My_hid_dev.connected = false;
-}
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_GAMEPAD_REPORT)];
 
-bool
-hid_set_suspend(bool need_suspend)
-{
-    bool last_state = My_hid_dev.suspended_state;
-    My_hid_dev.suspended_state = need_suspend;
-    return last_state;
+    if (direction > HID_GAMEPAD_HAT_NONE) {
+        return 2;
+    }
+
+    hid_report_write_begin(dev, report);
+    bool edge = direction != hid_desc_ref_read(dev->buffers.gamepad, &Layout->gamepad.hat);
+    hid_desc_ref_write(dev->buffers.gamepad, &Layout->gamepad.hat, direction);
+    hid_report_write_end(dev, report);
+
+    return hid_gamepad_send(dev, edge);
 }
 
-bool
-hid_set_report_mode(bool is_mode_boot)
+/* true if usage fits into the consumer control array */
+static bool
+hid_cc_usage_valid(uint16_t usage)
 {
-    bool old_boot = My_hid_dev.report_mode_boot;
-    My_hid_dev.report_mode_boot = is_mode_boot;
-    return old_boot;
+    return usage != 0 && Layout->cc && usage <= Layout->cc->logical_max;
 }
 
-char outbuf[100];
-
-char * print_buf(uint8_t *buf, int buf_size)
+/*
+press or release valid usage and render consumer control buffer, call between hid_report_write_begin/end;
+returns 0 if report changed, -1 if nothing changed, 1 if usage can not be pressed or released
+*/
+static int
+hid_cc_usage_set(struct hid_dev *dev, uint16_t usage, bool pressed)
 {
-    outbuf[0] = 0;
-    for (int i = 0; i < buf_size; ++i) {
-        sprintf(outbuf + strlen(outbuf),"%s%02X", i?" ":"", buf[i]);
+    struct hid_cc_keys *keys = &dev->cc_keys;
+    int slots = Layout->cc->count < HID_CC_SLOTS ? Layout->cc->count : HID_CC_SLOTS;
+    int rc = hid_cc_keys_set(keys, slots, usage, pressed);
+
+    if (rc) {
+        return rc;
     }
-    return outbuf;
+    for (int i = 0; i < slots; ++i) {
+        hid_desc_field_write(dev->buffers.cc, Layout->cc, i, i < keys->count ? keys->pressed[i] : 0);
+    }
+    return 0;
 }
 
+/* press or release any Consumer page usage, several usages can be held at once */
 int
-hid_read_buffer(struct os_mbuf *buf, int handle_num)
+hid_cc_change_usage(struct hid_dev *dev, uint16_t usage, bool pressed)
 {
-    int rc = 0;
-    int rep_idx = -1;
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_CC_REPORT)];
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (Notify_data_reports[i].handle_num == handle_num ||
-            Notify_data_reports[i].handle_boot_num == handle_num) {
-            rep_idx = i;
-            break;
-        }
+    if (!hid_cc_usage_valid(usage)) {
+        return 2;   // usage can not be reported
     }
 
-    if (rep_idx != -1 && lock_hid_data() == 0) {
-        rc = os_mbuf_append(buf,
-            Notify_data_reports[rep_idx].buffer,
-            Notify_data_reports[rep_idx].buffer_size);
-        unlock_hid_data();
+    hid_report_write_begin(dev, report);
+    int rc = hid_cc_usage_set(dev, usage, pressed);
+    hid_report_write_end(dev, report);
 
-        // ESP_LOGI("", "%s read data: %s", __FUNCTION__,
-        //     print_buf(Notify_data_reports[rep_idx].buffer,
-        //         Notify_data_reports[rep_idx].buffer_size));
-    } else {
-        if (rep_idx == -1) ESP_LOGW(tag, "%s: handle_num %d not found", __FUNCTION__, handle_num);
-        return 2;
+    if (rc) {
+        return rc == -1 ? 0 : rc;
     }
 
-    return rc;
+    return hid_send_report(dev, HANDLE_HID_CC_REPORT);
 }
 
+/* press or release HID_CONSUMER_* code, the codes are Consumer page usages */
 int
-hid_write_buffer(struct os_mbuf *buf, int handle_num)
+hid_cc_change_key(struct hid_dev *dev, int key, bool pressed)
 {
-    int rc = 0;
+    if (key <= 0 || key > 255) {
+        return 2;
+    }
 
-    int rep_idx = -1;
+    return hid_cc_change_usage(dev, key, pressed);
+}
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (Notify_data_reports[i].handle_num == handle_num ||
-            Notify_data_reports[i].handle_boot_num == handle_num) {
-            rep_idx = i;
-            break;
-        }
-    }
-    if (rep_idx != -1 && lock_hid_data() == 0) {
-        if (OS_MBUF_PKTLEN(buf) == Notify_data_reports[rep_idx].buffer_size) {
-            rc = ble_hs_mbuf_to_flat(buf,
-                Notify_data_reports[rep_idx].buffer,
-                OS_MBUF_PKTLEN(buf),
-                NULL);
-        } else {
-            rc = 4;
+/*
+build 6KRO report from press order list, all slots are ErrorRollOver if more keys are pressed;
+codes above HID_BOOT_KB_MAX_KEY are outside the logical range of the array, they are left out
+*/
+static void
+hid_keyboard_build_boot(struct hid_dev *dev, uint8_t *buffer)
+{
+    int n = 2;
+
+    buffer[0] = dev->key_state.modifiers;
+    memset(buffer + 1, 0, HIDD_LE_REPORT_KB_IN_SIZE - 1);
+
+    for (uint8_t key = dev->key_state.next[0]; key; key = dev->key_state.next[key]) {
+        if (key > HID_BOOT_KB_MAX_KEY) {
+            continue;
         }
-        unlock_hid_data();
-        if (rc == 0) {
-            if (handle_num == HANDLE_HID_KB_OUT_REPORT) {
-                // change LEDs level when Keyboard out report received
-                set_leds(Leds_buffer[0]);
-            }
+        if (n == HIDD_LE_REPORT_KB_IN_SIZE) {
+            memset(buffer + 2, HID_KEY_ERR_ROLLOVER, HIDD_LE_REPORT_KB_IN_SIZE - 2);
+            return;
         }
+        buffer[n++] = key;
+    }
+}
+
+/* change one key in dev->key_state, call between hid_report_write_begin/end, returns false if nothing changed */
+static bool
+hid_key_state_set(struct hid_dev *dev, uint8_t key, bool pressed)
+{
+    bool is_modifier = key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI;
+    uint8_t mask = 1 << (key & 7);
+    bool was_pressed = dev->key_state.pressed[key >> 3] & mask;
+
+    if (was_pressed == pressed) {
+        return false;
+    }
+
+    if (pressed) {
+        dev->key_state.pressed[key >> 3] |= mask;
     } else {
-        return 2;
+        dev->key_state.pressed[key >> 3] &= ~mask;
     }
 
-    return rc;
+    if (is_modifier) {
+        // it is modifier (Ctrl Shift Alt or Winkey)
+        dev->key_state.modifiers = dev->key_state.pressed[HID_KEY_LEFT_CTRL >> 3];
+    } else if (pressed) {
+        // ordinary key, append to the end of press order list
+        uint8_t last = dev->key_state.prev[0];
+        dev->key_state.next[last] = key;
+        dev->key_state.prev[key] = last;
+        dev->key_state.next[key] = 0;
+        dev->key_state.prev[0] = key;
+        dev->key_state.count++;
+    } else {
+        // unlink released key from press order list
+        dev->key_state.next[dev->key_state.prev[key]] = dev->key_state.next[key];
+        dev->key_state.prev[dev->key_state.next[key]] = dev->key_state.prev[key];
+        dev->key_state.count--;
+    }
+
+    return true;
 }
 
-/*  send report to central using different ways
-    0 - using ble_gattc_indicate_custom     using custom buffer
-    1 - using ble_gattc_indicate            to only one connection
-    2 - using ble_gatts_chr_updated         to all connected centrals
-*/
-#define SEND_METHOD_CUSTOM  0
-#define SEND_METHOD_STD     1
-#define SEND_METHOD_ALL     2
+/* render dev->key_state to NKRO report */
+static void
+hid_keyboard_build_nkro(struct hid_dev *dev, uint8_t *buffer)
+{
+    buffer[0] = dev->key_state.modifiers;
+    memcpy(buffer + 1, dev->key_state.pressed, HIDD_LE_REPORT_KB_NKRO_SIZE - 1);
+}
+
+/* send both keyboard reports, every central gets the one of its protocol mode */
+static int
+hid_keyboard_send(struct hid_dev *dev)
+{
+    // boot host knows only 6KRO report
+    int rc = hid_send_report(dev, HANDLE_HID_KB_NKRO_REPORT);
+    int rc_boot = hid_send_report(dev, HANDLE_HID_KB_IN_REPORT);
 
-#define NOTIFY_METHOD SEND_METHOD_STD
+    return rc ? rc : rc_boot;
+}
 
-/* send report data to central using notify/indicate */
-int
-hid_send_report(int report_handle_num)
+/* render dev->key_state to NKRO report and send keyboard reports, keyboard buffer is built already */
+static int
+hid_keyboard_publish(struct hid_dev *dev)
 {
-    /* check semaphore, connection and suspend state */
-    if ( !My_hid_dev.semaphore || !My_hid_dev.connected || My_hid_dev.suspended_state) {
-        ESP_LOGI(tag, "%s semaphore %p %d %d", __FUNCTION__,
-            My_hid_dev.semaphore, My_hid_dev.connected, My_hid_dev.suspended_state);
-        return 1;
-    }
+    struct hid_notify_data *report_nkro = &dev->reports[hid_report_idx(HANDLE_HID_KB_NKRO_REPORT)];
 
-    int report_idx = -1;
+    hid_report_write_begin(dev, report_nkro);
+    hid_keyboard_build_nkro(dev, dev->buffers.keyboard_nkro);
+    hid_report_write_end(dev, report_nkro);
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (report_handle_num == Notify_data_reports[i].handle_num) {
-            report_idx = i;
-            break;
-        }
+    return hid_keyboard_send(dev);
+}
+
+int
+hid_keyboard_change_key(struct hid_dev *dev, uint8_t key, bool pressed)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_KB_IN_REPORT)];
+    bool is_modifier = key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI;
+
+    if (key == HID_KEY_RESERVED || (!is_modifier && key > HID_NKRO_MAX_KEY)) {
+        return 1; // key can not be reported
     }
 
-    if (report_idx == -1) {
-        ESP_LOGW(tag, "%s: Unknown report_handle_num %d", __FUNCTION__, report_handle_num);
-        return 2;
+    hid_report_write_begin(dev, report);
+
+    bool changed = hid_key_state_set(dev, key, pressed);
+    if (changed) {
+        hid_keyboard_build_boot(dev, dev->buffers.keyboard);
     }
 
-    uint16_t send_handle;
-    int rc = 0;
+    hid_report_write_end(dev, report);
 
-    if (My_hid_dev.report_mode_boot) {
-        send_handle = Svc_char_handles[Notify_data_reports[report_idx].handle_boot_num];
-    } else {
-        send_handle = Svc_char_handles[Notify_data_reports[report_idx].handle_num];
+    if (!changed) {
+        return pressed ? 0 : 1; // nothing changed, or key not found
     }
 
-    switch (NOTIFY_METHOD) {
-        case SEND_METHOD_CUSTOM: {
-            if (lock_hid_data() == 0) {
-                struct os_mbuf *om = ble_hs_mbuf_from_flat(
-                    Notify_data_reports[report_idx].buffer,
-                    Notify_data_reports[report_idx].buffer_size);
-                unlock_hid_data();
-
-                if (Notify_data_reports[report_idx].can_indicate) {
-                    rc = ble_gattc_indicate_custom(My_hid_dev.conn_handle, send_handle, om);
-                } else if (Notify_data_reports[report_idx].can_notify) {
-                    rc = ble_gattc_notify_custom(My_hid_dev.conn_handle, send_handle, om);
-                }
-            }
-            break;
-        }
+    return hid_keyboard_publish(dev);
+}
 
-        case SEND_METHOD_STD:
-            if (Notify_data_reports[report_idx].can_indicate) {
-                rc = ble_gattc_indicate(My_hid_dev.conn_handle, send_handle);
-            } else if (Notify_data_reports[report_idx].can_notify) {
-                rc = ble_gattc_notify(My_hid_dev.conn_handle, send_handle);
-            }
-            break;
+/*
+Input frames. Changes of keyboard, consumer control and mouse collected in a
+frame are applied under one lock, so GATT reads never see half of a chord, and
+queued in a fixed order right after that: keyboard, consumer control, mouse.
+Modifiers thus reach the host before the click of Ctrl+click, and every report
+is queued once however many changes it got. The NimBLE host gets the reports of
+a frame in one go, see hid_frame_hold(): a central with room in its link gets
+them in one connection event, one which has a backlog gets them in order.
+*/
+void
+hid_frame_begin(struct hid_frame *frame)
+{
+    frame->count = 0;
+}
 
-        case SEND_METHOD_ALL:
-            ble_gatts_chr_updated(send_handle);
-            rc = 0;
-            break;
-    }
-    if (rc) {
-        ESP_LOGE(tag, "%s: Notify error in function", __FUNCTION__);
+static int
+hid_frame_add(struct hid_frame *frame, uint8_t type, uint16_t code, int16_t x, int16_t y, bool pressed)
+{
+    if (frame->count == HID_FRAME_OPS) {
+        return 3;   // frame is full
     }
 
+    frame->ops[frame->count].type = type;
+    frame->ops[frame->count].code = code;
+    frame->ops[frame->count].x = x;
+    frame->ops[frame->count].y = y;
+    frame->ops[frame->count].pressed = pressed;
+    frame->count++;
     return 0;
 }
 
-uint8_t
-hid_battery_level_get(void)
+int
+hid_frame_key(struct hid_frame *frame, uint8_t key, bool pressed)
+{
+    bool is_modifier = key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI;
+
+    if (key == HID_KEY_RESERVED || (!is_modifier && key > HID_NKRO_MAX_KEY)) {
+        return 1; // key can not be reported
+    }
+    return hid_frame_add(frame, HID_FRAME_KEY, key, 0, 0, pressed);
+}
+
+int
+hid_frame_cc(struct hid_frame *frame, uint16_t usage, bool pressed)
 {
-    return Battery_level[0];
+    if (!hid_cc_usage_valid(usage)) {
+        return 2;
+    }
+    return hid_frame_add(frame, HID_FRAME_CC, usage, 0, 0, pressed);
 }
 
 int
-hid_battery_level_set(uint8_t level)
+hid_frame_mouse(struct hid_frame *frame, int cmd, int16_t move_x, int16_t move_y, bool pressed)
 {
-    int rc = 0;
+    if ((cmd < HID_MOUSE_LEFT || cmd > HID_MOUSE_WHEEL_DOWN) && !move_x && !move_y) {
+        return 1;   // unknown command without motion
+    }
+    return hid_frame_add(frame, HID_FRAME_MOUSE, cmd, move_x, move_y, pressed);
+}
 
-    if (lock_hid_data() == 0) {
-        if (Battery_level[0] != level) {
-            Battery_level[0] = level;
+/*
+while a frame is queued the pump of every central waits, so the NimBLE host
+does not take the first report of the frame before the others are queued;
+released, every central that got reports is pumped once
+*/
+static void
+hid_frame_hold(struct hid_dev *dev, bool hold)
+{
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_conn *conn = &dev->conns[i];
+        bool release;
+
+        portENTER_CRITICAL(&conn->tx.lock);
+        conn->tx.held += hold ? 1 : -1;
+        release = !conn->tx.held && conn->tx.release_held && conn->in_use;
+        if (release) {
+            conn->tx.release_held = false;
         }
-        unlock_hid_data();
+        portEXIT_CRITICAL(&conn->tx.lock);
 
-        rc = hid_send_report(HANDLE_BATTERY_LEVEL);
-    } else {
-        return -2;
+        if (release) {
+            hid_tx_release(conn);
+        }
     }
-
-    return rc;
 }
 
+/* apply all changes of the frame at once and send reports they changed, the frame is empty after it */
 int
-hid_mouse_change_key(int cmd, int8_t move_x, int8_t move_y, bool pressed)
+hid_frame_commit(struct hid_dev *dev, struct hid_frame *frame)
 {
-    int rc = 0;
+    struct hid_notify_data *reports[] = {
+        &dev->reports[hid_report_idx(HANDLE_HID_KB_IN_REPORT)],
+        &dev->reports[hid_report_idx(HANDLE_HID_KB_NKRO_REPORT)],
+        &dev->reports[hid_report_idx(HANDLE_HID_CC_REPORT)],
+        &dev->reports[hid_report_idx(HANDLE_HID_MOUSE_REPORT)],
+    };
+    bool kb_changed = false, cc_changed = false, buttons_changed = false;
+    int32_t dx = 0, dy = 0, wheel = 0;
+
+    portENTER_CRITICAL(&dev->writer_lock);
+    hid_lat_stamp(hid_lat_current(), HID_LAT_LOCKED);
+    for (int i = 0; i < sizeof(reports) / sizeof(reports[0]); ++i) {
+        hid_report_seq_begin(reports[i]);
+    }
 
-    if (lock_hid_data() == 0) {
+    for (int i = 0; i < frame->count; ++i) {
+        const struct hid_frame_op *op = &frame->ops[i];
 
-        switch (cmd) {
-            case HID_MOUSE_LEFT:
-            case HID_MOUSE_MIDDLE:
-            case HID_MOUSE_RIGHT:
-                if (pressed) {
-                    Mouse_buffer[0] |= 1 << (cmd - HID_MOUSE_LEFT);
-                } else {
-                    Mouse_buffer[0] &= ~(1 << (cmd - HID_MOUSE_LEFT));
-                }
+        switch (op->type) {
+            case HID_FRAME_KEY:
+                kb_changed |= hid_key_state_set(dev, op->code, op->pressed);
                 break;
-            case HID_MOUSE_WHEEL_UP:
-                Mouse_buffer[3] = 1;
+            case HID_FRAME_CC:
+                cc_changed |= hid_cc_usage_set(dev, op->code, op->pressed) == 0;
                 break;
-            case HID_MOUSE_WHEEL_DOWN:
-                Mouse_buffer[3] = -1;
+            case HID_FRAME_MOUSE:
+                buttons_changed |= hid_mouse_button_set(dev, op->code, op->pressed, &wheel);
+                dx += op->x * HID_MOUSE_SUBPIXELS;
+                dy += op->y * HID_MOUSE_SUBPIXELS;
                 break;
-            default:
-                rc = 1;
-                ESP_LOGI(tag, "Unknown mouse cmd %d!", cmd);
         }
+    }
 
-        Mouse_buffer[1] = move_x;
-        Mouse_buffer[2] = move_y;
+    if (kb_changed) {
+        hid_keyboard_build_boot(dev, dev->buffers.keyboard);
+        hid_keyboard_build_nkro(dev, dev->buffers.keyboard_nkro);
+    }
 
-        unlock_hid_data();
+    bool mouse_changed = buttons_changed || dx || dy || wheel;
+    if (mouse_changed) {
+        hid_mouse_motion_add(dev, dx, dy, wheel, 0, buttons_changed);
+    }
 
-        if (rc == 0 || move_x || move_y) {
-            rc = hid_send_report(HANDLE_HID_MOUSE_REPORT);
-        }
-    } else {
-        rc = 1;
+    for (int i = 0; i < sizeof(reports) / sizeof(reports[0]); ++i) {
+        hid_report_seq_end(reports[i]);
     }
+    portEXIT_CRITICAL(&dev->writer_lock);
 
-    return rc;
-}
+    frame->count = 0;
 
-int
-hid_cc_build_report(uint8_t *buffer, consumer_cmd_t cmd, bool pressed)
-{
-    if (!buffer) {
-        ESP_LOGE(tag, "%s(), the buffer is NULL.", __func__);
-        return 1;
-    }
+    int rc = 0, send_rc;
 
-    int rc = 0;
+    hid_frame_hold(dev, true);
+    if (kb_changed) {
+        rc = hid_keyboard_send(dev);
+    }
+    if (cc_changed) {
+        send_rc = hid_send_report(dev, HANDLE_HID_CC_REPORT);
+        rc = rc ? rc : send_rc;
+    }
+    if (mouse_changed) {
+        // part of the chord, it does not wait for the next connection interval
+        send_rc = hid_mouse_send(dev, true);
+        rc = rc ? rc : send_rc;
+    }
+    hid_frame_hold(dev, false);
 
-    switch (cmd) {
-        case HID_CONSUMER_CHANNEL_UP:
-            HID_CC_RPT_SET_CHANNEL(buffer, pressed ? HID_CC_RPT_CHANNEL_UP : 0);
-            break;
+    return rc;
+}
 
-        case HID_CONSUMER_CHANNEL_DOWN:
-            HID_CC_RPT_SET_CHANNEL(buffer, pressed ? HID_CC_RPT_CHANNEL_DOWN : 0);
-            break;
+/* key code for ASCII character, letters are not here, 0 if it can not be typed */
+static const uint8_t Ascii_keys[128] = {
+    ['\b'] = HID_KEY_DELETE,
+    ['\t'] = HID_KEY_TAB,
+    ['\n'] = HID_KEY_RETURN,
+    ['\r'] = HID_KEY_RETURN,
+    [0x1b] = HID_KEY_ESCAPE,
+    [' '] = HID_KEY_SPACEBAR,
+    ['!'] = HID_KEY_1 | HID_TYPE_SHIFT,
+    ['"'] = HID_KEY_SGL_QUOTE | HID_TYPE_SHIFT,
+    ['#'] = HID_KEY_3 | HID_TYPE_SHIFT,
+    ['$'] = HID_KEY_4 | HID_TYPE_SHIFT,
+    ['%'] = HID_KEY_5 | HID_TYPE_SHIFT,
+    ['&'] = HID_KEY_7 | HID_TYPE_SHIFT,
+    ['\''] = HID_KEY_SGL_QUOTE,
+    ['('] = HID_KEY_9 | HID_TYPE_SHIFT,
+    [')'] = HID_KEY_0 | HID_TYPE_SHIFT,
+    ['*'] = HID_KEY_8 | HID_TYPE_SHIFT,
+    ['+'] = HID_KEY_EQUAL | HID_TYPE_SHIFT,
+    [','] = HID_KEY_COMMA,
+    ['-'] = HID_KEY_MINUS,
+    ['.'] = HID_KEY_DOT,
+    ['/'] = HID_KEY_FWD_SLASH,
+    ['0'] = HID_KEY_0,
+    ['1'] = HID_KEY_1, ['2'] = HID_KEY_2, ['3'] = HID_KEY_3,
+    ['4'] = HID_KEY_4, ['5'] = HID_KEY_5, ['6'] = HID_KEY_6,
+    ['7'] = HID_KEY_7, ['8'] = HID_KEY_8, ['9'] = HID_KEY_9,
+    [':'] = HID_KEY_SEMI_COLON | HID_TYPE_SHIFT,
+    [';'] = HID_KEY_SEMI_COLON,
+    ['<'] = HID_KEY_COMMA | HID_TYPE_SHIFT,
+    ['='] = HID_KEY_EQUAL,
+    ['>'] = HID_KEY_DOT | HID_TYPE_SHIFT,
+    ['?'] = HID_KEY_FWD_SLASH | HID_TYPE_SHIFT,
+    ['@'] = HID_KEY_2 | HID_TYPE_SHIFT,
+    ['['] = HID_KEY_LEFT_BRKT,
+    ['\\'] = HID_KEY_BACK_SLASH,
+    [']'] = HID_KEY_RIGHT_BRKT,
+    ['^'] = HID_KEY_6 | HID_TYPE_SHIFT,
+    ['_'] = HID_KEY_MINUS | HID_TYPE_SHIFT,
+    ['`'] = HID_KEY_GRV_ACCENT,
+    ['{'] = HID_KEY_LEFT_BRKT | HID_TYPE_SHIFT,
+    ['|'] = HID_KEY_BACK_SLASH | HID_TYPE_SHIFT,
+    ['}'] = HID_KEY_RIGHT_BRKT | HID_TYPE_SHIFT,
+    ['~'] = HID_KEY_GRV_ACCENT | HID_TYPE_SHIFT,
+};
 
-        case HID_CONSUMER_VOLUME_UP:
-            HID_CC_RPT_SET_VOLUME(buffer, pressed ? HID_CC_RPT_VOLUME_UP : 0);
-            break;
+/* key code with HID_TYPE_SHIFT flag for character, 0 if it can not be typed */
+static uint8_t
+hid_type_key(char c)
+{
+    if (c >= 'a' && c <= 'z') {
+        return HID_KEY_A + (c - 'a');
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return (HID_KEY_A + (c - 'A')) | HID_TYPE_SHIFT;
+    }
+    return (c & 0x80) ? 0 : Ascii_keys[(uint8_t) c];   // not ASCII, UTF-8 sequences are skipped
+}
 
-        case HID_CONSUMER_VOLUME_DOWN:
-            HID_CC_RPT_SET_VOLUME(buffer, pressed ? HID_CC_RPT_VOLUME_DOWN : 0);
-            break;
+/* all centrals taking keyboard reports can take another one, nobody taking them means wait */
+static bool
+hid_type_link_ready(struct hid_dev *dev)
+{
+    struct hid_notify_data *boot = &dev->reports[hid_report_idx(HANDLE_HID_KB_IN_REPORT)];
+    struct hid_notify_data *nkro = &dev->reports[hid_report_idx(HANDLE_HID_KB_NKRO_REPORT)];
+    bool connected = false;
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        if (!dev->conns[i].in_use ||
+            !(hid_conn_wants(&dev->conns[i], boot) || hid_conn_wants(&dev->conns[i], nkro))) {
+            continue;   // link is not encrypted or subscribed yet
+        }
+        connected = true;
+        if (__atomic_load_n(&dev->conns[i].tx.count, __ATOMIC_RELAXED) >= HID_TYPE_AHEAD) {
+            return false;
+        }
+    }
+    return connected;
+}
 
-        case HID_CONSUMER_MUTE:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_MUTE : 0);
-            break;
+/* build and send the next typing report, false if there is nothing to send */
+static bool
+hid_type_next_report(struct hid_dev *dev)
+{
+    struct hid_notify_data *report = &dev->reports[hid_report_idx(HANDLE_HID_KB_IN_REPORT)];
+    uint8_t code = 0;
 
-        case HID_CONSUMER_POWER:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_POWER : 0);
+    portENTER_CRITICAL(&dev->typing.lock);
+    while (dev->typing.count) {
+        code = hid_type_key(dev->typing.buf[dev->typing.head]);
+        if (code) {
             break;
+        }
+        // character can not be typed, skip it
+        dev->typing.head = (dev->typing.head + 1) % HID_TYPE_BUF_SIZE;
+        dev->typing.count--;
+    }
+    portEXIT_CRITICAL(&dev->typing.lock);
 
-        case HID_CONSUMER_RECALL_LAST:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_LAST : 0);
-            break;
+    uint8_t key = code & ~HID_TYPE_SHIFT;
+    bool shift = code & HID_TYPE_SHIFT;
+    bool consume = false;
 
-        case HID_CONSUMER_ASSIGN_SEL:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_ASSIGN_SEL : 0);
-            break;
+    if (!code && !dev->typing.key && !dev->typing.shift) {
+        return false;   // text is over and everything is released
+    }
 
-        case HID_CONSUMER_PLAY:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_PLAY : 0);
-            break;
+    hid_report_write_begin(dev, report);
 
-        case HID_CONSUMER_PAUSE:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_PAUSE : 0);
-            break;
+    if (!code || (dev->typing.key && (key == dev->typing.key || shift != dev->typing.shift))) {
+        // release held key alone, shift may change with it
+        if (dev->typing.key) {
+            hid_key_state_set(dev, dev->typing.key, false);
+            dev->typing.key = 0;
+        }
+        if (shift != dev->typing.shift) {
+            hid_key_state_set(dev, HID_KEY_LEFT_SHIFT, shift);
+            dev->typing.shift = shift;
+        }
+    } else if (shift != dev->typing.shift) {
+        // modifier only report, so the host sees shift before the key
+        hid_key_state_set(dev, HID_KEY_LEFT_SHIFT, shift);
+        dev->typing.shift = shift;
+    } else {
+        // release previous key and press the next one in the same report
+        if (dev->typing.key) {
+            hid_key_state_set(dev, dev->typing.key, false);
+        }
+        hid_key_state_set(dev, key, true);
+        dev->typing.key = key;
+        consume = true;
+    }
 
-        case HID_CONSUMER_RECORD:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_RECORD : 0);
-            break;
+    hid_keyboard_build_boot(dev, dev->buffers.keyboard);
 
-        case HID_CONSUMER_FAST_FORWARD:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_FAST_FWD : 0);
-            break;
+    hid_report_write_end(dev, report);
 
-        case HID_CONSUMER_REWIND:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_REWIND : 0);
-            break;
+    if (consume) {
+        portENTER_CRITICAL(&dev->typing.lock);
+        dev->typing.head = (dev->typing.head + 1) % HID_TYPE_BUF_SIZE;
+        dev->typing.count--;
+        portEXIT_CRITICAL(&dev->typing.lock);
+    }
 
-        case HID_CONSUMER_SCAN_NEXT_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_SCAN_NEXT_TRK : 0);
-            break;
+    hid_keyboard_publish(dev);
 
-        case HID_CONSUMER_SCAN_PREV_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_SCAN_PREV_TRK : 0);
-            break;
+    return true;
+}
 
-        case HID_CONSUMER_STOP:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_STOP : 0);
-            break;
+/* send typing reports while centrals have room in TX queues, runs in NimBLE host task */
+static void
+hid_type_step(struct ble_npl_event *ev)
+{
+    struct hid_dev *dev = ble_npl_event_get_arg(ev);
 
-        default:
-            rc = 2;
-            break;
+    while (hid_type_link_ready(dev) && hid_type_next_report(dev)) {
     }
-
-    return rc;
 }
 
-int
-hid_cc_change_key(int key, bool pressed)
+/* drop text not typed yet and release typing keys, when the last central disconnects */
+static void
+hid_type_reset(struct hid_dev *dev)
 {
-    int rc = 0;
+    portENTER_CRITICAL(&dev->typing.lock);
+    dev->typing.head = 0;
+    dev->typing.count = 0;
+    portEXIT_CRITICAL(&dev->typing.lock);
 
-    if (lock_hid_data() == 0) {
+    dev->typing.key = 0;
+    dev->typing.shift = false;
+}
 
-        rc = hid_cc_build_report(CC_buffer, (consumer_cmd_t) key, pressed);
+/* queue text for typing, returns number of bytes taken, the rest does not fit now */
+int
+hid_keyboard_type(struct hid_dev *dev, const char *text, size_t len)
+{
+    size_t taken;
 
-        unlock_hid_data();
+    portENTER_CRITICAL(&dev->typing.lock);
+    taken = HID_TYPE_BUF_SIZE - dev->typing.count;
+    if (taken > len) {
+        taken = len;
+    }
+    for (size_t i = 0; i < taken; ++i) {
+        dev->typing.buf[(dev->typing.head + dev->typing.count) % HID_TYPE_BUF_SIZE] = text[i];
+        dev->typing.count++;
+    }
+    portEXIT_CRITICAL(&dev->typing.lock);
 
-        if (rc == 0) {
-            rc = hid_send_report(HANDLE_HID_CC_REPORT);
-        }
-    } else {
-        rc = 2;
+    if (taken) {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &dev->typing.step_ev);
     }
 
-    return rc;
+    return taken;
 }
 
+/* characters waiting to be typed */
 int
-hid_keyboard_change_key(uint8_t key, bool pressed)
+hid_keyboard_type_pending(struct hid_dev *dev)
 {
-    int rc = 0;
-
-    if (lock_hid_data() == 0) {
-
-        if (key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI) {
-            // it is modifier (Ctrl Shift Alt or Winkey)
-            if (pressed) {
-                Keyboard_buffer[0] |= 1 << ( key - HID_KEY_LEFT_CTRL );
-            } else {
-                Keyboard_buffer[0] &= ~( 1 << ( key - HID_KEY_LEFT_CTRL ));
-            }
-        } else {
-            // ordinary key
-            bool found = false;
-            if (pressed) {
-                // if pressed, adding key to buffer
-                for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
-                    if (Keyboard_buffer[i] == 0) {
-                        Keyboard_buffer[i] = key;
-                        found = true;
-                        break;
-                    }
-                }
-            } else {
-                // if key is released then delete key from buffer
-                for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
-                    if (!found) {
-                        if (Keyboard_buffer[i] == key) {
-                            Keyboard_buffer[i] = 0;
-                            found = true;
-                        }
-                    } else {
-                        if (Keyboard_buffer[i] == 0) {
-                            break;
-                        }
-                        // shift other keys to the left
-                        Keyboard_buffer[i-1] = Keyboard_buffer[i];
-                        Keyboard_buffer[i] = 0;
-                    }
-                }
-            }
-            if (!found) {
-                rc = 1; // no room for new key or key not found
-            }
-        }
-
-        unlock_hid_data();
-
-        if (rc == 0) {
-            rc = hid_send_report(HANDLE_HID_KB_IN_REPORT);
-        }
-    } else {
-        rc = 2;
-    }
-
-    return rc;
+    return dev->typing.count;
 }
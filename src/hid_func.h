@@ -4,22 +4,137 @@
 
 #include "host/ble_gap.h"
 
-extern void hid_clean_vars(struct ble_gap_conn_desc *desc);
-extern void hid_set_disconnected();
-extern void hid_set_notify(uint16_t attr_handle, uint8_t cur_notify, uint8_t cur_indicate);
-extern bool hid_set_suspend(bool need_suspend);
-extern bool hid_set_report_mode(bool boot_mode);
-
-extern uint8_t hid_battery_level_get(void);
-
-extern int hid_battery_level_set(uint8_t level);
-extern int hid_keyboard_change_key(uint8_t key, bool pressed);
-extern int hid_cc_change_key(int key, bool pressed);
-extern int hid_mouse_change_key(int cmd, int8_t move_x, int8_t move_y, bool pressed);
+#include "hid_input.h"
+
+/* counters of report TX queue */
+struct hid_tx_stats {
+    uint32_t depth;             // reports waiting in queue now
+    uint32_t max_depth;         // queue high-water mark
+    uint32_t sent;              // reports handed to NimBLE
+    uint32_t suppressed;        // reports not queued, central has got the same one last time
+    uint32_t coalesced;         // reports merged into an indication waiting in queue
+    uint32_t retries;           // sends repeated after BLE_HS_ENOMEM
+    uint32_t drops;             // reports lost: queue full or send error
+};
+
+/* counters of the mbuf pool for custom sent reports */
+struct hid_mbuf_stats {
+    uint32_t blocks;            // pool size
+    uint32_t in_use;            // blocks held by the host now
+    uint32_t high_water;        // most blocks ever in use at once
+    uint32_t exhausted;         // sends postponed because the pool was empty
+};
+
+/* counters of input kept while no central could take it */
+struct hid_pending_stats {
+    uint32_t kept;              // report snapshots kept
+    uint32_t collapsed;         // snapshots which replaced an older state of the same report
+    uint32_t replayed;          // snapshots queued to a central after it became ready
+    uint32_t expired;           // snapshots older than CONFIG_HID_PENDING_INPUT_TTL_MS
+    uint32_t overflows;         // oldest snapshots dropped for newer ones
+    uint32_t max_wait_ms;       // longest time from input to replay
+};
+
+/* hid_set_delivery() policies */
+#define HID_DELIVERY_NOTIFY     0   // notifications, indications only if central takes nothing else
+#define HID_DELIVERY_RELIABLE   1   // indications if central enabled them
+
+/* hid_abs_pointer_move() switches, same bits as in the report */
+#define HID_ABS_TIP             0x01
+#define HID_ABS_BARREL          0x02
+#define HID_ABS_IN_RANGE        0x04
+
+/* gamepad axes for hid_gamepad_axis_set(): sticks from -32767 to 32767, triggers from 0 to 255 */
+#define HID_GAMEPAD_AXIS_X      0   // left stick
+#define HID_GAMEPAD_AXIS_Y      1
+#define HID_GAMEPAD_AXIS_Z      2   // right stick
+#define HID_GAMEPAD_AXIS_RZ     3
+#define HID_GAMEPAD_AXIS_LT     4   // left trigger, Rx
+#define HID_GAMEPAD_AXIS_RT     5   // right trigger, Ry
+#define HID_GAMEPAD_AXES        6
+
+#define HID_GAMEPAD_BUTTONS     16
+/* hat directions clockwise from 0 (up) to 7 (up left), HID_GAMEPAD_HAT_NONE when released */
+#define HID_GAMEPAD_HAT_NONE    8
+
+/* whole gamepad state for hid_gamepad_update() */
+struct hid_gamepad_state {
+    uint16_t buttons;           // bit 0 is button 1
+    int32_t axes[HID_GAMEPAD_AXES];
+    uint8_t hat;
+};
+
+/* changes collected by hid_frame_*(), applied and sent together by hid_frame_commit() */
+#define HID_FRAME_OPS           8
+
+#define HID_FRAME_KEY           1
+#define HID_FRAME_CC            2
+#define HID_FRAME_MOUSE         3
+
+struct hid_frame_op {
+    uint8_t type;               // HID_FRAME_*
+    bool pressed;
+    uint16_t code;              // key code, Consumer page usage or mouse command
+    int16_t x, y;               // mouse motion in counts
+};
+
+struct hid_frame {
+    uint8_t count;
+    struct hid_frame_op ops[HID_FRAME_OPS];
+};
+
+/* device context, its layout is in hid_dev.h */
+struct hid_dev;
+
+extern void hid_init(struct hid_dev *dev, const uint16_t *char_handles);
+extern int hid_set_connected(struct hid_dev *dev, struct ble_gap_conn_desc *desc);
+extern int hid_conn_slots_free(struct hid_dev *dev);
+extern void hid_set_conn_itvl(struct hid_dev *dev, uint16_t conn_handle, uint16_t conn_itvl);
+extern void hid_set_disconnected(struct hid_dev *dev, uint16_t conn_handle);
+extern void hid_set_encrypted(struct hid_dev *dev, uint16_t conn_handle, bool encrypted);
+extern void hid_set_notify(struct hid_dev *dev, uint16_t conn_handle, uint16_t attr_handle,
+                           uint8_t cur_notify, uint8_t cur_indicate);
+extern bool hid_set_suspend(struct hid_dev *dev, uint16_t conn_handle, bool need_suspend);
+extern bool hid_set_report_mode(struct hid_dev *dev, uint16_t conn_handle, bool boot_mode);
+extern bool hid_get_report_mode(struct hid_dev *dev, uint16_t conn_handle);
+extern void hid_notify_tx_done(struct hid_dev *dev, uint16_t conn_handle, int status, bool indication);
+extern int hid_tx_stats_get(struct hid_dev *dev, uint16_t conn_handle, struct hid_tx_stats *stats);
+extern int hid_resync(struct hid_dev *dev, uint16_t conn_handle);
+extern int hid_set_delivery(struct hid_dev *dev, int report_handle_num, uint8_t delivery);
+extern void hid_mbuf_stats_get(struct hid_dev *dev, struct hid_mbuf_stats *stats);
+extern void hid_pending_stats_get(struct hid_dev *dev, struct hid_pending_stats *stats);
+
+extern uint8_t hid_battery_level_get(struct hid_dev *dev);
+
+extern int hid_battery_level_set(struct hid_dev *dev, uint8_t level);
+extern int hid_keyboard_change_key(struct hid_dev *dev, uint8_t key, bool pressed);
+extern int hid_keyboard_type(struct hid_dev *dev, const char *text, size_t len);
+extern int hid_keyboard_type_pending(struct hid_dev *dev);
+extern int hid_cc_change_key(struct hid_dev *dev, int key, bool pressed);
+extern int hid_cc_change_usage(struct hid_dev *dev, uint16_t usage, bool pressed);
+extern int hid_mouse_change_key(struct hid_dev *dev, int cmd, int16_t move_x, int16_t move_y, bool pressed);
+extern int hid_mouse_move(struct hid_dev *dev, int32_t dx, int32_t dy);
+extern int hid_mouse_scroll(struct hid_dev *dev, int32_t wheel, int32_t pan);
+extern int hid_mouse_keys_change(struct hid_dev *dev, int8_t dir_x, int8_t dir_y, bool pressed);
+extern int hid_mouse_keys_profile_set(struct hid_dev *dev, const struct hid_mouse_keys_profile *profile);
+extern int hid_abs_pointer_move(struct hid_dev *dev, uint16_t x, uint16_t y, uint8_t switches);
+extern int hid_abs_pointer_leave(struct hid_dev *dev);
+extern int hid_gamepad_update(struct hid_dev *dev, const struct hid_gamepad_state *state);
+extern int hid_gamepad_axis_set(struct hid_dev *dev, int axis, int32_t value);
+extern int hid_gamepad_button_set(struct hid_dev *dev, int button, bool pressed);
+extern int hid_gamepad_hat_set(struct hid_dev *dev, uint8_t direction);
+
+extern void hid_frame_begin(struct hid_frame *frame);
+extern int hid_frame_key(struct hid_frame *frame, uint8_t key, bool pressed);
+extern int hid_frame_cc(struct hid_frame *frame, uint16_t usage, bool pressed);
+extern int hid_frame_mouse(struct hid_frame *frame, int cmd, int16_t move_x, int16_t move_y, bool pressed);
+extern int hid_frame_commit(struct hid_dev *dev, struct hid_frame *frame);
 extern int hid_leds_write(struct os_mbuf *buf);
 
-extern int hid_write_buffer(struct os_mbuf *buf, int handle_num);
+extern int hid_write_buffer(struct hid_dev *dev, struct os_mbuf *buf, int handle_num);
+extern int hid_mouse_feature_read(struct hid_dev *dev, uint16_t conn_handle, struct os_mbuf *buf);
+extern int hid_mouse_feature_write(struct hid_dev *dev, uint16_t conn_handle, struct os_mbuf *buf);
 
-extern int hid_read_buffer(struct os_mbuf *buf, int handle_num);
+extern int hid_read_buffer(struct hid_dev *dev, struct os_mbuf *buf, int handle_num);
 
 #endif
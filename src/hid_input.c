@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "hid_input.h"
+
+/*
+build the speed curve of profile into lut (HID_MOUSE_KEYS_LUT + 1 steps, subpixels
+per second): quadratic from initial_speed to max_speed; returns 1 if the profile is not valid
+*/
+int
+hid_mouse_keys_lut_build(const struct hid_mouse_keys_profile *profile, uint32_t *lut)
+{
+    if (profile->max_speed < profile->initial_speed || !profile->time_to_max_ms) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i <= HID_MOUSE_KEYS_LUT; ++i) {
+        uint32_t rise = (uint32_t)(profile->max_speed - profile->initial_speed) * i * i /
+            (HID_MOUSE_KEYS_LUT * HID_MOUSE_KEYS_LUT);
+
+        lut[i] = (profile->initial_speed + rise) * HID_MOUSE_SUBPIXELS;
+    }
+    return 0;
+}
+
+/* speed after moving continuously for t_us, subpixels per second */
+uint32_t
+hid_mouse_keys_lut_speed(const uint32_t *lut, uint16_t time_to_max_ms, int64_t t_us)
+{
+    int64_t full_us = (int64_t) time_to_max_ms * 1000;
+
+    if (t_us >= full_us) {
+        return lut[HID_MOUSE_KEYS_LUT];
+    }
+    if (t_us <= 0) {
+        return lut[0];
+    }
+
+    // interpolate between two steps of the curve
+    int64_t pos = t_us * HID_MOUSE_KEYS_LUT;
+    int step = pos / full_us;
+    int64_t frac = pos % full_us;
+    uint32_t lo = lut[step], hi = lut[step + 1];
+
+    return lo + (uint32_t)((hi - lo) * frac / full_us);
+}
+
+/*
+press or release usage in the first slots of keys; returns 0 if keys changed,
+-1 if nothing changed, 1 if usage can not be pressed (all slots busy) or released (not pressed)
+*/
+int
+hid_cc_keys_set(struct hid_cc_keys *keys, int slots, uint16_t usage, bool pressed)
+{
+    int pos = 0;
+
+    if (slots > HID_CC_SLOTS) {
+        slots = HID_CC_SLOTS;
+    }
+    while (pos < keys->count && keys->pressed[pos] != usage) {
+        pos++;
+    }
+
+    if (pressed) {
+        if (pos < keys->count) {
+            return -1;  // already pressed
+        }
+        if (keys->count >= slots) {
+            return 1;   // all slots are busy
+        }
+        keys->pressed[keys->count++] = usage;
+    } else {
+        if (pos == keys->count) {
+            return 1;   // usage was not pressed
+        }
+        memmove(&keys->pressed[pos], &keys->pressed[pos + 1],
+            (keys->count - pos - 1) * sizeof(keys->pressed[0]));
+        keys->count--;
+    }
+    return 0;
+}
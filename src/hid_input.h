@@ -0,0 +1,66 @@
+#ifndef H_HID_INPUT_
+#define H_HID_INPUT_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hid_reports.h"
+
+/*
+Input arithmetic of hid_func.c which does not need the BLE stack: motion
+accumulators, the mouse keys acceleration curve and the consumer control
+slots. It is built on the host by the tests in test/ as well.
+*/
+
+/* hid_mouse_move() units per pointer count, hid_mouse_scroll() units are 1/HID_WHEEL_MULTIPLIER detents */
+#define HID_MOUSE_SUBPIXELS     256
+
+/* mouse keys acceleration, see hid_mouse_keys_profile_set(); speeds are in pointer counts per second */
+struct hid_mouse_keys_profile {
+    uint16_t delay_ms;          // a press moves one count, continuous motion starts after the delay
+    uint16_t initial_speed;
+    uint16_t max_speed;
+    uint16_t time_to_max_ms;    // from continuous motion start to max_speed
+};
+
+#define HID_MOUSE_KEYS_LUT      32          // curve steps between initial and max speed
+
+/* consumer control usages held, in press order */
+struct hid_cc_keys {
+    uint16_t pressed[HID_CC_SLOTS];
+    uint8_t count;
+};
+
+/* add delta to accumulator, saturating instead of wrapping around */
+static inline int32_t
+hid_sat_add(int32_t acc, int32_t delta)
+{
+    int32_t sum;
+
+    if (__builtin_add_overflow(acc, delta, &sum)) {
+        return delta > 0 ? INT32_MAX : INT32_MIN;
+    }
+    return sum;
+}
+
+/* take whole counts of accumulated delta that fit into report field, leave the rest */
+static inline int32_t
+hid_take_delta(int32_t *acc, int32_t unit, int32_t limit)
+{
+    int32_t part = *acc / unit;     // rounds toward zero, fraction keeps the sign of acc
+
+    if (part > limit) {
+        part = limit;
+    } else if (part < -limit) {
+        part = -limit;
+    }
+    *acc -= part * unit;
+    return part;
+}
+
+extern int hid_mouse_keys_lut_build(const struct hid_mouse_keys_profile *profile, uint32_t *lut);
+extern uint32_t hid_mouse_keys_lut_speed(const uint32_t *lut, uint16_t time_to_max_ms, int64_t t_us);
+
+extern int hid_cc_keys_set(struct hid_cc_keys *keys, int slots, uint16_t usage, bool pressed);
+
+#endif
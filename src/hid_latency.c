@@ -0,0 +1,172 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "hid_latency.h"
+
+static const char *tag = "NimBLEKBD_LATENCY";
+
+static const char *Hist_names[HID_LAT_HISTS] = {
+    "debounce",     // ISR to DEBOUNCED
+    "queue",        // DEBOUNCED to DEQUEUED
+    "lock",         // DEQUEUED to LOCKED
+    "tx queue",     // LOCKED to SENT
+    "host tx",      // SENT to TX_DONE
+    "total",        // ISR to TX_DONE
+};
+
+struct hid_lat_trace Hid_lat_traces[HID_LAT_SLOTS];
+uint8_t Hid_lat_current = HID_LAT_NONE;
+TaskHandle_t Hid_lat_current_task;
+
+/* next slot to hand out, slots are reused round robin, an unfinished trace is overwritten */
+static uint8_t Next_slot;
+
+static struct hid_lat_hist {
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t buckets[HID_LAT_BUCKETS];
+} Hists[HID_LAT_HISTS];
+
+static portMUX_TYPE Hist_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+start trace of a debounced event, isr_us is the time of its first edge; GPIO and
+matrix tasks call it at the same time, the slot is taken by compare and swap
+*/
+uint8_t
+hid_lat_begin(uint32_t isr_us)
+{
+    uint8_t slot = __atomic_load_n(&Next_slot, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&Next_slot, &slot, (slot + 1) % HID_LAT_SLOTS, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    memset(&Hid_lat_traces[slot], 0, sizeof(Hid_lat_traces[slot]));
+    Hid_lat_traces[slot].us[HID_LAT_ISR] = isr_us ? isr_us : hid_lat_now();
+    Hid_lat_traces[slot].us[HID_LAT_DEBOUNCED] = hid_lat_now();
+
+    return slot;
+}
+
+static void
+hid_lat_hist_add(struct hid_lat_hist *hist, uint32_t us)
+{
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+
+    if (bucket >= HID_LAT_BUCKETS) {
+        bucket = HID_LAT_BUCKETS - 1;
+    }
+
+    hist->count++;
+    hist->buckets[bucket]++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+/* host is done with the report of the event, add its stage times to histograms */
+void
+hid_lat_done(uint8_t slot)
+{
+    if (slot >= HID_LAT_SLOTS) {
+        return;
+    }
+
+    struct hid_lat_trace trace = Hid_lat_traces[slot];
+
+    if (!trace.us[HID_LAT_ISR]) {
+        return;     // finished by report to another central already
+    }
+    trace.us[HID_LAT_TX_DONE] = hid_lat_now();
+    Hid_lat_traces[slot].us[HID_LAT_ISR] = 0;
+
+    portENTER_CRITICAL(&Hist_lock);
+    for (int i = 0; i < HID_LAT_STAGES - 1; ++i) {
+        // stage can be skipped, e.g. report was not sent from app_main
+        if (trace.us[i] && trace.us[i + 1]) {
+            hid_lat_hist_add(&Hists[i], trace.us[i + 1] - trace.us[i]);
+        }
+    }
+    hid_lat_hist_add(&Hists[HID_LAT_HISTS - 1], trace.us[HID_LAT_TX_DONE] - trace.us[HID_LAT_ISR]);
+    portEXIT_CRITICAL(&Hist_lock);
+}
+
+void
+hid_lat_reset(void)
+{
+    portENTER_CRITICAL(&Hist_lock);
+    memset(Hists, 0, sizeof(Hists));
+    portEXIT_CRITICAL(&Hist_lock);
+}
+
+/* upper bound of the bucket holding the given percentile, never more than max */
+static uint32_t
+hid_lat_percentile(const struct hid_lat_hist *hist, int percent)
+{
+    uint32_t rank = (hist->count * percent + 99) / 100, seen = 0;
+
+    for (int i = 0; i < HID_LAT_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if (seen >= rank && seen) {
+            uint32_t upper = i ? (1u << i) - 1 : 0;
+            return upper < hist->max_us && i < HID_LAT_BUCKETS - 1 ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+static void
+hid_lat_summarize(const struct hid_lat_hist *hist, struct hid_lat_summary *summary)
+{
+    summary->count = hist->count;
+    summary->p50_us = hid_lat_percentile(hist, 50);
+    summary->p99_us = hid_lat_percentile(hist, 99);
+    summary->max_us = hist->max_us;
+}
+
+void
+hid_lat_summary_get(struct hid_lat_summary summary[HID_LAT_HISTS])
+{
+    struct hid_lat_hist hist;
+
+    for (int i = 0; i < HID_LAT_HISTS; ++i) {
+        portENTER_CRITICAL(&Hist_lock);
+        hist = Hists[i];
+        portEXIT_CRITICAL(&Hist_lock);
+
+        hid_lat_summarize(&hist, &summary[i]);
+    }
+}
+
+/* print all histograms to the console */
+void
+hid_lat_dump(void)
+{
+    struct hid_lat_hist hist;
+    struct hid_lat_summary summary;
+
+    for (int i = 0; i < HID_LAT_HISTS; ++i) {
+        portENTER_CRITICAL(&Hist_lock);
+        hist = Hists[i];
+        portEXIT_CRITICAL(&Hist_lock);
+
+        hid_lat_summarize(&hist, &summary);
+        ESP_LOGI(tag, "%-8s: %" PRIu32 " events, p50 %" PRIu32 " us, p99 %" PRIu32 " us, max %" PRIu32 " us",
+            Hist_names[i], summary.count, summary.p50_us, summary.p99_us, summary.max_us);
+
+        for (int b = 0; b < HID_LAT_BUCKETS; ++b) {
+            if (hist.buckets[b]) {
+                ESP_LOGI(tag, "    < %8" PRIu32 " us: %" PRIu32, (uint32_t) 1 << b, hist.buckets[b]);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef H_HID_LATENCY_
+#define H_HID_LATENCY_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Key press latency trace. Every button event gets a trace slot when debouncing
+is over, the slot number travels with the event through buttons_queue and the
+TX queue, every stage writes its microsecond timestamp into the slot. When the
+report is done with (BLE_GAP_EVENT_NOTIFY_TX: the host has taken a notification,
+the central has confirmed an indication) the time between stages is added to
+histograms. Without CONFIG_HID_LATENCY_TRACE all of it compiles out.
+*/
+
+/* stages of one key event */
+#define HID_LAT_ISR         0   // first GPIO edge, gpio_isr_handler1
+#define HID_LAT_DEBOUNCED   1   // rattle is over, event goes to buttons_queue
+#define HID_LAT_DEQUEUED    2   // app_main took event from buttons_queue
+#define HID_LAT_LOCKED      3   // report buffer lock taken
+#define HID_LAT_SENT        4   // report about to be handed to ble_gattc_notify_custom
+#define HID_LAT_TX_DONE     5   // BLE_GAP_EVENT_NOTIFY_TX of notification, confirmation of indication
+
+/*
+SENT to TX_DONE ("host tx") is not time on air: NimBLE raises NOTIFY_TX of a
+notification inside ble_gattc_notify_custom(), when the host has handed it to
+the controller. Only an indication waits for the central, its confirmation
+comes a connection event or more later.
+*/
+#define HID_LAT_STAGES      6
+
+/* histogram n is time from stage n to stage n + 1, the last one is total from ISR to TX done */
+#define HID_LAT_HISTS       HID_LAT_STAGES
+
+/* bucket 0 counts 0 us, bucket n counts 2^(n-1) to 2^n - 1 us, the last one is open ended */
+#define HID_LAT_BUCKETS     24
+
+#define HID_LAT_SLOTS       15      // slot + 1 must fit in BUTTON_TRACE_MASK
+#define HID_LAT_NONE        0xFF    // event is not traced
+
+struct hid_lat_summary {
+    uint32_t count;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+};
+
+#ifdef CONFIG_HID_LATENCY_TRACE
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+struct hid_lat_trace {
+    uint32_t us[HID_LAT_STAGES];    // 0 if stage is not reached yet
+};
+
+extern struct hid_lat_trace Hid_lat_traces[HID_LAT_SLOTS];
+extern uint8_t Hid_lat_current;
+extern TaskHandle_t Hid_lat_current_task;
+
+static inline uint32_t
+hid_lat_now(void)
+{
+    // 0 is kept for "no timestamp"
+    return (uint32_t) esp_timer_get_time() | 1;
+}
+
+/* write timestamp of stage, only the first one counts when a stage is passed several times */
+static inline void
+hid_lat_stamp(uint8_t slot, int stage)
+{
+    if (slot < HID_LAT_SLOTS && !Hid_lat_traces[slot].us[stage]) {
+        Hid_lat_traces[slot].us[stage] = hid_lat_now();
+    }
+}
+
+/*
+trace of the event app_main is handling now; reports made by timers and the NimBLE
+host task at the same time are not part of it, they get HID_LAT_NONE
+*/
+static inline uint8_t
+hid_lat_current(void)
+{
+    return xTaskGetCurrentTaskHandle() == Hid_lat_current_task ? Hid_lat_current : HID_LAT_NONE;
+}
+
+/* the calling task handles event of slot now, HID_LAT_NONE when it is done */
+static inline void
+hid_lat_set_current(uint8_t slot)
+{
+    Hid_lat_current_task = xTaskGetCurrentTaskHandle();
+    Hid_lat_current = slot;
+}
+
+extern uint8_t hid_lat_begin(uint32_t isr_us);
+extern void hid_lat_done(uint8_t slot);
+extern void hid_lat_reset(void);
+extern void hid_lat_summary_get(struct hid_lat_summary summary[HID_LAT_HISTS]);
+extern void hid_lat_dump(void);
+
+#else
+
+static inline uint32_t hid_lat_now(void) { return 0; }
+static inline void hid_lat_stamp(uint8_t slot, int stage) { }
+static inline uint8_t hid_lat_current(void) { return HID_LAT_NONE; }
+static inline void hid_lat_set_current(uint8_t slot) { }
+static inline uint8_t hid_lat_begin(uint32_t isr_us) { return HID_LAT_NONE; }
+static inline void hid_lat_done(uint8_t slot) { }
+static inline void hid_lat_dump(void) { }
+
+#endif
+
+#endif
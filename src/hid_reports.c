@@ -0,0 +1,318 @@
+#include "hid_reports.h"
+
+// HID Report Map characteristic value
+// Keyboard report descriptor (using format for Boot interface descriptor)
+const uint8_t Hid_report_map[] = {
+    /*** MOUSE REPORT ***/
+    0x05, 0x01,  // Usage Page (Generic Desktop)
+    0x09, 0x02,  // Usage (Mouse)
+    0xA1, 0x01,  // Collection (Application)
+    0x85, 0x01,  // Report Id (1)
+    0x09, 0x01,  //   Usage (Pointer)
+    0xA1, 0x00,  //   Collection (Physical)
+    0x05, 0x09,  //     Usage Page (Buttons)
+    0x19, 0x01,  //     Usage Minimum (01) - Button 1
+    0x29, 0x03,  //     Usage Maximum (03) - Button 3
+    0x15, 0x00,  //     Logical Minimum (0)
+    0x25, 0x01,  //     Logical Maximum (1)
+    0x75, 0x01,  //     Report Size (1)
+    0x95, 0x03,  //     Report Count (3)
+    0x81, 0x02,  //     Input (Data, Variable, Absolute) - Button states
+    0x75, 0x05,  //     Report Size (5)
+    0x95, 0x01,  //     Report Count (1)
+    0x81, 0x01,  //     Input (Constant) - Padding or Reserved bits
+    0x05, 0x01,  //     Usage Page (Generic Desktop)
+    0x09, 0x30,  //     Usage (X)
+    0x09, 0x31,  //     Usage (Y)
+    0x16, 0x01, 0x80,  //     Logical Minimum (-32767)
+    0x26, 0xFF, 0x7F,  //     Logical Maximum (32767)
+    0x75, 0x10,  //     Report Size (16)
+    0x95, 0x02,  //     Report Count (2)
+    0x81, 0x06,  //     Input (Data, Variable, Relative) - X coordinate, Y coordinate
+    0xA1, 0x02,  //     Collection (Logical)
+    0x09, 0x48,  //       Usage (Resolution Multiplier)
+    0x15, 0x00,  //       Logical Minimum (0)
+    0x25, 0x01,  //       Logical Maximum (1)
+    0x35, 0x01,  //       Physical Minimum (1)
+    0x45, HID_WHEEL_MULTIPLIER, //       Physical Maximum (HID_WHEEL_MULTIPLIER)
+    0x75, 0x02,  //       Report Size (2)
+    0x95, 0x01,  //       Report Count (1)
+    0xB1, 0x02,  //       Feature (Data, Variable, Absolute) - wheel resolution multiplier
+    0x35, 0x00,  //       Physical Minimum (0)
+    0x45, 0x00,  //       Physical Maximum (0)
+    0x09, 0x38,  //       Usage (Wheel)
+    0x15, 0x81,  //       Logical Minimum (-127)
+    0x25, 0x7F,  //       Logical Maximum (127)
+    0x75, 0x08,  //       Report Size (8)
+    0x95, 0x01,  //       Report Count (1)
+    0x81, 0x06,  //       Input (Data, Variable, Relative) - wheel
+    0xC0,        //     End Collection
+    0xA1, 0x02,  //     Collection (Logical)
+    0x09, 0x48,  //       Usage (Resolution Multiplier)
+    0x15, 0x00,  //       Logical Minimum (0)
+    0x25, 0x01,  //       Logical Maximum (1)
+    0x35, 0x01,  //       Physical Minimum (1)
+    0x45, HID_WHEEL_MULTIPLIER, //       Physical Maximum (HID_WHEEL_MULTIPLIER)
+    0x75, 0x02,  //       Report Size (2)
+    0x95, 0x01,  //       Report Count (1)
+    0xB1, 0x02,  //       Feature (Data, Variable, Absolute) - AC Pan resolution multiplier
+    0x35, 0x00,  //       Physical Minimum (0)
+    0x45, 0x00,  //       Physical Maximum (0)
+    0x05, 0x0C,  //       Usage Page (Consumer)
+    0x0A, 0x38, 0x02, //       Usage (AC Pan)
+    0x15, 0x81,  //       Logical Minimum (-127)
+    0x25, 0x7F,  //       Logical Maximum (127)
+    0x75, 0x08,  //       Report Size (8)
+    0x95, 0x01,  //       Report Count (1)
+    0x81, 0x06,  //       Input (Data, Variable, Relative) - horizontal wheel
+    0xC0,        //     End Collection
+    0x75, 0x04,  //     Report Size (4)
+    0x95, 0x01,  //     Report Count (1)
+    0xB1, 0x01,  //     Feature (Constant) - padding
+    0xC0,        //   End Collection
+    0xC0,        // End Collection
+
+    /*** KEYBOARD REPORT ***/
+    0x05, 0x01,  // Usage Pg (Generic Desktop)
+    0x09, 0x06,  // Usage (Keyboard)
+    0xA1, 0x01,  // Collection: (Application)
+    0x85, 0x02,  // Report Id (2)
+    //
+    0x05, 0x07,  //   Usage Pg (Key Codes)
+    0x19, 0xE0,  //   Usage Min (224)
+    0x29, 0xE7,  //   Usage Max (231)
+    0x15, 0x00,  //   Log Min (0)
+    0x25, 0x01,  //   Log Max (1)
+    //
+    //   Modifier byte
+    0x75, 0x01,  //   Report Size (1)
+    0x95, 0x08,  //   Report Count (8)
+    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
+    //
+    //   Reserved byte
+    0x95, 0x01,  //   Report Count (1)
+    0x75, 0x08,  //   Report Size (8)
+    0x81, 0x01,  //   Input: (Constant)
+    //
+    //   LED report
+    0x95, 0x05,  //   Report Count (5)
+    0x75, 0x01,  //   Report Size (1)
+    0x05, 0x08,  //   Usage Pg (LEDs)
+    0x19, 0x01,  //   Usage Min (1)
+    0x29, 0x05,  //   Usage Max (5)
+    0x91, 0x02,  //   Output: (Data, Variable, Absolute)
+    //
+    //   LED report padding
+    0x95, 0x01,  //   Report Count (1)
+    0x75, 0x03,  //   Report Size (3)
+    0x91, 0x01,  //   Output: (Constant)
+    //
+    //   Key arrays (6 bytes)
+    0x95, 0x06,  //   Report Count (6)
+    0x75, 0x08,  //   Report Size (8)
+    0x15, 0x00,  //   Log Min (0)
+    0x25, 0x65,  //   Log Max (101)
+    0x05, 0x07,  //   Usage Pg (Key Codes)
+    0x19, 0x00,  //   Usage Min (0)
+    0x29, 0x65,  //   Usage Max (101)
+    0x81, 0x00,  //   Input: (Data, Array)
+    //
+    0xC0,        // End Collection
+    //
+    /*** N-KEY ROLLOVER KEYBOARD REPORT ***/
+    0x05, 0x01,  // Usage Pg (Generic Desktop)
+    0x09, 0x06,  // Usage (Keyboard)
+    0xA1, 0x01,  // Collection: (Application)
+    0x85, 0x05,  // Report Id (5)
+    //
+    0x05, 0x07,  //   Usage Pg (Key Codes)
+    0x19, 0xE0,  //   Usage Min (224)
+    0x29, 0xE7,  //   Usage Max (231)
+    0x15, 0x00,  //   Log Min (0)
+    0x25, 0x01,  //   Log Max (1)
+    //
+    //   Modifier byte
+    0x75, 0x01,  //   Report Size (1)
+    0x95, 0x08,  //   Report Count (8)
+    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
+    //
+    //   Key bitmap (19 bytes), one bit per key code
+    0x19, 0x00,  //   Usage Min (0)
+    0x29, 0x97,  //   Usage Max (151)
+    0x95, 0x98,  //   Report Count (152)
+    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
+    //
+    0xC0,        // End Collection
+    //
+    /*** ABSOLUTE POINTER (PEN) REPORT ***/
+    0x05, 0x0D,  // Usage Page (Digitizer)
+    0x09, 0x02,  // Usage (Pen)
+    0xA1, 0x01,  // Collection (Application)
+    0x85, 0x06,  //   Report Id (6)
+    0x09, 0x20,  //   Usage (Stylus)
+    0xA1, 0x00,  //   Collection (Physical)
+    0x09, 0x42,  //     Usage (Tip Switch)
+    0x09, 0x44,  //     Usage (Barrel Switch)
+    0x09, 0x32,  //     Usage (In Range)
+    0x15, 0x00,  //     Logical Minimum (0)
+    0x25, 0x01,  //     Logical Maximum (1)
+    0x75, 0x01,  //     Report Size (1)
+    0x95, 0x03,  //     Report Count (3)
+    0x81, 0x02,  //     Input (Data, Variable, Absolute) - tip, barrel, in range
+    0x95, 0x05,  //     Report Count (5)
+    0x81, 0x01,  //     Input (Constant) - padding
+    0x05, 0x01,  //     Usage Page (Generic Desktop)
+    0x09, 0x30,  //     Usage (X)
+    0x09, 0x31,  //     Usage (Y)
+    0x15, 0x00,  //     Logical Minimum (0)
+    0x26, 0xFF, 0x7F,  //     Logical Maximum (32767)
+    0x75, 0x10,  //     Report Size (16)
+    0x95, 0x02,  //     Report Count (2)
+    0x81, 0x02,  //     Input (Data, Variable, Absolute) - X coordinate, Y coordinate
+    0xC0,        //   End Collection
+    0xC0,        // End Collection
+    //
+    /*** GAMEPAD REPORT ***/
+    0x05, 0x01,  // Usage Page (Generic Desktop)
+    0x09, 0x05,  // Usage (Game Pad)
+    0xA1, 0x01,  // Collection (Application)
+    0x85, 0x07,  //   Report Id (7)
+    0x05, 0x09,  //   Usage Page (Buttons)
+    0x19, 0x01,  //   Usage Minimum (01) - Button 1
+    0x29, 0x10,  //   Usage Maximum (16) - Button 16
+    0x15, 0x00,  //   Logical Minimum (0)
+    0x25, 0x01,  //   Logical Maximum (1)
+    0x75, 0x01,  //   Report Size (1)
+    0x95, 0x10,  //   Report Count (16)
+    0x81, 0x02,  //   Input (Data, Variable, Absolute) - button states
+    0x05, 0x01,  //   Usage Page (Generic Desktop)
+    0x09, 0x30,  //   Usage (X)
+    0x09, 0x31,  //   Usage (Y)
+    0x09, 0x32,  //   Usage (Z)
+    0x09, 0x35,  //   Usage (Rz)
+    0x16, 0x01, 0x80,  //   Logical Minimum (-32767)
+    0x26, 0xFF, 0x7F,  //   Logical Maximum (32767)
+    0x75, 0x10,  //   Report Size (16)
+    0x95, 0x04,  //   Report Count (4)
+    0x81, 0x02,  //   Input (Data, Variable, Absolute) - left stick X, Y, right stick Z, Rz
+    0x09, 0x33,  //   Usage (Rx)
+    0x09, 0x34,  //   Usage (Ry)
+    0x15, 0x00,  //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,  //   Logical Maximum (255)
+    0x75, 0x08,  //   Report Size (8)
+    0x95, 0x02,  //   Report Count (2)
+    0x81, 0x02,  //   Input (Data, Variable, Absolute) - left and right trigger
+    0x09, 0x39,  //   Usage (Hat switch)
+    0x15, 0x00,  //   Logical Minimum (0)
+    0x25, 0x07,  //   Logical Maximum (7)
+    0x35, 0x00,  //   Physical Minimum (0)
+    0x46, 0x3B, 0x01,  //   Physical Maximum (315)
+    0x65, 0x14,  //   Unit (Degrees)
+    0x75, 0x04,  //   Report Size (4)
+    0x95, 0x01,  //   Report Count (1)
+    0x81, 0x42,  //   Input (Data, Variable, Absolute, Null State) - hat, 8 is released
+    0x65, 0x00,  //   Unit (None)
+    0x45, 0x00,  //   Physical Maximum (0)
+    0x81, 0x01,  //   Input (Constant) - padding
+    0xC0,        // End Collection
+    //
+    /*** CONSUMER DEVICE REPORT ***/
+    0x05, 0x0C,   // Usage Pg (Consumer Devices)
+    0x09, 0x01,   // Usage (Consumer Control)
+    0xA1, 0x01,   // Collection (Application)
+    0x85, 0x03,   // Report Id (3)
+    0x15, 0x00,   //   Logical Min (0)
+    0x26, 0xFF, 0x03, //   Logical Max (1023)
+    0x19, 0x00,   //   Usage Min (0)
+    0x2A, 0xFF, 0x03, //   Usage Max (1023)
+    0x75, 0x10,   //   Report Size (16)
+    0x95, 0x03,   //   Report Count (3)
+    0x81, 0x00,   //   Input (Data, Ary, Abs) - usages of pressed controls, 0 if slot is empty
+    0xC0,         // End Collection
+};
+
+size_t Hid_report_map_size = sizeof(Hid_report_map);
+
+/* Report reference table, byte 0 - report id from report map, byte 1 - report type (in,out,feature)*/
+struct report_reference_table Hid_report_ref_data[] = {
+    { .id = HANDLE_HID_MOUSE_REPORT,    .hidReportRef = { HID_RPT_ID_MOUSE_IN,  HID_REPORT_TYPE_INPUT   }},
+    { .id = HANDLE_HID_KB_IN_REPORT,    .hidReportRef = { HID_RPT_ID_KB_IN,     HID_REPORT_TYPE_INPUT   }},
+    { .id = HANDLE_HID_KB_OUT_REPORT,   .hidReportRef = { HID_RPT_ID_KB_IN,     HID_REPORT_TYPE_OUTPUT  }},
+    { .id = HANDLE_HID_CC_REPORT,       .hidReportRef = { HID_RPT_ID_CC_IN,     HID_REPORT_TYPE_INPUT   }},
+    { .id = HANDLE_HID_FEATURE_REPORT,  .hidReportRef = { HID_RPT_ID_FEATURE,   HID_REPORT_TYPE_FEATURE }},
+    { .id = HANDLE_HID_KB_NKRO_REPORT,  .hidReportRef = { HID_RPT_ID_KB_NKRO_IN, HID_REPORT_TYPE_INPUT  }},
+    { .id = HANDLE_HID_ABS_POINTER_REPORT, .hidReportRef = { HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT }},
+    { .id = HANDLE_HID_MOUSE_FEATURE_REPORT, .hidReportRef = { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_FEATURE }},
+    { .id = HANDLE_HID_GAMEPAD_REPORT,  .hidReportRef = { HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT }},
+};
+size_t Hid_report_ref_data_count = sizeof(Hid_report_ref_data)/sizeof(Hid_report_ref_data[0]);
+
+/* reports sent by notifications, hid_func.c keeps a buffer and sequence counter for every one */
+const struct hid_report_def Hid_report_defs[HID_REPORTS_COUNT] =
+{
+    {   .name = "mouse",
+        .handle_num = HANDLE_HID_MOUSE_REPORT,
+        .handle_boot_num = HANDLE_HID_BOOT_MOUSE_REPORT,
+        .buffer_size = HIDD_LE_REPORT_MOUSE_SIZE,
+        .send_in = HID_SEND_IN_ANY,
+        .relative = true,
+        .tx_class = HID_TX_CLASS_POINTER,
+    },
+    {   .name = "keyboard",
+        .handle_num = HANDLE_HID_KB_IN_REPORT,
+        .handle_boot_num = HANDLE_HID_BOOT_KB_IN_REPORT,
+        .buffer_size = HIDD_LE_REPORT_KB_IN_SIZE,
+        .send_in = HID_SEND_IN_BOOT,
+        .pending = HID_PENDING_EVENTS,
+    },
+    {   .name = "leds",
+        .handle_num = HANDLE_HID_KB_OUT_REPORT,
+        .handle_boot_num = HANDLE_HID_BOOT_KB_OUT_REPORT,
+        .buffer_size = HIDD_LE_REPORT_KB_OUT_SIZE,
+        .send_in = HID_SEND_IN_ANY,
+    },
+    {   .name = "consumer control",
+        .handle_num = HANDLE_HID_CC_REPORT,
+        .handle_boot_num = HANDLE_HID_CC_REPORT,
+        .buffer_size = HIDD_LE_REPORT_CC_SIZE,
+        .send_in = HID_SEND_IN_ANY,
+        .pending = HID_PENDING_EVENTS,
+    },
+    {   .name = "battery level",
+        .handle_num = HANDLE_BATTERY_LEVEL,
+        .handle_boot_num = HANDLE_BATTERY_LEVEL,
+        .buffer_size = HIDD_LE_BATTERY_LEVEL_SIZE,
+        .send_in = HID_SEND_IN_ANY,
+        .tx_class = HID_TX_CLASS_BULK,
+        .pending = HID_PENDING_STATE,
+    },
+    {   .name = "feature",
+        .handle_num = HANDLE_HID_FEATURE_REPORT,
+        .handle_boot_num = HANDLE_HID_FEATURE_REPORT,
+        .buffer_size = HIDD_LE_REPORT_FEATURE,
+        .send_in = HID_SEND_IN_ANY,
+        .tx_class = HID_TX_CLASS_BULK,
+    },
+    {   .name = "keyboard nkro",
+        .handle_num = HANDLE_HID_KB_NKRO_REPORT,
+        .handle_boot_num = HANDLE_HID_KB_NKRO_REPORT,
+        .buffer_size = HIDD_LE_REPORT_KB_NKRO_SIZE,
+        .send_in = HID_SEND_IN_REPORT,
+        .pending = HID_PENDING_EVENTS,
+    },
+    {   .name = "absolute pointer",
+        .handle_num = HANDLE_HID_ABS_POINTER_REPORT,
+        .handle_boot_num = HANDLE_HID_ABS_POINTER_REPORT,
+        .buffer_size = HIDD_LE_REPORT_ABS_POINTER_SIZE,
+        .send_in = HID_SEND_IN_REPORT,
+        .tx_class = HID_TX_CLASS_POINTER,
+        .pending = HID_PENDING_STATE,
+    },
+    {   .name = "gamepad",
+        .handle_num = HANDLE_HID_GAMEPAD_REPORT,
+        .handle_boot_num = HANDLE_HID_GAMEPAD_REPORT,
+        .buffer_size = HIDD_LE_REPORT_GAMEPAD_SIZE,
+        .send_in = HID_SEND_IN_REPORT,
+        .tx_class = HID_TX_CLASS_POINTER,
+    },
+};
@@ -0,0 +1,149 @@
+#ifndef H_HID_REPORTS_
+#define H_HID_REPORTS_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+Reports of the HID service: the report map, report IDs and sizes and what the
+code does with every report. Nothing here needs NimBLE or ESP-IDF, so the
+report map can be checked against the report table on the host (test/).
+*/
+
+// HID Report IDs for the service
+#define HID_RPT_ID_KB_OUT               0   // LED output report ID from report map
+#define HID_RPT_ID_MOUSE_IN             1   // Mouse input report ID from report map
+#define HID_RPT_ID_KB_IN                2   // Keyboard input report ID from report map
+#define HID_RPT_ID_CC_IN                3   // Consumer Control input report ID from report map
+#define HID_RPT_ID_FEATURE              4   // Feature report ID from report map
+#define HID_RPT_ID_KB_NKRO_IN           5   // N-key rollover keyboard input report ID from report map
+#define HID_RPT_ID_ABS_POINTER_IN       6   // Absolute pointer (pen) input report ID from report map
+#define HID_RPT_ID_GAMEPAD_IN           7   // Gamepad input report ID from report map
+
+// boot report cb_access args
+#define HID_BOOT_KB_IN                  6   // Keyboard input report ID
+#define HID_BOOT_KB_OUT                 7   // LED output report ID
+#define HID_BOOT_MOUSE_IN               8   // Mouse input report ID
+
+// HID Report types
+#define HID_REPORT_TYPE_INPUT           1
+#define HID_REPORT_TYPE_OUTPUT          2
+#define HID_REPORT_TYPE_FEATURE         3
+
+// Keyboard report size
+#define HIDD_LE_REPORT_KB_IN_SIZE       (8)
+// largest key code of the 6-byte key array, its Logical Maximum in the report map
+#define HID_BOOT_KB_MAX_KEY             101
+
+// N-key rollover keyboard report: modifiers byte and bitmap of key codes 0 to HID_NKRO_MAX_KEY
+#define HID_NKRO_MAX_KEY                151
+#define HIDD_LE_REPORT_KB_NKRO_SIZE     (1 + (HID_NKRO_MAX_KEY + 1) / 8)
+
+// Mouse report size: buttons, 16-bit X and Y, wheel, AC Pan
+#define HIDD_LE_REPORT_MOUSE_SIZE       (7)
+// Mouse feature report size: wheel and AC Pan resolution multipliers
+#define HIDD_LE_REPORT_MOUSE_FEATURE_SIZE (1)
+// wheel and AC Pan steps per detent when the host enabled the resolution multiplier
+#define HID_WHEEL_MULTIPLIER            8
+// Boot mouse report size: buttons, 8-bit X, Y and wheel
+#define HIDD_LE_BOOT_MOUSE_SIZE         (4)
+
+// Absolute pointer report size: switches, 16-bit X and Y from 0 to HID_ABS_POINTER_MAX
+#define HIDD_LE_REPORT_ABS_POINTER_SIZE (5)
+#define HID_ABS_POINTER_MAX             32767
+
+// Gamepad report size: 16 buttons, 16-bit X, Y, Z, Rz sticks, 8-bit Rx, Ry triggers, hat switch
+#define HIDD_LE_REPORT_GAMEPAD_SIZE     (13)
+
+// LEDS report size
+#define HIDD_LE_REPORT_KB_OUT_SIZE      (1)
+
+// Consumer control report size: array of 16-bit Consumer page usages
+#define HID_CC_SLOTS                    3
+#define HIDD_LE_REPORT_CC_SIZE          (2 * HID_CC_SLOTS)
+
+// battery level data size
+#define HIDD_LE_BATTERY_LEVEL_SIZE      (1)
+
+// feature data size
+#define HIDD_LE_REPORT_FEATURE          (6)
+
+#define HID_REPORT_REF_LEN              2         // HID Report Reference Descriptor
+
+enum attr_handles {
+    HANDLE_BATTERY_LEVEL,               //  0
+    HANDLE_DIS_MODEL_NUMBER,            //  1
+    HANDLE_DIS_SERIAL_NUMBER,           //  2
+    HANDLE_DIS_HARDWARE_REVISION,       //  3
+    HANDLE_DIS_FIRMWARE_REVISION,       //  4
+    HANDLE_DIS_SOFWARE_REVISION,        //  5
+    HANDLE_DIS_MANUFACTURER_NAME,       //  6
+    HANDLE_DIS_SYSTEM_ID,               //  7
+    HANDLE_DIS_PNP_INFO,                //  8
+
+    // HID SERVICE
+    HANDLE_HID_INFORMATION,             //  9
+    HANDLE_HID_CONTROL_POINT,           // 10
+    HANDLE_HID_REPORT_MAP,              // 11
+    HANDLE_HID_PROTO_MODE,              // 12
+    HANDLE_HID_MOUSE_REPORT,            // 13
+    HANDLE_HID_KB_IN_REPORT,            // 14
+    HANDLE_HID_KB_OUT_REPORT,           // 15
+    HANDLE_HID_CC_REPORT,               // 16
+    HANDLE_HID_BOOT_KB_IN_REPORT,       // 17
+    HANDLE_HID_BOOT_KB_OUT_REPORT,      // 18
+    HANDLE_HID_BOOT_MOUSE_REPORT,       // 19
+    HANDLE_HID_FEATURE_REPORT,          // 20
+    HANDLE_HID_KB_NKRO_REPORT,          // 21
+    HANDLE_HID_ABS_POINTER_REPORT,      // 22
+    HANDLE_HID_MOUSE_FEATURE_REPORT,    // 23
+    HANDLE_HID_GAMEPAD_REPORT,          // 24
+    HANDLE_HID_COUNT                    // 25
+};
+
+struct report_reference_table {
+    int id;
+    uint8_t hidReportRef[HID_REPORT_REF_LEN];
+} __attribute__((packed));
+
+/* protocol modes a report is sent in, report mode host gets keyboard as NKRO bitmap */
+#define HID_SEND_IN_REPORT  0x01
+#define HID_SEND_IN_BOOT    0x02
+#define HID_SEND_IN_ANY     (HID_SEND_IN_REPORT | HID_SEND_IN_BOOT)
+
+/* TX queue classes in priority order, see hid_tx_pick() */
+#define HID_TX_CLASS_KEYS       0   // keyboard, consumer control and pointer button changes
+#define HID_TX_CLASS_POINTER    1   // mouse, absolute pointer and gamepad motion
+#define HID_TX_CLASS_BULK       2   // battery level and feature
+#define HID_TX_CLASSES          3
+
+/* how input made while no central can take it is kept, see hid_pending_add() */
+#define HID_PENDING_NONE        0   // dropped, resync on subscribe is enough
+#define HID_PENDING_STATE       1   // only the newest state is kept
+#define HID_PENDING_EVENTS      2   // every change is replayed, a keystroke is press and release
+
+/* one report sent by notifications, its buffer and sequence counter are kept by hid_func.c */
+struct hid_report_def {
+    const char *name;
+    int handle_num;             // handle index from Svc_char_handles
+    int handle_boot_num;        // handle num in boot mode
+    size_t buffer_size;
+    uint8_t send_in;            // HID_SEND_IN_* protocol modes the report is sent in
+    bool relative;              // carries deltas, a report is not a state to repeat
+    uint8_t tx_class;           // HID_TX_CLASS_*, keys if not set
+    uint8_t pending;            // HID_PENDING_*, none if not set
+};
+
+#define HID_REPORTS_COUNT       9
+
+extern const struct hid_report_def Hid_report_defs[HID_REPORTS_COUNT];
+
+extern const uint8_t Hid_report_map[];
+
+extern size_t Hid_report_map_size;
+
+extern struct report_reference_table Hid_report_ref_data[];
+extern size_t Hid_report_ref_data_count;
+
+#endif
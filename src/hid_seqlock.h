@@ -0,0 +1,55 @@
+#ifndef H_HID_SEQLOCK_
+#define H_HID_SEQLOCK_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+Sequence counter (seqlock) guarding one report buffer. A writer makes the
+counter odd, changes the buffer and makes it even again, a reader copies the
+buffer and retries if the counter was odd or has changed meanwhile. Writers
+of the same buffer must be serialized by the caller.
+*/
+
+/* make sequence counter odd before the buffer is changed */
+static inline void
+hid_seq_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* make sequence counter even again, the changed buffer is published */
+static inline void
+hid_seq_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+copy size bytes of buf to dst once, false if a writer was active meanwhile and
+the copy is torn, it must be retried then
+*/
+static inline bool
+hid_seq_read_try(const uint32_t *seq, const void *buf, void *dst, size_t size)
+{
+    uint32_t seq_start, seq_end;
+
+    seq_start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    memcpy(dst, buf, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq_end = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    return !(seq_start & 1) && seq_start == seq_end;
+}
+
+/* copy consistent snapshot of size bytes of buf to dst */
+static inline void
+hid_seq_read(const uint32_t *seq, const void *buf, void *dst, size_t size)
+{
+    while (!hid_seq_read_try(seq, buf, dst, size)) {
+    }
+}
+
+#endif
@@ -28,20 +28,43 @@
 
 #include "hid_codes.h"
 #include "hid_func.h"
+#include "hid_dev.h"
 #include "gpio_func.h"
+#include "matrix_func.h"
+#include "hid_latency.h"
+#include "tlog.h"
 
 #include "host/ble_store.h"
 
 static const char *tag = "NimBLEKBD_main";
 
 /* from ble_func.c */
-extern void ble_init();
+extern void ble_init(struct hid_dev *dev);
+
+/* the HID device, all the hid_* calls get it */
+static struct hid_dev Hid_dev;
+
+// buttons array
+static struct gpio_button Hid_buttons[] = {
+    { .gpio = 13, .hid_button = HID_CONSUMER_VOLUME_DOWN    | BUTTON_TYPE_CC },
+    { .gpio = 12, .hid_button = HID_CONSUMER_VOLUME_UP      | BUTTON_TYPE_CC },
+    // { .gpio = 13, .hid_button = HID_KEY_LEFT_ARROW          | BUTTON_TYPE_KEYBOARD },
+    // { .gpio = 12, .hid_button = HID_KEY_RIGHT_ARROW         | BUTTON_TYPE_KEYBOARD },
+    // { .gpio = 13, .hid_button = BUTTON_MOUSE_DIR(-1, 0) },  // pointer left
+    // { .gpio = 12, .hid_button = BUTTON_MOUSE_DIR(0, -1) },  // pointer up
+};
+static struct gpio_buttons Gpio_buttons = {
+    .buttons = Hid_buttons,
+    .count = sizeof(Hid_buttons)/sizeof(Hid_buttons[0]),
+};
 
 void
 app_main(void)
 {
     ESP_LOGI(tag, "app_main start");
 
+    tlog_init();
+
     /* Initialize NVS — it is used to store PHY calibration data and bonding data */
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -53,7 +76,7 @@ app_main(void)
     ESP_LOGI(tag, "NVS initialized");
 
     ESP_LOGI(tag, "Starting BLE initialization...");
-    ble_init();
+    ble_init(&Hid_dev);
     ESP_LOGI(tag, "BLE init ok");
 
         // Optional: wipe bonds and IRKs to recover from bad state
@@ -79,17 +102,32 @@ app_main(void)
         esp_restart();
     }
 
+    Gpio_buttons.queue = buttons_queue;
+
     ESP_LOGI(tag, "Creating GPIO task...");
-    if (xTaskCreate(gpio_btn_task, "gpio_btn_task", 2048, buttons_queue, 10, NULL) != pdPASS) {
+    if (xTaskCreate(gpio_btn_task, "gpio_btn_task", 2048, &Gpio_buttons, 10, NULL) != pdPASS) {
         ESP_LOGE(tag, "Can not create gpio_btn_task!");
         vTaskDelay(pdMS_TO_TICKS(30000));
         esp_restart();
     }
+#ifdef CONFIG_HID_KEY_MATRIX
+    if (xTaskCreate(matrix_task, "matrix_task", 3072, buttons_queue, 10, NULL) != pdPASS) {
+        ESP_LOGE(tag, "Can not create matrix_task!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
+#endif
     ESP_LOGI(tag, "GPIO task created, waiting for buttons ...");
 
     while (1) {
         uint32_t button, key_to_send;
         if (xQueueReceive(buttons_queue, &button, portMAX_DELAY) == pdTRUE) {
+            uint8_t trace = HID_LAT_NONE;
+            if (button & BUTTON_TRACE_MASK) {
+                trace = ((button & BUTTON_TRACE_MASK) >> BUTTON_TRACE_SHIFT) - 1;
+            }
+            hid_lat_stamp(trace, HID_LAT_DEQUEUED);
+            hid_lat_set_current(trace);
 
             // released or pressed?
             bool pressed = true;
@@ -98,26 +136,37 @@ app_main(void)
             // byte 0 have a key code
             key_to_send = button & 0xff;
 
-            ESP_LOGI(tag, "button %d type %08X (src %08X) %s",
+            TLOGI(tag, "button %d type %08X (src %08X) %s",
                 key_to_send, button & BUTTON_TYPE_MASK, button,
                 pressed ? "pressed" : "released");
 
             switch (button & BUTTON_TYPE_MASK) {
                 case BUTTON_TYPE_KEYBOARD:
-                    hid_keyboard_change_key(key_to_send, pressed);
+                    hid_keyboard_change_key(&Hid_dev, key_to_send, pressed);
                     break;
 
                 case BUTTON_TYPE_CC:
-                    hid_cc_change_key(key_to_send, pressed);
+                    hid_cc_change_key(&Hid_dev, key_to_send, pressed);
                     break;
 
                 case BUTTON_TYPE_MOUSE:
-                    hid_mouse_change_key(key_to_send, 0, 0, pressed);
+                    if (button & BUTTON_MOUSE_KEYS) {
+                        // pointer moves while the button is held
+                        hid_mouse_keys_change(&Hid_dev, (int8_t)(button >> 8), (int8_t)(button >> 16), pressed);
+                        break;
+                    }
+                    // bytes 1 and 2 keep X and Y motion, applied on press
+                    hid_mouse_change_key(&Hid_dev, key_to_send,
+                        pressed ? (int8_t)(button >> 8) : 0,
+                        pressed ? (int8_t)(button >> 16) : 0,
+                        pressed);
                     break;
 
                 default:
-                    ESP_LOGI(tag, "unknown button type %d", (button & BUTTON_TYPE_MASK) >> 24);
+                    TLOGI(tag, "unknown button type %d", (button & BUTTON_TYPE_MASK) >> 24);
             }
+
+            hid_lat_set_current(HID_LAT_NONE);
         }
     }
 }
@@ -0,0 +1,359 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_HID_KEY_MATRIX
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "soc/gpio_reg.h"
+
+#include "gpio_func.h"
+#include "hid_codes.h"
+#include "hid_latency.h"
+#include "matrix_func.h"
+#include "matrix_keys.h"
+
+static const char *tag = "NimBLEKBD_matrix";
+
+/*
+Key matrix. While nothing is pressed all driven lines are held low and every
+read line waits for a low level interrupt, so the CPU is idle. The first key
+down wakes matrix_task, which scans every CONFIG_HID_MATRIX_SCAN_US: a pass
+drives one line low at a time and reads all read lines at once from the GPIO
+input register, pressed keys pull their read line low. When every key is
+released and settled the matrix goes back to idle.
+
+All matrix lines must be GPIOs below 32, they are in one input register then.
+*/
+
+// time a key must keep its new state, same as ANTI_RATTLE_TIME of GPIO buttons
+#define MATRIX_DEBOUNCE_US  5000
+#define MATRIX_DEBOUNCE_PASSES  (MATRIX_DEBOUNCE_US / CONFIG_HID_MATRIX_SCAN_US > 0 ? \
+                                 MATRIX_DEBOUNCE_US / CONFIG_HID_MATRIX_SCAN_US : 1)
+
+// time for a line to settle after it was driven or released
+#define MATRIX_SETTLE_US    5
+
+#define ESP_INTR_FLAG_DEFAULT 0
+
+#define MATRIX_ROWS 4
+#define MATRIX_COLS 4
+
+// pick GPIOs of your board which are free, not strapping or flash pins
+static const uint8_t Matrix_row_gpios[MATRIX_ROWS] = { 0, 1, 3, 4 };
+static const uint8_t Matrix_col_gpios[MATRIX_COLS] = { 5, 6, 7, 10 };
+
+/* button to emulate for every key, same as hid_button of Hid_buttons in main.c, 0 if there is no key */
+static const uint32_t Keymap[MATRIX_ROWS][MATRIX_COLS] = {
+    {   HID_KEYPAD_7    | BUTTON_TYPE_KEYBOARD, HID_KEYPAD_8    | BUTTON_TYPE_KEYBOARD,
+        HID_KEYPAD_9    | BUTTON_TYPE_KEYBOARD, HID_KEY_DIVIDE  | BUTTON_TYPE_KEYBOARD },
+    {   HID_KEYPAD_4    | BUTTON_TYPE_KEYBOARD, HID_KEYPAD_5    | BUTTON_TYPE_KEYBOARD,
+        HID_KEYPAD_6    | BUTTON_TYPE_KEYBOARD, HID_KEY_MULTIPLY| BUTTON_TYPE_KEYBOARD },
+    {   HID_KEYPAD_1    | BUTTON_TYPE_KEYBOARD, HID_KEYPAD_2    | BUTTON_TYPE_KEYBOARD,
+        HID_KEYPAD_3    | BUTTON_TYPE_KEYBOARD, HID_KEY_SUBTRACT| BUTTON_TYPE_KEYBOARD },
+    {   HID_KEYPAD_0    | BUTTON_TYPE_KEYBOARD, HID_KEYPAD_DOT  | BUTTON_TYPE_KEYBOARD,
+        HID_KEY_ENTER   | BUTTON_TYPE_KEYBOARD, HID_KEY_ADD     | BUTTON_TYPE_KEYBOARD },
+};
+
+/* diodes let current flow from the read line through the key into the driven one */
+#ifdef CONFIG_HID_MATRIX_ROW2COL
+#define MATRIX_OUTS         MATRIX_COLS
+#define MATRIX_INS          MATRIX_ROWS
+#define Matrix_out_gpios    Matrix_col_gpios
+#define Matrix_in_gpios     Matrix_row_gpios
+#define MATRIX_KEY(out, in) Keymap[in][out]
+#else
+#define MATRIX_OUTS         MATRIX_ROWS
+#define MATRIX_INS          MATRIX_COLS
+#define Matrix_out_gpios    Matrix_row_gpios
+#define Matrix_in_gpios     Matrix_col_gpios
+#define MATRIX_KEY(out, in) Keymap[out][in]
+#endif
+
+_Static_assert(MATRIX_ROWS <= MATRIX_KEYS_MAX_LINES && MATRIX_COLS <= MATRIX_KEYS_MAX_LINES,
+    "key state is kept for MATRIX_KEYS_MAX_LINES lines");
+
+#ifdef CONFIG_HID_MATRIX_NO_DIODES
+#define MATRIX_NO_DIODES    true
+#else
+#define MATRIX_NO_DIODES    false
+#endif
+
+static struct matrix {
+    TaskHandle_t task;
+    esp_timer_handle_t scan_timer;
+    uint32_t out_mask, in_mask;         // lines as bits of GPIO output and input registers
+    int8_t in_by_gpio[32];              // read line of GPIO, -1 for others
+    struct matrix_keys keys;            // debounced key state, fed with every pass
+    volatile uint32_t wake_us;          // wake interrupt time, 0 after the first pass
+    portMUX_TYPE lock;                  // guards stats
+    struct matrix_stats stats;
+} Matrix = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static void IRAM_ATTR
+matrix_isr_handler(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    // level interrupt fires until the key is released, scanning takes over now
+    for (int i = 0; i < MATRIX_INS; ++i) {
+        gpio_intr_disable(Matrix_in_gpios[i]);
+    }
+    if (!Matrix.wake_us) {
+        Matrix.wake_us = (uint32_t) esp_timer_get_time() | 1;
+    }
+
+    vTaskNotifyGiveFromISR(Matrix.task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void
+matrix_timer_cb(void *arg)
+{
+    xTaskNotifyGive(Matrix.task);
+}
+
+/* drive one line low and read all read lines, returns pressed keys as bits of read lines */
+static inline uint32_t
+matrix_read_line(int out)
+{
+    uint32_t bit = 1u << Matrix_out_gpios[out];
+    uint32_t pressed = 0;
+
+    REG_WRITE(GPIO_OUT_W1TC_REG, bit);
+    esp_rom_delay_us(MATRIX_SETTLE_US);
+    uint32_t low = ~REG_READ(GPIO_IN_REG) & Matrix.in_mask;
+    REG_WRITE(GPIO_OUT_W1TS_REG, bit);
+
+    for (; low; low &= low - 1) {
+        pressed |= 1u << Matrix.in_by_gpio[__builtin_ctz(low)];
+    }
+    return pressed;
+}
+
+/* queue debounced change of one key, false if there is no room in the queue; matrix_keys_send_t */
+static bool
+matrix_send(void *arg, int out, int in, bool pressed, uint32_t seen_us)
+{
+    QueueHandle_t buttons_queue = arg;
+    uint32_t button = MATRIX_KEY(out, in);
+
+    if (!button) {
+        return true;    // no key at this crossing
+    }
+    if (!pressed) {
+        button |= BUTTON_RELEASED_BIT;
+    }
+
+    uint32_t event = button;
+#ifdef CONFIG_HID_LATENCY_TRACE
+    // the change is retried while the queue is full, it takes a trace slot only when it goes
+    if (!uxQueueSpacesAvailable(buttons_queue)) {
+        ESP_LOGI(tag, "No room in out queue!");
+        return false;
+    }
+    event |= (uint32_t)(hid_lat_begin(seen_us) + 1) << BUTTON_TRACE_SHIFT;
+#endif
+    if (xQueueSend(buttons_queue, (void *) &event, 0) != pdTRUE) {
+        ESP_LOGI(tag, "No room in out queue!");
+        return false;
+    }
+
+    uint32_t detect_us = (uint32_t) esp_timer_get_time() - seen_us;
+
+    portENTER_CRITICAL(&Matrix.lock);
+    if (detect_us > Matrix.stats.detect_us_max) {
+        Matrix.stats.detect_us_max = detect_us;
+    }
+    portEXIT_CRITICAL(&Matrix.lock);
+
+    return true;
+}
+
+/* one pass over the matrix, changes are queued once debounced; false when nothing is pressed or settling */
+static bool
+matrix_scan(QueueHandle_t buttons_queue)
+{
+    uint32_t raw[MATRIX_OUTS];
+    uint32_t start_us = (uint32_t) esp_timer_get_time();
+    bool ghost;
+
+    for (int out = 0; out < MATRIX_OUTS; ++out) {
+        raw[out] = matrix_read_line(out);
+    }
+
+    uint32_t pass_us = (uint32_t) esp_timer_get_time() - start_us;
+
+    // keys seen down on the first pass went down when the matrix woke up
+    uint32_t seen_us = Matrix.wake_us ? Matrix.wake_us : start_us;
+
+    Matrix.wake_us = 0;
+    bool active = matrix_keys_pass(&Matrix.keys, raw, seen_us, matrix_send, buttons_queue, &ghost);
+
+    portENTER_CRITICAL(&Matrix.lock);
+    Matrix.stats.passes++;
+    Matrix.stats.pass_us_total += pass_us;
+    if (pass_us > Matrix.stats.pass_us_max) {
+        Matrix.stats.pass_us_max = pass_us;
+    }
+    if (ghost) {
+        Matrix.stats.ghost_passes++;
+    }
+    portEXIT_CRITICAL(&Matrix.lock);
+
+    return active;
+}
+
+/* hold all driven lines low and sleep until a key goes down */
+static void
+matrix_idle(void)
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, Matrix.out_mask);
+    esp_rom_delay_us(MATRIX_SETTLE_US);
+
+    // forget timer ticks of the last scans
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    // a key down already fires the level interrupt at once
+    for (int i = 0; i < MATRIX_INS; ++i) {
+        gpio_intr_enable(Matrix_in_gpios[i]);
+    }
+
+    while (!Matrix.wake_us) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    REG_WRITE(GPIO_OUT_W1TS_REG, Matrix.out_mask);
+    esp_rom_delay_us(MATRIX_SETTLE_US);
+
+    portENTER_CRITICAL(&Matrix.lock);
+    Matrix.stats.wakes++;
+    portEXIT_CRITICAL(&Matrix.lock);
+}
+
+static bool
+matrix_setup(void)
+{
+    esp_err_t ret;
+
+    matrix_keys_init(&Matrix.keys, MATRIX_OUTS, MATRIX_INS, MATRIX_DEBOUNCE_PASSES, MATRIX_NO_DIODES);
+    memset(Matrix.in_by_gpio, -1, sizeof(Matrix.in_by_gpio));
+    for (int i = 0; i < MATRIX_OUTS; ++i) {
+        if (Matrix_out_gpios[i] >= 32) {
+            ESP_LOGE(tag, "matrix line GPIO%d is not in the first GPIO register", Matrix_out_gpios[i]);
+            return false;
+        }
+        Matrix.out_mask |= 1u << Matrix_out_gpios[i];
+    }
+    for (int i = 0; i < MATRIX_INS; ++i) {
+        if (Matrix_in_gpios[i] >= 32) {
+            ESP_LOGE(tag, "matrix line GPIO%d is not in the first GPIO register", Matrix_in_gpios[i]);
+            return false;
+        }
+        Matrix.in_mask |= 1u << Matrix_in_gpios[i];
+        Matrix.in_by_gpio[Matrix_in_gpios[i]] = i;
+    }
+
+    ESP_LOGI(tag, "Setting up %dx%d key matrix, driven lines %08" PRIX32 ", read lines %08" PRIX32,
+        MATRIX_ROWS, MATRIX_COLS, Matrix.out_mask, Matrix.in_mask);
+
+    // driven lines are open drain: a released line is pulled up and does not fight a pressed neighbour
+    REG_WRITE(GPIO_OUT_W1TS_REG, Matrix.out_mask);
+
+    gpio_config_t io_conf;
+    memset(&io_conf, 0, sizeof(io_conf));
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.pin_bit_mask = Matrix.out_mask;
+    io_conf.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+    io_conf.pull_up_en = 1;
+    ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(tag, "gpio_config of driven lines failed: %d", ret);
+        return false;
+    }
+
+    io_conf.intr_type = GPIO_INTR_LOW_LEVEL;
+    io_conf.pin_bit_mask = Matrix.in_mask;
+    io_conf.mode = GPIO_MODE_INPUT;
+    ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(tag, "gpio_config of read lines failed: %d", ret);
+        return false;
+    }
+
+    ret = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(tag, "gpio_install_isr_service failed: %d", ret);
+        return false;
+    }
+
+    for (int i = 0; i < MATRIX_INS; ++i) {
+        gpio_intr_disable(Matrix_in_gpios[i]);
+        ret = gpio_isr_handler_add(Matrix_in_gpios[i], matrix_isr_handler, NULL);
+        if (ret != ESP_OK) {
+            ESP_LOGE(tag, "Failed to add ISR for GPIO%d: %d", Matrix_in_gpios[i], ret);
+            return false;
+        }
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = matrix_timer_cb,
+        .name = "matrix_scan",
+    };
+
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &Matrix.scan_timer));
+
+    return true;
+}
+
+void
+matrix_stats_get(struct matrix_stats *stats)
+{
+    portENTER_CRITICAL(&Matrix.lock);
+    *stats = Matrix.stats;
+    portEXIT_CRITICAL(&Matrix.lock);
+}
+
+/* scan the key matrix, send button events to buttons_queue like gpio_btn_task */
+void
+matrix_task(void *arg)
+{
+    QueueHandle_t buttons_queue = arg;
+    struct matrix_stats stats;
+
+    Matrix.task = xTaskGetCurrentTaskHandle();
+
+    if (!matrix_setup()) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(tag, "Key matrix ready, scan every %d us while keys are down", CONFIG_HID_MATRIX_SCAN_US);
+
+    while (1) {
+        matrix_idle();
+
+        esp_timer_start_periodic(Matrix.scan_timer, CONFIG_HID_MATRIX_SCAN_US);
+        // the first pass runs at once, the next ones on timer ticks
+        while (matrix_scan(buttons_queue)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        esp_timer_stop(Matrix.scan_timer);
+
+        matrix_stats_get(&stats);
+        ESP_LOGD(tag, "idle again: %" PRIu32 " wakes, %" PRIu32 " passes, %" PRIu32 " us per pass, max %" PRIu32
+            " us, %" PRIu32 " ghost passes, detection max %" PRIu32 " us",
+            stats.wakes, stats.passes, stats.passes ? stats.pass_us_total / stats.passes : 0,
+            stats.pass_us_max, stats.ghost_passes, stats.detect_us_max);
+    }
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef H_MATRIX_FUNC_
+#define H_MATRIX_FUNC_
+
+#include <stdint.h>
+
+/* counters of the key matrix scanner */
+struct matrix_stats {
+    uint32_t wakes;             // idle ended by a column interrupt
+    uint32_t passes;            // scan passes over all driven lines
+    uint32_t pass_us_total;     // time spent in passes, average is pass_us_total / passes
+    uint32_t pass_us_max;
+    uint32_t ghost_passes;      // passes with an ambiguous key rectangle, changes held back
+    uint32_t detect_us_max;     // longest time from the first edge to the queued event
+};
+
+extern void matrix_task(void *arg);
+extern void matrix_stats_get(struct matrix_stats *stats);
+
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "matrix_keys.h"
+
+void
+matrix_keys_init(struct matrix_keys *keys, int outs, int ins, int debounce_passes, bool no_diodes)
+{
+    memset(keys, 0, sizeof(*keys));
+    keys->outs = outs;
+    keys->ins = ins;
+    keys->debounce_passes = debounce_passes > 0 ? debounce_passes : 1;
+    keys->no_diodes = no_diodes;
+}
+
+/*
+Without diodes three pressed keys at corners of a rectangle make the fourth
+one look pressed too, current flows back through them. Two driven lines which
+share two or more pressed read lines are such a rectangle: a real fourth key
+and a phantom can not be told apart, so both lines keep their debounced state
+until the rectangle is gone. Returns true if some lines were held.
+*/
+bool
+matrix_keys_ghost_hold(const struct matrix_keys *keys, uint32_t *raw)
+{
+    uint32_t hold = 0;
+
+    for (int a = 0; a < keys->outs; ++a) {
+        if (!(raw[a] & (raw[a] - 1))) {
+            continue;   // less than two keys on the line
+        }
+        for (int b = a + 1; b < keys->outs; ++b) {
+            uint32_t common = raw[a] & raw[b];
+
+            if (common & (common - 1)) {
+                hold |= (1u << a) | (1u << b);
+            }
+        }
+    }
+
+    for (int out = 0; hold && out < keys->outs; ++out) {
+        if (hold & (1u << out)) {
+            raw[out] = keys->debounced[out];
+        }
+    }
+    return hold != 0;
+}
+
+/*
+one pass over the matrix: raw has the keys read, a word of read line bits per driven
+line; keys which start to change are stamped with seen_us, changes are sent once
+debounced; returns false when nothing is pressed or settling, *ghost if lines were held
+*/
+bool
+matrix_keys_pass(struct matrix_keys *keys, uint32_t *raw, uint32_t seen_us,
+    matrix_keys_send_t send, void *arg, bool *ghost)
+{
+    bool active = false;
+
+    *ghost = keys->no_diodes && matrix_keys_ghost_hold(keys, raw);
+
+    for (int out = 0; out < keys->outs; ++out) {
+        uint32_t changed = raw[out] ^ keys->debounced[out];
+
+        // keys back in their debounced state were rattling, they start over
+        keys->settling[out] &= changed;
+
+        for (uint32_t bits = changed; bits; bits &= bits - 1) {
+            uint32_t bit = bits & -bits;
+            int in = __builtin_ctz(bits);
+
+            if (!(keys->settling[out] & bit)) {
+                keys->settling[out] |= bit;
+                keys->passes[out][in] = 0;
+                keys->seen_us[out][in] = seen_us;
+            }
+            if (++keys->passes[out][in] < keys->debounce_passes) {
+                continue;
+            }
+
+            if (send(arg, out, in, raw[out] & bit, keys->seen_us[out][in])) {
+                keys->debounced[out] ^= bit;
+                keys->settling[out] &= ~bit;
+            } else {
+                // no room in queue, trying to send it on the next pass
+                keys->passes[out][in] = keys->debounce_passes - 1;
+            }
+        }
+
+        active |= keys->debounced[out] || keys->settling[out];
+    }
+
+    return active;
+}
@@ -0,0 +1,36 @@
+#ifndef H_MATRIX_KEYS_
+#define H_MATRIX_KEYS_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Key state of the matrix without any hardware access: matrix_func.c reads the
+lines and gives every pass to matrix_keys_pass(), which debounces the keys and
+holds ambiguous key rectangles back. It is built on the host by the tests in
+test/ as well.
+*/
+
+/* driven or read lines the key state is kept for */
+#define MATRIX_KEYS_MAX_LINES   8
+
+/* hand a debounced change of key out, in to the buttons queue; false if there is no room */
+typedef bool (*matrix_keys_send_t)(void *arg, int out, int in, bool pressed, uint32_t seen_us);
+
+struct matrix_keys {
+    uint8_t outs, ins;                  // driven and read lines in use
+    uint8_t debounce_passes;            // passes a key must keep its new state
+    bool no_diodes;                     // hold key rectangles, see matrix_keys_ghost_hold()
+    /* keys as bits of read lines, one word per driven line */
+    uint32_t debounced[MATRIX_KEYS_MAX_LINES];  // pressed, sent
+    uint32_t settling[MATRIX_KEYS_MAX_LINES];   // differ from debounced, waiting for debounce_passes
+    uint8_t passes[MATRIX_KEYS_MAX_LINES][MATRIX_KEYS_MAX_LINES];   // passes the settling key has kept its new state
+    uint32_t seen_us[MATRIX_KEYS_MAX_LINES][MATRIX_KEYS_MAX_LINES]; // the settling key changed then
+};
+
+extern void matrix_keys_init(struct matrix_keys *keys, int outs, int ins, int debounce_passes, bool no_diodes);
+extern bool matrix_keys_ghost_hold(const struct matrix_keys *keys, uint32_t *raw);
+extern bool matrix_keys_pass(struct matrix_keys *keys, uint32_t *raw, uint32_t seen_us,
+    matrix_keys_send_t send, void *arg, bool *ghost);
+
+#endif
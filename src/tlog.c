@@ -0,0 +1,129 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_TLOG_ENABLE
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "tlog.h"
+
+static const char *tag = "NimBLEKBD_TLOG";
+
+#define TLOG_RING_SIZE      CONFIG_TLOG_RING_SIZE   // records, power of 2
+#define TLOG_FLUSH_MS       20                      // printing task wakes up this often
+#define TLOG_MSG_MAX        160
+
+_Static_assert((TLOG_RING_SIZE & (TLOG_RING_SIZE - 1)) == 0, "TLOG_RING_SIZE must be a power of 2");
+
+struct tlog_record {
+    const struct tlog_site *site;
+    uint32_t time_ms;
+    uint32_t args[6];
+};
+
+static struct tlog_record Ring[TLOG_RING_SIZE];
+
+/* free running counters, record n is at Ring[n % TLOG_RING_SIZE] */
+static uint32_t Ring_head;      // next record to write
+static uint32_t Ring_tail;      // next record to print
+
+static struct tlog_stats Stats;
+
+static portMUX_TYPE Ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* keep one record, drop it if the ring is full; can be called from ISR */
+void
+tlog_write(const struct tlog_site *site, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+           uint32_t a4, uint32_t a5)
+{
+    uint32_t time_ms = esp_log_timestamp();
+
+    portENTER_CRITICAL_SAFE(&Ring_lock);
+    uint32_t used = Ring_head - Ring_tail;
+    if (used == TLOG_RING_SIZE) {
+        Stats.dropped++;
+    } else {
+        struct tlog_record *rec = &Ring[Ring_head % TLOG_RING_SIZE];
+
+        rec->site = site;
+        rec->time_ms = time_ms;
+        rec->args[0] = a0;
+        rec->args[1] = a1;
+        rec->args[2] = a2;
+        rec->args[3] = a3;
+        rec->args[4] = a4;
+        rec->args[5] = a5;
+        Ring_head++;
+        Stats.written++;
+        if (used + 1 > Stats.high_water) {
+            Stats.high_water = used + 1;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&Ring_lock);
+}
+
+void
+tlog_stats_get(struct tlog_stats *stats)
+{
+    portENTER_CRITICAL_SAFE(&Ring_lock);
+    *stats = Stats;
+    portEXIT_CRITICAL_SAFE(&Ring_lock);
+}
+
+static void
+tlog_print(const struct tlog_record *rec)
+{
+    static const char letters[] = "NEWIDV";
+    const struct tlog_site *site = rec->site;
+    char msg[TLOG_MSG_MAX];
+
+    snprintf(msg, sizeof(msg), site->fmt, rec->args[0], rec->args[1], rec->args[2], rec->args[3],
+        rec->args[4], rec->args[5]);
+    esp_log_write(site->level, *site->tag, "%c (%" PRIu32 ") %s: %s\n",
+        letters[site->level < sizeof(letters) - 1 ? site->level : 0], rec->time_ms, *site->tag, msg);
+}
+
+/* print records in the order they were written */
+static void
+tlog_task(void *arg)
+{
+    uint32_t dropped_reported = 0;
+    struct tlog_record rec;
+
+    while (1) {
+        while (1) {
+            portENTER_CRITICAL(&Ring_lock);
+            if (Ring_tail == Ring_head) {
+                portEXIT_CRITICAL(&Ring_lock);
+                break;
+            }
+            rec = Ring[Ring_tail % TLOG_RING_SIZE];
+            Ring_tail++;
+            portEXIT_CRITICAL(&Ring_lock);
+
+            tlog_print(&rec);
+        }
+
+        uint32_t dropped = __atomic_load_n(&Stats.dropped, __ATOMIC_RELAXED);
+        if (dropped != dropped_reported) {
+            ESP_LOGW(tag, "%" PRIu32 " log records dropped, ring is full", dropped - dropped_reported);
+            dropped_reported = dropped;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(TLOG_FLUSH_MS));
+    }
+}
+
+/* start printing task, records written before it starts wait in the ring */
+void
+tlog_init(void)
+{
+    if (xTaskCreate(tlog_task, "tlog_task", 3072, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(tag, "Can not create tlog_task!");
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef H_TLOG_
+#define H_TLOG_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_log.h"
+
+/*
+Deferred log. TLOGx() keeps only the address of a static call site record
+(tag, format and level) and up to 6 raw 32-bit arguments in a ring, a low
+priority task formats and prints them later. So the call costs a few stores
+instead of formatting a string on the caller's task. A record is 32 bytes.
+
+Arguments are kept as uint32_t: use 32-bit integer conversions, %c, %p, and
+%s only for strings that live forever (literals, __func__, static names).
+
+The level filter is compiled in: define TLOG_LOCAL_LEVEL before including
+this header to change it for one file (one tag), calls above it compile out.
+Without CONFIG_TLOG_ENABLE the calls are plain ESP_LOG_LEVEL().
+*/
+
+#ifndef TLOG_LOCAL_LEVEL
+#define TLOG_LOCAL_LEVEL LOG_LOCAL_LEVEL
+#endif
+
+/* records written and dropped because the ring was full */
+struct tlog_stats {
+    uint32_t written;
+    uint32_t dropped;
+    uint32_t high_water;        // most records waiting at once
+};
+
+#ifdef CONFIG_TLOG_ENABLE
+
+/* call site, one static record for every TLOGx() */
+struct tlog_site {
+    const char *const *tag;     // address of the file's tag variable
+    const char *fmt;
+    uint8_t level;              // esp_log_level_t
+};
+
+extern void tlog_write(const struct tlog_site *site, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+                       uint32_t a4, uint32_t a5);
+
+#define TLOG_ARG(x)                     ((uint32_t)(uintptr_t)(x))
+#define TLOG_ARGS_(z, a, b, c, d, e, f, ...) \
+        TLOG_ARG(a), TLOG_ARG(b), TLOG_ARG(c), TLOG_ARG(d), TLOG_ARG(e), TLOG_ARG(f)
+#define TLOG_ARGS(...)                  TLOG_ARGS_(__VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#define TLOG_COUNT_(z, a, b, c, d, e, f, g, n, ...) n
+#define TLOG_COUNT(...)                 TLOG_COUNT_(__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+
+#define TLOG_LEVEL(level_, tag_, fmt_, ...) do {                                        \
+        if ((level_) <= TLOG_LOCAL_LEVEL) {                                             \
+            _Static_assert(TLOG_COUNT(0, ##__VA_ARGS__) <= 6, "TLOG keeps 6 arguments"); \
+            static const struct tlog_site tlog_site_ = {                                \
+                .tag = &(tag_), .fmt = (fmt_), .level = (level_) };                     \
+            if (0) {                                                                    \
+                printf(fmt_, ##__VA_ARGS__);    /* format check only */                 \
+            }                                                                           \
+            tlog_write(&tlog_site_, TLOG_ARGS(0, ##__VA_ARGS__));                       \
+        }                                                                               \
+    } while (0)
+
+extern void tlog_init(void);
+extern void tlog_stats_get(struct tlog_stats *stats);
+
+#else
+
+#define TLOG_LEVEL(level_, tag_, fmt_, ...) do {                                        \
+        if ((level_) <= TLOG_LOCAL_LEVEL) {                                             \
+            ESP_LOG_LEVEL(level_, tag_, fmt_, ##__VA_ARGS__);                           \
+        }                                                                               \
+    } while (0)
+
+static inline void tlog_init(void) { }
+
+#endif
+
+#define TLOGE(tag, fmt, ...) TLOG_LEVEL(ESP_LOG_ERROR,   tag, fmt, ##__VA_ARGS__)
+#define TLOGW(tag, fmt, ...) TLOG_LEVEL(ESP_LOG_WARN,    tag, fmt, ##__VA_ARGS__)
+#define TLOGI(tag, fmt, ...) TLOG_LEVEL(ESP_LOG_INFO,    tag, fmt, ##__VA_ARGS__)
+#define TLOGD(tag, fmt, ...) TLOG_LEVEL(ESP_LOG_DEBUG,   tag, fmt, ##__VA_ARGS__)
+#define TLOGV(tag, fmt, ...) TLOG_LEVEL(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+#endif
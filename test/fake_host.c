@@ -0,0 +1,1038 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+
+/*
+Fake NimBLE host, see fake_host.h. Run time state is per thread, only the GATT
+attribute table is per process: services are registered once, as on the device.
+*/
+
+#define FAKE_ATTRS          SVC_ATTR_HANDLES_MAX
+#define FAKE_MSYS_COUNT     16
+#define FAKE_MSYS_BUF_SIZE  512     // the whole report map fits into one buffer
+#define FAKE_MSYS_BLOCK     OS_ALIGN(sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) + \
+                                FAKE_MSYS_BUF_SIZE, OS_ALIGNMENT)
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    bool active;
+    int64_t expiry_us;
+};
+
+struct fake_thread {
+    int64_t now_us;
+    struct ble_npl_eventq evq;
+    struct esp_timer **timers;
+    int timer_count, timer_size;
+    struct ble_npl_callout **callouts;
+    int callout_count, callout_size;
+    struct fake_central centrals[FAKE_CENTRALS];
+    uint16_t last_conn_handle;
+    uint32_t rng;
+    int leds;
+    bool msys_ready;
+    os_membuf_t msys_mem[OS_MEMPOOL_SIZE(FAKE_MSYS_COUNT, FAKE_MSYS_BLOCK)];
+    struct os_mempool msys_mempool;
+    struct os_mbuf_pool msys;
+};
+
+static _Thread_local struct fake_thread Fake;
+
+/* attribute of the GATT table: a characteristic value or a descriptor */
+struct fake_attr {
+    const struct ble_gatt_chr_def *chr;
+    const struct ble_gatt_dsc_def *dsc;
+    uint16_t chr_val_handle;    // of the characteristic a descriptor belongs to
+};
+
+static struct fake_attr Attrs[FAKE_ATTRS];
+static uint16_t Next_attr_handle = 1;
+static int Cccds;
+static struct hid_dev *Gatt_dev;
+static pthread_mutex_t Gatt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct ble_hs_cfg ble_hs_cfg;
+
+/* clock */
+
+int64_t
+esp_timer_get_time(void)
+{
+    return Fake.now_us;
+}
+
+int64_t
+fake_now(void)
+{
+    return Fake.now_us;
+}
+
+uint32_t
+esp_log_timestamp(void)
+{
+    return (uint32_t) (Fake.now_us / 1000);
+}
+
+void
+esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void) level;
+    (void) tag;
+    (void) format;
+}
+
+/* esp_timer */
+
+esp_err_t
+esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (Fake.timer_count == Fake.timer_size) {
+        Fake.timer_size = Fake.timer_size ? 2 * Fake.timer_size : 16;
+        Fake.timers = realloc(Fake.timers, Fake.timer_size * sizeof(Fake.timers[0]));
+    }
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    Fake.timers[Fake.timer_count++] = timer;
+    *handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t
+esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = true;
+    timer->expiry_us = Fake.now_us + (int64_t) timeout_us;
+    return ESP_OK;
+}
+
+esp_err_t
+esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+bool
+esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer->active;
+}
+
+/* porting layer events, a callout tick is a millisecond */
+
+void
+ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->fn = fn;
+    ev->arg = arg;
+}
+
+void *
+ble_npl_event_get_arg(struct ble_npl_event *ev)
+{
+    return ev->arg;
+}
+
+void
+ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    if (ev->queued) {
+        return;
+    }
+    ev->queued = true;
+    ev->next = NULL;
+    if (evq->tail) {
+        evq->tail->next = ev;
+    } else {
+        evq->head = ev;
+    }
+    evq->tail = ev;
+}
+
+struct ble_npl_eventq *
+nimble_port_get_dflt_eventq(void)
+{
+    return &Fake.evq;
+}
+
+void
+ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq, ble_npl_event_fn *fn, void *arg)
+{
+    memset(co, 0, sizeof(*co));
+    ble_npl_event_init(&co->ev, fn, arg);
+    co->evq = evq;
+
+    for (int i = 0; i < Fake.callout_count; ++i) {
+        if (Fake.callouts[i] == co) {
+            return;
+        }
+    }
+    if (Fake.callout_count == Fake.callout_size) {
+        Fake.callout_size = Fake.callout_size ? 2 * Fake.callout_size : 16;
+        Fake.callouts = realloc(Fake.callouts, Fake.callout_size * sizeof(Fake.callouts[0]));
+    }
+    Fake.callouts[Fake.callout_count++] = co;
+}
+
+int
+ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks)
+{
+    co->active = true;
+    co->expiry_us = Fake.now_us + (int64_t) ticks * 1000;
+    return 0;
+}
+
+void
+ble_npl_callout_stop(struct ble_npl_callout *co)
+{
+    co->active = false;
+}
+
+bool
+ble_npl_callout_is_active(struct ble_npl_callout *co)
+{
+    return co->active;
+}
+
+ble_npl_time_t
+ble_npl_time_ms_to_ticks32(uint32_t ms)
+{
+    return ms;
+}
+
+/* FreeRTOS: a spinlock is only ever contended by the threads of parallel tests */
+
+static _Thread_local char Task_id;
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle(void)
+{
+    return &Task_id;
+}
+
+BaseType_t
+xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+            UBaseType_t priority, TaskHandle_t *handle)
+{
+    return pdFALSE;
+}
+
+void
+vTaskDelay(TickType_t ticks)
+{
+    fake_run((int64_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void
+portMUX_INITIALIZE(portMUX_TYPE *mux)
+{
+    mux->owner = 0;
+    mux->count = 0;
+}
+
+void
+portENTER_CRITICAL(portMUX_TYPE *mux)
+{
+    uintptr_t self = (uintptr_t) &Task_id;
+
+    if (__atomic_load_n(&mux->owner, __ATOMIC_RELAXED) == self) {
+        mux->count++;
+        return;
+    }
+    uintptr_t expected = 0;
+    while (!__atomic_compare_exchange_n(&mux->owner, &expected, self, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        expected = 0;
+    }
+    mux->count = 1;
+}
+
+void
+portEXIT_CRITICAL(portMUX_TYPE *mux)
+{
+    if (--mux->count == 0) {
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* memory pools and mbufs, a packet is never chained */
+
+int
+os_mempool_init(struct os_mempool *mp, uint16_t blocks, uint32_t block_size, void *membuf, const char *name)
+{
+    uint32_t size = OS_ALIGN(block_size, OS_ALIGNMENT);
+
+    mp->mp_block_size = size;
+    mp->mp_num_blocks = blocks;
+    mp->mp_num_free = blocks;
+    mp->mp_min_free = blocks;
+    mp->mp_free = NULL;
+    mp->name = name;
+    for (int i = blocks - 1; i >= 0; --i) {
+        struct os_memblock *block = (struct os_memblock *) ((uint8_t *) membuf + i * size);
+
+        block->next = mp->mp_free;
+        mp->mp_free = block;
+    }
+    return 0;
+}
+
+int
+os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp, uint16_t buf_len, uint16_t nbufs)
+{
+    (void) nbufs;
+    omp->omp_databuf_len = buf_len - sizeof(struct os_mbuf);
+    omp->omp_pool = mp;
+    return 0;
+}
+
+struct os_mbuf *
+os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, uint8_t user_pkthdr_len)
+{
+    struct os_mempool *mp = omp->omp_pool;
+    struct os_memblock *block = mp->mp_free;
+
+    if (!block) {
+        return NULL;
+    }
+    mp->mp_free = block->next;
+    if (--mp->mp_num_free < mp->mp_min_free) {
+        mp->mp_min_free = mp->mp_num_free;
+    }
+
+    struct os_mbuf *om = (struct os_mbuf *) block;
+
+    memset(om, 0, sizeof(*om));
+    om->om_pkthdr_len = sizeof(struct os_mbuf_pkthdr) + user_pkthdr_len;
+    om->om_data = om->om_databuf + om->om_pkthdr_len;
+    om->om_omp = omp;
+    return om;
+}
+
+int
+os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    uint8_t *end = om->om_databuf + om->om_omp->omp_databuf_len;
+
+    if (om->om_data + om->om_len + len > end) {
+        return BLE_HS_ENOMEM;
+    }
+    memcpy(om->om_data + om->om_len, data, len);
+    om->om_len += len;
+    return 0;
+}
+
+int
+os_mbuf_free_chain(struct os_mbuf *om)
+{
+    if (om) {
+        struct os_mempool *mp = om->om_omp->omp_pool;
+        struct os_memblock *block = (struct os_memblock *) om;
+
+        block->next = mp->mp_free;
+        mp->mp_free = block;
+        mp->mp_num_free++;
+    }
+    return 0;
+}
+
+static struct os_mbuf_pool *
+fake_msys(void)
+{
+    if (!Fake.msys_ready) {
+        os_mempool_init(&Fake.msys_mempool, FAKE_MSYS_COUNT, FAKE_MSYS_BLOCK, Fake.msys_mem, "msys");
+        os_mbuf_pool_init(&Fake.msys, &Fake.msys_mempool, FAKE_MSYS_BLOCK, FAKE_MSYS_COUNT);
+        Fake.msys_ready = true;
+    }
+    return &Fake.msys;
+}
+
+void
+fake_msys_stats(int *in_use, int *high_water)
+{
+    struct os_mempool *mp = fake_msys()->omp_pool;
+
+    *in_use = mp->mp_num_blocks - mp->mp_num_free;
+    *high_water = mp->mp_num_blocks - mp->mp_min_free;
+}
+
+struct os_mbuf *
+ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    struct os_mbuf *om = os_mbuf_get_pkthdr(fake_msys(), 0);
+
+    if (om && os_mbuf_append(om, buf, len) != 0) {
+        os_mbuf_free_chain(om);
+        om = NULL;
+    }
+    return om;
+}
+
+int
+ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t len = om->om_len < max_len ? om->om_len : max_len;
+
+    memcpy(flat, om->om_data, len);
+    if (out_copy_len) {
+        *out_copy_len = len;
+    }
+    return len < om->om_len ? BLE_HS_EMSGSIZE : 0;
+}
+
+/* UUIDs */
+
+uint16_t
+ble_uuid_u16(const ble_uuid_t *uuid)
+{
+    return uuid->type == BLE_UUID_TYPE_16 ? ((const ble_uuid16_t *) uuid)->value : 0;
+}
+
+char *
+ble_uuid_to_str(const ble_uuid_t *uuid, char *dst)
+{
+    if (uuid->type == BLE_UUID_TYPE_16) {
+        sprintf(dst, "0x%04x", ((const ble_uuid16_t *) uuid)->value);
+    } else {
+        const uint8_t *v = ((const ble_uuid128_t *) uuid)->value;
+
+        for (int i = 0; i < 16; ++i) {
+            sprintf(dst + 2 * i, "%02x", v[15 - i]);
+        }
+    }
+    return dst;
+}
+
+/* GATT registration, handles are given out in the order NimBLE uses */
+
+static uint16_t
+fake_gatt_next_handle(void)
+{
+    if (Next_attr_handle >= FAKE_ATTRS) {
+        fprintf(stderr, "fake host: out of attribute handles\n");
+        abort();
+    }
+    return Next_attr_handle++;
+}
+
+int
+ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs)
+{
+    (void) defs;
+    return 0;
+}
+
+int
+ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs)
+{
+    struct ble_gatt_register_ctxt ctxt;
+
+    for (const struct ble_gatt_svc_def *svc = svcs; svc->type != BLE_GATT_SVC_TYPE_END; ++svc) {
+        memset(&ctxt, 0, sizeof(ctxt));
+        ctxt.op = BLE_GATT_REGISTER_OP_SVC;
+        ctxt.svc.handle = fake_gatt_next_handle();
+        ctxt.svc.svc_def = svc;
+        if (ble_hs_cfg.gatts_register_cb) {
+            ble_hs_cfg.gatts_register_cb(&ctxt, ble_hs_cfg.gatts_register_arg);
+        }
+
+        for (int i = 0; svc->includes && svc->includes[i]; ++i) {
+            fake_gatt_next_handle();
+        }
+
+        for (const struct ble_gatt_chr_def *chr = svc->characteristics; chr && chr->uuid; ++chr) {
+            memset(&ctxt, 0, sizeof(ctxt));
+            ctxt.op = BLE_GATT_REGISTER_OP_CHR;
+            ctxt.chr.def_handle = fake_gatt_next_handle();
+            ctxt.chr.val_handle = fake_gatt_next_handle();
+            ctxt.chr.chr_def = chr;
+            ctxt.chr.svc_def = svc;
+            Attrs[ctxt.chr.val_handle].chr = chr;
+            if (chr->val_handle) {
+                *chr->val_handle = ctxt.chr.val_handle;
+            }
+            if (ble_hs_cfg.gatts_register_cb) {
+                ble_hs_cfg.gatts_register_cb(&ctxt, ble_hs_cfg.gatts_register_arg);
+            }
+
+            uint16_t val_handle = ctxt.chr.val_handle;
+
+            if (chr->flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE)) {
+                fake_gatt_next_handle();
+                Cccds++;
+            }
+
+            for (struct ble_gatt_dsc_def *dsc = chr->descriptors; dsc && dsc->uuid; ++dsc) {
+                memset(&ctxt, 0, sizeof(ctxt));
+                ctxt.op = BLE_GATT_REGISTER_OP_DSC;
+                ctxt.dsc.handle = fake_gatt_next_handle();
+                ctxt.dsc.dsc_def = dsc;
+                ctxt.dsc.chr_def = chr;
+                ctxt.dsc.svc_def = svc;
+                Attrs[ctxt.dsc.handle].dsc = dsc;
+                Attrs[ctxt.dsc.handle].chr_val_handle = val_handle;
+                if (ble_hs_cfg.gatts_register_cb) {
+                    ble_hs_cfg.gatts_register_cb(&ctxt, ble_hs_cfg.gatts_register_arg);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+fake_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    static const char name[] = "fake";
+
+    (void) conn_handle;
+    (void) attr_handle;
+    (void) arg;
+    return ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR ? os_mbuf_append(ctxt->om, name, sizeof(name) - 1) : 0;
+}
+
+/* GAP service: device name and appearance */
+static const struct ble_gatt_svc_def Fake_gap_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(0x1800),
+        .characteristics = (struct ble_gatt_chr_def[]) { {
+            .uuid = BLE_UUID16_DECLARE(0x2A00),
+            .access_cb = fake_svc_access,
+            .flags = BLE_GATT_CHR_F_READ,
+        }, {
+            .uuid = BLE_UUID16_DECLARE(0x2A01),
+            .access_cb = fake_svc_access,
+            .flags = BLE_GATT_CHR_F_READ,
+        }, {
+            0,
+        } },
+    },
+    {
+        0,
+    },
+};
+
+/* GATT service: Service Changed */
+static const struct ble_gatt_svc_def Fake_gatt_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(0x1801),
+        .characteristics = (struct ble_gatt_chr_def[]) { {
+            .uuid = BLE_UUID16_DECLARE(0x2A05),
+            .access_cb = fake_svc_access,
+            .flags = BLE_GATT_CHR_F_INDICATE,
+        }, {
+            0,
+        } },
+    },
+    {
+        0,
+    },
+};
+
+void
+ble_svc_gap_init(void)
+{
+    ble_gatts_add_svcs(Fake_gap_svcs);
+}
+
+void
+ble_svc_gatt_init(void)
+{
+    ble_gatts_add_svcs(Fake_gatt_svcs);
+}
+
+int
+fake_gatt_cccds(void)
+{
+    return Cccds;
+}
+
+uint16_t
+fake_gatt_dsc_handle(uint16_t chr_val_handle, uint16_t uuid16)
+{
+    for (int i = 1; i < FAKE_ATTRS; ++i) {
+        if (Attrs[i].dsc && Attrs[i].chr_val_handle == chr_val_handle &&
+            ble_uuid_u16(Attrs[i].dsc->uuid) == uuid16) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* run access callback of attribute for a central, om has the written data or gets the read one */
+static int
+fake_gatt_access(struct fake_central *c, uint16_t attr_handle, bool write, struct os_mbuf *om)
+{
+    struct ble_gatt_access_ctxt ctxt;
+    const struct fake_attr *attr = attr_handle < FAKE_ATTRS ? &Attrs[attr_handle] : NULL;
+
+    memset(&ctxt, 0, sizeof(ctxt));
+    ctxt.om = om;
+    if (attr && attr->dsc) {
+        ctxt.op = write ? BLE_GATT_ACCESS_OP_WRITE_DSC : BLE_GATT_ACCESS_OP_READ_DSC;
+        ctxt.dsc = attr->dsc;
+        return attr->dsc->access_cb(c->conn_handle, attr_handle, &ctxt, attr->dsc->arg);
+    }
+    if (attr && attr->chr) {
+        ctxt.op = write ? BLE_GATT_ACCESS_OP_WRITE_CHR : BLE_GATT_ACCESS_OP_READ_CHR;
+        ctxt.chr = attr->chr;
+        return attr->chr->access_cb(c->conn_handle, attr_handle, &ctxt, attr->chr->arg);
+    }
+    return BLE_ATT_ERR_INVALID_HANDLE;
+}
+
+int
+fake_gatt_read(struct fake_central *c, uint16_t attr_handle, void *data, uint16_t max_len, uint16_t *len)
+{
+    struct os_mbuf *om = os_mbuf_get_pkthdr(fake_msys(), 0);
+    int rc;
+
+    if (!om) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    rc = fake_gatt_access(c, attr_handle, false, om);
+    if (rc == 0) {
+        ble_hs_mbuf_to_flat(om, data, max_len, len);
+    }
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+int
+fake_gatt_write(struct fake_central *c, uint16_t attr_handle, const void *data, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    int rc;
+
+    if (!om) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    rc = fake_gatt_access(c, attr_handle, true, om);
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+/* notifications and indications */
+
+static struct fake_central *
+fake_central_find(uint16_t conn_handle)
+{
+    for (int i = 0; i < FAKE_CENTRALS; ++i) {
+        if (Fake.centrals[i].connected && Fake.centrals[i].conn_handle == conn_handle) {
+            return &Fake.centrals[i];
+        }
+    }
+    return NULL;
+}
+
+static uint32_t
+fake_rand(void)
+{
+    // xorshift32
+    Fake.rng ^= Fake.rng << 13;
+    Fake.rng ^= Fake.rng >> 17;
+    Fake.rng ^= Fake.rng << 5;
+    return Fake.rng;
+}
+
+void
+fake_seed(uint32_t seed)
+{
+    Fake.rng = seed ? seed : 1;
+}
+
+/*
+host takes the packet or refuses it, BLE_GAP_EVENT_NOTIFY_TX tells the result
+before the call returns, as NimBLE does
+*/
+static int
+fake_gattc_send(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om, bool indication)
+{
+    struct fake_central *c = fake_central_find(conn_handle);
+    int rc = 0;
+
+    if (!c) {
+        os_mbuf_free_chain(om);
+        return BLE_HS_ENOTCONN;
+    }
+
+    if (c->refuse_percent && (int) (fake_rand() % 100) < c->refuse_percent) {
+        rc = BLE_HS_ENOMEM;
+    } else if (c->link_count == FAKE_LINK_PACKETS) {
+        rc = BLE_HS_ENOMEM;
+    }
+
+    if (rc) {
+        os_mbuf_free_chain(om);
+        c->refused++;
+    } else {
+        struct fake_packet *packet = &c->link[(c->link_head + c->link_count++) % FAKE_LINK_PACKETS];
+
+        packet->om = om;
+        packet->attr_handle = attr_handle;
+        packet->indication = indication;
+        packet->queued_us = Fake.now_us;
+        c->accepted++;
+    }
+
+    hid_notify_tx_done(c->dev, conn_handle, rc, indication);
+    return rc;
+}
+
+int
+ble_gattc_notify_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom)
+{
+    return fake_gattc_send(conn_handle, chr_val_handle, txom, false);
+}
+
+int
+ble_gattc_indicate_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom)
+{
+    return fake_gattc_send(conn_handle, chr_val_handle, txom, true);
+}
+
+/* value read through the access callback into an msys mbuf, as NimBLE does for the std methods */
+static struct os_mbuf *
+fake_gatts_read_value(uint16_t conn_handle, uint16_t chr_val_handle)
+{
+    struct fake_central *c = fake_central_find(conn_handle);
+    struct os_mbuf *om = os_mbuf_get_pkthdr(fake_msys(), 0);
+
+    if (om && c && fake_gatt_access(c, chr_val_handle, false, om) != 0) {
+        os_mbuf_free_chain(om);
+        om = NULL;
+    }
+    return om;
+}
+
+int
+ble_gattc_notify(uint16_t conn_handle, uint16_t chr_val_handle)
+{
+    struct os_mbuf *om = fake_gatts_read_value(conn_handle, chr_val_handle);
+
+    if (!om) {
+        return BLE_HS_ENOMEM;
+    }
+    return fake_gattc_send(conn_handle, chr_val_handle, om, false);
+}
+
+int
+ble_gattc_indicate(uint16_t conn_handle, uint16_t chr_val_handle)
+{
+    struct os_mbuf *om = fake_gatts_read_value(conn_handle, chr_val_handle);
+
+    if (!om) {
+        return BLE_HS_ENOMEM;
+    }
+    return fake_gattc_send(conn_handle, chr_val_handle, om, true);
+}
+
+void
+ble_gatts_chr_updated(uint16_t chr_val_handle)
+{
+    for (int i = 0; i < FAKE_CENTRALS; ++i) {
+        if (Fake.centrals[i].connected) {
+            ble_gattc_notify(Fake.centrals[i].conn_handle, chr_val_handle);
+        }
+    }
+}
+
+/* LEDs of the keyboard output report */
+int
+set_leds(uint8_t hid_leds)
+{
+    Fake.leds = hid_leds;
+    return 0;
+}
+
+int
+fake_leds(void)
+{
+    return Fake.leds;
+}
+
+/* simulated centrals */
+
+static void
+fake_rx_add(struct fake_central *c, const struct fake_packet *packet)
+{
+    if (c->rx_count == c->rx_size) {
+        c->rx_size = c->rx_size ? 2 * c->rx_size : 256;
+        c->rx = realloc(c->rx, c->rx_size * sizeof(c->rx[0]));
+    }
+
+    struct fake_rx *rx = &c->rx[c->rx_count++];
+    uint16_t len;
+
+    memset(rx, 0, sizeof(*rx));
+    rx->time_us = Fake.now_us;
+    rx->queued_us = packet->queued_us;
+    rx->handle_num = gatt_svr_handle_num(packet->attr_handle);
+    rx->indication = packet->indication;
+    ble_hs_mbuf_to_flat(packet->om, rx->data, sizeof(rx->data), &len);
+    rx->size = len;
+}
+
+/* connection event: confirm the indication sent last time, send what the controller holds */
+static void
+fake_central_event(struct fake_central *c)
+{
+    c->events++;
+    c->next_event_us += c->itvl_us;
+
+    if (c->confirm_due) {
+        c->confirm_due = false;
+        hid_notify_tx_done(c->dev, c->conn_handle, BLE_HS_EDONE, true);
+    }
+
+    for (int sent = 0; sent < c->per_event && c->link_count; ++sent) {
+        struct fake_packet *packet = &c->link[c->link_head];
+
+        fake_rx_add(c, packet);
+        os_mbuf_free_chain(packet->om);
+        c->link_head = (c->link_head + 1) % FAKE_LINK_PACKETS;
+        c->link_count--;
+        c->confirm_due |= packet->indication;
+    }
+}
+
+struct fake_central *
+fake_connect(struct hid_dev *dev, uint32_t itvl_us, bool encrypted)
+{
+    struct fake_central *c = NULL;
+
+    for (int i = 0; i < FAKE_CENTRALS && !c; ++i) {
+        if (!Fake.centrals[i].connected) {
+            c = &Fake.centrals[i];
+        }
+    }
+    if (!c) {
+        return NULL;
+    }
+
+    free(c->rx);
+    memset(c, 0, sizeof(*c));
+    c->dev = dev;
+    c->conn_handle = ++Fake.last_conn_handle;
+    c->itvl_us = itvl_us;
+    c->next_event_us = Fake.now_us + itvl_us;
+    c->per_event = 4;
+
+    struct ble_gap_conn_desc desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.sec_state.encrypted = encrypted;
+    desc.conn_handle = c->conn_handle;
+    desc.conn_itvl = itvl_us / 1250;
+    if (hid_set_connected(dev, &desc) != 0) {
+        return NULL;
+    }
+    c->connected = true;
+    return c;
+}
+
+void
+fake_disconnect(struct fake_central *c)
+{
+    c->connected = false;
+    while (c->link_count) {
+        os_mbuf_free_chain(c->link[c->link_head].om);
+        c->link_head = (c->link_head + 1) % FAKE_LINK_PACKETS;
+        c->link_count--;
+    }
+    hid_set_disconnected(c->dev, c->conn_handle);
+}
+
+void
+fake_encrypt(struct fake_central *c)
+{
+    hid_set_encrypted(c->dev, c->conn_handle, true);
+}
+
+void
+fake_subscribe(struct fake_central *c, int handle_num, bool notify, bool indicate)
+{
+    hid_set_notify(c->dev, c->conn_handle, Svc_char_handles[handle_num], notify, indicate);
+}
+
+void
+fake_subscribe_reports(struct fake_central *c, bool boot)
+{
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        const struct hid_report_def *def = &Hid_report_defs[i];
+
+        if (def->send_in & (boot ? HID_SEND_IN_BOOT : HID_SEND_IN_REPORT)) {
+            fake_subscribe(c, boot ? def->handle_boot_num : def->handle_num, true, false);
+        }
+    }
+}
+
+void
+fake_rx_clear(struct fake_central *c)
+{
+    c->rx_count = 0;
+}
+
+int
+fake_rx_count(const struct fake_central *c, int handle_num)
+{
+    int count = 0;
+
+    for (int i = 0; i < c->rx_count; ++i) {
+        count += c->rx[i].handle_num == handle_num;
+    }
+    return count;
+}
+
+const struct fake_rx *
+fake_rx_last(const struct fake_central *c, int handle_num)
+{
+    for (int i = c->rx_count - 1; i >= 0; --i) {
+        if (c->rx[i].handle_num == handle_num) {
+            return &c->rx[i];
+        }
+    }
+    return NULL;
+}
+
+/* event loop */
+
+static void
+fake_run_events(void)
+{
+    struct ble_npl_event *ev;
+
+    while ((ev = Fake.evq.head)) {
+        Fake.evq.head = ev->next;
+        if (!Fake.evq.head) {
+            Fake.evq.tail = NULL;
+        }
+        ev->queued = false;
+        ev->fn(ev);
+    }
+}
+
+void
+fake_run_until(int64_t time_us)
+{
+    while (1) {
+        fake_run_events();
+
+        // the earliest of timers, callouts and connection events, in that order on a tie
+        int64_t next_us = INT64_MAX;
+        struct esp_timer *timer = NULL;
+        struct ble_npl_callout *co = NULL;
+        struct fake_central *c = NULL;
+
+        for (int i = 0; i < Fake.timer_count; ++i) {
+            if (Fake.timers[i]->active && Fake.timers[i]->expiry_us < next_us) {
+                timer = Fake.timers[i];
+                next_us = timer->expiry_us;
+            }
+        }
+        for (int i = 0; i < Fake.callout_count; ++i) {
+            if (Fake.callouts[i]->active && Fake.callouts[i]->expiry_us < next_us) {
+                timer = NULL;
+                co = Fake.callouts[i];
+                next_us = co->expiry_us;
+            }
+        }
+        for (int i = 0; i < FAKE_CENTRALS; ++i) {
+            if (Fake.centrals[i].connected && Fake.centrals[i].next_event_us < next_us) {
+                timer = NULL;
+                co = NULL;
+                c = &Fake.centrals[i];
+                next_us = c->next_event_us;
+            }
+        }
+
+        if (next_us > time_us) {
+            break;
+        }
+        if (next_us > Fake.now_us) {
+            Fake.now_us = next_us;
+        }
+
+        if (timer) {
+            timer->active = false;
+            timer->callback(timer->arg);
+        } else if (co) {
+            co->active = false;
+            ble_npl_eventq_put(co->evq, &co->ev);
+        } else {
+            fake_central_event(c);
+        }
+    }
+
+    if (time_us > Fake.now_us) {
+        Fake.now_us = time_us;
+    }
+}
+
+void
+fake_run(int64_t duration_us)
+{
+    fake_run_until(Fake.now_us + duration_us);
+}
+
+/* setup */
+
+void
+fake_host_reset(void)
+{
+    for (int i = 0; i < Fake.timer_count; ++i) {
+        free(Fake.timers[i]);
+    }
+    free(Fake.timers);
+    free(Fake.callouts);
+    for (int i = 0; i < FAKE_CENTRALS; ++i) {
+        free(Fake.centrals[i].rx);
+    }
+    memset(&Fake, 0, sizeof(Fake));
+    Fake.now_us = 1000000;
+    Fake.rng = 1;
+}
+
+void
+fake_host_add_device(struct hid_dev *dev)
+{
+    hid_init(dev, Svc_char_handles);
+
+    pthread_mutex_lock(&Gatt_lock);
+    if (!Gatt_dev) {
+        Gatt_dev = dev;
+        ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
+        if (gatt_svr_init(dev) != 0) {
+            fprintf(stderr, "fake host: GATT services can not be registered\n");
+            abort();
+        }
+    }
+    pthread_mutex_unlock(&Gatt_lock);
+}
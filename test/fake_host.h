@@ -0,0 +1,105 @@
+#ifndef H_FAKE_HOST_
+#define H_FAKE_HOST_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "host/ble_hs.h"
+
+/*
+Fake NimBLE host for tests of hid_func.c and gatt_svr.c. Time is virtual:
+esp_timer_get_time() is the clock of the calling thread and moves only in
+fake_run_until(), which runs queued host events, expired timers and callouts
+and the connection events of simulated centrals in time order. Every thread
+has its own clock, event queue and centrals, so devices can run in parallel.
+
+A central takes reports from the host the way NimBLE does: a notification is
+accepted inside ble_gattc_notify_custom() (BLE_GAP_EVENT_NOTIFY_TX with status
+0), or refused at random with BLE_HS_ENOMEM when refuse_percent is set. The
+controller holds accepted packets, mbufs included, until a connection event
+sends them, up to per_event packets every conn interval. An indication is
+confirmed (BLE_HS_EDONE) at the event after the one which sent it.
+*/
+
+struct hid_dev;
+
+/* one packet the central got */
+struct fake_rx {
+    int64_t time_us;            // connection event which sent it
+    int64_t queued_us;          // when the host handed it to the controller
+    uint16_t handle_num;        // index in Svc_char_handles
+    bool indication;
+    uint8_t size;
+    uint8_t data[32];
+};
+
+#define FAKE_LINK_PACKETS   64  // packets the controller holds for one central
+
+struct fake_packet {
+    struct os_mbuf *om;
+    uint16_t attr_handle;
+    bool indication;
+    int64_t queued_us;
+};
+
+struct fake_central {
+    bool connected;
+    struct hid_dev *dev;
+    uint16_t conn_handle;
+    uint32_t itvl_us;
+    int64_t next_event_us;      // next connection event
+    int per_event;              // packets sent in one connection event
+    int refuse_percent;         // sends refused with BLE_HS_ENOMEM at random
+    /* controller buffer */
+    struct fake_packet link[FAKE_LINK_PACKETS];
+    int link_head, link_count;
+    bool confirm_due;           // an indication was sent, it is confirmed at the next event
+    /* what the central got, in order */
+    struct fake_rx *rx;
+    int rx_count, rx_size;
+    /* counters */
+    uint32_t accepted;          // sends the host took
+    uint32_t refused;           // sends refused with BLE_HS_ENOMEM
+    uint32_t events;            // connection events
+};
+
+#define FAKE_CENTRALS       8
+
+/* clock, queues and centrals of the calling thread back to start, the clock starts at 1 s */
+extern void fake_host_reset(void);
+/* hid_init() of a device; the first device of the process also registers the GATT services */
+extern void fake_host_add_device(struct hid_dev *dev);
+extern void fake_seed(uint32_t seed);
+
+extern int64_t fake_now(void);
+extern void fake_run_until(int64_t time_us);
+extern void fake_run(int64_t duration_us);
+
+/* connect a central, its first connection event is one interval from now, NULL if refused */
+extern struct fake_central *fake_connect(struct hid_dev *dev, uint32_t itvl_us, bool encrypted);
+extern void fake_disconnect(struct fake_central *c);
+extern void fake_encrypt(struct fake_central *c);
+extern void fake_subscribe(struct fake_central *c, int handle_num, bool notify, bool indicate);
+/* subscribe to notifications of every input report of the protocol mode */
+extern void fake_subscribe_reports(struct fake_central *c, bool boot);
+extern void fake_rx_clear(struct fake_central *c);
+/* packets got from the characteristic, in order, and the last of them, NULL if none */
+extern int fake_rx_count(const struct fake_central *c, int handle_num);
+extern const struct fake_rx *fake_rx_last(const struct fake_central *c, int handle_num);
+
+/* GATT read and write of a central, the access callback result is returned */
+extern int fake_gatt_read(struct fake_central *c, uint16_t attr_handle, void *data, uint16_t max_len,
+    uint16_t *len);
+extern int fake_gatt_write(struct fake_central *c, uint16_t attr_handle, const void *data, uint16_t len);
+/* handle of a descriptor of the characteristic with value handle chr_val_handle, 0 if none */
+extern uint16_t fake_gatt_dsc_handle(uint16_t chr_val_handle, uint16_t uuid16);
+/* characteristics registered with a CCCD, NimBLE keeps a CCCD state for each of them */
+extern int fake_gatt_cccds(void);
+
+/* msys blocks held now and the most held at once, the std send methods and ATT reads take them */
+extern void fake_msys_stats(int *in_use, int *high_water);
+
+/* LED state set by the keyboard output report */
+extern int fake_leds(void);
+
+#endif
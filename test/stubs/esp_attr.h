@@ -0,0 +1,6 @@
+#ifndef H_TEST_ESP_ATTR_
+#define H_TEST_ESP_ATTR_
+
+#define IRAM_ATTR
+
+#endif
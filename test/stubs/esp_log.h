@@ -0,0 +1,36 @@
+#ifndef H_TEST_ESP_LOG_
+#define H_TEST_ESP_LOG_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+/* ESP-IDF logging on the host: errors and warnings go to stderr, the rest is only type checked */
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { if (0) fprintf(stderr, format, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) do { if (0) fprintf(stderr, format, ##__VA_ARGS__); } while (0)
+
+#define ESP_LOG_LEVEL(level, tag, format, ...) do { \
+        if ((level) <= ESP_LOG_WARN) { \
+            fprintf(stderr, "%c %s: " format "\n", (level) == ESP_LOG_ERROR ? 'E' : 'W', tag, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_TEST_ESP_NIMBLE_HCI_
+#define H_TEST_ESP_NIMBLE_HCI_
+
+/* included by gatt_svr.h, nothing of it is used by the code built on the host */
+
+#endif
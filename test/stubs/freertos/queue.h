@@ -0,0 +1,8 @@
+#ifndef H_TEST_FREERTOS_QUEUE_
+#define H_TEST_FREERTOS_QUEUE_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#endif
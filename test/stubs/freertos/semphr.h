@@ -0,0 +1,8 @@
+#ifndef H_TEST_FREERTOS_SEMPHR_
+#define H_TEST_FREERTOS_SEMPHR_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+#endif
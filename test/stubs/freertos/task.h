@@ -0,0 +1,17 @@
+#ifndef H_TEST_FREERTOS_TASK_
+#define H_TEST_FREERTOS_TASK_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+/* every thread is a task */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/* there is no scheduler, tasks are never created */
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef H_TEST_BLE_HS_
+#define H_TEST_BLE_HS_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+The part of the NimBLE host API the firmware uses, with the same names, values
+and layouts where the code depends on them. fake_host.c implements it on the
+virtual clock: GATT registration, mbuf pools, notifications and indications to
+simulated centrals.
+*/
+
+#define MYNEWT_VAL(name)                MYNEWT_VAL_##name
+#define MYNEWT_VAL_BLE_MAX_CONNECTIONS  3
+
+/* mbufs, a packet never spans more than one block here */
+typedef uint32_t os_membuf_t;
+
+#define OS_ALIGNMENT                4
+#define OS_ALIGN(n, a)              (((n) + ((a) - 1)) & ~((a) - 1))
+#define OS_MEMPOOL_SIZE(n, blksize) ((n) * (OS_ALIGN(blksize, OS_ALIGNMENT) / sizeof(os_membuf_t)))
+
+struct os_memblock {
+    struct os_memblock *next;
+};
+
+struct os_mempool {
+    uint32_t mp_block_size;
+    uint16_t mp_num_blocks;
+    uint16_t mp_num_free;
+    uint16_t mp_min_free;
+    struct os_memblock *mp_free;
+    const char *name;
+};
+
+struct os_mbuf_pool {
+    uint16_t omp_databuf_len;
+    struct os_mempool *omp_pool;
+};
+
+struct os_mbuf_pkthdr {
+    uint16_t omp_len;
+    uint16_t omp_flags;
+};
+
+struct os_mbuf {
+    uint8_t *om_data;
+    uint8_t om_flags;
+    uint8_t om_pkthdr_len;
+    uint16_t om_len;
+    struct os_mbuf_pool *om_omp;
+    struct os_mbuf *om_next;
+    uint8_t om_databuf[];
+};
+
+#define OS_MBUF_PKTLEN(om)          ((om)->om_len)
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks, uint32_t block_size, void *membuf,
+                    const char *name);
+int os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp, uint16_t buf_len, uint16_t nbufs);
+struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, uint8_t user_pkthdr_len);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+int os_mbuf_free_chain(struct os_mbuf *om);
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
+
+/* host error codes */
+#define BLE_HS_EAGAIN               1
+#define BLE_HS_EALREADY             2
+#define BLE_HS_EINVAL               3
+#define BLE_HS_EMSGSIZE             4
+#define BLE_HS_ENOENT               5
+#define BLE_HS_ENOMEM               6
+#define BLE_HS_ENOTCONN             7
+#define BLE_HS_ENOTSUP              8
+#define BLE_HS_ETIMEOUT             13
+#define BLE_HS_EDONE                14
+#define BLE_HS_EBUSY                15
+
+#define BLE_HS_CONN_HANDLE_NONE     0xffff
+#define BLE_HS_IO_NO_INPUT_OUTPUT   0x03
+
+/* UUIDs */
+#define BLE_UUID_TYPE_16            16
+#define BLE_UUID_TYPE_128           128
+#define BLE_UUID_STR_LEN            37
+
+typedef struct {
+    uint8_t type;
+} ble_uuid_t;
+
+typedef struct {
+    ble_uuid_t u;
+    uint16_t value;
+} ble_uuid16_t;
+
+typedef struct {
+    ble_uuid_t u;
+    uint8_t value[16];
+} ble_uuid128_t;
+
+#define BLE_UUID16_INIT(uuid16)     { .u = { .type = BLE_UUID_TYPE_16 }, .value = (uuid16) }
+#define BLE_UUID128_INIT(...)       { .u = { .type = BLE_UUID_TYPE_128 }, .value = { __VA_ARGS__ } }
+#define BLE_UUID16_DECLARE(uuid16)  ((const ble_uuid_t *) (&(ble_uuid16_t) BLE_UUID16_INIT(uuid16)))
+#define BLE_UUID128_DECLARE(...)    ((const ble_uuid_t *) (&(ble_uuid128_t) BLE_UUID128_INIT(__VA_ARGS__)))
+
+uint16_t ble_uuid_u16(const ble_uuid_t *uuid);
+char *ble_uuid_to_str(const ble_uuid_t *uuid, char *dst);
+
+/* ATT */
+#define BLE_ATT_ERR_INVALID_HANDLE          0x01
+#define BLE_ATT_ERR_READ_NOT_PERMITTED      0x02
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED     0x03
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN  0x0d
+#define BLE_ATT_ERR_UNLIKELY                0x0e
+#define BLE_ATT_ERR_INSUFFICIENT_RES        0x11
+#define BLE_ATT_ERR_VALUE_NOT_ALLOWED       0x13
+
+#define BLE_ATT_F_READ                      0x01
+#define BLE_ATT_F_WRITE                     0x02
+#define BLE_ATT_F_READ_ENC                  0x04
+#define BLE_ATT_F_READ_AUTHEN               0x08
+#define BLE_ATT_F_READ_AUTHOR               0x10
+#define BLE_ATT_F_WRITE_ENC                 0x20
+
+/* GATT server */
+#define BLE_GATT_SVC_TYPE_END               0
+#define BLE_GATT_SVC_TYPE_PRIMARY           1
+#define BLE_GATT_SVC_TYPE_SECONDARY         2
+
+#define BLE_GATT_CHR_F_BROADCAST            0x0001
+#define BLE_GATT_CHR_F_READ                 0x0002
+#define BLE_GATT_CHR_F_WRITE_NO_RSP         0x0004
+#define BLE_GATT_CHR_F_WRITE                0x0008
+#define BLE_GATT_CHR_F_NOTIFY               0x0010
+#define BLE_GATT_CHR_F_INDICATE             0x0020
+#define BLE_GATT_CHR_F_READ_ENC             0x0200
+#define BLE_GATT_CHR_F_READ_AUTHEN          0x0400
+#define BLE_GATT_CHR_F_READ_AUTHOR          0x0800
+#define BLE_GATT_CHR_F_WRITE_ENC            0x1000
+#define BLE_GATT_CHR_F_WRITE_AUTHEN         0x2000
+
+#define BLE_GATT_ACCESS_OP_READ_CHR         0
+#define BLE_GATT_ACCESS_OP_WRITE_CHR        1
+#define BLE_GATT_ACCESS_OP_READ_DSC         2
+#define BLE_GATT_ACCESS_OP_WRITE_DSC        3
+
+#define BLE_GATT_REGISTER_OP_SVC            1
+#define BLE_GATT_REGISTER_OP_CHR            2
+#define BLE_GATT_REGISTER_OP_DSC            3
+
+struct ble_gatt_access_ctxt;
+
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+struct ble_gatt_dsc_def {
+    const ble_uuid_t *uuid;
+    uint8_t att_flags;
+    uint8_t min_key_size;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+};
+
+struct ble_gatt_chr_def {
+    const ble_uuid_t *uuid;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+    struct ble_gatt_dsc_def *descriptors;
+    uint16_t flags;
+    uint8_t min_key_size;
+    uint16_t *val_handle;
+};
+
+struct ble_gatt_svc_def {
+    uint8_t type;
+    const ble_uuid_t *uuid;
+    const struct ble_gatt_svc_def **includes;
+    const struct ble_gatt_chr_def *characteristics;
+};
+
+struct ble_gatt_access_ctxt {
+    uint8_t op;
+    struct os_mbuf *om;
+    union {
+        const struct ble_gatt_chr_def *chr;
+        const struct ble_gatt_dsc_def *dsc;
+    };
+};
+
+struct ble_gatt_register_ctxt {
+    uint8_t op;
+    union {
+        struct {
+            uint16_t handle;
+            const struct ble_gatt_svc_def *svc_def;
+        } svc;
+        struct {
+            uint16_t def_handle;
+            uint16_t val_handle;
+            const struct ble_gatt_chr_def *chr_def;
+            const struct ble_gatt_svc_def *svc_def;
+        } chr;
+        struct {
+            uint16_t handle;
+            const struct ble_gatt_dsc_def *dsc_def;
+            const struct ble_gatt_chr_def *chr_def;
+            const struct ble_gatt_svc_def *svc_def;
+        } dsc;
+    };
+};
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs);
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+void ble_gatts_chr_updated(uint16_t chr_val_handle);
+int ble_gattc_notify(uint16_t conn_handle, uint16_t chr_val_handle);
+int ble_gattc_notify_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom);
+int ble_gattc_indicate(uint16_t conn_handle, uint16_t chr_val_handle);
+int ble_gattc_indicate_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom);
+
+/* GAP */
+#define BLE_GAP_EVENT_NOTIFY_TX             13
+
+typedef struct {
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
+
+struct ble_gap_sec_state {
+    unsigned encrypted:1;
+    unsigned authenticated:1;
+    unsigned bonded:1;
+    unsigned key_size:5;
+};
+
+struct ble_gap_conn_desc {
+    struct ble_gap_sec_state sec_state;
+    ble_addr_t our_id_addr;
+    ble_addr_t peer_id_addr;
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+    uint8_t role;
+};
+
+/* host configuration, only what GATT registration needs */
+struct ble_hs_cfg {
+    void (*gatts_register_cb)(struct ble_gatt_register_ctxt *ctxt, void *arg);
+    void *gatts_register_arg;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_TEST_BLE_UUID_
+#define H_TEST_BLE_UUID_
+
+#include "host/ble_hs.h"
+
+#endif
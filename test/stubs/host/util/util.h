@@ -0,0 +1,6 @@
+#ifndef H_TEST_HOST_UTIL_
+#define H_TEST_HOST_UTIL_
+
+/* included by gatt_svr.h, nothing of it is used by the code built on the host */
+
+#endif
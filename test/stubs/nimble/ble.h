@@ -0,0 +1,6 @@
+#ifndef H_TEST_BLE_
+#define H_TEST_BLE_
+
+/* included by gatt_svr.h, nothing of it is used by the code built on the host */
+
+#endif
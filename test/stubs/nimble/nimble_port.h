@@ -0,0 +1,47 @@
+#ifndef H_TEST_NIMBLE_PORT_
+#define H_TEST_NIMBLE_PORT_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+NimBLE porting layer events of the host task. The fake host (fake_host.c) has
+one event queue per thread, fake_run_until() runs its events and expired
+callouts in order on the virtual clock; a callout tick is a millisecond.
+*/
+struct ble_npl_event;
+
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+typedef uint32_t ble_npl_time_t;
+
+struct ble_npl_event {
+    ble_npl_event_fn *fn;
+    void *arg;
+    bool queued;
+    struct ble_npl_event *next;
+};
+
+struct ble_npl_eventq {
+    struct ble_npl_event *head, *tail;
+};
+
+struct ble_npl_callout {
+    struct ble_npl_event ev;
+    struct ble_npl_eventq *evq;
+    bool active;
+    int64_t expiry_us;
+};
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+void *ble_npl_event_get_arg(struct ble_npl_event *ev);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
+
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq,
+                          ble_npl_event_fn *fn, void *arg);
+int ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks);
+void ble_npl_callout_stop(struct ble_npl_callout *co);
+bool ble_npl_callout_is_active(struct ble_npl_callout *co);
+ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_TEST_NVS_FLASH_
+#define H_TEST_NVS_FLASH_
+
+/* hid_codes.h includes it, nothing of it is used by the code built on the host */
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_TEST_SDKCONFIG_
+#define H_TEST_SDKCONFIG_
+
+/* CONFIG_* options of a host test come from its compile definitions in CMakeLists.txt */
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef H_TEST_BLE_SVC_BAS_
+#define H_TEST_BLE_SVC_BAS_
+
+#define BLE_SVC_BAS_UUID16                      0x180F
+#define BLE_SVC_BAS_CHR_UUID16_BATTERY_LEVEL    0x2A19
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_TEST_BLE_SVC_GAP_
+#define H_TEST_BLE_SVC_GAP_
+
+void ble_svc_gap_init(void);
+
+#endif
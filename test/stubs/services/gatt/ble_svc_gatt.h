@@ -0,0 +1,7 @@
+#ifndef H_TEST_BLE_SVC_GATT_
+#define H_TEST_BLE_SVC_GATT_
+
+/* GATT service of the host: Service Changed, indicated, one CCCD per bonded central */
+void ble_svc_gatt_init(void);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "hid_reports.h"
+#include "test_util.h"
+
+/*
+GATT server of gatt_svr.c on the fake NimBLE host: ATT handles are dispatched
+to the right report through the lookup tables, and what it costs; every central
+connected at once keeps its own protocol mode, subscriptions, suspend state and
+resolution multipliers.
+*/
+
+#define ITVL_US         7500
+
+static struct hid_dev Dev;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* handle index the way it was found before Svc_handle_nums, a scan of Svc_char_handles */
+static int
+scan_handle_num(uint16_t attr_handle)
+{
+    for (int i = 0; i < HANDLE_HID_COUNT; ++i) {
+        if (Svc_char_handles[i] == attr_handle) {
+            return i;
+        }
+    }
+    return HANDLE_HID_COUNT;
+}
+
+/* every value handle maps back to its index, every report reference names its report */
+static void
+test_dispatch(struct fake_central *c)
+{
+    for (int i = 0; i < HANDLE_HID_COUNT; ++i) {
+        if (Svc_char_handles[i]) {
+            CHECK_EQ(gatt_svr_handle_num(Svc_char_handles[i]), i);
+        }
+    }
+    CHECK_EQ(gatt_svr_handle_num(0), HANDLE_HID_COUNT);
+    CHECK_EQ(gatt_svr_handle_num(SVC_ATTR_HANDLES_MAX), HANDLE_HID_COUNT);
+
+    for (size_t i = 0; i < Hid_report_ref_data_count; ++i) {
+        uint16_t dsc = fake_gatt_dsc_handle(Svc_char_handles[Hid_report_ref_data[i].id], GATT_UUID_RPT_REF_DESCR);
+        uint8_t ref[HID_REPORT_REF_LEN];
+        uint16_t len;
+
+        CHECK(dsc);
+        CHECK_EQ(fake_gatt_read(c, dsc, ref, sizeof(ref), &len), 0);
+        CHECK_EQ(len, HID_REPORT_REF_LEN);
+        CHECK(!memcmp(ref, Hid_report_ref_data[i].hidReportRef, HID_REPORT_REF_LEN));
+    }
+}
+
+static uint8_t
+read_proto_mode(struct fake_central *c)
+{
+    uint8_t mode = 0xFF;
+    uint16_t len;
+
+    CHECK_EQ(fake_gatt_read(c, Svc_char_handles[HANDLE_HID_PROTO_MODE], &mode, 1, &len), 0);
+    CHECK_EQ(len, 1);
+    return mode;
+}
+
+/*
+three centrals at once: one in report mode, one in boot mode, one which has not
+subscribed; what one of them sets or does must not reach the others
+*/
+static void
+test_centrals(void)
+{
+    struct fake_central *c[HID_MAX_CONNS];
+    uint8_t boot = HID_PROTOCOL_MODE_BOOT;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        c[i] = fake_connect(&Dev, ITVL_US, true);
+        CHECK(c[i]);
+    }
+    CHECK(!fake_connect(&Dev, ITVL_US, true));
+
+    fake_subscribe_reports(c[0], false);
+    CHECK_EQ(fake_gatt_write(c[1], Svc_char_handles[HANDLE_HID_PROTO_MODE], &boot, 1), 0);
+    fake_subscribe_reports(c[1], true);
+    fake_run(ITVL_US);
+    CHECK_EQ(read_proto_mode(c[0]), HID_PROTOCOL_MODE_REPORT);
+    CHECK_EQ(read_proto_mode(c[1]), HID_PROTOCOL_MODE_BOOT);
+    CHECK_EQ(read_proto_mode(c[2]), HID_PROTOCOL_MODE_REPORT);
+
+    // resolution multipliers of one central
+    uint16_t feature = Svc_char_handles[HANDLE_HID_MOUSE_FEATURE_REPORT];
+    uint8_t set[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE], got[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE];
+    uint16_t len;
+
+    // high resolution wheel on
+    memset(set, 0, sizeof(set));
+    CHECK_EQ(hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_FEATURE, set, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_RESOLUTION_MULTIPLIER, 1), 0);
+    CHECK_EQ(fake_gatt_write(c[0], feature, set, sizeof(set)), 0);
+    CHECK_EQ(fake_gatt_read(c[0], feature, got, sizeof(got), &len), 0);
+    CHECK(!memcmp(got, set, sizeof(set)));
+    CHECK(Dev.conns[0].wheel_hires);
+    for (int i = 1; i < HID_MAX_CONNS; ++i) {
+        CHECK_EQ(fake_gatt_read(c[i], feature, got, sizeof(got), &len), 0);
+        CHECK_EQ(len, HIDD_LE_REPORT_MOUSE_FEATURE_SIZE);
+        for (int j = 0; j < len; ++j) {
+            CHECK_EQ(got[j], 0);
+        }
+        CHECK(!Dev.conns[i].wheel_hires);
+    }
+
+    // each central gets the report of its protocol mode, and only if it subscribed
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        fake_rx_clear(c[i]);
+    }
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A, true), 0);
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(c[0], HANDLE_HID_KB_NKRO_REPORT), 1);
+    CHECK_EQ(fake_rx_count(c[0], HANDLE_HID_BOOT_KB_IN_REPORT), 0);
+    CHECK_EQ(fake_rx_count(c[1], HANDLE_HID_BOOT_KB_IN_REPORT), 1);
+    CHECK_EQ(fake_rx_count(c[1], HANDLE_HID_KB_NKRO_REPORT), 0);
+    CHECK_EQ(fake_rx_last(c[1], HANDLE_HID_BOOT_KB_IN_REPORT)->data[2], HID_KEY_A);
+    CHECK_EQ(c[2]->rx_count, 0);
+
+    // a suspended central gets nothing, the others go on
+    hid_set_suspend(&Dev, c[0]->conn_handle, true);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_B, true), 0);
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(c[0], HANDLE_HID_KB_NKRO_REPORT), 1);
+    CHECK_EQ(fake_rx_count(c[1], HANDLE_HID_BOOT_KB_IN_REPORT), 2);
+    hid_set_suspend(&Dev, c[0]->conn_handle, false);
+
+    // one central leaving clears neither the keys held nor the others' state
+    fake_disconnect(c[1]);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_C, true), 0);
+    fake_run(100000);
+
+    const struct fake_rx *rx = fake_rx_last(c[0], HANDLE_HID_KB_NKRO_REPORT);
+
+    CHECK(rx);
+    CHECK((rx->data[1 + HID_KEY_A / 8] >> (HID_KEY_A % 8)) & 1);
+    CHECK((rx->data[1 + HID_KEY_B / 8] >> (HID_KEY_B % 8)) & 1);
+    CHECK((rx->data[1 + HID_KEY_C / 8] >> (HID_KEY_C % 8)) & 1);
+    CHECK(Dev.conns[0].wheel_hires);
+    CHECK_EQ(read_proto_mode(c[0]), HID_PROTOCOL_MODE_REPORT);
+    CHECK_EQ(c[2]->rx_count, 0);
+
+    // the freed slot starts clean, in report mode with default multipliers
+    c[1] = fake_connect(&Dev, ITVL_US, true);
+    CHECK(c[1]);
+    CHECK_EQ(read_proto_mode(c[1]), HID_PROTOCOL_MODE_REPORT);
+    CHECK_EQ(fake_gatt_read(c[1], feature, got, sizeof(got), &len), 0);
+    CHECK_EQ(got[0], 0);
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        fake_disconnect(c[i]);
+    }
+}
+
+/* value of a CONFIG_ option in sdkconfig.defaults, -1 if not set */
+static long
+sdkconfig_default(const char *name)
+{
+    FILE *f = fopen(SDKCONFIG_DEFAULTS, "r");
+    char line[256];
+    size_t len = strlen(name);
+    long value = -1;
+
+    CHECK(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, name, len) && line[len] == '=') {
+            value = strtol(line + len + 1, NULL, 0);
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+/* NimBLE keeps a CCCD state for every characteristic with a CCCD and every bonded central */
+static void
+test_cccd_budget(void)
+{
+    long max_cccds = sdkconfig_default("CONFIG_BT_NIMBLE_MAX_CCCDS");
+    long max_conns = sdkconfig_default("CONFIG_BT_NIMBLE_MAX_CONNECTIONS");
+
+    CHECK_EQ(max_conns, HID_MAX_CONNS);
+    CHECK(max_cccds >= fake_gatt_cccds() * max_conns);
+    printf("gatt_svr: %d centrals kept apart; %d CCCDs for each central, %ld of %ld used by %ld centrals\n",
+        HID_MAX_CONNS, fake_gatt_cccds(), fake_gatt_cccds() * max_conns, max_cccds, max_conns);
+}
+
+/*
+CPU time of the handle lookup, table against scan, and of a whole read through
+ble_svc_report_access() for report values and report reference descriptors
+*/
+static void
+bench_access(struct fake_central *c)
+{
+    enum { ROUNDS = 20000 };
+    uint16_t values[HANDLE_HID_COUNT], dscs[HANDLE_HID_COUNT];
+    int value_count = 0, dsc_count = 0;
+    volatile int sink = 0;
+    double start, table_ns, scan_ns, value_ns, dsc_ns;
+
+    for (int i = HANDLE_HID_MOUSE_REPORT; i < HANDLE_HID_COUNT; ++i) {
+        if (Svc_char_handles[i] && i != HANDLE_HID_MOUSE_FEATURE_REPORT) {
+            values[value_count++] = Svc_char_handles[i];
+        }
+    }
+    for (size_t i = 0; i < Hid_report_ref_data_count; ++i) {
+        dscs[dsc_count++] = fake_gatt_dsc_handle(Svc_char_handles[Hid_report_ref_data[i].id],
+            GATT_UUID_RPT_REF_DESCR);
+    }
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < value_count; ++i) {
+            sink += gatt_svr_handle_num(values[i]);
+        }
+    }
+    table_ns = (now_ns() - start) / ROUNDS / value_count;
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < value_count; ++i) {
+            sink += scan_handle_num(values[i]);
+        }
+    }
+    scan_ns = (now_ns() - start) / ROUNDS / value_count;
+
+    uint8_t data[64];
+    uint16_t len;
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < value_count; ++i) {
+            sink += fake_gatt_read(c, values[i], data, sizeof(data), &len);
+        }
+    }
+    value_ns = (now_ns() - start) / ROUNDS / value_count;
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < dsc_count; ++i) {
+            sink += fake_gatt_read(c, dscs[i], data, sizeof(data), &len);
+        }
+    }
+    dsc_ns = (now_ns() - start) / ROUNDS / dsc_count;
+
+    CHECK(sink > 0);
+    printf("gatt_svr: handle lookup %.1f ns by table, %.1f ns by scan; report read %.0f ns, "
+        "report reference read %.0f ns (%d reports)\n", table_ns, scan_ns, value_ns, dsc_ns, value_count);
+}
+
+int
+main(void)
+{
+    test_centrals();
+    test_cccd_budget();
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    fake_run(ITVL_US);
+
+    test_dispatch(c);
+    bench_access(c);
+    return 0;
+}
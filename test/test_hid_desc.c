@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hid_desc.h"
+#include "hid_reports.h"
+#include "test_util.h"
+
+/*
+Parse the real report map and check it against the report table: every
+report the code sends or takes has a reference, its report ID and type are
+in the map and the map gives it exactly the size of its buffer. And what a
+write through the parsed fields costs next to fixed byte offsets.
+*/
+
+/* report data must fit into one notification with the default ATT MTU */
+#define ATT_DEFAULT_PAYLOAD     20
+
+static const struct hid_report_def *
+report_def_by_handle(int handle_num)
+{
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        if (Hid_report_defs[i].handle_num == handle_num) {
+            return &Hid_report_defs[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct report_reference_table *
+report_ref_by_handle(int handle_num)
+{
+    for (size_t i = 0; i < Hid_report_ref_data_count; ++i) {
+        if (Hid_report_ref_data[i].id == handle_num) {
+            return &Hid_report_ref_data[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+test_report_sizes(void)
+{
+    for (size_t i = 0; i < Hid_report_ref_data_count; ++i) {
+        const struct report_reference_table *ref = &Hid_report_ref_data[i];
+        const struct hid_report_def *def = report_def_by_handle(ref->id);
+        size_t size = hid_desc_report_size(ref->hidReportRef[0], ref->hidReportRef[1]);
+
+        /* no two characteristics share a report ID and type */
+        for (size_t j = i + 1; j < Hid_report_ref_data_count; ++j) {
+            CHECK(memcmp(ref->hidReportRef, Hid_report_ref_data[j].hidReportRef, HID_REPORT_REF_LEN) != 0);
+        }
+
+        /* the vendor feature report is not declared in the map (SUPPORT_REPORT_VENDOR) */
+        if (ref->id == HANDLE_HID_FEATURE_REPORT) {
+            CHECK_EQ(size, 0);
+            continue;
+        }
+        if (size == 0) {
+            fprintf(stderr, "report %u type %u (handle %d) is not in report map\n",
+                ref->hidReportRef[0], ref->hidReportRef[1], ref->id);
+        }
+        CHECK(size > 0);
+        CHECK(size <= ATT_DEFAULT_PAYLOAD);
+        if (def) {
+            if (size != def->buffer_size) {
+                fprintf(stderr, "report %s: %u bytes in report map, buffer has %u\n",
+                    def->name, (unsigned) size, (unsigned) def->buffer_size);
+            }
+            CHECK_EQ(size, def->buffer_size);
+        } else {
+            /* the only referenced report outside the table, read and written by gatt_svr.c */
+            CHECK_EQ(ref->id, HANDLE_HID_MOUSE_FEATURE_REPORT);
+            CHECK_EQ(size, HIDD_LE_REPORT_MOUSE_FEATURE_SIZE);
+        }
+    }
+}
+
+static void
+test_report_table(void)
+{
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        const struct hid_report_def *def = &Hid_report_defs[i];
+
+        CHECK(def->buffer_size > 0 && def->buffer_size <= ATT_DEFAULT_PAYLOAD);
+        CHECK(def->tx_class < HID_TX_CLASSES);
+        CHECK(def->send_in & HID_SEND_IN_ANY);
+        /* battery level is a characteristic of the battery service, it has no report ID */
+        if (def->handle_num != HANDLE_BATTERY_LEVEL) {
+            CHECK(report_ref_by_handle(def->handle_num) != NULL);
+        }
+        for (int j = i + 1; j < HID_REPORTS_COUNT; ++j) {
+            CHECK(Hid_report_defs[j].handle_num != def->handle_num);
+        }
+    }
+    /* boot reports have a fixed format and are not described by the map */
+    CHECK_EQ(HIDD_LE_REPORT_KB_IN_SIZE, 8);
+    CHECK_EQ(report_def_by_handle(HANDLE_HID_KB_IN_REPORT)->handle_boot_num, HANDLE_HID_BOOT_KB_IN_REPORT);
+    CHECK_EQ(report_def_by_handle(HANDLE_HID_MOUSE_REPORT)->handle_boot_num, HANDLE_HID_BOOT_MOUSE_REPORT);
+}
+
+static void
+test_fields(void)
+{
+    struct hid_desc_ref x, y, hat, key;
+    uint8_t buf[HIDD_LE_REPORT_MOUSE_SIZE] = { 0 };
+
+    /* mouse X and Y are signed and round trip through the report buffer */
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &x), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &y), 0);
+    CHECK(x.field->flags & HID_DESC_F_SIGNED);
+    CHECK(x.field->flags & HID_DESC_F_RELATIVE);
+    hid_desc_ref_write(buf, &x, -300);
+    hid_desc_ref_write(buf, &y, 1234);
+    CHECK_EQ(hid_desc_ref_read(buf, &x), -300);
+    CHECK_EQ(hid_desc_ref_read(buf, &y), 1234);
+
+    /* consumer control is an array of HID_CC_SLOTS 16-bit usages */
+    const struct hid_desc_field *cc =
+        hid_desc_report_field(hid_desc_report_get(HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT), 0);
+    CHECK(cc != NULL);
+    CHECK(!(cc->flags & HID_DESC_F_VARIABLE));
+    CHECK_EQ(cc->count, HID_CC_SLOTS);
+    CHECK_EQ(cc->bit_size, 16);
+
+    /* NKRO bitmap reaches the last key code the keyboard code sets */
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_KB_NKRO_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_KEYBOARD,
+        HID_NKRO_MAX_KEY, &key), 0);
+
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_HAT_SWITCH, &hat), 0);
+
+    /* a usage which is not in the report is not found and not written */
+    CHECK(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_RZ, &key) != 0);
+    CHECK(key.field == NULL);
+    CHECK_EQ(hid_desc_ref_read(buf, &key), 0);
+}
+
+/* long items are skipped whole, one cut short anywhere is an error, not a read past the map */
+static void
+test_long_items(void)
+{
+    static const uint8_t map[] = {
+        0x85, 0x01,                 // Report ID (1)
+        0xFE, 0x02, 0x10, 0xAA, 0xBB,   // long item, 2 data bytes
+        0x75, 0x08,                 // Report Size (8)
+        0x95, 0x02,                 // Report Count (2)
+        0x81, 0x02,                 // Input (Data, Variable, Absolute)
+        0xFE, 0x04, 0x10, 0x01,     // long item, 4 data bytes, cut after 1
+    };
+
+    CHECK_EQ(hid_desc_parse(map, sizeof(map) - 4), 0);
+    CHECK_EQ(hid_desc_report_size(1, HID_REPORT_TYPE_INPUT), 2);
+    for (size_t size = sizeof(map) - 3; size < sizeof(map); ++size) {
+        CHECK_EQ(hid_desc_parse(map, size), 2);
+    }
+    CHECK_EQ(hid_desc_parse(map, 4), 2);
+
+    CHECK_EQ(hid_desc_parse(Hid_report_map, Hid_report_map_size), 0);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* report mode mouse input at fixed offsets, the way it was built before the map was parsed */
+#define MOUSE_BUTTONS_SET(buf, b)   ((buf)[0] = (b) & 0x07)
+#define MOUSE_XY_SET(buf, x, y)     ((buf)[1] = (x) & 0xff, (buf)[2] = ((x) >> 8) & 0xff, \
+                                     (buf)[3] = (y) & 0xff, (buf)[4] = ((y) >> 8) & 0xff)
+#define MOUSE_WHEEL_SET(buf, w)     ((buf)[5] = (uint8_t) (int8_t) (w))
+#define MOUSE_PAN_SET(buf, p)       ((buf)[6] = (uint8_t) (int8_t) (p))
+
+/*
+CPU time to fill a mouse report: fields resolved once (hid_desc_ref_write), fixed
+byte offsets, and a field look-up for every value (hid_desc_set); all three must
+give the same bytes
+*/
+static void
+bench_field_write(void)
+{
+    enum { ROUNDS = 1000000 };
+    struct hid_desc_ref buttons[3], x, y, wheel, pan;
+    uint8_t by_ref[HIDD_LE_REPORT_MOUSE_SIZE], fixed[HIDD_LE_REPORT_MOUSE_SIZE], by_set[HIDD_LE_REPORT_MOUSE_SIZE];
+    uint32_t sum_ref = 0, sum_fixed = 0, sum_set = 0;
+    double start, ref_ns, fixed_ns, set_ns;
+
+    for (int i = 0; i < 3; ++i) {
+        CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, i + 1,
+            &buttons[i]), 0);
+    }
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &x), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &y), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_WHEEL, &wheel), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_CONSUMER,
+        HID_USAGE_AC_PAN, &pan), 0);
+
+    start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) {
+        int32_t v = (int32_t) (i * 2654435761u) >> 16;
+
+        memset(by_ref, 0, sizeof(by_ref));
+        for (int b = 0; b < 3; ++b) {
+            hid_desc_ref_write(by_ref, &buttons[b], (i >> b) & 1);
+        }
+        hid_desc_ref_write(by_ref, &x, v);
+        hid_desc_ref_write(by_ref, &y, -v);
+        hid_desc_ref_write(by_ref, &wheel, v % 128);
+        hid_desc_ref_write(by_ref, &pan, -v % 128);
+        sum_ref += by_ref[i % sizeof(by_ref)];
+    }
+    ref_ns = (now_ns() - start) / ROUNDS;
+
+    start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) {
+        int32_t v = (int32_t) (i * 2654435761u) >> 16;
+
+        memset(fixed, 0, sizeof(fixed));
+        MOUSE_BUTTONS_SET(fixed, i);
+        MOUSE_XY_SET(fixed, v, -v);
+        MOUSE_WHEEL_SET(fixed, v % 128);
+        MOUSE_PAN_SET(fixed, -v % 128);
+        sum_fixed += fixed[i % sizeof(fixed)];
+    }
+    fixed_ns = (now_ns() - start) / ROUNDS;
+
+    start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) {
+        int32_t v = (int32_t) (i * 2654435761u) >> 16;
+
+        memset(by_set, 0, sizeof(by_set));
+        for (int b = 0; b < 3; ++b) {
+            hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, by_set, HID_USAGE_PAGE_BUTTON, b + 1,
+                (i >> b) & 1);
+        }
+        hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, by_set, HID_USAGE_PAGE_GENERIC_DESKTOP,
+            HID_USAGE_X, v);
+        hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, by_set, HID_USAGE_PAGE_GENERIC_DESKTOP,
+            HID_USAGE_Y, -v);
+        hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, by_set, HID_USAGE_PAGE_GENERIC_DESKTOP,
+            HID_USAGE_WHEEL, v % 128);
+        hid_desc_set(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, by_set, HID_USAGE_PAGE_CONSUMER,
+            HID_USAGE_AC_PAN, -v % 128);
+        sum_set += by_set[i % sizeof(by_set)];
+    }
+    set_ns = (now_ns() - start) / ROUNDS;
+
+    CHECK(!memcmp(by_ref, fixed, sizeof(fixed)));
+    CHECK(!memcmp(by_set, fixed, sizeof(fixed)));
+    CHECK_EQ(sum_ref, sum_fixed);
+    CHECK_EQ(sum_set, sum_fixed);
+    printf("hid_desc: mouse report write %.1f ns by resolved fields, %.1f ns at fixed offsets, "
+        "%.1f ns with a look-up for every field\n", ref_ns, fixed_ns, set_ns);
+}
+
+int
+main(void)
+{
+    CHECK_EQ(hid_desc_parse(Hid_report_map, Hid_report_map_size), 0);
+    test_report_sizes();
+    test_report_table();
+    test_fields();
+    test_long_items();
+    printf("hid_desc: %u references checked against report map\n", (unsigned) Hid_report_ref_data_count);
+    bench_field_write();
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+Gamepad reports of hid_func.c on the fake NimBLE host: a button or hat tap
+shorter than the connection interval reaches the central as a press and a
+release while the sticks move all the time, and how many reports and how long
+it takes a stream of axis updates to get to the central.
+*/
+
+#define ITVL_US             7500
+#define TAPS                50
+#define TAP_PERIOD_US       20000   // with notifications
+#define TAP_PERIOD_IND_US   100000  // indications carry a report every second interval
+#define BENCH_US            2000000
+
+static struct hid_dev Dev;
+
+static struct hid_desc_ref Pad_button1, Pad_x, Pad_hat;
+
+static struct fake_central *
+setup(bool indicate)
+{
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, 1,
+        &Pad_button1), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &Pad_x), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_GAMEPAD_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_HAT_SWITCH, &Pad_hat), 0);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    if (indicate) {
+        fake_subscribe(c, HANDLE_HID_GAMEPAD_REPORT, false, true);
+    }
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+    return c;
+}
+
+/* button 1 and hat changes in the gamepad reports the central got */
+static void
+count_edges(const struct fake_central *c, int *button_edges, int *hat_edges, int *reports)
+{
+    int32_t button = 0, hat = HID_GAMEPAD_HAT_NONE;
+
+    *button_edges = *hat_edges = *reports = 0;
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num != HANDLE_HID_GAMEPAD_REPORT) {
+            continue;
+        }
+        int32_t b = hid_desc_ref_read(c->rx[i].data, &Pad_button1);
+        int32_t h = hid_desc_ref_read(c->rx[i].data, &Pad_hat);
+
+        *button_edges += b != button;
+        *hat_edges += h != hat;
+        button = b;
+        hat = h;
+        (*reports)++;
+    }
+}
+
+/*
+the left stick moves every millisecond, button 1 is pressed for 1 ms and the hat
+for 2 ms every tap period; none of the taps may be merged away, with
+notifications and with indications, which wait for the previous confirmation
+*/
+static void
+test_taps(bool indicate)
+{
+    struct fake_central *c = setup(indicate);
+    int64_t period_us = indicate ? TAP_PERIOD_IND_US : TAP_PERIOD_US;
+    int32_t x = 0;
+
+    for (int i = 0; i < TAPS; ++i) {
+        int64_t start = fake_now();
+
+        hid_gamepad_axis_set(&Dev, HID_GAMEPAD_AXIS_X, x += 5);
+        CHECK_EQ(hid_gamepad_button_set(&Dev, 1, true), 0);
+        fake_run(1000);
+        hid_gamepad_axis_set(&Dev, HID_GAMEPAD_AXIS_X, x += 5);
+        CHECK_EQ(hid_gamepad_button_set(&Dev, 1, false), 0);
+        CHECK_EQ(hid_gamepad_hat_set(&Dev, 2), 0);
+        fake_run(1000);
+        hid_gamepad_axis_set(&Dev, HID_GAMEPAD_AXIS_X, x += 5);
+        fake_run(1000);
+        CHECK_EQ(hid_gamepad_hat_set(&Dev, HID_GAMEPAD_HAT_NONE), 0);
+        // setting the same state again is no edge
+        CHECK_EQ(hid_gamepad_hat_set(&Dev, HID_GAMEPAD_HAT_NONE), 0);
+        while (fake_now() < start + period_us) {
+            hid_gamepad_axis_set(&Dev, HID_GAMEPAD_AXIS_X, x += 5);
+            fake_run(1000);
+        }
+    }
+    fake_run(100000);
+
+    int button_edges, hat_edges, reports;
+
+    count_edges(c, &button_edges, &hat_edges, &reports);
+    CHECK_EQ(button_edges, 2 * TAPS);
+    CHECK_EQ(hat_edges, 2 * TAPS);
+    CHECK_EQ(hid_desc_ref_read(fake_rx_last(c, HANDLE_HID_GAMEPAD_REPORT)->data, &Pad_x), x);
+
+    struct hid_tx_stats stats;
+
+    hid_tx_stats_get(&Dev, c->conn_handle, &stats);
+    CHECK_EQ(stats.drops, 0);
+    printf("gamepad taps with %s: %d button and %d hat edges of %d taps each in %d reports\n",
+        indicate ? "indications" : "notifications", button_edges, hat_edges, TAPS, reports);
+}
+
+/*
+X moves every update_us for BENCH_US, a new value each time; the latency of an
+update is the time until the first report carrying it or a later value
+*/
+static void
+bench_axis(bool indicate, int64_t update_us)
+{
+    struct fake_central *c = setup(indicate);
+    static int64_t update_time[BENCH_US / 500];
+    int updates = BENCH_US / update_us;
+    int64_t start = fake_now();
+
+    CHECK(updates <= (int) (sizeof(update_time) / sizeof(update_time[0])));
+    for (int i = 0; i < updates; ++i) {
+        update_time[i] = fake_now();
+        CHECK_EQ(hid_gamepad_axis_set(&Dev, HID_GAMEPAD_AXIS_X, i + 1), 0);
+        fake_run(update_us);
+    }
+    fake_run(100000);
+
+    int reports = 0, next = 0;
+    int64_t total_us = 0, max_us = 0;
+
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num != HANDLE_HID_GAMEPAD_REPORT) {
+            continue;
+        }
+        int32_t value = hid_desc_ref_read(c->rx[i].data, &Pad_x);
+
+        reports++;
+        for (; next < value; ++next) {
+            int64_t latency_us = c->rx[i].time_us - update_time[next];
+
+            total_us += latency_us;
+            if (latency_us > max_us) {
+                max_us = latency_us;
+            }
+        }
+    }
+    CHECK_EQ(next, updates);
+    // axes are paced to a report an interval at most
+    CHECK(reports <= (fake_now() - start) / ITVL_US + 1);
+
+    printf("gamepad axis with %s, an update every %.1f ms at %.1f ms interval: %d updates, "
+        "%.0f reports/s, update to report %.2f ms average %.2f ms max\n",
+        indicate ? "indications" : "notifications", update_us / 1000.0, ITVL_US / 1000.0, updates,
+        reports * 1e6 / BENCH_US, (double) total_us / updates / 1000, max_us / 1000.0);
+}
+
+int
+main(void)
+{
+    test_taps(false);
+    test_taps(true);
+    bench_axis(false, 1000);
+    bench_axis(false, 4000);
+    bench_axis(true, 1000);
+    return 0;
+}
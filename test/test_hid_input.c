@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hid_codes.h"
+#include "hid_input.h"
+#include "test_util.h"
+
+/*
+Motion accumulators (saturation and carry of fractions), the mouse keys
+acceleration curve and the consumer control slots of hid_input.c.
+*/
+
+static void
+test_sat_add(void)
+{
+    CHECK_EQ(hid_sat_add(100, -300), -200);
+    CHECK_EQ(hid_sat_add(INT32_MAX - 5, 5), INT32_MAX);
+    CHECK_EQ(hid_sat_add(INT32_MAX - 5, 6), INT32_MAX);
+    CHECK_EQ(hid_sat_add(INT32_MAX, INT32_MAX), INT32_MAX);
+    CHECK_EQ(hid_sat_add(INT32_MIN + 5, -6), INT32_MIN);
+    CHECK_EQ(hid_sat_add(INT32_MIN, INT32_MIN), INT32_MIN);
+    /* a saturated accumulator moves back at once in the other direction */
+    CHECK_EQ(hid_sat_add(INT32_MAX, -1), INT32_MAX - 1);
+}
+
+static void
+test_take_delta(void)
+{
+    int32_t acc = 300;
+
+    /* the fraction stays in the accumulator and is carried into the next report */
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), 1);
+    CHECK_EQ(acc, 44);
+    acc += 212;
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), 1);
+    CHECK_EQ(acc, 0);
+
+    /* rounds toward zero, the fraction keeps the sign */
+    acc = -300;
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), -1);
+    CHECK_EQ(acc, -44);
+    acc = -255;
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), 0);
+    CHECK_EQ(acc, -255);
+
+    /* what does not fit into the field is sent by the next reports */
+    acc = 200 * HID_MOUSE_SUBPIXELS + 10;
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), 127);
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127), 73);
+    CHECK_EQ(acc, 10);
+    acc = -200 * HID_WHEEL_MULTIPLIER;
+    CHECK_EQ(hid_take_delta(&acc, HID_WHEEL_MULTIPLIER, 127), -127);
+    CHECK_EQ(acc, -73 * HID_WHEEL_MULTIPLIER);
+
+    /* a saturated accumulator drains without overflow */
+    acc = INT32_MIN;
+    CHECK_EQ(hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 32767), -32767);
+    CHECK_EQ(acc, INT32_MIN + 32767 * HID_MOUSE_SUBPIXELS);
+}
+
+/* whatever comes in, goes out: reports plus the rest in the accumulator equal the input */
+static void
+test_no_motion_lost(void)
+{
+    int64_t in = 0, out = 0;
+    int32_t acc = 0;
+
+    srand(1);
+    for (int i = 0; i < 100000; ++i) {
+        int32_t delta = rand() % (64 * HID_MOUSE_SUBPIXELS) - 32 * HID_MOUSE_SUBPIXELS;
+
+        acc = hid_sat_add(acc, delta);
+        in += delta;
+        if (i % 3 == 0) {
+            int32_t part = hid_take_delta(&acc, HID_MOUSE_SUBPIXELS, 127);
+
+            CHECK(part >= -127 && part <= 127);
+            out += (int64_t) part * HID_MOUSE_SUBPIXELS;
+        }
+    }
+    CHECK_EQ(out + acc, in);
+}
+
+static void
+test_lut(void)
+{
+    const struct hid_mouse_keys_profile profile = {
+        .delay_ms = 250, .initial_speed = 80, .max_speed = 1200, .time_to_max_ms = 1500,
+    };
+    const struct hid_mouse_keys_profile slower_max = { .initial_speed = 100, .max_speed = 50, .time_to_max_ms = 1 },
+                                        no_time = { .initial_speed = 10, .max_speed = 50 };
+    uint32_t lut[HID_MOUSE_KEYS_LUT + 1];
+    int64_t full_us = (int64_t) profile.time_to_max_ms * 1000;
+
+    CHECK_EQ(hid_mouse_keys_lut_build(&slower_max, lut), 1);
+    CHECK_EQ(hid_mouse_keys_lut_build(&no_time, lut), 1);
+    CHECK_EQ(hid_mouse_keys_lut_build(&profile, lut), 0);
+
+    /* quadratic from initial to max speed */
+    CHECK_EQ(lut[0], 80 * HID_MOUSE_SUBPIXELS);
+    CHECK_EQ(lut[HID_MOUSE_KEYS_LUT / 2], (80 + (1200 - 80) / 4) * HID_MOUSE_SUBPIXELS);
+    CHECK_EQ(lut[HID_MOUSE_KEYS_LUT], 1200 * HID_MOUSE_SUBPIXELS);
+    for (int i = 1; i <= HID_MOUSE_KEYS_LUT; ++i) {
+        CHECK(lut[i] >= lut[i - 1]);
+        /* the curve gets steeper */
+        if (i >= 2) {
+            CHECK(lut[i] - lut[i - 1] >= lut[i - 1] - lut[i - 2]);
+        }
+    }
+
+    /* speed over time: ends of the curve, its steps and monotonic in between */
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, 0), lut[0]);
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, -1000), lut[0]);
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, full_us), lut[HID_MOUSE_KEYS_LUT]);
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, 10 * full_us), lut[HID_MOUSE_KEYS_LUT]);
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, full_us / 2), lut[HID_MOUSE_KEYS_LUT / 2]);
+
+    uint32_t prev = 0;
+
+    for (int64_t t = 0; t <= full_us; t += 997) {
+        uint32_t speed = hid_mouse_keys_lut_speed(lut, profile.time_to_max_ms, t);
+        int step = t * HID_MOUSE_KEYS_LUT / full_us;
+
+        CHECK(speed >= prev);
+        CHECK(speed >= lut[step]);
+        CHECK(step == HID_MOUSE_KEYS_LUT || speed <= lut[step + 1]);
+        prev = speed;
+    }
+
+    /* constant speed profile */
+    const struct hid_mouse_keys_profile flat = { .initial_speed = 300, .max_speed = 300, .time_to_max_ms = 100 };
+
+    CHECK_EQ(hid_mouse_keys_lut_build(&flat, lut), 0);
+    CHECK_EQ(hid_mouse_keys_lut_speed(lut, flat.time_to_max_ms, 33333), 300 * HID_MOUSE_SUBPIXELS);
+}
+
+static void
+test_cc_keys(void)
+{
+    struct hid_cc_keys keys = { .count = 0 };
+
+    /* HID_CONSUMER_* codes are Consumer page usages, hid_cc_change_key() sends them as they are */
+    CHECK_EQ(HID_CONSUMER_POWER, 0x030);
+    CHECK_EQ(HID_CONSUMER_MENU, 0x040);
+    CHECK_EQ(HID_CONSUMER_PLAY_PAUSE, 0x0CD);
+    CHECK_EQ(HID_CONSUMER_MUTE, 0x0E2);
+    CHECK_EQ(HID_CONSUMER_VOLUME_UP, 0x0E9);
+    CHECK_EQ(HID_CONSUMER_VOLUME_DOWN, 0x0EA);
+
+    /* press order is kept, a usage takes one slot */
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_VOLUME_UP, true), 0);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_MUTE, true), 0);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_MUTE, true), -1);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_PLAY_PAUSE, true), 0);
+    CHECK_EQ(keys.count, 3);
+    CHECK_EQ(keys.pressed[0], HID_CONSUMER_VOLUME_UP);
+    CHECK_EQ(keys.pressed[1], HID_CONSUMER_MUTE);
+    CHECK_EQ(keys.pressed[2], HID_CONSUMER_PLAY_PAUSE);
+
+    /* no free slot */
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_POWER, true), 1);
+    CHECK_EQ(keys.count, 3);
+
+    /* release from the middle closes the gap, the order of the rest stays */
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_MUTE, false), 0);
+    CHECK_EQ(keys.count, 2);
+    CHECK_EQ(keys.pressed[0], HID_CONSUMER_VOLUME_UP);
+    CHECK_EQ(keys.pressed[1], HID_CONSUMER_PLAY_PAUSE);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_MUTE, false), 1);
+
+    /* the report map may give fewer slots than the buffer has */
+    CHECK_EQ(hid_cc_keys_set(&keys, 2, HID_CONSUMER_POWER, true), 1);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS + 5, HID_CONSUMER_POWER, true), 0);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS + 5, HID_CONSUMER_MENU, true), 1);
+
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_VOLUME_UP, false), 0);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_PLAY_PAUSE, false), 0);
+    CHECK_EQ(hid_cc_keys_set(&keys, HID_CC_SLOTS, HID_CONSUMER_POWER, false), 0);
+    CHECK_EQ(keys.count, 0);
+}
+
+int
+main(void)
+{
+    test_sat_add();
+    test_take_delta();
+    test_no_motion_lost();
+    test_lut();
+    test_cc_keys();
+    printf("hid_input: accumulators, mouse keys curve and consumer slots ok\n");
+    return 0;
+}
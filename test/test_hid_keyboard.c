@@ -0,0 +1,451 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+Keyboard reports of hid_func.c on the fake NimBLE host: the NKRO bitmap in
+report mode, the 6-key boot array and its rollover in boot mode, input frames
+which send a chord in order, text typed by hid_keyboard_type() and its rate.
+*/
+
+#define ITVL_US         7500
+
+static struct hid_dev Dev;
+
+static struct fake_central *
+setup(bool boot)
+{
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    if (boot) {
+        hid_set_report_mode(&Dev, c->conn_handle, true);
+    }
+    fake_subscribe_reports(c, boot);
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+    return c;
+}
+
+static bool
+nkro_has(const uint8_t *report, uint8_t key)
+{
+    return report[1 + key / 8] & (1 << (key % 8));
+}
+
+/* more keys than any array holds are all in the bitmap, whatever their codes */
+static void
+test_nkro(void)
+{
+    static const uint8_t keys[] = {
+        HID_KEY_A, HID_KEY_B, HID_KEY_C, HID_KEY_D, HID_KEY_E, HID_KEY_F, HID_KEY_G, HID_KEY_H,
+        HID_KEY_I, HID_KEY_J, HID_KEY_K, HID_KEY_L, HID_KEY_M, HID_KEY_N, HID_KEY_O, HID_KEY_P,
+        HID_KEY_1, HID_KEY_2, HID_KEY_3, HID_KEY_4, HID_KEY_SPACEBAR, 101, 102, 135, HID_NKRO_MAX_KEY,
+    };
+    struct fake_central *c = setup(false);
+    const struct fake_rx *rx;
+
+    CHECK(sizeof(keys) >= 20);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_LEFT_SHIFT, true), 0);
+    for (size_t i = 0; i < sizeof(keys); ++i) {
+        CHECK_EQ(hid_keyboard_change_key(&Dev, keys[i], true), 0);
+        fake_run(2000);
+    }
+    CHECK(hid_keyboard_change_key(&Dev, HID_NKRO_MAX_KEY + 1, true) != 0);
+    fake_run(200000);
+
+    rx = fake_rx_last(c, HANDLE_HID_KB_NKRO_REPORT);
+    CHECK(rx);
+    CHECK_EQ(rx->size, HIDD_LE_REPORT_KB_NKRO_SIZE);
+    CHECK_EQ(rx->data[0], 0x02);    // left shift
+    int bits = 0;
+    for (int key = 0; key <= HID_NKRO_MAX_KEY; ++key) {
+        bits += nkro_has(rx->data, key);
+    }
+    CHECK_EQ(bits, sizeof(keys));
+    for (size_t i = 0; i < sizeof(keys); ++i) {
+        CHECK(nkro_has(rx->data, keys[i]));
+    }
+    // one report per change, none merged or lost
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_KB_NKRO_REPORT), sizeof(keys) + 1);
+    // the boot report is not sent in report mode
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_BOOT_KB_IN_REPORT), 0);
+
+    for (size_t i = 0; i < sizeof(keys); ++i) {
+        CHECK_EQ(hid_keyboard_change_key(&Dev, keys[i], false), 0);
+        fake_run(2000);
+    }
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_LEFT_SHIFT, false), 0);
+    fake_run(200000);
+    rx = fake_rx_last(c, HANDLE_HID_KB_NKRO_REPORT);
+    for (int i = 0; i < HIDD_LE_REPORT_KB_NKRO_SIZE; ++i) {
+        CHECK_EQ(rx->data[i], 0);
+    }
+}
+
+static void
+check_boot(struct fake_central *c, const uint8_t *keys, int count)
+{
+    const struct fake_rx *rx;
+
+    fake_run(100000);
+    rx = fake_rx_last(c, HANDLE_HID_BOOT_KB_IN_REPORT);
+    CHECK(rx);
+    CHECK_EQ(rx->size, HIDD_LE_REPORT_KB_IN_SIZE);
+    CHECK_EQ(rx->data[1], 0);
+    for (int i = 0; i < HIDD_LE_REPORT_KB_IN_SIZE - 2; ++i) {
+        CHECK_EQ(rx->data[2 + i], i < count ? keys[i] : 0);
+    }
+}
+
+/*
+boot array: keys in press order, ErrorRollOver in every slot for a seventh key,
+codes above its Logical Maximum are never put into it
+*/
+static void
+test_boot_fallback(void)
+{
+    static const uint8_t order[] = { HID_KEY_Q, HID_KEY_W, HID_KEY_E, HID_KEY_R, HID_KEY_T, HID_KEY_Y };
+    static const uint8_t rollover[] = {
+        HID_KEY_ERR_ROLLOVER, HID_KEY_ERR_ROLLOVER, HID_KEY_ERR_ROLLOVER,
+        HID_KEY_ERR_ROLLOVER, HID_KEY_ERR_ROLLOVER, HID_KEY_ERR_ROLLOVER,
+    };
+    struct fake_central *c = setup(true);
+
+    for (int i = 0; i < 5; ++i) {
+        CHECK_EQ(hid_keyboard_change_key(&Dev, order[i], true), 0);
+    }
+    check_boot(c, order, 5);
+
+    // outside the array range: nothing changes for a boot host, no report is sent
+    int before = fake_rx_count(c, HANDLE_HID_BOOT_KB_IN_REPORT);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_BOOT_KB_MAX_KEY + 1, true), 0);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, 135, true), 0);
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_NKRO_MAX_KEY, true), 0);
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_BOOT_KB_IN_REPORT), before);
+    check_boot(c, order, 5);
+
+    // the sixth key fits, those out of range do not count towards rollover
+    CHECK_EQ(hid_keyboard_change_key(&Dev, order[5], true), 0);
+    check_boot(c, order, 6);
+
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_U, true), 0);
+    check_boot(c, rollover, 6);
+
+    CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_U, false), 0);
+    check_boot(c, order, 6);
+
+    CHECK_EQ(hid_keyboard_change_key(&Dev, order[0], false), 0);
+    check_boot(c, order + 1, 5);
+
+    for (int i = 1; i < 6; ++i) {
+        CHECK_EQ(hid_keyboard_change_key(&Dev, order[i], false), 0);
+    }
+    check_boot(c, order, 0);
+    // the NKRO report is not sent in boot mode
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_KB_NKRO_REPORT), 0);
+}
+
+/* the central got exactly these reports since the last check, in this order, in one connection event */
+static int
+check_frame(struct fake_central *c, const int *handles, int count, bool one_event)
+{
+    CHECK_EQ(c->rx_count, count);
+    for (int i = 0; i < c->rx_count && i < count; ++i) {
+        CHECK_EQ(c->rx[i].handle_num, handles[i]);
+        if (one_event) {
+            CHECK_EQ(c->rx[i].time_us, c->rx[0].time_us);
+        } else if (i) {
+            CHECK(c->rx[i].time_us >= c->rx[i - 1].time_us);
+        }
+    }
+    fake_rx_clear(c);
+    return count;
+}
+
+/*
+chords in input frames to a report mode and a boot mode central: every report a
+frame changed once, keyboard, consumer control, mouse, in one connection event;
+in order still when the link takes one packet an event
+*/
+static void
+test_frames(void)
+{
+    static const int kb_mouse[] = { HANDLE_HID_KB_NKRO_REPORT, HANDLE_HID_MOUSE_REPORT };
+    static const int kb_cc[] = { HANDLE_HID_KB_NKRO_REPORT, HANDLE_HID_CC_REPORT };
+    static const int all[] = { HANDLE_HID_KB_NKRO_REPORT, HANDLE_HID_CC_REPORT, HANDLE_HID_MOUSE_REPORT };
+    static const int kb[] = { HANDLE_HID_KB_NKRO_REPORT };
+    static const int boot_kb_mouse[] = { HANDLE_HID_BOOT_KB_IN_REPORT, HANDLE_HID_BOOT_MOUSE_REPORT };
+    static const int boot_kb_cc[] = { HANDLE_HID_BOOT_KB_IN_REPORT, HANDLE_HID_CC_REPORT };
+    static const int boot_all[] = {
+        HANDLE_HID_BOOT_KB_IN_REPORT, HANDLE_HID_CC_REPORT, HANDLE_HID_BOOT_MOUSE_REPORT,
+    };
+    static const int boot_kb[] = { HANDLE_HID_BOOT_KB_IN_REPORT };
+    struct fake_central *c = setup(false);
+    struct fake_central *b = fake_connect(&Dev, ITVL_US, true);
+    struct hid_frame frame;
+    int frames = 0, changes = 0, sent = 0, boot_sent = 0;
+
+    CHECK(b);
+    hid_set_report_mode(&Dev, b->conn_handle, true);
+    fake_subscribe_reports(b, true);
+    fake_run(100000);
+    fake_rx_clear(c);
+    fake_rx_clear(b);
+
+    // Ctrl+click: the modifier is in before the click
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_LEFT_CTRL, true), 0);
+    CHECK_EQ(hid_frame_mouse(&frame, HID_MOUSE_LEFT, 0, 0, true), 0);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    CHECK_EQ(frame.count, 0);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, kb_mouse, 2, true);
+    boot_sent += check_frame(b, boot_kb_mouse, 2, true);
+
+    // a key and a volume step
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_cc(&frame, HID_CONSUMER_VOLUME_UP, true), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_A, true), 0);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, kb_cc, 2, true);
+    boot_sent += check_frame(b, boot_kb_cc, 2, true);
+
+    // everything released at once, mouse first in the frame, last on the air
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_mouse(&frame, HID_MOUSE_LEFT, 0, 0, false), 0);
+    CHECK_EQ(hid_frame_cc(&frame, HID_CONSUMER_VOLUME_UP, false), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_A, false), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_LEFT_CTRL, false), 0);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, all, 3, true);
+    boot_sent += check_frame(b, boot_all, 3, true);
+
+    // pressed and released in one frame: no state change, nothing is sent
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_B, true), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_B, false), 0);
+    changes += frame.count;
+    hid_frame_commit(&Dev, &frame);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, kb, 0, true);
+    boot_sent += check_frame(b, boot_kb, 0, true);
+
+    // three keys and motion make one keyboard report and one mouse report
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_X, true), 0);
+    CHECK_EQ(hid_frame_mouse(&frame, 0, 10, 5, false), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_Y, true), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_Z, true), 0);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, kb_mouse, 2, true);
+    boot_sent += check_frame(b, boot_kb_mouse, 2, true);
+
+    // a frame full of changes to one report
+    hid_frame_begin(&frame);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_X, false), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_Y, false), 0);
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_Z, false), 0);
+    for (int i = 0; i < HID_FRAME_OPS - 3; ++i) {
+        CHECK_EQ(hid_frame_key(&frame, HID_KEY_1 + i, i & 1), 0);
+    }
+    CHECK_EQ(hid_frame_key(&frame, HID_KEY_2, true), 3);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    frames++;
+    fake_run(100000);
+    sent += check_frame(c, kb, 1, true);
+    boot_sent += check_frame(b, boot_kb, 1, true);
+
+    // one packet a connection event: the frame takes three events, its order stays
+    c->per_event = 1;
+    hid_frame_begin(&frame);
+    for (int i = 0; i < HID_FRAME_OPS - 3; ++i) {
+        CHECK_EQ(hid_frame_key(&frame, HID_KEY_1 + i, false), 0);
+    }
+    CHECK_EQ(hid_frame_mouse(&frame, HID_MOUSE_RIGHT, 0, 0, true), 0);
+    CHECK_EQ(hid_frame_cc(&frame, HID_CONSUMER_VOLUME_DOWN, true), 0);
+    changes += frame.count;
+    CHECK_EQ(hid_frame_commit(&Dev, &frame), 0);
+    frames++;
+    fake_run(100000);
+    CHECK(c->rx[2].time_us - c->rx[0].time_us >= 2 * ITVL_US);
+    sent += check_frame(c, all, 3, false);
+    boot_sent += check_frame(b, boot_all, 3, true);
+
+    printf("hid_keyboard: %d frames of %d changes, %d reports to the report mode central, %d to the boot "
+        "one, in order, all of a frame in one connection event while the link has room\n",
+        frames, changes, sent, boot_sent);
+}
+
+/* character of a key newly pressed in a report, 0 if the test text does not use it */
+static char
+key_char(uint8_t key, bool shift)
+{
+    if (key >= HID_KEY_A && key <= HID_KEY_Z) {
+        return (shift ? 'A' : 'a') + key - HID_KEY_A;
+    }
+    if (key >= HID_KEY_1 && key <= HID_KEY_0 && !shift) {
+        return key == HID_KEY_0 ? '0' : '1' + key - HID_KEY_1;
+    }
+    return key == HID_KEY_SPACEBAR ? ' ' : 0;
+}
+
+/* text the central sees in NKRO reports: every key pressed which was not in the report before */
+static int
+typed_text(const struct fake_central *c, char *text, int max)
+{
+    uint8_t last[HIDD_LE_REPORT_KB_NKRO_SIZE] = { 0 };
+    int len = 0;
+
+    for (int i = 0; i < c->rx_count; ++i) {
+        const uint8_t *data = c->rx[i].data;
+
+        if (c->rx[i].handle_num != HANDLE_HID_KB_NKRO_REPORT) {
+            continue;
+        }
+        for (int key = HID_KEY_A; key <= HID_KEY_SPACEBAR; ++key) {
+            if (nkro_has(data, key) && !nkro_has(last, key)) {
+                CHECK(len < max);
+                text[len++] = key_char(key, data[0] & 0x22);
+            }
+        }
+        memcpy(last, data, sizeof(last));
+    }
+    return len;
+}
+
+/*
+paste a text at a conn interval: it is typed exactly, with repeated keys and
+shift changes, and as fast as the link takes reports; returns characters a second
+*/
+static double
+test_typing(uint32_t itvl_us, int *chars, int *reports)
+{
+    static const char words[] =
+        "The quick brown fox jumps over 13 lazy dogs and Bees buzz at 2000 feet ";
+    static char text[1200], got[1200];
+    struct fake_central *c;
+    int len = 0, taken = 0;
+
+    while (len + (int) sizeof(words) - 1 <= (int) sizeof(text)) {
+        memcpy(text + len, words, sizeof(words) - 1);
+        len += sizeof(words) - 1;
+    }
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    c = fake_connect(&Dev, itvl_us, true);
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(itvl_us);
+    fake_rx_clear(c);
+
+    int64_t start_us = fake_now();
+
+    // the text does not fit the typing buffer, feed it as it empties
+    while (taken < len || hid_keyboard_type_pending(&Dev)) {
+        taken += hid_keyboard_type(&Dev, text + taken, len - taken);
+        fake_run(1000);
+    }
+    // the controller still holds what the host has handed it
+    fake_run(2000000);
+
+    const struct fake_rx *rx = fake_rx_last(c, HANDLE_HID_KB_NKRO_REPORT);
+
+    CHECK(rx);
+    CHECK_EQ(typed_text(c, got, sizeof(got)), len);
+    CHECK(!memcmp(got, text, len));
+    *chars = len;
+    *reports = fake_rx_count(c, HANDLE_HID_KB_NKRO_REPORT);
+    // the last report releases everything
+    for (int i = 0; i < HIDD_LE_REPORT_KB_NKRO_SIZE; ++i) {
+        CHECK_EQ(rx->data[i], 0);
+    }
+    return len * 1e6 / (rx->time_us - start_us);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* CPU time of a press and release, report building and queueing included */
+static double
+bench_press_release(bool boot, int held)
+{
+    enum { ROUNDS = 200000 };
+    struct fake_central *c = setup(boot);
+    double ns = 0;
+
+    for (int i = 0; i < held; ++i) {
+        hid_keyboard_change_key(&Dev, HID_KEY_1 + i, true);
+    }
+    fake_run(100000);
+
+    for (int i = 0; i < ROUNDS; ++i) {
+        uint8_t key = HID_KEY_A + i % 20;
+        double start = now_ns();
+
+        hid_keyboard_change_key(&Dev, key, true);
+        hid_keyboard_change_key(&Dev, key, false);
+        ns += now_ns() - start;
+        // the link takes the reports, so the queue never fills up
+        fake_run(ITVL_US);
+    }
+    fake_rx_clear(c);
+    return ns / ROUNDS;
+}
+
+int
+main(void)
+{
+    test_nkro();
+    test_boot_fallback();
+    test_frames();
+
+    static const uint32_t itvls[] = { 7500, 15000, 30000 };
+
+    for (size_t i = 0; i < sizeof(itvls) / sizeof(itvls[0]); ++i) {
+        int chars, reports;
+        double cps = test_typing(itvls[i], &chars, &reports);
+
+        printf("hid_keyboard: typing at %.1f ms conn interval, %.0f chars/s, %d reports for %d chars\n",
+            itvls[i] / 1000.0, cps, reports, chars);
+    }
+
+    double nkro = bench_press_release(false, 0), nkro_held = bench_press_release(false, 16),
+           boot = bench_press_release(true, 0), boot_held = bench_press_release(true, 16);
+
+    printf("hid_keyboard: NKRO with 25 keys and 6KRO rollover ok; press+release %.0f ns NKRO (%.0f ns "
+        "with 16 keys held), %.0f ns boot (%.0f ns with 16 keys held)\n", nkro, nkro_held, boot, boot_held);
+    return 0;
+}
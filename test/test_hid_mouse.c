@@ -0,0 +1,384 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+Relative mouse motion of hid_func.c on the fake NimBLE host: whatever the
+queue or the central does, the pointer ends where the input put it. Scroll
+reaches a central with and without the resolution multipliers exactly, in a
+report or two an interval. And how many reports and how long it takes to put
+the pointer on a target with relative motion and with the absolute pointer
+report.
+*/
+
+#define ITVL_US         7500
+
+static struct hid_dev Dev;
+
+static struct hid_desc_ref Mouse_x, Mouse_y;
+
+static struct fake_central *
+setup(uint32_t itvl_us, bool encrypted)
+{
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &Mouse_x), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &Mouse_y), 0);
+
+    struct fake_central *c = fake_connect(&Dev, itvl_us, encrypted);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(itvl_us);
+    fake_rx_clear(c);
+    return c;
+}
+
+/* sum of X and Y deltas the central got, returns the number of mouse reports */
+static int
+mouse_total(const struct fake_central *c, int32_t *x, int32_t *y)
+{
+    int reports = 0;
+
+    *x = *y = 0;
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num == HANDLE_HID_MOUSE_REPORT) {
+            *x += hid_desc_ref_read(c->rx[i].data, &Mouse_x);
+            *y += hid_desc_ref_read(c->rx[i].data, &Mouse_y);
+            reports++;
+        }
+    }
+    return reports;
+}
+
+/*
+the host refuses everything, so the pointer class fills up and refuses reports
+too; their deltas must come back to the accumulator, not vanish
+*/
+static void
+test_queue_full(void)
+{
+    struct fake_central *c = setup(ITVL_US, true);
+    struct hid_tx_stats stats;
+    int32_t x, y, moved = 0;
+
+    c->refuse_percent = 100;
+    for (int i = 0; i < 40 * HID_TX_CLASS_SIZE; ++i) {
+        hid_mouse_move(&Dev, 5 * HID_MOUSE_SUBPIXELS, -2 * HID_MOUSE_SUBPIXELS);
+        moved += 5;
+        fake_run(ITVL_US / 3);
+    }
+    CHECK_EQ(hid_tx_stats_get(&Dev, c->conn_handle, &stats), 0);
+    CHECK_EQ(stats.depth, HID_TX_CLASS_SIZE);
+    CHECK(stats.drops > 0);     // the queue did refuse reports
+
+    c->refuse_percent = 0;
+    fake_run(1000000);
+
+    int reports = mouse_total(c, &x, &y);
+
+    CHECK_EQ(x, moved);
+    CHECK_EQ(y, -2 * moved / 5);
+    printf("hid_mouse: queue full %u times, %d counts moved in %d reports, none lost\n",
+        (unsigned) stats.drops, (int) moved, reports);
+}
+
+/*
+motion made while a central does not take mouse reports (link not encrypted,
+not subscribed, suspended) is not kept for it and sent in a jump later
+*/
+static void
+test_not_wanted(void)
+{
+    struct fake_central *c = setup(ITVL_US, false);
+    int32_t x, y;
+
+    CHECK_EQ(hid_mouse_move(&Dev, 50 * HID_MOUSE_SUBPIXELS, 0), 0);
+    CHECK_EQ(Dev.conns[0].motion.x, 0);
+    fake_encrypt(c);
+    fake_run(ITVL_US);
+
+    // a report was sent just now, the next motion waits for the interval
+    CHECK_EQ(hid_mouse_move(&Dev, 5 * HID_MOUSE_SUBPIXELS, 0), 0);
+    fake_subscribe(c, HANDLE_HID_MOUSE_REPORT, false, false);
+    CHECK_EQ(hid_mouse_move(&Dev, 40 * HID_MOUSE_SUBPIXELS, 0), 0);
+    fake_subscribe(c, HANDLE_HID_MOUSE_REPORT, true, false);
+    fake_run(100000);
+
+    hid_set_suspend(&Dev, c->conn_handle, true);
+    CHECK_EQ(hid_mouse_move(&Dev, 30 * HID_MOUSE_SUBPIXELS, 0), 0);
+    hid_set_suspend(&Dev, c->conn_handle, false);
+    CHECK_EQ(hid_mouse_move(&Dev, 2 * HID_MOUSE_SUBPIXELS, 0), 0);
+    fake_run(100000);
+
+    mouse_total(c, &x, &y);
+    CHECK_EQ(x, 5 + 2);
+    CHECK_EQ(y, 0);
+}
+
+/* the central sets both resolution multipliers of the mouse feature report on or off */
+static void
+set_multipliers(struct fake_central *c, bool on)
+{
+    const struct hid_desc_report *report = hid_desc_report_get(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_FEATURE);
+    uint8_t data[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE] = { 0 };
+    int set = 0;
+
+    CHECK(report);
+    for (int i = 0; i < report->field_count; ++i) {
+        const struct hid_desc_field *field = hid_desc_report_field(report, i);
+
+        if (field->usage_page == HID_USAGE_PAGE_GENERIC_DESKTOP &&
+            field->usage_min == HID_USAGE_RESOLUTION_MULTIPLIER) {
+            hid_desc_field_write(data, field, 0, on ? field->logical_max : 0);
+            set++;
+        }
+    }
+    CHECK_EQ(set, 2);
+    CHECK_EQ(fake_gatt_write(c, Svc_char_handles[HANDLE_HID_MOUSE_FEATURE_REPORT], data, sizeof(data)), 0);
+}
+
+/* wheel and AC Pan the central got, returns the mouse reports which scrolled */
+static int
+scroll_total(struct fake_central *c, const struct hid_desc_ref *wheel_ref, const struct hid_desc_ref *pan_ref,
+    int32_t *wheel, int32_t *pan)
+{
+    int reports = 0;
+
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num == HANDLE_HID_MOUSE_REPORT) {
+            int32_t w = hid_desc_ref_read(c->rx[i].data, wheel_ref), p = hid_desc_ref_read(c->rx[i].data, pan_ref);
+
+            *wheel += w;
+            *pan += p;
+            reports += w || p;
+        }
+    }
+    fake_rx_clear(c);
+    return reports;
+}
+
+/*
+scroll gestures of many small steps, as a touch wheel makes them, to a central
+with the resolution multipliers on and one with them off: the first gets every
+1/HID_WHEEL_MULTIPLIER step, the other whole detents, the rest of a detent
+waits for the next gesture; no report carries a step twice, and there is at
+most one report an interval
+*/
+static void
+test_scroll(void)
+{
+    static const struct {
+        int steps, step_us;
+        int16_t wheel, pan;
+    } gestures[] = {
+        { 40, 1000, 3, 0 },         // 15 detents up
+        { 13, 2000, -5, 2 },        // diagonal, leaves parts of detents
+        { 30, 250, 0, -7 },         // fast horizontal flick
+        { 5, 10000, 1, 1 },         // slower than the interval
+    };
+    struct fake_central *hires = setup(ITVL_US, true);
+    struct fake_central *lores = fake_connect(&Dev, ITVL_US, true);
+    struct hid_desc_ref wheel_ref, pan_ref;
+    int32_t wheel = 0, pan = 0, hi_wheel = 0, hi_pan = 0, lo_wheel = 0, lo_pan = 0;
+
+    CHECK(lores);
+    fake_subscribe_reports(lores, false);
+    set_multipliers(hires, true);
+    set_multipliers(lores, false);
+    CHECK(Dev.conns[0].wheel_hires && Dev.conns[0].pan_hires);
+    CHECK(!Dev.conns[1].wheel_hires && !Dev.conns[1].pan_hires);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_WHEEL, &wheel_ref), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_CONSUMER,
+        HID_USAGE_AC_PAN, &pan_ref), 0);
+    fake_run(100000);
+    fake_rx_clear(hires);
+    fake_rx_clear(lores);
+
+    for (size_t g = 0; g < sizeof(gestures) / sizeof(gestures[0]); ++g) {
+        int duration_us = gestures[g].steps * gestures[g].step_us;
+
+        for (int i = 0; i < gestures[g].steps; ++i) {
+            CHECK_EQ(hid_mouse_scroll(&Dev, gestures[g].wheel, gestures[g].pan), 0);
+            wheel += gestures[g].wheel;
+            pan += gestures[g].pan;
+            fake_run(gestures[g].step_us);
+        }
+        fake_run(100000);
+
+        int hi_reports = scroll_total(hires, &wheel_ref, &pan_ref, &hi_wheel, &hi_pan);
+        int lo_reports = scroll_total(lores, &wheel_ref, &pan_ref, &lo_wheel, &lo_pan);
+
+        // every step; whole detents, the rest less than one detent waits
+        CHECK_EQ(hi_wheel, wheel);
+        CHECK_EQ(hi_pan, pan);
+        CHECK_EQ(lo_wheel * HID_WHEEL_MULTIPLIER + Dev.conns[1].motion.wheel, wheel);
+        CHECK_EQ(lo_pan * HID_WHEEL_MULTIPLIER + Dev.conns[1].motion.pan, pan);
+        CHECK(abs(Dev.conns[1].motion.wheel) < HID_WHEEL_MULTIPLIER);
+        CHECK(abs(Dev.conns[1].motion.pan) < HID_WHEEL_MULTIPLIER);
+        CHECK(hi_reports <= duration_us / ITVL_US + 2);
+        CHECK(lo_reports <= hi_reports);
+        printf("hid_mouse: scroll %d steps of %d/%d wheel %d/%d pan in %.1f ms: %d reports with the multipliers, "
+            "%d without\n", gestures[g].steps, gestures[g].wheel, HID_WHEEL_MULTIPLIER, gestures[g].pan,
+            HID_WHEEL_MULTIPLIER, duration_us / 1000.0, hi_reports, lo_reports);
+    }
+
+    // what the central without multipliers is owed makes whole detents, then motion: no scroll is sent again
+    int32_t wheel_rest = Dev.conns[1].motion.wheel, pan_rest = Dev.conns[1].motion.pan;
+    int32_t wheel_add = wheel_rest ? (wheel_rest > 0 ? 1 : -1) * HID_WHEEL_MULTIPLIER - wheel_rest : 0,
+            pan_add = pan_rest ? (pan_rest > 0 ? 1 : -1) * HID_WHEEL_MULTIPLIER - pan_rest : 0;
+
+    CHECK_EQ(hid_mouse_scroll(&Dev, wheel_add, pan_add), 0);
+    wheel += wheel_add;
+    pan += pan_add;
+    fake_run(100000);
+    scroll_total(hires, &wheel_ref, &pan_ref, &hi_wheel, &hi_pan);
+    scroll_total(lores, &wheel_ref, &pan_ref, &lo_wheel, &lo_pan);
+    CHECK_EQ(hid_mouse_move(&Dev, 3 * HID_MOUSE_SUBPIXELS, 0), 0);
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(hires, HANDLE_HID_MOUSE_REPORT), 1);
+    CHECK_EQ(fake_rx_count(lores, HANDLE_HID_MOUSE_REPORT), 1);
+    CHECK_EQ(scroll_total(hires, &wheel_ref, &pan_ref, &hi_wheel, &hi_pan), 0);
+    CHECK_EQ(scroll_total(lores, &wheel_ref, &pan_ref, &lo_wheel, &lo_pan), 0);
+    CHECK_EQ(Dev.conns[1].motion.wheel, 0);
+    CHECK_EQ(Dev.conns[1].motion.pan, 0);
+    CHECK_EQ(hi_wheel, wheel);
+    CHECK_EQ(hi_pan, pan);
+    CHECK_EQ(lo_wheel * HID_WHEEL_MULTIPLIER, wheel);
+    CHECK_EQ(lo_pan * HID_WHEEL_MULTIPLIER, pan);
+    printf("hid_mouse: scrolled %d/%d detents wheel and %d/%d AC Pan, exact with and without the multipliers\n",
+        (int) wheel, HID_WHEEL_MULTIPLIER, (int) pan, HID_WHEEL_MULTIPLIER);
+}
+
+/* time from the input to the last report of the characteristic, the number of those reports */
+static int
+reports_since(const struct fake_central *c, int handle_num, int64_t start_us, int64_t *last_us)
+{
+    int count = fake_rx_count(c, handle_num);
+
+    *last_us = start_us;
+    if (count) {
+        *last_us = fake_rx_last(c, handle_num)->time_us;
+    }
+    return count;
+}
+
+/* boot mouse report: buttons, 8-bit X, Y and wheel */
+static int
+boot_total(const struct fake_central *c, int32_t *x, int32_t *y)
+{
+    int reports = 0;
+
+    *x = *y = 0;
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num == HANDLE_HID_BOOT_MOUSE_REPORT) {
+            *x += (int8_t) c->rx[i].data[1];
+            *y += (int8_t) c->rx[i].data[2];
+            reports++;
+        }
+    }
+    return reports;
+}
+
+/*
+targets at random places of a 1920x1080 screen, a pixel is a count: relative
+motion takes as many reports as the distance needs fields of xy_max counts (127
+in the boot report), the absolute report always one; a report mode central and a
+boot mode one are connected at once
+*/
+static void
+bench_targets(void)
+{
+    enum { TARGETS = 200, WIDTH = 1920, HEIGHT = 1080 };
+    struct fake_central *c = setup(ITVL_US, true);
+    struct fake_central *b = fake_connect(&Dev, ITVL_US, true);
+    struct hid_desc_ref abs_x, abs_y;
+    uint32_t rng = 2463534242u;
+    int px = WIDTH / 2, py = HEIGHT / 2;
+    int rel_reports = 0, boot_reports = 0, abs_reports = 0;
+    int64_t rel_us = 0, boot_us = 0, abs_us = 0, last_us;
+
+    CHECK(b);
+    hid_set_report_mode(&Dev, b->conn_handle, true);
+    fake_subscribe_reports(b, true);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &abs_x), 0);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_Y, &abs_y), 0);
+    fake_run(100000);
+
+    for (int i = 0; i < TARGETS; ++i) {
+        int tx, ty;
+        int32_t x, y;
+        int64_t start_us;
+
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        tx = rng % WIDTH;
+        ty = (rng >> 16) % HEIGHT;
+
+        fake_rx_clear(c);
+        fake_rx_clear(b);
+        start_us = fake_now();
+        CHECK_EQ(hid_mouse_move(&Dev, (tx - px) * HID_MOUSE_SUBPIXELS, (ty - py) * HID_MOUSE_SUBPIXELS), 0);
+        fake_run(1000000);
+        mouse_total(c, &x, &y);
+        CHECK_EQ(x, tx - px);
+        CHECK_EQ(y, ty - py);
+        rel_reports += reports_since(c, HANDLE_HID_MOUSE_REPORT, start_us, &last_us);
+        rel_us += last_us - start_us;
+        boot_total(b, &x, &y);
+        CHECK_EQ(x, tx - px);
+        CHECK_EQ(y, ty - py);
+        boot_reports += reports_since(b, HANDLE_HID_BOOT_MOUSE_REPORT, start_us, &last_us);
+        boot_us += last_us - start_us;
+        px = tx;
+        py = ty;
+
+        fake_rx_clear(c);
+        start_us = fake_now();
+        // the report map has the same 0..HID_ABS_POINTER_MAX range as the API
+        CHECK_EQ(hid_abs_pointer_move(&Dev, tx * HID_ABS_POINTER_MAX / (WIDTH - 1),
+            ty * HID_ABS_POINTER_MAX / (HEIGHT - 1), 0), 0);
+        fake_run(1000000);
+        abs_reports += reports_since(c, HANDLE_HID_ABS_POINTER_REPORT, start_us, &last_us);
+        abs_us += last_us - start_us;
+
+        const struct fake_rx *rx = fake_rx_last(c, HANDLE_HID_ABS_POINTER_REPORT);
+
+        CHECK(rx);
+        CHECK_EQ(hid_desc_ref_read(rx->data, &abs_x), tx * HID_ABS_POINTER_MAX / (WIDTH - 1));
+        CHECK_EQ(hid_desc_ref_read(rx->data, &abs_y), ty * HID_ABS_POINTER_MAX / (HEIGHT - 1));
+    }
+    // the boot central does not take the absolute report
+    CHECK_EQ(fake_rx_count(b, HANDLE_HID_ABS_POINTER_REPORT), 0);
+
+    printf("hid_mouse: %d targets on a %dx%d screen, reports and ms a target: relative %.2f %.1f, "
+        "relative boot %.2f %.1f, absolute %.2f %.1f\n", TARGETS, WIDTH, HEIGHT,
+        (double) rel_reports / TARGETS, rel_us / 1000.0 / TARGETS,
+        (double) boot_reports / TARGETS, boot_us / 1000.0 / TARGETS,
+        (double) abs_reports / TARGETS, abs_us / 1000.0 / TARGETS);
+}
+
+int
+main(void)
+{
+    test_queue_full();
+    test_not_wanted();
+    test_scroll();
+    bench_targets();
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+Many device contexts of hid_func.c in one process, each on its own thread with
+its own fake host and central: every hid_init() starts at the same moment, the
+report map layout they share is built once, and each central gets exactly the
+input of its own device. How the reports a second scale with the contexts.
+*/
+
+#define ITVL_US         7500
+#define MAX_CONTEXTS    64
+#define KEYSTROKES      5000
+
+struct worker {
+    pthread_t thread;
+    int id;
+    struct hid_dev dev;
+    int keyboard_reports;       // keyboard reports the central got
+    int mouse_reports;
+    int32_t mouse_x;            // sum of the X deltas it got
+};
+
+static struct worker Workers[MAX_CONTEXTS];
+static pthread_barrier_t Start;
+
+/* count and check what the central got so far, then let it forget it */
+static void
+worker_take_rx(struct worker *w, struct fake_central *c, uint8_t key, const struct hid_desc_ref *mouse_x)
+{
+    for (int i = 0; i < c->rx_count; ++i) {
+        const struct fake_rx *rx = &c->rx[i];
+
+        if (rx->handle_num == HANDLE_HID_KB_NKRO_REPORT) {
+            uint8_t keys[HIDD_LE_REPORT_KB_NKRO_SIZE];
+
+            // nothing but the own key, pressed or released
+            memcpy(keys, rx->data, sizeof(keys));
+            keys[1 + key / 8] &= ~(1 << (key % 8));
+            for (size_t j = 0; j < sizeof(keys); ++j) {
+                CHECK_EQ(keys[j], 0);
+            }
+            w->keyboard_reports++;
+        } else if (rx->handle_num == HANDLE_HID_MOUSE_REPORT) {
+            w->mouse_x += hid_desc_ref_read(rx->data, mouse_x);
+            w->mouse_reports++;
+        }
+    }
+    fake_rx_clear(c);
+}
+
+/* every context types its own key and moves by its own step */
+static void *
+worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct hid_desc_ref mouse_x;
+    uint8_t key = HID_KEY_A + w->id % 26;
+
+    pthread_barrier_wait(&Start);
+    fake_host_reset();
+    fake_host_add_device(&w->dev);
+    // report map tables are only read once any hid_init() has returned
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &mouse_x), 0);
+
+    struct fake_central *c = fake_connect(&w->dev, ITVL_US, true);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+
+    w->keyboard_reports = w->mouse_reports = 0;
+    w->mouse_x = 0;
+    for (int i = 0; i < KEYSTROKES; ++i) {
+        CHECK_EQ(hid_keyboard_change_key(&w->dev, key, true), 0);
+        CHECK_EQ(hid_mouse_move(&w->dev, (w->id + 1) * HID_MOUSE_SUBPIXELS, 0), 0);
+        fake_run(ITVL_US);
+        CHECK_EQ(hid_keyboard_change_key(&w->dev, key, false), 0);
+        fake_run(ITVL_US);
+        if (i % 100 == 99) {
+            worker_take_rx(w, c, key, &mouse_x);
+        }
+    }
+    fake_run(100000);
+    worker_take_rx(w, c, key, &mouse_x);
+    return NULL;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* run n contexts at once, returns reports a second of wall time, all contexts together */
+static double
+bench_contexts(int n)
+{
+    int reports = 0;
+
+    CHECK_EQ(pthread_barrier_init(&Start, NULL, n + 1), 0);
+    for (int i = 0; i < n; ++i) {
+        Workers[i].id = i;
+        CHECK_EQ(pthread_create(&Workers[i].thread, NULL, worker_run, &Workers[i]), 0);
+    }
+
+    double start = now_ns();
+
+    pthread_barrier_wait(&Start);
+    for (int i = 0; i < n; ++i) {
+        CHECK_EQ(pthread_join(Workers[i].thread, NULL), 0);
+    }
+    double elapsed_ns = now_ns() - start;
+
+    pthread_barrier_destroy(&Start);
+    for (int i = 0; i < n; ++i) {
+        CHECK_EQ(Workers[i].keyboard_reports, 2 * KEYSTROKES);
+        CHECK_EQ(Workers[i].mouse_x, (i + 1) * KEYSTROKES);
+        reports += Workers[i].keyboard_reports + Workers[i].mouse_reports;
+    }
+    return reports * 1e9 / elapsed_ns;
+}
+
+int
+main(void)
+{
+    double single = 0;
+
+
+    for (int n = 1; n <= MAX_CONTEXTS; n *= 2) {
+        double rate = bench_contexts(n);
+
+        if (n == 1) {
+            single = rate;
+        }
+        printf("hid_parallel: %2d contexts on %ld CPUs, %.0f reports/s, %.2fx of one context\n",
+            n, sysconf(_SC_NPROCESSORS_ONLN), rate, rate / single);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+The keystroke which wakes a bonded host up, on the fake NimBLE host: the key is
+pressed while the central is away or while it reconnects, the central connects,
+encrypts the link after ENC_US and gets its subscriptions back, and the time
+from the press until the central sees the key is measured. Built once with
+CONFIG_HID_PENDING_INPUT, which keeps the input and replays it, and without
+it, where the keystroke made before the link is ready is lost.
+*/
+
+#define ITVL_US         7500
+#define ENC_US          (2 * ITVL_US)   // connect to encryption and restored subscriptions
+#define STEP_US         500
+#define TAP_US          40000
+#define HOLD_US         400000
+#define KEY             HID_KEY_A
+
+static struct hid_dev Dev;
+
+/* times from the press, a negative connect_us connects before it */
+struct reconnect {
+    const char *name;
+    int64_t connect_us;
+    int64_t release_us;
+    bool delivered;             // the press must reach the central
+};
+
+/* central got the key pressed in report */
+static bool
+nkro_has(const uint8_t *report, uint8_t key)
+{
+    return report[1 + key / 8] & (1 << (key % 8));
+}
+
+/*
+run one reconnect; returns the time from the press to the connection event
+which carried it, -1 if the central never saw the key; *ready_us is the same
+from the moment the link was encrypted
+*/
+static int64_t
+first_keystroke(const struct reconnect *r, int64_t *ready_us)
+{
+    struct fake_central *c = NULL;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    // bonded before: subscribed once, then gone
+    c = fake_connect(&Dev, ITVL_US, true);
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(ITVL_US);
+    fake_disconnect(c);
+    c = NULL;
+    fake_run(100000);
+
+    int64_t start = r->connect_us < 0 ? r->connect_us : 0;
+    int64_t end = (r->connect_us > r->release_us ? r->connect_us : r->release_us) + ENC_US + 200000;
+    int64_t press_us = 0, enc_us = 0;
+
+    for (int64_t t = start; t < end; t += STEP_US) {
+        if (t == 0) {
+            press_us = fake_now();
+            CHECK_EQ(hid_keyboard_change_key(&Dev, KEY, true), r->connect_us < 0 ? 0 : 1);
+        }
+        if (t == r->release_us) {
+            hid_keyboard_change_key(&Dev, KEY, false);
+        }
+        if (t == r->connect_us) {
+            c = fake_connect(&Dev, ITVL_US, false);
+            CHECK(c);
+        }
+        if (t == r->connect_us + ENC_US) {
+            enc_us = fake_now();
+            fake_encrypt(c);
+            fake_subscribe_reports(c, false);
+        }
+        fake_run(STEP_US);
+    }
+
+    int64_t latency_us = -1;
+    bool released = false;
+
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num != HANDLE_HID_KB_NKRO_REPORT) {
+            continue;
+        }
+        if (latency_us < 0 && nkro_has(c->rx[i].data, KEY)) {
+            latency_us = c->rx[i].time_us - press_us;
+            *ready_us = c->rx[i].time_us - enc_us;
+        } else if (latency_us >= 0 && !nkro_has(c->rx[i].data, KEY)) {
+            released = true;
+        }
+    }
+    // whatever the central saw ends with the key up
+    CHECK(latency_us < 0 || released);
+    return latency_us;
+}
+
+int
+main(void)
+{
+#ifdef CONFIG_HID_PENDING_INPUT
+    const bool pending = true;
+    const char *build = "pending input";
+#else
+    const bool pending = false;
+    const char *build = "no pending input";
+#endif
+    const struct reconnect runs[] = {
+        { "tap, then the central reconnects", 100000, TAP_US, pending },
+        { "tap while the link encrypts", -ITVL_US, 4000, pending },
+        { "key held until after encryption", 100000, HOLD_US, pending },
+        // CONFIG_HID_PENDING_INPUT_TTL_MS is 3 s
+        { "tap 4 s before the central reconnects", 4000000, TAP_US, false },
+    };
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+        int64_t ready_us = 0;
+        int64_t latency_us = first_keystroke(&runs[i], &ready_us);
+
+        CHECK_EQ(latency_us >= 0, runs[i].delivered);
+        if (latency_us >= 0) {
+            printf("hid_reconnect, %s: %s, first keystroke seen %.1f ms after the press, %.1f ms after "
+                "encryption\n", build, runs[i].name, latency_us / 1000.0, ready_us / 1000.0);
+        } else {
+            printf("hid_reconnect, %s: %s, first keystroke lost\n", build, runs[i].name);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,586 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_desc.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "test_util.h"
+
+/*
+Report TX queue of hid_func.c on the fake NimBLE host: reports reach the
+central in order, exactly once, whatever the host refuses, and every credit
+and mbuf comes back. Key release latency while absolute pointer reports
+saturate the link, jitter of the time reports wait for their connection event,
+reports a second with notifications and with reliable delivery. Built with
+NOTIFY_METHOD set to SEND_METHOD_STD too, to compare the mbufs a burst takes
+with either send method, and with CONFIG_HID_TX_EVENT_ALIGN, to compare the
+jitter with reports released just before the connection event.
+*/
+
+#define STEPS           2000
+#define TEST_STR_(x)    #x
+#define TEST_STR(x)     TEST_STR_(x)
+#define ITVL_US         7500
+
+static struct hid_dev Dev;
+
+#if NOTIFY_METHOD == SEND_METHOD_CUSTOM
+/* credits held by reports in flight and free credits add up in every queue */
+static void
+check_credits(struct hid_dev *dev)
+{
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        struct hid_tx_queue *tx = &dev->conns[i].tx;
+        int inflight = 0;
+
+        if (!dev->conns[i].in_use) {
+            continue;
+        }
+        for (int j = 0; j < HID_TX_CLASSES; ++j) {
+            inflight += tx->classes[j].inflight;
+        }
+        CHECK(tx->credits <= HID_TX_CREDITS);
+        CHECK_EQ(tx->credits + inflight, HID_TX_CREDITS);
+    }
+}
+
+/* wait until the queue has room, reports are never dropped for a full queue here */
+static void
+wait_queue(struct fake_central *c)
+{
+    struct hid_tx_stats stats;
+
+    while (hid_tx_stats_get(&Dev, c->conn_handle, &stats) == 0 && stats.depth >= HID_TX_CLASS_SIZE / 2) {
+        fake_run(1000);
+        check_credits(&Dev);
+    }
+}
+
+static int
+mouse_x_total(const struct fake_central *c, int *reports)
+{
+    struct hid_desc_ref x;
+    int total = 0;
+
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &x), 0);
+    *reports = 0;
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num == HANDLE_HID_MOUSE_REPORT) {
+            total += hid_desc_ref_read(c->rx[i].data, &x);
+            (*reports)++;
+        }
+    }
+    return total;
+}
+
+/*
+keys are pressed and released while the pointer moves; the host refuses every
+send at random, the queue retries them; the central must see every keyboard
+state in order, exactly once, and the whole pointer motion
+*/
+static void
+test_random_refusals(bool indicate, uint32_t seed)
+{
+    static uint8_t expected[STEPS][HIDD_LE_REPORT_KB_NKRO_SIZE];
+    int count = 0, moved = 0, mouse_reports;
+
+    fake_host_reset();
+    fake_seed(seed);
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+    uint16_t nkro = Svc_char_handles[HANDLE_HID_KB_NKRO_REPORT];
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    if (indicate) {
+        fake_subscribe(c, HANDLE_HID_KB_NKRO_REPORT, false, true);
+    }
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+    c->refuse_percent = 30;
+
+    for (int i = 0; i < STEPS; ++i) {
+        int j = i / 2;
+        uint16_t len;
+
+        wait_queue(c);
+        if (i & 1) {
+            // release the key pressed one step before, one or two keys are held
+            if (!j) {
+                continue;
+            }
+            CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A + (j - 1) % 20, false), 0);
+        } else {
+            CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A + j % 20, true), 0);
+        }
+        CHECK_EQ(fake_gatt_read(c, nkro, expected[count], sizeof(expected[0]), &len), 0);
+        CHECK_EQ(len, HIDD_LE_REPORT_KB_NKRO_SIZE);
+        count++;
+
+        CHECK_EQ(hid_mouse_move(&Dev, 3 * HID_MOUSE_SUBPIXELS, 0), 0);
+        moved += 3;
+
+        fake_run(1500);
+        check_credits(&Dev);
+    }
+    fake_run(1000000);
+
+    // keyboard: every state in order, none lost or duplicated
+    int got = 0;
+    for (int i = 0; i < c->rx_count; ++i) {
+        if (c->rx[i].handle_num != HANDLE_HID_KB_NKRO_REPORT) {
+            continue;
+        }
+        CHECK(got < count);
+        CHECK_EQ(c->rx[i].size, HIDD_LE_REPORT_KB_NKRO_SIZE);
+        CHECK(!memcmp(c->rx[i].data, expected[got], HIDD_LE_REPORT_KB_NKRO_SIZE));
+        CHECK_EQ(c->rx[i].indication, indicate);
+        got++;
+    }
+    CHECK_EQ(got, count);
+
+    // pointer: deltas are neither lost nor applied twice
+    CHECK_EQ(mouse_x_total(c, &mouse_reports), moved);
+
+    // everything sent, every credit and mbuf back
+    struct hid_tx_stats stats;
+    struct hid_mbuf_stats mbuf;
+
+    CHECK_EQ(hid_tx_stats_get(&Dev, c->conn_handle, &stats), 0);
+    hid_mbuf_stats_get(&Dev, &mbuf);
+    CHECK_EQ(stats.depth, 0);
+    CHECK_EQ(stats.drops, 0);
+    CHECK_EQ(stats.sent, c->accepted);
+    CHECK_EQ(stats.retries, c->refused + mbuf.exhausted);
+    CHECK(c->refused > 0);
+    CHECK_EQ(mbuf.in_use, 0);
+    CHECK_EQ(Dev.conns[0].tx.credits, HID_TX_CREDITS);
+    CHECK(!Dev.conns[0].tx.indication_pending);
+
+    printf("hid_tx: %s, %d key reports and %d mouse reports in order, %u of %u sends refused and retried\n",
+        indicate ? "indications" : "notifications", got, mouse_reports,
+        (unsigned) c->refused, (unsigned) (c->refused + c->accepted));
+}
+#endif
+
+/*
+the first mouse report with no button pressed is motion, not a button edge, it
+waits in the pointer class; the first absolute pointer report comes in range,
+an edge in the keys class, the positions which follow it there while the host
+refuses everything merge into one indication; pressing the tip is an edge again
+*/
+static void
+test_edges(void)
+{
+    struct hid_tx_queue *tx = &Dev.conns[0].tx;
+    struct hid_desc_ref abs_x;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    CHECK_EQ(hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+        HID_USAGE_X, &abs_x), 0);
+    fake_subscribe_reports(c, false);
+    fake_subscribe(c, HANDLE_HID_ABS_POINTER_REPORT, false, true);
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+
+    c->refuse_percent = 100;
+    CHECK_EQ(hid_mouse_move(&Dev, 5 * HID_MOUSE_SUBPIXELS, 0), 0);
+    fake_run(2 * ITVL_US);
+    CHECK_EQ(tx->classes[HID_TX_CLASS_KEYS].count, 0);
+    CHECK_EQ(tx->classes[HID_TX_CLASS_POINTER].count, 1);
+
+    for (int i = 1; i <= 10; ++i) {
+        CHECK_EQ(hid_abs_pointer_move(&Dev, i * 100, 100, 0), 0);
+        CHECK_EQ(tx->classes[HID_TX_CLASS_KEYS].count, i == 1 ? 1 : 2);
+        fake_run(1000);
+    }
+    c->refuse_percent = 0;
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_MOUSE_REPORT), 1);
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_ABS_POINTER_REPORT), 2);
+    CHECK_EQ(hid_desc_ref_read(fake_rx_last(c, HANDLE_HID_ABS_POINTER_REPORT)->data, &abs_x), 1000);
+
+    c->refuse_percent = 100;
+    CHECK_EQ(hid_abs_pointer_move(&Dev, 1000, 100, HID_ABS_TIP), 0);
+    CHECK_EQ(hid_abs_pointer_move(&Dev, 1000, 100, 0), 0);
+    // both edges are kept
+    CHECK_EQ(tx->classes[HID_TX_CLASS_KEYS].count, 2);
+    c->refuse_percent = 0;
+    fake_run(100000);
+    CHECK_EQ(fake_rx_count(c, HANDLE_HID_ABS_POINTER_REPORT), 4);
+}
+
+static bool
+nkro_has(const uint8_t *report, uint8_t key)
+{
+    return report[1 + key / 8] & (1 << (key % 8));
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+keystrokes as fast as the queues take them to every central, while each central
+reads the battery level every millisecond: the reads need msys buffers as any
+other ATT traffic does, the std send methods take their reports from there too
+*/
+static void
+bench_burst(void)
+{
+    enum { KEYSTROKES = 200 };
+    struct fake_central *c[HID_MAX_CONNS];
+    struct hid_tx_stats stats;
+    struct hid_mbuf_stats mbuf;
+    uint32_t reads = 0, reads_refused = 0, retries = 0;
+    int delivered = 0, msys_in_use, msys_high_water;
+    int64_t start_us, end_us = 0;
+    double cpu_ns = 0;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        c[i] = fake_connect(&Dev, ITVL_US, true);
+        CHECK(c[i]);
+        fake_subscribe_reports(c[i], false);
+    }
+    fake_run(ITVL_US);
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        fake_rx_clear(c[i]);
+    }
+
+    uint16_t battery = Svc_char_handles[HANDLE_BATTERY_LEVEL];
+    uint32_t depth;
+
+    start_us = fake_now();
+    for (int i = 0; i < 2 * KEYSTROKES; ++i) {
+        double start = now_ns();
+
+        CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A + i / 2 % 20, !(i & 1)), 0);
+        cpu_ns += now_ns() - start;
+        do {
+            fake_run(1000);
+            depth = 0;
+            for (int j = 0; j < HID_MAX_CONNS; ++j) {
+                uint8_t level;
+                uint16_t len;
+
+                reads++;
+                reads_refused += fake_gatt_read(c[j], battery, &level, 1, &len) != 0;
+                CHECK_EQ(hid_tx_stats_get(&Dev, c[j]->conn_handle, &stats), 0);
+                depth = stats.depth > depth ? stats.depth : depth;
+            }
+        } while (depth >= HID_TX_CLASS_SIZE / 2);
+    }
+    fake_run(1000000);
+
+    for (int i = 0; i < HID_MAX_CONNS; ++i) {
+        CHECK_EQ(hid_tx_stats_get(&Dev, c[i]->conn_handle, &stats), 0);
+        CHECK_EQ(stats.drops, 0);
+        CHECK_EQ(stats.depth, 0);
+        retries += stats.retries;
+        delivered += fake_rx_count(c[i], HANDLE_HID_KB_NKRO_REPORT);
+        for (int j = 0; j < c[i]->rx_count; ++j) {
+            end_us = c[i]->rx[j].time_us > end_us ? c[i]->rx[j].time_us : end_us;
+        }
+    }
+    hid_mbuf_stats_get(&Dev, &mbuf);
+    fake_msys_stats(&msys_in_use, &msys_high_water);
+    CHECK_EQ(mbuf.in_use, 0);
+    CHECK_EQ(msys_in_use, 0);
+
+    printf("hid_tx: burst, %s method: %d key reports to %d centrals in %.0f ms, %.0f ns CPU a change; "
+        "msys high water %d, HID pool high water %u of %u; %u of %u battery reads refused, %u sends retried\n",
+        NOTIFY_METHOD == SEND_METHOD_CUSTOM ? "custom" : "std", delivered, HID_MAX_CONNS,
+        (end_us - start_us) / 1000.0, cpu_ns / (2 * KEYSTROKES), msys_high_water,
+        (unsigned) mbuf.high_water, (unsigned) mbuf.blocks, (unsigned) reads_refused, (unsigned) reads,
+        (unsigned) retries);
+}
+
+/*
+a key pressed every 100 ms and released 50 ms later, while absolute pointer moves
+are queued as fast as the pointer class takes them or not at all; returns the
+mean time from the release to the connection event which sent it, *fifo_us the
+mean time it would have taken behind the pointer reports queued and in the
+controller before it, as in the one FIFO queue the classes replaced
+*/
+static double
+release_latency(bool saturate, double *fifo_us, int *max_us)
+{
+    enum { KEYSTROKES = 100 };
+    struct hid_tx_class *pointer = &Dev.conns[0].tx.classes[HID_TX_CLASS_POINTER];
+    int64_t release_us = 0, total_us = 0, fifo_total_us = 0;
+    int nkro_reports = 0, released = 0;
+    uint16_t x = 0;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(ITVL_US);
+    *max_us = 0;
+
+    for (int step = 0; released < KEYSTROKES; ++step) {
+        int64_t t = step * 500;
+        uint8_t key = HID_KEY_A + t / 100000 % 20;
+
+        if (saturate && pointer->count < HID_TX_CLASS_SIZE - 2) {
+            x = (x + 97) % HID_ABS_POINTER_MAX;
+            CHECK_EQ(hid_abs_pointer_move(&Dev, x, 100, 0), 0);
+        }
+        if (t % 100000 == 0) {
+            CHECK_EQ(hid_keyboard_change_key(&Dev, key, true), 0);
+        } else if (t % 100000 == 50000) {
+            int ahead = pointer->count + c->link_count;
+
+            CHECK(!release_us);
+            release_us = fake_now();
+            nkro_reports = fake_rx_count(c, HANDLE_HID_KB_NKRO_REPORT);
+            CHECK_EQ(hid_keyboard_change_key(&Dev, key, false), 0);
+            // the controller sends per_event packets an event, the release after those ahead of it
+            fifo_total_us += c->next_event_us - release_us + (int64_t) ahead / c->per_event * c->itvl_us;
+        }
+        fake_run(500);
+
+        if (release_us && fake_rx_count(c, HANDLE_HID_KB_NKRO_REPORT) > nkro_reports) {
+            const struct fake_rx *rx = fake_rx_last(c, HANDLE_HID_KB_NKRO_REPORT);
+            int us = rx->time_us - release_us;
+
+            CHECK(!nkro_has(rx->data, key));
+            total_us += us;
+            *max_us = us > *max_us ? us : *max_us;
+            release_us = 0;
+            released++;
+        }
+    }
+
+    struct hid_tx_stats stats;
+
+    CHECK_EQ(hid_tx_stats_get(&Dev, c->conn_handle, &stats), 0);
+    CHECK_EQ(stats.drops, 0);
+    CHECK(!saturate || fake_rx_count(c, HANDLE_HID_ABS_POINTER_REPORT) > 40 * KEYSTROKES);
+    *fifo_us = (double) fifo_total_us / KEYSTROKES;
+    return (double) total_us / KEYSTROKES;
+}
+
+static void
+bench_release(void)
+{
+    double idle_fifo_us, fifo_us;
+    int idle_max_us, max_us;
+    double idle_us = release_latency(false, &idle_fifo_us, &idle_max_us);
+    double us = release_latency(true, &fifo_us, &max_us);
+
+    printf("hid_tx: %s method, key release to its connection event at %.1f ms conn interval: idle %.1f ms "
+        "(max %.1f), absolute pointer saturating the link %.1f ms (max %.1f), %.1f ms behind it in one FIFO\n",
+        NOTIFY_METHOD == SEND_METHOD_CUSTOM ? "custom" : "std", ITVL_US / 1000.0, idle_us / 1000,
+        idle_max_us / 1000.0, us / 1000, max_us / 1000.0, fifo_us / 1000);
+}
+
+/* mean and spread (max - min) of times in us */
+struct spread {
+    int64_t total_us, min_us, max_us;
+    int count;
+};
+
+static void
+spread_add(struct spread *sp, int64_t us)
+{
+    if (!sp->count || us < sp->min_us) {
+        sp->min_us = us;
+    }
+    if (!sp->count || us > sp->max_us) {
+        sp->max_us = us;
+    }
+    sp->total_us += us;
+    sp->count++;
+}
+
+/*
+key changes at random times of the conn interval; for each report the time from
+the input and the time from the host handing it to the controller to the
+connection event which sent it
+*/
+static void
+report_jitter(uint32_t itvl_us, struct spread *input, struct spread *handoff)
+{
+    enum { CHANGES = 400 };
+    uint32_t rng = 88172645u;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, itvl_us, true);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_run(itvl_us);
+    fake_rx_clear(c);
+    memset(input, 0, sizeof(*input));
+    memset(handoff, 0, sizeof(*handoff));
+
+    for (int i = 0; i < CHANGES; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        // more than an interval apart, so a report never waits for another one
+        fake_run(2 * itvl_us + rng % itvl_us);
+
+        int64_t input_us = fake_now();
+
+        CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A + i / 2 % 20, !(i & 1)), 0);
+        fake_run(2 * itvl_us);
+        CHECK_EQ(c->rx_count, 1);
+        CHECK_EQ(c->rx[0].handle_num, HANDLE_HID_KB_NKRO_REPORT);
+        spread_add(input, c->rx[0].time_us - input_us);
+        spread_add(handoff, c->rx[0].time_us - c->rx[0].queued_us);
+        fake_rx_clear(c);
+    }
+}
+
+static void
+bench_jitter(void)
+{
+    static const uint32_t itvls[] = { 7500, 15000 };
+
+    for (size_t i = 0; i < sizeof(itvls) / sizeof(itvls[0]); ++i) {
+        struct spread input, handoff;
+
+        report_jitter(itvls[i], &input, &handoff);
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+        // released before the event which sends it, never after
+        CHECK(handoff.min_us >= 0 && handoff.max_us <= CONFIG_HID_TX_RELEASE_LEAD_US);
+#endif
+        printf("hid_tx: %s, %.1f ms conn interval: input to connection event %.2f ms mean, %.2f ms spread; "
+            "handed to the controller to connection event %.2f ms mean, %.2f ms spread\n",
+#ifdef CONFIG_HID_TX_EVENT_ALIGN
+            "released " TEST_STR(CONFIG_HID_TX_RELEASE_LEAD_US) " us before the event",
+#else
+            "released at once",
+#endif
+            itvls[i] / 1000.0, input.total_us / 1000.0 / input.count, (input.max_us - input.min_us) / 1000.0,
+            handoff.total_us / 1000.0 / handoff.count, (handoff.max_us - handoff.min_us) / 1000.0);
+    }
+}
+
+/*
+central subscribed to both methods of the report and sent input as fast as the
+queue takes it for 2 s, key changes or a new absolute pointer position every
+2.5 ms, less than notifications can carry;
+returns reports a second the central got, *inputs the input changes made
+*/
+static double
+delivery_rate(uint8_t delivery, bool keys, int *inputs)
+{
+    int handle_num = keys ? HANDLE_HID_KB_NKRO_REPORT : HANDLE_HID_ABS_POINTER_REPORT;
+    struct hid_tx_stats stats;
+    int64_t start_us;
+    uint16_t x = 0;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    fake_subscribe_reports(c, false);
+    fake_subscribe(c, handle_num, true, true);
+    CHECK_EQ(hid_set_delivery(&Dev, handle_num, delivery), 0);
+    fake_run(ITVL_US);
+    fake_rx_clear(c);
+
+    *inputs = 0;
+    start_us = fake_now();
+    while (fake_now() - start_us < 2000000) {
+        CHECK_EQ(hid_tx_stats_get(&Dev, c->conn_handle, &stats), 0);
+        if (keys && stats.depth >= HID_TX_CLASS_SIZE / 2) {
+            fake_run(500);
+            continue;
+        }
+        if (keys) {
+            CHECK_EQ(hid_keyboard_change_key(&Dev, HID_KEY_A + *inputs / 2 % 20, !(*inputs & 1)), 0);
+            fake_run(500);
+        } else {
+            x = (x + 97) % HID_ABS_POINTER_MAX;
+            CHECK_EQ(hid_abs_pointer_move(&Dev, x, 100, 0), 0);
+            fake_run(2500);
+        }
+        ++*inputs;
+    }
+    fake_run(1000000);
+
+    const struct fake_rx *rx = fake_rx_last(c, handle_num);
+    int reports = fake_rx_count(c, handle_num);
+
+    CHECK(rx);
+    CHECK_EQ(rx->indication, delivery == HID_DELIVERY_RELIABLE);
+    CHECK_EQ(hid_tx_stats_get(&Dev, c->conn_handle, &stats), 0);
+    CHECK_EQ(stats.drops, 0);
+    if (keys) {
+        // every key change is a report of its own
+        CHECK_EQ(reports, *inputs);
+    } else {
+        // positions merge, the last one always arrives
+        struct hid_desc_ref abs_x;
+
+        CHECK_EQ(hid_desc_find(HID_RPT_ID_ABS_POINTER_IN, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP,
+            HID_USAGE_X, &abs_x), 0);
+        CHECK_EQ(hid_desc_ref_read(rx->data, &abs_x), x);
+        CHECK(reports <= *inputs);
+    }
+    return reports * 1e6 / (rx->time_us - start_us);
+}
+
+static void
+bench_delivery(void)
+{
+    int key_inputs[2], abs_inputs[2];
+    double keys[2], abs[2];
+
+    for (int i = 0; i < 2; ++i) {
+        uint8_t delivery = i ? HID_DELIVERY_RELIABLE : HID_DELIVERY_NOTIFY;
+
+        keys[i] = delivery_rate(delivery, true, &key_inputs[i]);
+        abs[i] = delivery_rate(delivery, false, &abs_inputs[i]);
+    }
+    printf("hid_tx: %s method, reports/s at %.1f ms conn interval: keys %.0f notify, %.0f reliable "
+        "(%d and %d key changes in 2 s); absolute pointer at 400 moves/s %.0f notify, %.0f reliable\n",
+        NOTIFY_METHOD == SEND_METHOD_CUSTOM ? "custom" : "std", ITVL_US / 1000.0, keys[0], keys[1],
+        key_inputs[0], key_inputs[1], abs[0], abs[1]);
+}
+
+int
+main(void)
+{
+#if NOTIFY_METHOD == SEND_METHOD_CUSTOM
+    // other methods read the report buffer when they send, a report state can be skipped
+    test_random_refusals(false, 12345);
+    test_random_refusals(true, 777);
+#endif
+    test_edges();
+    bench_burst();
+    bench_release();
+    bench_jitter();
+    bench_delivery();
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "matrix_keys.h"
+#include "test_util.h"
+
+/*
+Key matrix simulation: raw passes go to matrix_keys_pass() as matrix_func.c
+would give them, sent changes land in a queue which can run full. Keys are
+written as (driven line, read line).
+*/
+#define OUTS        4
+#define INS         4
+#define DEBOUNCE    3
+#define QUEUE_SIZE  16
+
+struct event {
+    int out, in;
+    bool pressed;
+    uint32_t seen_us;
+};
+
+static struct {
+    struct event events[QUEUE_SIZE];
+    int count;
+    int room;                   // events the queue takes before it is full
+} Queue;
+
+static struct matrix_keys Keys;
+static bool Down[OUTS][INS];    // keys held by the fingers
+static uint32_t Now_us;
+
+static bool
+queue_send(void *arg, int out, int in, bool pressed, uint32_t seen_us)
+{
+    (void) arg;
+
+    if (Queue.count == Queue.room) {
+        return false;
+    }
+    Queue.events[Queue.count++] = (struct event) { out, in, pressed, seen_us };
+    return true;
+}
+
+static void
+reset(bool no_diodes)
+{
+    matrix_keys_init(&Keys, OUTS, INS, DEBOUNCE, no_diodes);
+    memset(&Queue, 0, sizeof(Queue));
+    Queue.room = QUEUE_SIZE;
+    memset(Down, 0, sizeof(Down));
+    Now_us = 1000;
+}
+
+/* what the read lines show: without diodes a key rectangle closes through the fourth key */
+static void
+read_matrix(uint32_t *raw, bool no_diodes)
+{
+    for (int out = 0; out < OUTS; ++out) {
+        raw[out] = 0;
+        for (int in = 0; in < INS; ++in) {
+            raw[out] |= (uint32_t) Down[out][in] << in;
+        }
+    }
+    if (!no_diodes) {
+        return;
+    }
+    // current flows from a read line over any pressed keys into the driven line
+    for (bool grown = true; grown; ) {
+        grown = false;
+        for (int a = 0; a < OUTS; ++a) {
+            for (int b = 0; b < OUTS; ++b) {
+                if (a != b && (raw[a] & raw[b]) && (raw[a] | raw[b]) != raw[a]) {
+                    raw[a] |= raw[b];
+                    grown = true;
+                }
+            }
+        }
+    }
+}
+
+/* run passes, returns the active flag of the last one */
+static bool
+scan(int passes, bool *ghost_seen)
+{
+    bool active = false, ghost;
+    bool no_diodes = Keys.no_diodes;
+
+    for (int i = 0; i < passes; ++i) {
+        uint32_t raw[OUTS];
+
+        read_matrix(raw, no_diodes);
+        active = matrix_keys_pass(&Keys, raw, Now_us, queue_send, NULL, &ghost);
+        if (ghost_seen) {
+            *ghost_seen |= ghost;
+        }
+        Now_us += 1000;
+    }
+    return active;
+}
+
+static bool
+sent(int out, int in, bool pressed)
+{
+    for (int i = 0; i < Queue.count; ++i) {
+        if (Queue.events[i].out == out && Queue.events[i].in == in && Queue.events[i].pressed == pressed) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+test_debounce(void)
+{
+    reset(false);
+    CHECK(!scan(1, NULL));
+
+    Down[1][2] = true;
+    uint32_t pressed_us = Now_us;
+
+    CHECK(scan(DEBOUNCE - 1, NULL));
+    CHECK_EQ(Queue.count, 0);
+    CHECK(scan(1, NULL));
+    CHECK_EQ(Queue.count, 1);
+    CHECK(sent(1, 2, true));
+    // the event carries the time the key was first seen down
+    CHECK_EQ(Queue.events[0].seen_us, pressed_us);
+
+    Down[1][2] = false;
+    CHECK(scan(DEBOUNCE - 1, NULL));
+    CHECK(!scan(1, NULL));
+    CHECK_EQ(Queue.count, 2);
+    CHECK(sent(1, 2, false));
+}
+
+/* a key flipping back before it has settled starts over, rattle is never sent */
+static void
+test_chatter(void)
+{
+    reset(false);
+
+    for (int i = 0; i < 5; ++i) {
+        Down[0][0] = true;
+        scan(DEBOUNCE - 1, NULL);
+        Down[0][0] = false;
+        scan(1, NULL);
+    }
+    CHECK_EQ(Queue.count, 0);
+    // the settling key was forgotten, the matrix may go idle
+    CHECK(!scan(1, NULL));
+
+    // after chatter the key is taken once it holds still, stamped at its last change
+    Down[0][0] = true;
+    uint32_t settled_us = Now_us;
+
+    scan(DEBOUNCE, NULL);
+    CHECK_EQ(Queue.count, 1);
+    CHECK(sent(0, 0, true));
+    CHECK_EQ(Queue.events[0].seen_us, settled_us);
+}
+
+/* without diodes three corners of a rectangle hold both lines, the phantom fourth key is never sent */
+static void
+test_ghost_rectangle(void)
+{
+    bool ghost = false;
+
+    reset(true);
+    Down[0][0] = Down[0][1] = true;
+    scan(DEBOUNCE, &ghost);
+    CHECK(!ghost);
+    CHECK_EQ(Queue.count, 2);
+
+    Down[1][0] = true;              // (1, 1) looks pressed now
+    scan(4 * DEBOUNCE, &ghost);
+    CHECK(ghost);
+    CHECK_EQ(Queue.count, 2);
+    CHECK(!sent(1, 1, true));
+    CHECK(!sent(1, 0, true));       // a real key of the held line waits too
+
+    Down[0][1] = false;             // the rectangle is gone
+    ghost = false;
+    scan(DEBOUNCE, &ghost);
+    CHECK(!ghost);
+    CHECK(sent(0, 1, false));
+    CHECK(sent(1, 0, true));
+    CHECK(!sent(1, 1, true));
+    CHECK_EQ(Queue.count, 4);
+
+    // keys on other lines go on while a rectangle holds two lines
+    reset(true);
+    Down[0][0] = Down[0][1] = Down[1][0] = true;
+    Down[3][3] = true;
+    scan(2 * DEBOUNCE, &ghost);
+    CHECK(sent(3, 3, true));
+    CHECK(!sent(1, 1, true));
+}
+
+/*
+a real fourth key can not be told from a phantom: three corners still make the
+released one look pressed, it is sent once a whole line of the rectangle is released
+*/
+static void
+test_real_fourth_key(void)
+{
+    reset(true);
+    Down[0][0] = Down[0][1] = true;
+    scan(DEBOUNCE, NULL);
+    Down[1][0] = true;
+    scan(DEBOUNCE, NULL);
+    Down[1][1] = true;
+    scan(4 * DEBOUNCE, NULL);
+    CHECK(!sent(1, 0, true));
+    CHECK(!sent(1, 1, true));
+
+    Down[0][0] = false;             // (0, 0) is the phantom now
+    scan(4 * DEBOUNCE, NULL);
+    CHECK(!sent(0, 0, false));
+    CHECK(!sent(1, 1, true));
+
+    Down[0][1] = false;
+    scan(DEBOUNCE, NULL);
+    CHECK(sent(0, 0, false));
+    CHECK(sent(0, 1, false));
+    CHECK(sent(1, 0, true));
+    CHECK(sent(1, 1, true));
+
+    // everything released, all releases are sent and the matrix goes idle
+    memset(Down, 0, sizeof(Down));
+    CHECK(!scan(DEBOUNCE, NULL));
+    CHECK(sent(1, 0, false));
+    CHECK(sent(1, 1, false));
+    CHECK_EQ(Queue.count, 8);
+}
+
+/* no room in the queue: the change is kept and sent on a later pass, nothing is lost or doubled */
+static void
+test_full_queue(void)
+{
+    reset(false);
+    Queue.room = 1;
+
+    Down[2][0] = Down[2][3] = true;
+    scan(DEBOUNCE, NULL);
+    CHECK_EQ(Queue.count, 1);
+    // the key left over keeps the matrix scanning
+    CHECK(scan(5, NULL));
+    CHECK_EQ(Queue.count, 1);
+
+    Queue.room = QUEUE_SIZE;
+    scan(1, NULL);
+    CHECK_EQ(Queue.count, 2);
+    CHECK(sent(2, 0, true));
+    CHECK(sent(2, 3, true));
+    scan(10, NULL);
+    CHECK_EQ(Queue.count, 2);
+
+    // a release which could not be sent is not lost either
+    Queue.room = 2;
+    Down[2][0] = false;
+    CHECK(scan(3 * DEBOUNCE, NULL));
+    CHECK(!sent(2, 0, false));
+    Queue.room = QUEUE_SIZE;
+    scan(1, NULL);
+    CHECK(sent(2, 0, false));
+    CHECK_EQ(Queue.count, 3);
+}
+
+int
+main(void)
+{
+    test_debounce();
+    test_chatter();
+    test_ghost_rectangle();
+    test_real_fourth_key();
+    test_full_queue();
+    printf("matrix_keys: debounce, chatter, ghost rectangle and full queue ok\n");
+    return 0;
+}
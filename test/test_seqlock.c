@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hid_seqlock.h"
+#include "test_util.h"
+
+/*
+One writer fills the whole report buffer with the same byte, one value after
+another, while readers copy it. A reader must never see a buffer mixing two
+values (torn report). Every torn copy a reader has to retry is counted, with
+the write rate it shows how much the readers pay for a writer busy all the
+time.
+*/
+#define REPORT_SIZE     20
+#define WRITES          2000000
+#define READERS         2
+
+static uint32_t Seq;
+static uint8_t Buffer[REPORT_SIZE];
+static bool Done;
+
+struct reader_stats {
+    unsigned long reads;
+    unsigned long retries;
+};
+
+static void *
+writer(void *arg)
+{
+    (void) arg;
+    for (uint32_t i = 1; i <= WRITES; ++i) {
+        hid_seq_write_begin(&Seq);
+        for (int n = 0; n < REPORT_SIZE; ++n) {
+            ((volatile uint8_t *) Buffer)[n] = (uint8_t) i;
+        }
+        hid_seq_write_end(&Seq);
+    }
+    __atomic_store_n(&Done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+    uint8_t report[REPORT_SIZE];
+    struct reader_stats *stats = arg;
+
+    while (!__atomic_load_n(&Done, __ATOMIC_ACQUIRE)) {
+        while (!hid_seq_read_try(&Seq, Buffer, report, sizeof(report))) {
+            ++stats->retries;
+        }
+        for (int n = 1; n < REPORT_SIZE; ++n) {
+            CHECK_EQ(report[n], report[0]);
+        }
+        ++stats->reads;
+    }
+    return NULL;
+}
+
+int
+main(void)
+{
+    pthread_t w, r[READERS];
+    struct reader_stats stats[READERS] = { 0 };
+    unsigned long reads = 0, retries = 0;
+    uint8_t report[REPORT_SIZE];
+    struct timespec start, end;
+    double seconds;
+
+    for (int i = 0; i < READERS; ++i) {
+        CHECK(pthread_create(&r[i], NULL, reader, &stats[i]) == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(pthread_create(&w, NULL, writer, NULL) == 0);
+    pthread_join(w, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int i = 0; i < READERS; ++i) {
+        pthread_join(r[i], NULL);
+        CHECK(stats[i].reads > 0);
+        reads += stats[i].reads;
+        retries += stats[i].retries;
+    }
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    /* counter is even and the last write is visible after the writer stopped */
+    CHECK_EQ(Seq & 1, 0);
+    CHECK_EQ(Seq, 2 * WRITES);
+    hid_seq_read(&Seq, Buffer, report, sizeof(report));
+    for (int n = 0; n < REPORT_SIZE; ++n) {
+        CHECK_EQ(report[n], (uint8_t) WRITES);
+    }
+    printf("seqlock: %.0f updates/s, %d readers %lu reads, %lu retried (%.1f%%), no torn report\n",
+        WRITES / seconds, READERS, reads, retries, 100.0 * retries / (reads + retries));
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "fake_host.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_dev.h"
+#include "hid_func.h"
+#include "hid_reports.h"
+#include "test_util.h"
+#include "tlog.h"
+
+/*
+Deferred log of tlog.c, built with CONFIG_TLOG_ENABLE: the hot paths of
+hid_func.c and gatt_svr.c write records into the ring instead of formatting,
+and what a TLOGI() call costs next to formatting the same line as ESP_LOGI()
+does before it writes it out.
+*/
+
+#define ITVL_US         7500
+#define ROUNDS          (CONFIG_TLOG_RING_SIZE / 2)
+
+static const char *tag = "test_tlog";
+
+static struct hid_dev Dev;
+
+/* subscribing, a protocol mode write and a disconnect log on the device side */
+static void
+test_hot_paths(void)
+{
+    struct tlog_stats before, after;
+
+    fake_host_reset();
+    fake_host_add_device(&Dev);
+
+    struct fake_central *c = fake_connect(&Dev, ITVL_US, true);
+
+    CHECK(c);
+    tlog_stats_get(&before);
+    fake_subscribe_reports(c, false);
+    fake_run(ITVL_US);
+    tlog_stats_get(&after);
+    // a hid_set_notify record for every report subscribed
+    uint32_t subscribed = 0;
+    for (int i = 0; i < HID_REPORTS_COUNT; ++i) {
+        subscribed += !!(Hid_report_defs[i].send_in & HID_SEND_IN_REPORT);
+    }
+    CHECK(subscribed > 0);
+    CHECK(after.written - before.written >= subscribed);
+
+    uint8_t mode = HID_PROTOCOL_MODE_BOOT;
+
+    before = after;
+    CHECK_EQ(fake_gatt_write(c, Svc_char_handles[HANDLE_HID_PROTO_MODE], &mode, 1), 0);
+    tlog_stats_get(&after);
+    CHECK(after.written - before.written >= 2);
+
+    before = after;
+    fake_disconnect(c);
+    tlog_stats_get(&after);
+    CHECK(after.written - before.written >= 3);
+    CHECK_EQ(after.dropped, 0);
+    CHECK_EQ(after.high_water, after.written);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t
+cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* the GATT access line: __func__ and 4 integers */
+static void
+log_access(int i)
+{
+    TLOGI(tag, "%s: UUID %04X attr %04X arg %d op %d", __func__, 0x2A4D, i & 0xFFFF, i & 7, 0);
+}
+
+/* ns and cycles of a call, the ring fills up by ROUNDS records */
+static double
+bench_tlog(double *cycles_call)
+{
+    uint64_t start_cycles = cycles();
+    double start = now_ns();
+
+    for (int i = 0; i < ROUNDS; ++i) {
+        log_access(i);
+    }
+    *cycles_call = (double) (cycles() - start_cycles) / ROUNDS;
+    return (now_ns() - start) / ROUNDS;
+}
+
+/* what ESP_LOGI() does on the caller's task before the UART takes the line */
+static double
+bench_format(double *cycles_call)
+{
+    char msg[160];
+    size_t total = 0;
+    uint64_t start_cycles = cycles();
+    double start = now_ns();
+
+    for (int i = 0; i < ROUNDS; ++i) {
+        total += snprintf(msg, sizeof(msg), "I (%u) %s: %s: UUID %04X attr %04X arg %d op %d\n",
+            (unsigned) esp_log_timestamp(), tag, __func__, 0x2A4D, i & 0xFFFF, i & 7, 0);
+        __asm__ volatile("" : : "r" (msg) : "memory");
+    }
+    *cycles_call = (double) (cycles() - start_cycles) / ROUNDS;
+    CHECK(total > 0);
+    return (now_ns() - start) / ROUNDS;
+}
+
+int
+main(void)
+{
+    struct tlog_stats stats;
+    double tlog_cycles, format_cycles, full_cycles;
+
+    test_hot_paths();
+
+    tlog_stats_get(&stats);
+    CHECK(CONFIG_TLOG_RING_SIZE - stats.written >= ROUNDS);
+    double tlog_ns = bench_tlog(&tlog_cycles);
+    double format_ns = bench_format(&format_cycles);
+
+    // nothing prints, so the ring fills up and the rest is dropped
+    for (int i = 0; i < CONFIG_TLOG_RING_SIZE; ++i) {
+        log_access(i);
+    }
+    double full_ns = bench_tlog(&full_cycles);
+
+    tlog_stats_get(&stats);
+    CHECK_EQ(stats.written, CONFIG_TLOG_RING_SIZE);
+    CHECK_EQ(stats.high_water, CONFIG_TLOG_RING_SIZE);
+    CHECK(stats.dropped >= ROUNDS);
+
+    printf("tlog: a 5 argument line, %.1f ns %.0f cycles a TLOGI() call, %.1f ns %.0f cycles to format it "
+        "as ESP_LOGI() does before printing, %.1f ns %.0f cycles when the ring is full; %u records written, "
+        "%u dropped\n", tlog_ns, tlog_cycles, format_ns, format_cycles, full_ns, full_cycles,
+        (unsigned) stats.written, (unsigned) stats.dropped);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef H_TEST_UTIL_
+#define H_TEST_UTIL_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* fail the test with file and line if cond does not hold */
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long a_ = (long long)(a), b_ = (long long)(b); \
+    if (a_ != b_) { \
+        fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+            __FILE__, __LINE__, #a, #b, a_, b_); \
+        exit(1); \
+    } \
+} while (0)
+
+#endif